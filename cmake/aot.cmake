@@ -0,0 +1,56 @@
+# Ahead of time compilation of serialized tinyprog programs (.tpp) to C++ headers.
+#
+# tinyprog_generate_cpp(<target> INPUT <program.tpp> OUTPUT <header.h> [NAME <struct>]
+#                       [NAMESPACE <namespace>] [GENERATOR <target or executable>] [DOUBLE])
+#
+# Adds a build step running `tinyprog aot` and makes the directory of OUTPUT an include directory of
+# <target>. GENERATOR defaults to the tinyprogStandalone target; DOUBLE reads programs serialized
+# with the double precision traits. The generated struct is a template on the env traits, its
+# subprogram functions take the same binding array as eval_program_bytecode.
+
+function(tinyprog_generate_cpp target)
+  cmake_parse_arguments(TP_AOT "DOUBLE" "INPUT;OUTPUT;NAME;NAMESPACE;GENERATOR" "" ${ARGN})
+
+  if(NOT TP_AOT_INPUT OR NOT TP_AOT_OUTPUT)
+    message(FATAL_ERROR "tinyprog_generate_cpp: INPUT and OUTPUT are required")
+  endif()
+
+  if(NOT TP_AOT_GENERATOR)
+    set(TP_AOT_GENERATOR tinyprogStandalone)
+  endif()
+
+  if(TARGET ${TP_AOT_GENERATOR})
+    set(generator_command $<TARGET_FILE:${TP_AOT_GENERATOR}>)
+    set(generator_depends ${TP_AOT_GENERATOR})
+  else()
+    set(generator_command ${TP_AOT_GENERATOR})
+    set(generator_depends "")
+  endif()
+
+  get_filename_component(input ${TP_AOT_INPUT} ABSOLUTE)
+  get_filename_component(output ${TP_AOT_OUTPUT} ABSOLUTE BASE_DIR ${CMAKE_CURRENT_BINARY_DIR})
+  get_filename_component(output_dir ${output} DIRECTORY)
+
+  set(arguments aot ${input} ${output})
+  if(TP_AOT_NAME)
+    list(APPEND arguments --name ${TP_AOT_NAME})
+  endif()
+  if(TP_AOT_NAMESPACE)
+    list(APPEND arguments --namespace ${TP_AOT_NAMESPACE})
+  endif()
+  if(TP_AOT_DOUBLE)
+    list(APPEND arguments --double)
+  endif()
+
+  add_custom_command(
+    OUTPUT ${output}
+    COMMAND ${CMAKE_COMMAND} -E make_directory ${output_dir}
+    COMMAND ${generator_command} ${arguments}
+    DEPENDS ${input} ${generator_depends}
+    COMMENT "Generating ${output} from ${TP_AOT_INPUT}"
+    VERBATIM
+  )
+
+  target_sources(${target} PRIVATE ${output})
+  target_include_directories(${target} PRIVATE ${output_dir})
+endfunction()
@@ -30,9 +30,16 @@
 #ifndef __TINYPROG_H__
 #define __TINYPROG_H__
 
+#include <algorithm>
 #include <limits>
 #include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #ifndef TP_TESTING
 #define TP_TESTING 0
@@ -51,6 +58,131 @@
 #define TP_STANDARD_LIBRARY 0
 #endif // #ifndef TP_STANDARD_LIBRARY
 
+#ifndef TP_MAX_REGISTERS
+#define TP_MAX_REGISTERS 128
+#endif // #ifndef TP_MAX_REGISTERS
+
+// Frame slots for variables declared with 'var: name ? local', further locals fall back to bindings.
+#ifndef TP_MAX_LOCALS
+#define TP_MAX_LOCALS 32
+#endif // #ifndef TP_MAX_LOCALS
+
+// Lets the optimizer make rewrites that can change the last bit or the sign of a zero: x/c becomes x*(1/c), x^0.5 becomes sqrt(x),
+// small integer powers become chains of multiplications and additions of 0 are dropped.
+#ifndef TP_FAST_MATH
+#define TP_FAST_MATH 0
+#endif // #ifndef TP_FAST_MATH
+
+// The fma builtin rounds once using the FMA instructions, without them it rounds the product and the sum separately.
+#ifndef TP_FMA
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define TP_FMA 1
+#else
+#define TP_FMA 0
+#endif
+#endif // #ifndef TP_FMA
+
+// Lets the optimizer contract a*b+c and a*b-c into fma, which rounds once when TP_FMA is 1 and then changes the last bit.
+#ifndef TP_FMA_CONTRACT
+#define TP_FMA_CONTRACT TP_FAST_MATH
+#endif // #ifndef TP_FMA_CONTRACT
+
+// Programs turn a conditional jump around side effect free statements into a select when the expressions of both sides have up to this
+// many nodes together, 0 keeps every jump.
+#ifndef TP_SELECT_MAX_NODES
+#define TP_SELECT_MAX_NODES 16
+#endif // #ifndef TP_SELECT_MAX_NODES
+
+// Bytes of each block a compile_arena takes from its backing memory.
+#ifndef TP_ARENA_BLOCK_SIZE
+#define TP_ARENA_BLOCK_SIZE 65536
+#endif // #ifndef TP_ARENA_BLOCK_SIZE
+
+#ifndef TP_BATCH_BLOCK_SIZE
+#define TP_BATCH_BLOCK_SIZE 64
+#endif // #ifndef TP_BATCH_BLOCK_SIZE
+
+// Packed env_traits in the standard library: f32x4 needs SSE4.1, f32x8 and f64x4 need AVX2. MSVC has no switch for SSE4.1 alone and
+// baseline x64 only guarantees SSE2, so there SSE follows /arch:AVX (or define TP_SIMD_SSE to 1 for SSE4.1 targets); AVX2 follows
+// /arch:AVX2.
+#ifndef TP_SIMD_SSE
+#if defined(__SSE4_1__) || defined(__AVX__)
+#define TP_SIMD_SSE 1
+#else
+#define TP_SIMD_SSE 0
+#endif
+#endif // #ifndef TP_SIMD_SSE
+
+#ifndef TP_SIMD_AVX2
+#if defined(__AVX2__)
+#define TP_SIMD_AVX2 1
+#else
+#define TP_SIMD_AVX2 0
+#endif
+#endif // #ifndef TP_SIMD_AVX2
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define TP_JIT_SUPPORTED 1
+#else
+#define TP_JIT_SUPPORTED 0
+#endif
+
+#ifndef TP_JIT_ENABLED
+#if TP_TESTING
+#define TP_JIT_ENABLED TP_JIT_SUPPORTED
+#else
+#define TP_JIT_ENABLED 0
+#endif // #if TP_TESTING
+#endif // #ifndef TP_JIT_ENABLED
+
+#if TP_JIT_ENABLED
+#if !TP_JIT_SUPPORTED
+#error The JIT only targets x86-64.
+#endif // #if !TP_JIT_SUPPORTED
+#include <vector>
+#include <cstring>
+#include <type_traits>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#define TP_UNDEF_NOMINMAX
+#endif // #ifndef NOMINMAX
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#define TP_UNDEF_WIN32_LEAN_AND_MEAN
+#endif // #ifndef WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#ifdef TP_UNDEF_NOMINMAX
+#undef NOMINMAX
+#undef TP_UNDEF_NOMINMAX
+#endif // #ifdef TP_UNDEF_NOMINMAX
+#ifdef TP_UNDEF_WIN32_LEAN_AND_MEAN
+#undef WIN32_LEAN_AND_MEAN
+#undef TP_UNDEF_WIN32_LEAN_AND_MEAN
+#endif // #ifdef TP_UNDEF_WIN32_LEAN_AND_MEAN
+#else
+#include <sys/mman.h>
+#endif // #if defined(_WIN32)
+#endif // #if TP_JIT_ENABLED
+
+// tp::thread_pool and the eval_parallel/eval_program_parallel entry points.
+#ifndef TP_THREADS_ENABLED
+#define TP_THREADS_ENABLED TP_TESTING
+#endif // #ifndef TP_THREADS_ENABLED
+
+// Rows per work item of eval_parallel, threads that run out of work steal half of the items left to another thread.
+#ifndef TP_PARALLEL_GRAIN
+#define TP_PARALLEL_GRAIN (TP_BATCH_BLOCK_SIZE * 16)
+#endif // #ifndef TP_PARALLEL_GRAIN
+
+#if TP_THREADS_ENABLED
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif // #if TP_THREADS_ENABLED
+
 #if (_MSVC_LANG < 201703L)
 #define TP_MODERN_CPP 0
 #else
@@ -93,7 +225,69 @@ namespace tp
 		CLOSURE7,
 		CLOSURE_MAX,
 
-		FLAG_PURE = 32
+		FLAG_PURE = 32,
+
+		FLAG_OPERATOR = 64 // Function node calling a builtin operator, 'function' holds a builtin_operator instead of a binding index
+	};
+
+	// Operators the evaluators execute inline when the compiler resolved them to the builtin implementation.
+	// The values are part of the portable and bytecode formats, only ever append.
+	enum class builtin_operator : uint16_t
+	{
+		add,
+		sub,
+		mul,
+		divide,
+		pow,
+		fmod,
+		comma,
+		greater,
+		greater_eq,
+		lower,
+		lower_eq,
+		equal,
+		not_equal,
+		logical_and,
+		logical_or,
+		negate,
+		logical_not,
+		logical_notnot,
+		negate_logical_not,
+		negate_logical_notnot,
+		select,
+		fma,
+		min,
+		max,
+		clamp,
+		count
+	};
+
+	static constexpr const char* builtin_operator_names[] = {
+		"add",
+		"sub",
+		"mul",
+		"divide",
+		"pow",
+		"fmod",
+		"comma",
+		"greater",
+		"greater_eq",
+		"lower",
+		"lower_eq",
+		"equal",
+		"not_equal",
+		"logical_and",
+		"logical_or",
+		"negate",
+		"logical_not",
+		"logical_notnot",
+		"negate_logical_not",
+		"negate_logical_notnot",
+		"select",
+		"fma",
+		"min",
+		"max",
+		"clamp",
 	};
 
 	struct variable
@@ -104,26 +298,53 @@ namespace tp
 		void*		context;
 	};
 
+	struct symbol_table;
+
 	struct variable_lookup
 	{
 		const variable* lookup;
 		int				lookup_len;
+
+		// Hashed index of lookup built by the indexer, the compiler searches lookup linearly without one.
+		const symbol_table* symbols = nullptr;
 	};
 
+	// A node of an exported expression, packed in 32 bit words. Each parameter is an operand: the offset of a child node, or a
+	// variable or constant leaf stored inline, tagged in its two low bits (see portable_operand). Offsets are signed and relative
+	// to the root node of the expression. A closure's context binding follows its parameters, a constant's t_atom is stored
+	// unaligned in the buffer.
 	template<typename T_TRAITS>
 	struct expr_portable
 	{
 		using t_traits = T_TRAITS;
 		using t_atom   = typename T_TRAITS::t_atom;
 
-		int type;
+		uint32_t type;
 		union
 		{
-			t_atom value;
-			size_t bound;
-			size_t function;
+			int32_t	 constant; // offset of the value
+			uint32_t bound;
+			uint32_t function;
 		};
-		size_t parameters[1];
+		uint32_t parameters[1];
+	};
+
+	enum portable_operand : uint32_t
+	{
+		OPERAND_NODE	 = 0, // offset of a node
+		OPERAND_VARIABLE = 1, // binding index
+		OPERAND_CONSTANT = 2, // offset of the value
+
+		OPERAND_TAG_BITS = 2,
+		OPERAND_TAG_MASK = (1 << OPERAND_TAG_BITS) - 1,
+	};
+
+	// Order of the nodes of an exported expression, the recursive evaluator reads both. post_order writes every node after the
+	// nodes of its operands and the root last, followed by the constants, so eval_post_order runs it front to back with a stack.
+	enum class expression_layout : uint16_t
+	{
+		pre_order,
+		post_order,
 	};
 
 	namespace eval_details
@@ -175,26 +396,33 @@ namespace tp
 		template<typename T_VECTOR, typename T_RET, typename T_EVAL_ARG>
 		auto eval_function(int a, const void* fn, T_RET error_val, T_EVAL_ARG eval_arg) -> T_RET
 		{
+			// Arguments are evaluated left to right before the call, like the bytecode does, so the side effects of closures inside them
+			// happen in the same order on every path.
+			T_VECTOR v[7]{};
+			for (int e = 0; e < a; ++e)
+			{
+				v[e] = eval_arg(e);
+			}
+
 #define FUN(...) ((T_RET(*)(__VA_ARGS__))fn)
 			switch (a)
 			{
 			case 0:
 				return FUN(void)();
 			case 1:
-				return FUN(T_VECTOR)(eval_arg(0));
+				return FUN(T_VECTOR)(v[0]);
 			case 2:
-				return FUN(T_VECTOR, T_VECTOR)(eval_arg(0), eval_arg(1));
+				return FUN(T_VECTOR, T_VECTOR)(v[0], v[1]);
 			case 3:
-				return FUN(T_VECTOR, T_VECTOR, T_VECTOR)(eval_arg(0), eval_arg(1), eval_arg(2));
+				return FUN(T_VECTOR, T_VECTOR, T_VECTOR)(v[0], v[1], v[2]);
 			case 4:
-				return FUN(T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(eval_arg(0), eval_arg(1), eval_arg(2), eval_arg(3));
+				return FUN(T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(v[0], v[1], v[2], v[3]);
 			case 5:
-				return FUN(T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(eval_arg(0), eval_arg(1), eval_arg(2), eval_arg(3), eval_arg(4));
+				return FUN(T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(v[0], v[1], v[2], v[3], v[4]);
 			case 6:
-				return FUN(T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(eval_arg(0), eval_arg(1), eval_arg(2), eval_arg(3), eval_arg(4), eval_arg(5));
+				return FUN(T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(v[0], v[1], v[2], v[3], v[4], v[5]);
 			case 7:
-				return FUN(T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(
-					eval_arg(0), eval_arg(1), eval_arg(2), eval_arg(3), eval_arg(4), eval_arg(5), eval_arg(6));
+				return FUN(T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
 			}
 #undef FUN
 			return error_val;
@@ -203,50 +431,277 @@ namespace tp
 		template<typename T_VECTOR, typename T_RET, typename T_EVAL_ARG>
 		auto eval_closure(int a, const void* fn, const void* arity_params, T_RET error_val, T_EVAL_ARG eval_arg) -> T_RET
 		{
+			// Same order as eval_function.
+			T_VECTOR v[7]{};
+			for (int e = 0; e < a; ++e)
+			{
+				v[e] = eval_arg(e);
+			}
+
 #define FUN(...) ((T_RET(*)(__VA_ARGS__))fn)
 			switch (a)
 			{
 			case 0:
 				return FUN(const void*)(arity_params);
 			case 1:
-				return FUN(const void*, T_VECTOR)(arity_params, eval_arg(0));
+				return FUN(const void*, T_VECTOR)(arity_params, v[0]);
 			case 2:
-				return FUN(const void*, T_VECTOR, T_VECTOR)(arity_params, eval_arg(0), eval_arg(1));
+				return FUN(const void*, T_VECTOR, T_VECTOR)(arity_params, v[0], v[1]);
 			case 3:
-				return FUN(const void*, T_VECTOR, T_VECTOR, T_VECTOR)(arity_params, eval_arg(0), eval_arg(1), eval_arg(2));
+				return FUN(const void*, T_VECTOR, T_VECTOR, T_VECTOR)(arity_params, v[0], v[1], v[2]);
 			case 4:
-				return FUN(const void*, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(arity_params, eval_arg(0), eval_arg(1), eval_arg(2), eval_arg(3));
+				return FUN(const void*, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(arity_params, v[0], v[1], v[2], v[3]);
 			case 5:
-				return FUN(const void*, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(arity_params, eval_arg(0), eval_arg(1), eval_arg(2), eval_arg(3), eval_arg(4));
+				return FUN(const void*, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(arity_params, v[0], v[1], v[2], v[3], v[4]);
 			case 6:
 				return FUN(const void*, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(
-					arity_params, eval_arg(0), eval_arg(1), eval_arg(2), eval_arg(3), eval_arg(4), eval_arg(5));
+					arity_params, v[0], v[1], v[2], v[3], v[4], v[5]);
 			case 7:
 				return FUN(const void*, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR, T_VECTOR)(
-					arity_params, eval_arg(0), eval_arg(1), eval_arg(2), eval_arg(3), eval_arg(4), eval_arg(5), eval_arg(6));
+					arity_params, v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
 			}
 #undef FUN
 			return error_val;
 		}
 
-		template<typename T_TRAITS, typename T_ATOM, typename T_VECTOR>
-		static inline auto eval_portable_impl(const expr_portable<T_TRAITS>* n_portable, const unsigned char* expr_buffer, const void* const expr_context[]) noexcept -> T_VECTOR
+		// Number of operands of a builtin operator, 0 for values that aren't one.
+		inline int operator_arity(builtin_operator op) noexcept
+		{
+			switch (op)
+			{
+			case builtin_operator::negate:
+			case builtin_operator::logical_not:
+			case builtin_operator::logical_notnot:
+			case builtin_operator::negate_logical_not:
+			case builtin_operator::negate_logical_notnot:
+				return 1;
+			case builtin_operator::select:
+			case builtin_operator::fma:
+			case builtin_operator::clamp:
+				return 3;
+			default:
+				return (op < builtin_operator::count) ? 2 : 0;
+			}
+		}
+
+		template<typename T_NATIVE, typename T_VECTOR, typename T_EVAL_ARG>
+		static inline auto eval_operator(int op, T_EVAL_ARG eval_arg) -> T_VECTOR
+		{
+			// Operands are evaluated left to right before the operator runs, like the bytecode does: comma only exists to order side effects
+			// and setx(7) + x has to read the x setx wrote.
+			const auto o = builtin_operator(op);
+			const int  a = operator_arity(o);
+			T_VECTOR   v[3]{};
+			for (int e = 0; e < a; ++e)
+			{
+				v[e] = eval_arg(e);
+			}
+
+			switch (o)
+			{
+			case builtin_operator::add:
+				return T_NATIVE::add(v[0], v[1]);
+			case builtin_operator::sub:
+				return T_NATIVE::sub(v[0], v[1]);
+			case builtin_operator::mul:
+				return T_NATIVE::mul(v[0], v[1]);
+			case builtin_operator::divide:
+				return T_NATIVE::divide(v[0], v[1]);
+			case builtin_operator::pow:
+				return T_NATIVE::pow(v[0], v[1]);
+			case builtin_operator::fmod:
+				return T_NATIVE::fmod(v[0], v[1]);
+			case builtin_operator::comma:
+				return T_NATIVE::comma(v[0], v[1]);
+			case builtin_operator::greater:
+				return T_NATIVE::greater(v[0], v[1]);
+			case builtin_operator::greater_eq:
+				return T_NATIVE::greater_eq(v[0], v[1]);
+			case builtin_operator::lower:
+				return T_NATIVE::lower(v[0], v[1]);
+			case builtin_operator::lower_eq:
+				return T_NATIVE::lower_eq(v[0], v[1]);
+			case builtin_operator::equal:
+				return T_NATIVE::equal(v[0], v[1]);
+			case builtin_operator::not_equal:
+				return T_NATIVE::not_equal(v[0], v[1]);
+			case builtin_operator::logical_and:
+				return T_NATIVE::logical_and(v[0], v[1]);
+			case builtin_operator::logical_or:
+				return T_NATIVE::logical_or(v[0], v[1]);
+			case builtin_operator::negate:
+				return T_NATIVE::negate(v[0]);
+			case builtin_operator::logical_not:
+				return T_NATIVE::logical_not(v[0]);
+			case builtin_operator::logical_notnot:
+				return T_NATIVE::logical_notnot(v[0]);
+			case builtin_operator::negate_logical_not:
+				return T_NATIVE::negate_logical_not(v[0]);
+			case builtin_operator::negate_logical_notnot:
+				return T_NATIVE::negate_logical_notnot(v[0]);
+			case builtin_operator::select:
+				return T_NATIVE::select(v[0], v[1], v[2]);
+			case builtin_operator::fma:
+				return T_NATIVE::fma(v[0], v[1], v[2]);
+			case builtin_operator::min:
+				return T_NATIVE::min(v[0], v[1]);
+			case builtin_operator::max:
+				return T_NATIVE::max(v[0], v[1]);
+			case builtin_operator::clamp:
+				return T_NATIVE::clamp(v[0], v[1], v[2]);
+			default:
+				return T_NATIVE::nan();
+			}
+		}
+
+		// Offset or binding index of an operand, offsets may be negative.
+		inline int32_t operand_value(uint32_t operand) noexcept
+		{
+			return int32_t(operand) >> OPERAND_TAG_BITS;
+		}
+
+		template<typename T_TRAITS>
+		static inline auto load_portable_constant(const unsigned char* expr_buffer, int32_t offset) noexcept -> typename T_TRAITS::t_vector
+		{
+			typename T_TRAITS::t_atom value;
+			::memcpy(&value, expr_buffer + offset, sizeof(value));
+			return T_TRAITS::load_atom(value);
+		}
+
+		// Value of a variable or constant operand.
+		template<typename T_TRAITS, typename T_VECTOR>
+		static inline auto eval_portable_leaf(uint32_t operand, const unsigned char* expr_buffer, const void* const expr_context[]) noexcept -> T_VECTOR
+		{
+			if ((operand & OPERAND_TAG_MASK) == OPERAND_CONSTANT)
+			{
+				return load_portable_constant<T_TRAITS>(expr_buffer, operand_value(operand));
+			}
+			return (expr_context != nullptr) ? *((const T_VECTOR*)(expr_context[operand_value(operand)])) : T_TRAITS::nan();
+		}
+
+		// Evaluates one portable node, eval_arg(e) returns the value of its e-th parameter.
+		template<typename T_TRAITS, typename T_ATOM, typename T_VECTOR, typename T_EVAL_ARG>
+		static inline auto eval_portable_node(const expr_portable<T_TRAITS>* n_portable, const unsigned char* expr_buffer, const void* const expr_context[], T_EVAL_ARG eval_arg) noexcept -> T_VECTOR
 		{
-			using t_atom   = T_ATOM;
 			using t_vector = T_VECTOR;
 			using t_traits = T_TRAITS;
 
-			auto eval_arg = [&](int e) {
-				return eval_portable_impl<t_traits, t_atom, t_vector>((const expr_portable<t_traits>*)&expr_buffer[n_portable->parameters[e]], expr_buffer, expr_context);
-			};
+			if (n_portable->type & FLAG_OPERATOR)
+			{
+				// && and || skip their right hand side once the left one decides every lane.
+				const auto op = builtin_operator(n_portable->function);
+				if (op == builtin_operator::logical_and || op == builtin_operator::logical_or)
+				{
+					using t_native = typename t_traits::t_native;
+
+					const t_vector left	   = t_native::logical_notnot(eval_arg(0));
+					const int	   decided = (op == builtin_operator::logical_and) ? 0 : (1 << t_traits::lanes) - 1;
+					if (t_traits::lane_mask(left) == decided)
+					{
+						return left;
+					}
+					return (op == builtin_operator::logical_and) ? t_native::logical_and(left, eval_arg(1)) : t_native::logical_or(left, eval_arg(1));
+				}
+
+				// select only evaluates the branch the lanes take, both of them are blended when the lanes disagree.
+				if (op == builtin_operator::select)
+				{
+					const t_vector condition = eval_arg(0);
+					const int	   mask		 = t_traits::lane_mask(condition);
+					if (mask == (1 << t_traits::lanes) - 1)
+					{
+						return eval_arg(1);
+					}
+					if (mask == 0)
+					{
+						return eval_arg(2);
+					}
+					return t_traits::t_native::select(condition, eval_arg(1), eval_arg(2));
+				}
+
+				return eval_operator<typename t_traits::t_native, t_vector>(int(n_portable->function), eval_arg);
+			}
 
 			return eval_generic(
-				n_portable->type, [&]() { return t_traits::load_atom(n_portable->value); },
-				[&]() { return t_traits::load_atom((expr_context != nullptr) ? *((const t_vector*)(expr_context[n_portable->bound])) : t_traits::nan()); },
+				n_portable->type, [&]() { return load_portable_constant<t_traits>(expr_buffer, n_portable->constant); },
+				[&]() { return (expr_context != nullptr) ? *((const t_vector*)(expr_context[n_portable->bound])) : t_traits::nan(); },
 				[&](int a) { return eval_function<t_vector>(a, expr_context[n_portable->function], t_traits::nan(), eval_arg); },
 				[&](int a) { return eval_closure<t_vector>(a, expr_context[n_portable->function], (void*)expr_context[n_portable->parameters[a]], t_traits::nan(), eval_arg); },
 				[&]() { return t_traits::nan(); });
 		}
+
+		template<typename T_TRAITS, typename T_ATOM, typename T_VECTOR>
+		static inline auto eval_portable_impl(const expr_portable<T_TRAITS>* n_portable, const unsigned char* expr_buffer, const void* const expr_context[]) noexcept -> T_VECTOR
+		{
+			return eval_portable_node<T_TRAITS, T_ATOM, T_VECTOR>(n_portable, expr_buffer, expr_context, [&](int e) {
+				const uint32_t operand = n_portable->parameters[e];
+				if ((operand & OPERAND_TAG_MASK) != OPERAND_NODE)
+				{
+					return eval_portable_leaf<T_TRAITS, T_VECTOR>(operand, expr_buffer, expr_context);
+				}
+				return eval_portable_impl<T_TRAITS, T_ATOM, T_VECTOR>((const expr_portable<T_TRAITS>*)(expr_buffer + operand_value(operand)), expr_buffer, expr_context);
+			});
+		}
+
+		// Runs a post-order expression front to back, the results of node operands are taken from a stack. The exporter only
+		// picks that layout when the stack fits in TP_MAX_REGISTERS and what the lazy operators may skip has no side effects.
+		template<typename T_TRAITS, typename T_ATOM, typename T_VECTOR>
+		static inline auto eval_post_order_impl(const unsigned char* root, const void* const expr_context[]) noexcept -> T_VECTOR
+		{
+			using t_portable = expr_portable<T_TRAITS>;
+
+			// The first node is found by descending into the first node operand until there is none.
+			auto first = (const t_portable*)root;
+			for (int e = 0; e < arity(int(first->type));)
+			{
+				if ((first->parameters[e] & OPERAND_TAG_MASK) == OPERAND_NODE)
+				{
+					first = (const t_portable*)(root + operand_value(first->parameters[e]));
+					e	  = 0;
+					continue;
+				}
+				++e;
+			}
+
+			T_VECTOR stack[TP_MAX_REGISTERS];
+			int		 top = 0;
+			for (auto p = (const unsigned char*)first;;)
+			{
+				const auto n = (const t_portable*)p;
+				const int  a = arity(int(n->type));
+
+				int operands = 0;
+				for (int e = 0; e < a; ++e)
+				{
+					operands += ((n->parameters[e] & OPERAND_TAG_MASK) == OPERAND_NODE) ? 1 : 0;
+				}
+
+				const int	   bottom = top - operands;
+				const T_VECTOR value  = eval_portable_node<T_TRAITS, T_ATOM, T_VECTOR>(n, root, expr_context, [&](int e) {
+					 const uint32_t operand = n->parameters[e];
+					 if ((operand & OPERAND_TAG_MASK) != OPERAND_NODE)
+					 {
+						 return eval_portable_leaf<T_TRAITS, T_VECTOR>(operand, root, expr_context);
+					 }
+
+					 int slot = bottom;
+					 for (int i = 0; i < e; ++i)
+					 {
+						 slot += ((n->parameters[i] & OPERAND_TAG_MASK) == OPERAND_NODE) ? 1 : 0;
+					 }
+					 return stack[slot];
+				 });
+
+				if (p == root)
+				{
+					return value;
+				}
+
+				top			 = bottom;
+				stack[top++] = value;
+				p += sizeof(uint32_t) * (2 + a + ((type_mask(int(n->type)) >= CLOSURE0) ? 1 : 0));
+			}
+		}
 	} // namespace eval_details
 
 	enum class statement_type : int
@@ -264,2367 +719,7819 @@ namespace tp
 		int			   arg_b;
 	};
 
-#if (TP_COMPILER_ENABLED)
-	struct compiled_expr
+	enum class opcode : uint16_t
 	{
-		virtual ~compiled_expr() = default;
-
-		virtual size_t				 get_binding_array_size() const = 0;
-		virtual const void* const*	 get_binding_addresses() const	= 0;
-		virtual const char* const*	 get_binding_names() const		= 0;
-		virtual size_t				 get_data_size() const			= 0;
-		virtual const unsigned char* get_data() const				= 0;
+		load_constant, // reg = constants[arg_a]
+		load_variable, // reg = *bindings[arg_a]
+		store_variable, // *bindings[arg_a] = reg
+
+		call0, // reg = bindings[arg_a](reg, reg + 1, ...)
+		call1,
+		call2,
+		call3,
+		call4,
+		call5,
+		call6,
+		call7,
+
+		closure0, // reg = bindings[arg_a](bindings[arg_b], reg, reg + 1, ...)
+		closure1,
+		closure2,
+		closure3,
+		closure4,
+		closure5,
+		closure6,
+		closure7,
+
+		jump,	 // goto arg_a
+		jump_if, // if (reg) goto arg_a
+		ret,	 // return reg
+		ret_nan, // return nan
+
+		// Builtin operators in builtin_operator order, binary: reg = op(r[arg_a], r[arg_b]), unary: reg = op(r[arg_a])
+		add,
+		sub,
+		mul,
+		divide,
+		pow,
+		fmod,
+		comma,
+		greater,
+		greater_eq,
+		lower,
+		lower_eq,
+		equal,
+		not_equal,
+		logical_and,
+		logical_or,
+		negate,
+		logical_not,
+		logical_notnot,
+		negate_logical_not,
+		negate_logical_notnot,
+
+		// Binary operators with a constant right hand side: reg = op(r[arg_a], constants[arg_b])
+		add_k,
+		sub_k,
+		mul_k,
+		divide_k,
+
+		// Locals live in a frame of the invocation that starts zeroed, arg_a is the slot
+		load_local,	 // reg = frame[arg_a]
+		store_local, // frame[arg_a] = reg
+
+		select, // reg = r[reg] ? r[reg + 1] : r[reg + 2], lane by lane
+
+		fma,   // reg = r[reg] * r[reg + 1] + r[reg + 2]
+		min,   // reg = min(r[arg_a], r[arg_b])
+		max,   // reg = max(r[arg_a], r[arg_b])
+		clamp, // reg = min(max(r[reg], r[reg + 1]), r[reg + 2])
 	};
 
-	struct compiled_program
+	// The opcode executing a builtin operator.
+	static inline opcode operator_opcode(builtin_operator op) noexcept
 	{
-		virtual ~compiled_program() = default;
-
-		virtual size_t				 get_binding_array_size() const	  = 0;
-		virtual const void* const*	 get_binding_addresses() const	  = 0;
-		virtual const char* const*	 get_binding_names() const		  = 0;
-		virtual size_t				 get_data_size() const			  = 0;
-		virtual const unsigned char* get_data() const				  = 0;
-		virtual size_t				 get_statement_array_size() const = 0;
-		virtual const statement*	 get_statements() const			  = 0;
+		switch (op)
+		{
+		case builtin_operator::select:
+			return opcode::select;
+		case builtin_operator::fma:
+			return opcode::fma;
+		case builtin_operator::min:
+			return opcode::min;
+		case builtin_operator::max:
+			return opcode::max;
+		case builtin_operator::clamp:
+			return opcode::clamp;
+		default:
+			return opcode(int(opcode::add) + int(op));
+		}
+	}
+
+	struct instruction
+	{
+		opcode	 op;
+		uint16_t reg;
+		uint16_t arg_a;
+		uint16_t arg_b;
 	};
-#endif // #if (TP_COMPILER_ENABLED)
-} // namespace tp
-
-#if (TP_COMPILER_ENABLED)
-#include <unordered_map>
-#include <vector>
-#include <variant>
-#include <memory>
-#include <cassert>
 
-namespace tp
-{
-	template<typename T_TRAITS>
-	struct native
+	// A bytecode buffer is a bytecode_header, followed by the instruction array, followed by the constant array (t_atom).
+	struct bytecode_header
 	{
-		using t_traits = T_TRAITS;
-		using t_atom   = typename T_TRAITS::t_atom;
-		using t_vector = typename T_TRAITS::t_vector;
+		uint16_t num_registers;
+		uint16_t num_instructions;
+		uint16_t num_constants;
+		uint16_t num_locals;
+	};
 
-		struct expr_native
+	namespace eval_details
+	{
+		template<typename T_TRAITS, typename T_ATOM, typename T_VECTOR>
+		static inline auto eval_bytecode_impl(const unsigned char* bytecode, const void* const expr_context[]) noexcept -> T_VECTOR
 		{
-			int type;
-			union
-			{
-				t_atom		  value;
-				const t_atom* bound;
-				const void*	  function;
-			};
-			void* parameters[1];
-		};
-
-		typedef t_vector (*te_fun2)(t_vector, t_vector);
+			using t_atom   = T_ATOM;
+			using t_vector = T_VECTOR;
+			using t_traits = T_TRAITS;
+			using t_native = typename T_TRAITS::t_native;
 
-		enum
-		{
-			TOK_NUL = CLOSURE_MAX,
-			TOK_ERROR,
-			TOK_END,
-			TOK_SEP,
-			TOK_OPEN,
-			TOK_CLOSE,
-			TOK_NUMBER,
-			TOK_VARIABLE,
-			TOK_INFIX
-		};
+			const auto header	 = (const bytecode_header*)bytecode;
+			const auto code		 = (const instruction*)(bytecode + sizeof(bytecode_header));
+			const auto constants = (const t_atom*)(code + header->num_instructions);
 
-		struct state
-		{
-			const char* start;
-			const char* next;
-			int			type;
-			union
+			t_vector r[TP_MAX_REGISTERS];
+			t_vector frame[TP_MAX_LOCALS];
+			for (int l = 0; l < header->num_locals; ++l)
 			{
-				t_atom		  value;
-				const t_atom* bound;
-				const void*	  function;
-			};
-			void* context;
-
-			variable_lookup lookup;
-		};
-
-		static inline bool is_pure(int t) noexcept
-		{
-			return (((t)&FLAG_PURE) != 0);
-		}
-
-		static inline bool is_function(int t) noexcept
-		{
-			return (((t)&FUNCTION0) != 0);
-		}
-
-		static inline bool is_closure(int t) noexcept
-		{
-			return (((t)&CLOSURE0) != 0);
-		}
+				frame[l] = t_traits::explicit_load_atom(0);
+			}
 
-#define NEW_EXPR(type, ...)                                                                                                                                                        \
-	[&]() {                                                                                                                                                                        \
-		const expr_native* _args[] = {__VA_ARGS__};                                                                                                                                \
-		return new_expr((type), _args);                                                                                                                                            \
-	}()
+			// Packed traits run divergent code masked: lanes that disagree on a jump_if are parked at their own program counter, the
+			// lowest one runs with the other lanes' register and variable writes discarded, and lanes merge again once they reach the
+			// same instruction. Lanes that return keep their result until every lane has returned.
+			constexpr int lanes		= t_traits::lanes;
+			constexpr int all_lanes = (1 << lanes) - 1;
+			constexpr int finished	= 0x7fffffff;
+
+			int		 active = all_lanes;
+			int		 lane_pc[lanes];
+			t_vector result = t_traits::nan();
+			t_vector keep	= result;
+
+			auto schedule = [&](const instruction*& pc) {
+				const int current = int(pc - code);
+				int		  lowest  = finished;
+				for (int l = 0; l < lanes; ++l)
+				{
+					lane_pc[l] = (active & (1 << l)) ? current : lane_pc[l];
+					lowest	   = (lane_pc[l] < lowest) ? lane_pc[l] : lowest;
+				}
 
-		static expr_native* new_expr(const int type, const expr_native* parameters[])
-		{
-			const int	 arity = eval_details::arity(type);
-			const int	 psize = sizeof(void*) * arity;
-			const int	 size  = (sizeof(expr_native) - sizeof(void*)) + psize + (is_closure(type) ? sizeof(void*) : 0);
-			expr_native* ret   = (expr_native*)malloc(size);
-			if (ret)
-			{
-				memset(ret, 0, size);
-				if (arity && parameters)
+				active = 0;
+				for (int l = 0; l < lanes; ++l)
 				{
-					memcpy(ret->parameters, parameters, psize);
+					active |= (lane_pc[l] == lowest && lowest != finished) ? (1 << l) : 0;
 				}
-				ret->type  = type;
-				ret->bound = 0;
-			}
-			return ret;
-		}
+				pc = code + lowest;
+				return active != 0;
+			};
 
-		static void free_parameters(expr_native* n)
-		{
-			if (!n)
-				return;
+			auto retire = [&](const t_vector& value, const instruction*& pc) {
+				if constexpr (lanes > 1)
+				{
+					result = t_traits::select_lanes(active, value, result);
+				}
+				for (int l = 0; l < lanes; ++l)
+				{
+					lane_pc[l] = (active & (1 << l)) ? finished : lane_pc[l];
+				}
+				active = 0;
+				return schedule(pc);
+			};
 
-			for (int arity = eval_details::arity(n->type); arity > 0; --arity)
+#define FUN(...) ((t_vector(*)(__VA_ARGS__))expr_context[i.arg_a])
+#define CTX (expr_context[i.arg_b])
+			for (const instruction* pc = code;;)
 			{
-				free_native((expr_native*)n->parameters[arity - 1]);
-			}
-		}
-
-		static void free_native(expr_native* n)
-		{
-			if (!n)
-				return;
-			free_parameters(n);
-			free(n);
-		}
+				if constexpr (lanes > 1)
+				{
+					if (active != all_lanes)
+					{
+						schedule(pc);
+						const instruction& i = *pc;
+						keep = (i.op == opcode::store_variable) ? *((const t_vector*)expr_context[i.arg_a]) : (i.op == opcode::store_local) ? frame[i.arg_a] : r[i.reg];
+					}
+				}
 
-		static inline const void* find_wrapper(const char* name, state* s)
-		{
-			auto var = t_traits::find_by_name(name, int(strlen(name)), &s->lookup);
-			return var ? var->address : nullptr;
-		}
+				const instruction& i = *pc++;
+				t_vector*		   a = &r[i.reg];
 
-		static void next_token(state* s)
-		{
-			s->type = (int)TOK_NUL;
-
-			do
-			{
-				if (!*s->next || *s->next == ';')
-				{
-					s->type = (int)TOK_END;
-					return;
-				}
-
-				/* Try reading a number. */
-				if ((s->next[0] >= '0' && s->next[0] <= '9') || s->next[0] == '.')
-				{
-					s->value = (t_atom)strtod(s->next, (char**)&s->next);
-					s->type	 = (int)TOK_NUMBER;
-				}
-				else
+				switch (i.op)
 				{
-					/* Look for a variable or builtin function call. */
-					if ((s->next[0] >= 'a' && s->next[0] <= 'z') || (s->next[0] == '_'))
+				case opcode::load_constant:
+					a[0] = t_traits::load_atom(constants[i.arg_a]);
+					break;
+				case opcode::load_variable:
+					a[0] = *((const t_vector*)expr_context[i.arg_a]);
+					break;
+				case opcode::store_variable:
+					*((t_vector*)expr_context[i.arg_a]) = a[0];
+					break;
+				case opcode::load_local:
+					a[0] = frame[i.arg_a];
+					break;
+				case opcode::store_local:
+					frame[i.arg_a] = a[0];
+					break;
+				case opcode::select:
+					a[0] = t_native::select(a[0], a[1], a[2]);
+					break;
+				case opcode::fma:
+					a[0] = t_native::fma(a[0], a[1], a[2]);
+					break;
+				case opcode::clamp:
+					a[0] = t_native::clamp(a[0], a[1], a[2]);
+					break;
+				case opcode::call0:
+					a[0] = FUN(void)();
+					break;
+				case opcode::call1:
+					a[0] = FUN(t_vector)(a[0]);
+					break;
+				case opcode::call2:
+					a[0] = FUN(t_vector, t_vector)(a[0], a[1]);
+					break;
+				case opcode::call3:
+					a[0] = FUN(t_vector, t_vector, t_vector)(a[0], a[1], a[2]);
+					break;
+				case opcode::call4:
+					a[0] = FUN(t_vector, t_vector, t_vector, t_vector)(a[0], a[1], a[2], a[3]);
+					break;
+				case opcode::call5:
+					a[0] = FUN(t_vector, t_vector, t_vector, t_vector, t_vector)(a[0], a[1], a[2], a[3], a[4]);
+					break;
+				case opcode::call6:
+					a[0] = FUN(t_vector, t_vector, t_vector, t_vector, t_vector, t_vector)(a[0], a[1], a[2], a[3], a[4], a[5]);
+					break;
+				case opcode::call7:
+					a[0] = FUN(t_vector, t_vector, t_vector, t_vector, t_vector, t_vector, t_vector)(a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+					break;
+				case opcode::closure0:
+					a[0] = FUN(const void*)(CTX);
+					break;
+				case opcode::closure1:
+					a[0] = FUN(const void*, t_vector)(CTX, a[0]);
+					break;
+				case opcode::closure2:
+					a[0] = FUN(const void*, t_vector, t_vector)(CTX, a[0], a[1]);
+					break;
+				case opcode::closure3:
+					a[0] = FUN(const void*, t_vector, t_vector, t_vector)(CTX, a[0], a[1], a[2]);
+					break;
+				case opcode::closure4:
+					a[0] = FUN(const void*, t_vector, t_vector, t_vector, t_vector)(CTX, a[0], a[1], a[2], a[3]);
+					break;
+				case opcode::closure5:
+					a[0] = FUN(const void*, t_vector, t_vector, t_vector, t_vector, t_vector)(CTX, a[0], a[1], a[2], a[3], a[4]);
+					break;
+				case opcode::closure6:
+					a[0] = FUN(const void*, t_vector, t_vector, t_vector, t_vector, t_vector, t_vector)(CTX, a[0], a[1], a[2], a[3], a[4], a[5]);
+					break;
+				case opcode::closure7:
+					a[0] = FUN(const void*, t_vector, t_vector, t_vector, t_vector, t_vector, t_vector, t_vector)(CTX, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+					break;
+#define BINARY(OP) \
+	case opcode::OP: a[0] = t_native::OP(r[i.arg_a], r[i.arg_b]); break;
+#define UNARY(OP) \
+	case opcode::OP: a[0] = t_native::OP(r[i.arg_a]); break;
+#define BINARY_K(OP) \
+	case opcode::OP##_k: a[0] = t_native::OP(r[i.arg_a], t_traits::load_atom(constants[i.arg_b])); break;
+					BINARY(add)
+					BINARY(sub)
+					BINARY(mul)
+					BINARY(divide)
+					BINARY(pow)
+					BINARY(fmod)
+					BINARY(comma)
+					BINARY(greater)
+					BINARY(greater_eq)
+					BINARY(lower)
+					BINARY(lower_eq)
+					BINARY(equal)
+					BINARY(not_equal)
+					BINARY(logical_and)
+					BINARY(logical_or)
+					BINARY(min)
+					BINARY(max)
+					UNARY(negate)
+					UNARY(logical_not)
+					UNARY(logical_notnot)
+					UNARY(negate_logical_not)
+					UNARY(negate_logical_notnot)
+					BINARY_K(add)
+					BINARY_K(sub)
+					BINARY_K(mul)
+					BINARY_K(divide)
+#undef BINARY_K
+#undef UNARY
+#undef BINARY
+				case opcode::jump:
+					pc = code + i.arg_a;
+					break;
+				case opcode::jump_if:
+					if constexpr (lanes > 1)
 					{
-						const char* start;
-						start = s->next;
-						while ((s->next[0] >= 'a' && s->next[0] <= 'z') || (s->next[0] >= '0' && s->next[0] <= '9') || (s->next[0] == '_'))
-							s->next++;
-
-						const variable* var = t_traits::find_by_name(start, static_cast<int>(s->next - start), &s->lookup);
-
-						if (!var)
-						{
-							s->type = (int)TOK_ERROR;
-						}
-						else
+						const int taken = t_traits::lane_mask(a[0]) & active;
+						if (taken != 0 && taken != active)
 						{
-							const auto t = eval_details::type_mask(var->type);
-							if (t == CONSTANT)
-							{
-								s->type	 = (int)TOK_VARIABLE;
-								s->bound = (const t_atom*)var->address;
-							}
-							else if (t == VARIABLE)
-							{
-								s->type	 = (int)TOK_VARIABLE;
-								s->bound = (const t_atom*)var->address;
-							}
-							else if (t >= FUNCTION0)
+							// Park the lanes that jump and carry on with the rest, schedule() picks the lowest of the two next time.
+							for (int l = 0; l < lanes; ++l)
 							{
-								if (t < FUNCTION_MAX)
-								{
-									s->type		= var->type;
-									s->function = var->address;
-								}
-								else if (t >= CLOSURE0)
-								{
-									if (t < CLOSURE_MAX)
-									{
-										s->context	= var->context;
-										s->type		= var->type;
-										s->function = var->address;
-									}
-								}
+								lane_pc[l] = (taken & (1 << l)) ? int(i.arg_a) : lane_pc[l];
 							}
+							active &= ~taken;
+							continue;
+						}
+						if (taken != 0)
+						{
+							pc = code + i.arg_a;
 						}
 					}
-					else
+					else if (t_traits::lane_mask(a[0]))
 					{
-						/* Look for an operator or special character. */
-						switch (s->next++[0])
+						pc = code + i.arg_a;
+					}
+					break;
+				case opcode::ret:
+					if constexpr (lanes > 1)
+					{
+						if (active != all_lanes)
 						{
-						case '+':
-							s->type		= (int)TOK_INFIX;
-							s->function = find_wrapper("add", s);
-							break;
-						case '-':
-							s->type		= (int)TOK_INFIX;
-							s->function = find_wrapper("sub", s);
-							break;
-						case '*':
-							s->type		= (int)TOK_INFIX;
-							s->function = find_wrapper("mul", s);
-							break;
-						case '/':
-							s->type		= (int)TOK_INFIX;
-							s->function = find_wrapper("divide", s);
-							break;
-						case '^':
-							s->type		= (int)TOK_INFIX;
-							s->function = find_wrapper("pow", s);
-							break;
-						case '%':
-							s->type		= (int)TOK_INFIX;
-							s->function = find_wrapper("fmod", s);
-							break;
-						case '!':
-							if (s->next++[0] == '=')
-							{
-								s->type		= (int)TOK_INFIX;
-								s->function = find_wrapper("not_equal", s);
-							}
-							else
-							{
-								s->next--;
-								s->type		= (int)TOK_INFIX;
-								s->function = find_wrapper("logical_not", s);
-							}
-							break;
-						case '=':
-							if (s->next++[0] == '=')
-							{
-								s->type		= (int)TOK_INFIX;
-								s->function = find_wrapper("equal", s);
-							}
-							else
-							{
-								s->type = (int)TOK_ERROR;
-							}
-							break;
-						case '<':
-							if (s->next++[0] == '=')
+							if (!retire(a[0], pc))
 							{
-								s->type		= (int)TOK_INFIX;
-								s->function = find_wrapper("lower_eq", s);
-							}
-							else
-							{
-								s->next--;
-								s->type		= (int)TOK_INFIX;
-								s->function = find_wrapper("lower", s);
-							}
-							break;
-						case '>':
-							if (s->next++[0] == '=')
-							{
-								s->type		= (int)TOK_INFIX;
-								s->function = find_wrapper("greater_eq", s);
-							}
-							else
-							{
-								s->next--;
-								s->type		= (int)TOK_INFIX;
-								s->function = find_wrapper("greater", s);
-							}
-							break;
-						case '&':
-							if (s->next++[0] == '&')
-							{
-								s->type		= (int)TOK_INFIX;
-								s->function = find_wrapper("logical_and", s);
-							}
-							else
-							{
-								s->type = (int)TOK_ERROR;
-							}
-							break;
-						case '|':
-							if (s->next++[0] == '|')
-							{
-								s->type		= (int)TOK_INFIX;
-								s->function = find_wrapper("logical_or", s);
+								return result;
 							}
-							else
+							continue;
+						}
+					}
+					return a[0];
+				default:
+					if constexpr (lanes > 1)
+					{
+						if (active != all_lanes)
+						{
+							if (!retire(t_traits::nan(), pc))
 							{
-								s->type = (int)TOK_ERROR;
+								return result;
 							}
-							break;
-						case '(':
-							s->type = (int)TOK_OPEN;
-							break;
-						case ')':
-							s->type = (int)TOK_CLOSE;
-							break;
-						case ',':
-							s->type = (int)TOK_SEP;
-							break;
-						case ' ':
-						case '\t':
-						case '\n':
-						case '\r':
-							break;
-						default:
-							s->type = (int)TOK_ERROR;
-							break;
+							continue;
 						}
 					}
+					return t_traits::nan();
 				}
-			} while (s->type == (int)TOK_NUL);
-		}
-
-		static expr_native* base(state* s)
-		{
-			/* <base>      =    <constant> | <variable> | <function-0> {"(" ")"} | <function-1> <power> | <function-X>
-			 * "(" <expr> {"," <expr>} ")" | "(" <list> ")" */
-			expr_native* ret;
-
-			const auto t = eval_details::type_mask(s->type);
 
-			if (t == (int)TOK_NUMBER)
-			{
-				ret		   = new_expr(CONSTANT, 0);
-				ret->value = s->value;
-				next_token(s);
-			}
-			else if (t == (int)TOK_VARIABLE)
-			{
-				ret		   = new_expr(VARIABLE, 0);
-				ret->bound = s->bound;
-				next_token(s);
-			}
-			else if ((t >= FUNCTION0 && t < FUNCTION_MAX) || (t >= CLOSURE0 && t < CLOSURE_MAX))
-			{
-				const auto arity = eval_details::arity(s->type);
-				if (arity == 0)
+				if constexpr (lanes > 1)
 				{
-					ret			  = new_expr(s->type, 0);
-					ret->function = s->function;
-					if (is_closure(s->type))
-						ret->parameters[0] = s->context;
-					next_token(s);
-					if (s->type == (int)TOK_OPEN)
+					if (active != all_lanes)
 					{
-						next_token(s);
-						if (s->type != (int)TOK_CLOSE)
+						if (i.op == opcode::store_variable)
 						{
-							s->type = (int)TOK_ERROR;
+							auto dest = (t_vector*)expr_context[i.arg_a];
+							*dest	  = t_traits::select_lanes(active, *dest, keep);
+						}
+						else if (i.op == opcode::store_local)
+						{
+							frame[i.arg_a] = t_traits::select_lanes(active, frame[i.arg_a], keep);
 						}
 						else
 						{
-							next_token(s);
+							a[0] = t_traits::select_lanes(active, a[0], keep);
 						}
 					}
 				}
-				else if (arity == 1)
-				{
-					ret			  = new_expr(s->type, 0);
-					ret->function = s->function;
-					if (is_closure(s->type))
-						ret->parameters[1] = s->context;
-					next_token(s);
-					ret->parameters[0] = power(s);
-				}
-				else
-				{
-					ret			  = new_expr(s->type, 0);
-					ret->function = s->function;
-					if (is_closure(s->type))
-						ret->parameters[arity] = s->context;
-					next_token(s);
+			}
+#undef CTX
+#undef FUN
+		}
 
-					if (s->type != (int)TOK_OPEN)
+		// Collects the bindings the code stores to with a stride of 0 (declared variables shared by all rows, at most TP_MAX_REGISTERS of
+		// them), eval_bytecode_batch_impl gives each of them a per row column in scratch.
+		static inline int batch_locals(const unsigned char* bytecode, const size_t* strides, int* bindings) noexcept
+		{
+			const auto header = (const bytecode_header*)bytecode;
+			const auto code	  = (const instruction*)(bytecode + sizeof(bytecode_header));
+
+			int num_locals = 0;
+			for (int i = 0; strides && i < header->num_instructions; ++i)
+			{
+				if (code[i].op == opcode::store_variable && strides[code[i].arg_a] == 0 && num_locals < TP_MAX_REGISTERS)
+				{
+					int k = 0;
+					while (k < num_locals && bindings[k] != code[i].arg_a)
 					{
-						s->type = (int)TOK_ERROR;
+						++k;
 					}
-					else
-					{
-						int i;
-						for (i = 0; i < arity; i++)
-						{
-							next_token(s);
-							ret->parameters[i] = expr(s);
-							if (s->type != (int)TOK_SEP)
-							{
-								break;
-							}
-						}
-						if (s->type != (int)TOK_CLOSE || i != arity - 1)
-						{
-							s->type = (int)TOK_ERROR;
-						}
-						else
-						{
-							next_token(s);
-						}
-					}
-				}
-			}
-			else if (t == (int)TOK_OPEN)
-			{
-				next_token(s);
-				ret = list(s);
-				if (s->type != (int)TOK_CLOSE)
-				{
-					s->type = (int)TOK_ERROR;
-				}
-				else
-				{
-					next_token(s);
+					bindings[k] = code[i].arg_a;
+					num_locals += (k == num_locals) ? 1 : 0;
 				}
 			}
-			else
-			{
-				ret		   = new_expr(0, 0);
-				s->type	   = (int)TOK_ERROR;
-				ret->value = t_traits::nan();
-			}
+			return num_locals;
+		}
 
-			return ret;
+		// Number of t_vector eval_bytecode_batch_impl needs as scratch for its register file, per row variables and frame slots.
+		static inline size_t batch_scratch_size(const unsigned char* bytecode, const size_t* strides) noexcept
+		{
+			const auto header = (const bytecode_header*)bytecode;
+			int		   bindings[TP_MAX_REGISTERS];
+			return size_t(((header->num_registers > 0) ? header->num_registers : 1) + batch_locals(bytecode, strides, bindings) + header->num_locals) *
+				TP_BATCH_BLOCK_SIZE;
 		}
 
-		static expr_native* power(state* s)
+		// Runs bytecode over rows [first, first + count), TP_BATCH_BLOCK_SIZE rows at a time with one register file column per row.
+		// Variable bindings point to arrays, row i reads element i * strides[binding] (a stride of 0 broadcasts, no strides means every
+		// variable is a column) and the result goes to out[i]. Variables written with a stride of 0 start every row with the broadcast
+		// value and keep their writes per row, the original is left untouched. Rows are scheduled by lowest program counter, so straight
+		// code runs each instruction across the whole block and rows that took different jumps reconverge at the first shared
+		// instruction. Scratch is allocated per call unless the caller passes batch_scratch_size() elements.
+		template<typename T_TRAITS, typename T_ATOM, typename T_VECTOR>
+		static inline void eval_bytecode_batch_impl(const unsigned char* bytecode, size_t first, size_t count, const void* const column_context[],
+			const size_t* strides, T_VECTOR* out, T_VECTOR* scratch = nullptr) noexcept
 		{
-			/* <power>     =    {("-" | "+" | "!")} <base> */
-			int sign = 1;
-			while (s->type == (int)TOK_INFIX && (s->function == find_wrapper("add", s) || s->function == find_wrapper("sub", s)))
-			{
-				if (s->function == find_wrapper("sub", s))
-					sign = -sign;
-				next_token(s);
-			}
+			using t_atom   = T_ATOM;
+			using t_vector = T_VECTOR;
+			using t_traits = T_TRAITS;
+			using t_native = typename T_TRAITS::t_native;
 
-			int logical = 0;
-			while (s->type == (int)TOK_INFIX && (s->function == find_wrapper("add", s) || s->function == find_wrapper("sub", s) || s->function == find_wrapper("logical_not", s)))
+			constexpr int block = TP_BATCH_BLOCK_SIZE;
+
+			const auto header	 = (const bytecode_header*)bytecode;
+			const auto code		 = (const instruction*)(bytecode + sizeof(bytecode_header));
+			const auto constants = (const t_atom*)(code + header->num_instructions);
+			const int  end		 = header->num_instructions;
+
+			bool has_jumps = false;
+			for (int i = 0; i < end; ++i)
 			{
-				if (s->function == find_wrapper("logical_not", s))
-				{
-					if (logical == 0)
-					{
-						logical = -1;
-					}
-					else
-					{
-						logical = -logical;
-					}
-				}
-				next_token(s);
+				has_jumps |= (code[i].op == opcode::jump || code[i].op == opcode::jump_if);
 			}
 
-			expr_native* ret;
+			int		  local_bindings[TP_MAX_REGISTERS];
+			const int num_locals = batch_locals(bytecode, strides, local_bindings);
 
-			if (sign == 1)
+			// new[] honors the alignment of packed vectors
+			auto registers = scratch ? scratch : new (std::nothrow) t_vector[batch_scratch_size(bytecode, strides)];
+			if (registers == nullptr)
 			{
-				if (logical == 0)
-				{
-					ret = base(s);
-				}
-				else if (logical == -1)
+				for (size_t row = first; row < first + count; ++row)
 				{
-					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
-					ret->function = find_wrapper("logical_not", s);
+					out[row] = t_traits::nan();
 				}
-				else
+				return;
+			}
+			const auto locals = registers + ((header->num_registers > 0) ? header->num_registers : 1) * block;
+			const auto frame  = locals + num_locals * block;
+
+			// Returns the element of row base + j for j = 0 and the distance to the next row.
+			auto column = [&](int binding, size_t base) -> std::pair<t_vector*, size_t> {
+				for (int k = 0; k < num_locals; ++k)
 				{
-					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
-					ret->function = find_wrapper("logical_notnot", s);
+					if (local_bindings[k] == binding)
+					{
+						return {locals + k * block, 1};
+					}
 				}
-			}
-			else
+				const size_t stride = strides ? strides[binding] : 1;
+				return {((t_vector*)column_context[binding]) + base * stride, stride};
+			};
+
+			int pc[block];
+			int rows[block];
+
+			for (size_t base = first, last = first + count; base < last; base += block)
 			{
-				if (logical == 0)
+				const int n = (last - base < size_t(block)) ? int(last - base) : block;
+
+				for (int k = 0; k < num_locals; ++k)
 				{
-					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
-					ret->function = find_wrapper("negate", s);
+					std::fill(locals + k * block, locals + k * block + n, *(const t_vector*)column_context[local_bindings[k]]);
 				}
-				else if (logical == -1)
+				std::fill(frame, frame + header->num_locals * block, t_traits::explicit_load_atom(0));
+
+				// Runs one instruction for the listed rows, or for rows [0, num_rows) when the list is null.
+				auto execute = [&](const instruction& i, const int* row_list, int num_rows) {
+					t_vector*		a	= registers + i.reg * block;
+					const t_vector* b	= registers + i.arg_a * block;
+					const t_vector* c	= registers + i.arg_b * block;
+					auto			each = [&](auto&& f) {
+						   if (row_list)
+						   {
+							   for (int k = 0; k < num_rows; ++k)
+							   {
+								   f(row_list[k]);
+							   }
+						   }
+						   else
+						   {
+							   for (int j = 0; j < num_rows; ++j)
+							   {
+								   f(j);
+							   }
+						   }
+					};
+
+#define FUN(...) ((t_vector(*)(__VA_ARGS__))column_context[i.arg_a])
+#define CTX (column_context[i.arg_b])
+#define ARG(N) a[(N)*block + j]
+					switch (i.op)
+					{
+					case opcode::load_constant:
+					{
+						const t_vector k = t_traits::load_atom(constants[i.arg_a]);
+						each([&](int j) { a[j] = k; });
+						break;
+					}
+					case opcode::load_variable:
+					{
+						const auto src = column(i.arg_a, base);
+						each([&](int j) { a[j] = src.first[j * src.second]; });
+						break;
+					}
+					case opcode::store_variable:
+					{
+						const auto dst = column(i.arg_a, base);
+						each([&](int j) { dst.first[j * dst.second] = a[j]; });
+						break;
+					}
+					case opcode::load_local:
+					{
+						const t_vector* src = frame + i.arg_a * block;
+						each([&](int j) { a[j] = src[j]; });
+						break;
+					}
+					case opcode::store_local:
+					{
+						t_vector* dst = frame + i.arg_a * block;
+						each([&](int j) { dst[j] = a[j]; });
+						break;
+					}
+					case opcode::select:
+						each([&](int j) { ARG(0) = t_native::select(ARG(0), ARG(1), ARG(2)); });
+						break;
+					case opcode::fma:
+						each([&](int j) { ARG(0) = t_native::fma(ARG(0), ARG(1), ARG(2)); });
+						break;
+					case opcode::clamp:
+						each([&](int j) { ARG(0) = t_native::clamp(ARG(0), ARG(1), ARG(2)); });
+						break;
+					case opcode::call0:
+						each([&](int j) { ARG(0) = FUN(void)(); });
+						break;
+					case opcode::call1:
+						each([&](int j) { ARG(0) = FUN(t_vector)(ARG(0)); });
+						break;
+					case opcode::call2:
+						each([&](int j) { ARG(0) = FUN(t_vector, t_vector)(ARG(0), ARG(1)); });
+						break;
+					case opcode::call3:
+						each([&](int j) { ARG(0) = FUN(t_vector, t_vector, t_vector)(ARG(0), ARG(1), ARG(2)); });
+						break;
+					case opcode::call4:
+						each([&](int j) { ARG(0) = FUN(t_vector, t_vector, t_vector, t_vector)(ARG(0), ARG(1), ARG(2), ARG(3)); });
+						break;
+					case opcode::call5:
+						each([&](int j) { ARG(0) = FUN(t_vector, t_vector, t_vector, t_vector, t_vector)(ARG(0), ARG(1), ARG(2), ARG(3), ARG(4)); });
+						break;
+					case opcode::call6:
+						each([&](int j) {
+							ARG(0) = FUN(t_vector, t_vector, t_vector, t_vector, t_vector, t_vector)(ARG(0), ARG(1), ARG(2), ARG(3), ARG(4), ARG(5));
+						});
+						break;
+					case opcode::call7:
+						each([&](int j) {
+							ARG(0) = FUN(t_vector, t_vector, t_vector, t_vector, t_vector, t_vector, t_vector)(
+								ARG(0), ARG(1), ARG(2), ARG(3), ARG(4), ARG(5), ARG(6));
+						});
+						break;
+					case opcode::closure0:
+						each([&](int j) { ARG(0) = FUN(const void*)(CTX); });
+						break;
+					case opcode::closure1:
+						each([&](int j) { ARG(0) = FUN(const void*, t_vector)(CTX, ARG(0)); });
+						break;
+					case opcode::closure2:
+						each([&](int j) { ARG(0) = FUN(const void*, t_vector, t_vector)(CTX, ARG(0), ARG(1)); });
+						break;
+					case opcode::closure3:
+						each([&](int j) { ARG(0) = FUN(const void*, t_vector, t_vector, t_vector)(CTX, ARG(0), ARG(1), ARG(2)); });
+						break;
+					case opcode::closure4:
+						each([&](int j) { ARG(0) = FUN(const void*, t_vector, t_vector, t_vector, t_vector)(CTX, ARG(0), ARG(1), ARG(2), ARG(3)); });
+						break;
+					case opcode::closure5:
+						each([&](int j) {
+							ARG(0) = FUN(const void*, t_vector, t_vector, t_vector, t_vector, t_vector)(CTX, ARG(0), ARG(1), ARG(2), ARG(3), ARG(4));
+						});
+						break;
+					case opcode::closure6:
+						each([&](int j) {
+							ARG(0) = FUN(const void*, t_vector, t_vector, t_vector, t_vector, t_vector, t_vector)(
+								CTX, ARG(0), ARG(1), ARG(2), ARG(3), ARG(4), ARG(5));
+						});
+						break;
+					case opcode::closure7:
+						each([&](int j) {
+							ARG(0) = FUN(const void*, t_vector, t_vector, t_vector, t_vector, t_vector, t_vector, t_vector)(
+								CTX, ARG(0), ARG(1), ARG(2), ARG(3), ARG(4), ARG(5), ARG(6));
+						});
+						break;
+#define BINARY(OP) \
+	case opcode::OP: each([&](int j) { a[j] = t_native::OP(b[j], c[j]); }); break;
+#define UNARY(OP) \
+	case opcode::OP: each([&](int j) { a[j] = t_native::OP(b[j]); }); break;
+#define BINARY_K(OP)                                                 \
+	case opcode::OP##_k:                                             \
+	{                                                                \
+		const t_vector k = t_traits::load_atom(constants[i.arg_b]); \
+		each([&](int j) { a[j] = t_native::OP(b[j], k); });          \
+		break;                                                       \
+	}
+						BINARY(add)
+						BINARY(sub)
+						BINARY(mul)
+						BINARY(divide)
+						BINARY(pow)
+						BINARY(fmod)
+						BINARY(comma)
+						BINARY(greater)
+						BINARY(greater_eq)
+						BINARY(lower)
+						BINARY(lower_eq)
+						BINARY(equal)
+						BINARY(not_equal)
+						BINARY(logical_and)
+						BINARY(logical_or)
+						BINARY(min)
+						BINARY(max)
+						UNARY(negate)
+						UNARY(logical_not)
+						UNARY(logical_notnot)
+						UNARY(negate_logical_not)
+						UNARY(negate_logical_notnot)
+						BINARY_K(add)
+						BINARY_K(sub)
+						BINARY_K(mul)
+						BINARY_K(divide)
+#undef BINARY_K
+#undef UNARY
+#undef BINARY
+					default:
+						break;
+					}
+#undef ARG
+#undef CTX
+#undef FUN
+				};
+
+				if (!has_jumps)
 				{
-					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
-					ret->function = find_wrapper("negate_logical_not", s);
+					// Straight code, every row shares the program counter.
+					int index = 0;
+					for (; index < end; ++index)
+					{
+						const instruction& i = code[index];
+						if (i.op == opcode::ret)
+						{
+							const t_vector* a = registers + i.reg * block;
+							for (int j = 0; j < n; ++j)
+							{
+								out[base + j] = a[j];
+							}
+							break;
+						}
+						if (i.op == opcode::ret_nan)
+						{
+							break;
+						}
+						execute(i, nullptr, n);
+					}
+					if (index == end || code[index].op == opcode::ret_nan)
+					{
+						for (int j = 0; j < n; ++j)
+						{
+							out[base + j] = t_traits::nan();
+						}
+					}
+					continue;
 				}
-				else
+
+				for (int j = 0; j < n; ++j)
 				{
-					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
-					ret->function = find_wrapper("negate_logical_notnot", s);
+					pc[j] = 0;
 				}
-			}
-
-			return ret;
-		}
 
-#ifdef TP_POW_FROM_RIGHT
-		static expr_native* factor(state* s)
-		{
-			/* <factor>    =    <power> {"^" <power>} */
-			expr_native* ret = power(s);
+				for (int live = n; live > 0;)
+				{
+					int current = end + 1;
+					for (int j = 0; j < n; ++j)
+					{
+						current = (pc[j] < current) ? pc[j] : current;
+					}
 
-			const void*	 left_function = NUL;
-			expr_native* insertion	   = 0;
+					int num_rows = 0;
+					for (int j = 0; j < n; ++j)
+					{
+						if (pc[j] == current)
+						{
+							rows[num_rows++] = j;
+						}
+					}
 
-			if (ret->type == (FUNCTION1 | FLAG_PURE) &&
-				(ret->function == find_wrapper("negate", s) || ret->function == find_wrapper("logical_not", s) || ret->function == find_wrapper("logical_notnot", s) ||
-				 ret->function == find_wrapper("negate_logical_not", s) || ret->function == find_wrapper("negate_logical_notnot", s)))
-			{
-				left_function	= ret->function;
-				expr_native* se = ret->parameters[0];
-				free(ret);
-				ret = se;
-			}
+					// Rows past the last instruction finished without a return.
+					if (current >= end)
+					{
+						for (int k = 0; k < num_rows; ++k)
+						{
+							out[base + rows[k]] = t_traits::nan();
+							pc[rows[k]]			= end + 1;
+						}
+						live -= num_rows;
+						continue;
+					}
 
-			while (s->type == (int)TOK_INFIX && (s->function == find_wrapper("pow", s)))
-			{
-				te_fun2 t = s->function;
-				next_token(s);
+					const instruction& i		 = code[current];
+					const int*		   row_list = (num_rows == n) ? nullptr : rows;
+					const t_vector*	   a		 = registers + i.reg * block;
+					const int		   target	 = (i.arg_a < end) ? int(i.arg_a) : end;
 
-				if (insertion)
-				{
-					/* Make exponentiation go right-to-left. */
-					expr_native* insert		 = NEW_EXPR(FUNCTION2 | FLAG_PURE, insertion->parameters[1], power(s));
-					insert->function		 = t;
-					insertion->parameters[1] = insert;
-					insertion				 = insert;
-				}
-				else
-				{
-					ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, power(s));
-					ret->function = t;
-					insertion	  = ret;
+					switch (i.op)
+					{
+					case opcode::jump:
+						for (int k = 0; k < num_rows; ++k)
+						{
+							pc[rows[k]] = target;
+						}
+						break;
+					case opcode::jump_if:
+						for (int k = 0; k < num_rows; ++k)
+						{
+							pc[rows[k]] = t_traits::lane_mask(a[rows[k]]) ? target : current + 1;
+						}
+						break;
+					case opcode::ret:
+					case opcode::ret_nan:
+						for (int k = 0; k < num_rows; ++k)
+						{
+							out[base + rows[k]] = (i.op == opcode::ret) ? a[rows[k]] : t_traits::nan();
+							pc[rows[k]]			= end + 1;
+						}
+						live -= num_rows;
+						break;
+					default:
+						execute(i, row_list, num_rows);
+						for (int k = 0; k < num_rows; ++k)
+						{
+							pc[rows[k]] = current + 1;
+						}
+						break;
+					}
 				}
 			}
 
-			if (left_function)
+			if (registers != scratch)
 			{
-				ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, ret);
-				ret->function = left_function;
+				delete[] registers;
 			}
-
-			return ret;
 		}
-#else
-		static expr_native* factor(state* s)
-		{
-			/* <factor>    =    <power> {"^" <power>} */
-			expr_native* ret = power(s);
+	} // namespace eval_details
 
-			while (s->type == (int)TOK_INFIX && (s->function == find_wrapper("pow", s)))
+#if TP_THREADS_ENABLED
+	// A fixed set of threads for data parallel jobs, the thread calling parallel_for() works as thread 0. parallel_for() cuts
+	// [0, count) into items of grain rows and deals every thread a contiguous run of items; a thread takes items from the front of
+	// its own run and, once that is empty, steals the back half of another thread's run. Runs one job at a time.
+	class thread_pool
+	{
+	public:
+		// num_threads <= 0 uses one thread per hardware thread.
+		explicit thread_pool(int num_threads = 0) : m_queues(size_t(resolve_num_threads(num_threads)))
+		{
+			for (int t = 1; t < get_num_threads(); ++t)
 			{
-				te_fun2 t = (te_fun2)s->function;
-				next_token(s);
-				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, power(s));
-				ret->function = t;
+				m_threads.emplace_back([this, t]() { worker(t); });
 			}
-
-			return ret;
 		}
-#endif
 
-		static expr_native* term(state* s)
+		~thread_pool()
 		{
-			/* <term>      =    <factor> {("*" | "/" | "%") <factor>} */
-			expr_native* ret = factor(s);
-
-			while (s->type == (int)TOK_INFIX && (s->function == find_wrapper("mul", s) || s->function == find_wrapper("divide", s) || s->function == find_wrapper("fmod", s)))
 			{
-				te_fun2 t = (te_fun2)s->function;
-				next_token(s);
-				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, factor(s));
-				ret->function = t;
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_exit = true;
+			}
+			m_wake.notify_all();
+			for (auto& thread : m_threads)
+			{
+				thread.join();
 			}
-
-			return ret;
 		}
 
-		static expr_native* sum_expr(state* s)
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		int get_num_threads() const noexcept
 		{
-			/* <expr>      =    <term> {("+" | "-") <term>} */
-			expr_native* ret = term(s);
+			return int(m_queues.size());
+		}
 
-			while (s->type == (int)TOK_INFIX && (s->function == find_wrapper("add", s) || s->function == find_wrapper("sub", s)))
+		// Calls job(thread, begin, end) for row ranges covering [0, count) and returns once all of them ran.
+		template<typename T_JOB>
+		void parallel_for(size_t count, size_t grain, T_JOB&& job)
+		{
+			if (count == 0)
 			{
-				te_fun2 t = (te_fun2)s->function;
-				next_token(s);
-				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, term(s));
-				ret->function = t;
+				return;
 			}
 
-			return ret;
-		}
+			grain				= (grain > 0) ? grain : 1;
+			const size_t items	= (count + grain - 1) / grain;
+			const size_t thread = m_queues.size();
 
-		static expr_native* test_expr(state* s)
-		{
-			/* <expr>      =    <sum_expr> {(">" | ">=" | "<" | "<=" | "==" | "!=") <sum_expr>} */
-			expr_native* ret = sum_expr(s);
+			for (size_t t = 0; t < thread; ++t)
+			{
+				m_queues[t].range.store(pack(uint32_t(items * t / thread), uint32_t(items * (t + 1) / thread)), std::memory_order_relaxed);
+			}
+
+			m_job	= &job;
+			m_count = count;
+			m_grain = grain;
+			m_invoke = [](void* j, int t, size_t begin, size_t end) { (*(typename std::remove_reference<T_JOB>::type*)j)(t, begin, end); };
 
-			while (s->type == (int)TOK_INFIX &&
-				   (s->function == find_wrapper("greater", s) || s->function == find_wrapper("greater_eq", s) || s->function == find_wrapper("lower", s) ||
-					s->function == find_wrapper("lower_eq", s) || s->function == find_wrapper("equal", s) || s->function == find_wrapper("not_equal", s)))
 			{
-				te_fun2 t = (te_fun2)s->function;
-				next_token(s);
-				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, sum_expr(s));
-				ret->function = t;
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_busy = int(m_threads.size());
+				++m_generation;
 			}
+			m_wake.notify_all();
 
-			return ret;
+			run(0);
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_done.wait(lock, [this]() { return m_busy == 0; });
 		}
 
-		static expr_native* expr(state* s)
+	private:
+		struct alignas(64) queue
 		{
-			/* <expr>      =    <test_expr> {("&&" | "||") <test_expr>} */
-			expr_native* ret = test_expr(s);
+			std::atomic<uint64_t> range{0}; // first item << 32 | end item
+		};
 
-			while (s->type == (int)TOK_INFIX && (s->function == find_wrapper("logical_and", s) || s->function == find_wrapper("logical_or", s)))
+		static inline int resolve_num_threads(int num_threads) noexcept
+		{
+			if (num_threads <= 0)
 			{
-				te_fun2 t = (te_fun2)s->function;
-				next_token(s);
-				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, test_expr(s));
-				ret->function = t;
+				num_threads = int(std::thread::hardware_concurrency());
 			}
-
-			return ret;
+			return (num_threads > 0) ? num_threads : 1;
 		}
 
-		static expr_native* list(state* s)
+		static inline uint64_t pack(uint32_t begin, uint32_t end) noexcept
 		{
-			/* <list>      =    <expr> {"," <expr>} */
-			expr_native* ret = expr(s);
+			return (uint64_t(begin) << 32) | end;
+		}
 
-			while (s->type == (int)TOK_SEP)
+		bool pop(queue& q, uint32_t& item) noexcept
+		{
+			uint64_t range = q.range.load(std::memory_order_acquire);
+			for (;;)
 			{
-				next_token(s);
-				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, expr(s));
-				ret->function = find_wrapper("comma", s);
+				const uint32_t begin = uint32_t(range >> 32), end = uint32_t(range);
+				if (begin >= end)
+				{
+					return false;
+				}
+				if (q.range.compare_exchange_weak(range, pack(begin + 1, end), std::memory_order_acq_rel))
+				{
+					item = begin;
+					return true;
+				}
 			}
-
-			return ret;
 		}
 
-		static t_vector eval_native(const expr_native* n)
+		bool steal(queue& victim, uint32_t& begin_out, uint32_t& end_out) noexcept
 		{
-			if (!n)
-				return t_traits::nan();
-
-			auto eval_arg = [&](int e) {
-				return eval_native((const expr_native*)n->parameters[e]);
-			};
-
-			return eval_details::eval_generic(
-				n->type, [&]() { return n->value; }, [&]() { return *n->bound; },
-				[&](int a) { return eval_details::eval_function<t_vector>(a, n->function, t_traits::nan(), eval_arg); },
-				[&](int a) { return eval_details::eval_closure<t_vector>(a, n->function, (void*)n->parameters[a], t_traits::nan(), eval_arg); }, [&]() { return t_traits::nan(); });
+			uint64_t range = victim.range.load(std::memory_order_acquire);
+			for (;;)
+			{
+				const uint32_t begin = uint32_t(range >> 32), end = uint32_t(range);
+				if (begin >= end)
+				{
+					return false;
+				}
+				const uint32_t take = (end - begin + 1) / 2;
+				if (victim.range.compare_exchange_weak(range, pack(begin, end - take), std::memory_order_acq_rel))
+				{
+					begin_out = end - take;
+					end_out	  = end;
+					return true;
+				}
+			}
 		}
 
-		static void optimize(expr_native* n)
+		void run(int t)
 		{
-			/* Evaluates as much as possible. */
-			if (n->type == CONSTANT)
-		    {
-				return;
-			}
-			
-			if (n->type == VARIABLE)
-		    {
-				const variable* v = t_traits::find_by_addr(n->bound, nullptr);
-				if (v && (v->type == CONSTANT))
+			queue&		 own	 = m_queues[size_t(t)];
+			const size_t threads = m_queues.size();
+
+			for (;;)
+			{
+				uint32_t item;
+				while (pop(own, item))
 				{
-					free_parameters(n);
-					n->type	 = CONSTANT;
-					n->value = *((t_vector*)n->bound);
+					const size_t begin = size_t(item) * m_grain;
+					const size_t end   = (begin + m_grain < m_count) ? begin + m_grain : m_count;
+					m_invoke(m_job, t, begin, end);
 				}
-				return;
-			}
 
-			/* Only optimize out functions flagged as pure. */
-			if (is_pure(n->type))
-			{
-				const int arity = eval_details::arity(n->type);
-				int		  known = 1;
-				int		  i;
-				for (i = 0; i < arity; ++i)
+				// Items only ever move to the thread that stole them, so once every run looks empty there is nothing left to take.
+				bool stolen = false;
+				for (size_t k = 1; k < threads && !stolen; ++k)
 				{
-					optimize((expr_native*)n->parameters[i]);
-					if (((expr_native*)(n->parameters[i]))->type != CONSTANT)
+					uint32_t begin, end;
+					if (steal(m_queues[(size_t(t) + k) % threads], begin, end))
 					{
-						known = 0;
+						own.range.store(pack(begin, end), std::memory_order_release);
+						stolen = true;
 					}
 				}
-				if (known)
+
+				if (!stolen)
 				{
-					const t_vector value = eval_native(n);
-					free_parameters(n);
-					n->type	 = CONSTANT;
-					n->value = value;
+					return;
 				}
 			}
 		}
 
-		static expr_native* compile_native(const char* expression, const variable_lookup* lookup, int* error)
+		void worker(int t)
 		{
-			state s;
-			s.start = s.next	= expression;
-			if (lookup)
-			{
-				s.lookup = *lookup;
-			}
-			else
+			uint64_t generation = 0;
+			for (;;)
 			{
-				s.lookup = { 0, 0 };
-			}
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait(lock, [&]() { return m_exit || m_generation != generation; });
+					if (m_exit)
+					{
+						return;
+					}
+					generation = m_generation;
+				}
 
-			next_token(&s);
-			expr_native* root = list(&s);
+				run(t);
 
-			if (s.type != (int)TOK_END)
-			{
-				free_native(root);
-				if (error)
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (--m_busy == 0)
 				{
-					*error = static_cast<int>(s.next - s.start);
-					if (*error == 0)
-						*error = 1;
+					m_done.notify_one();
 				}
-				return 0;
-			}
-			else
-			{
-				optimize(root);
-				if (error)
-					*error = 0;
-
-				return root;
 			}
 		}
 
-		static t_vector interp_native(const char* expression, int* error)
+		std::vector<queue>		 m_queues;
+		std::vector<std::thread> m_threads;
+		std::mutex				 m_mutex;
+		std::condition_variable	 m_wake;
+		std::condition_variable	 m_done;
+		uint64_t				 m_generation = 0;
+		int						 m_busy		  = 0;
+		bool					 m_exit		  = false;
+
+		void* m_job = nullptr;
+		void (*m_invoke)(void*, int, size_t, size_t) = nullptr;
+		size_t m_count = 0;
+		size_t m_grain = 1;
+	};
+
+	namespace eval_details
+	{
+		// eval_bytecode_batch_impl spread over a thread pool, every thread runs its items with its own scratch (register file and per
+		// row variables).
+		template<typename T_TRAITS, typename T_ATOM, typename T_VECTOR>
+		static inline void eval_bytecode_parallel_impl(
+			thread_pool& pool, const unsigned char* bytecode, size_t count, const void* const column_context[], const size_t* strides, T_VECTOR* out)
 		{
-			expr_native* n = compile_native(expression, 0, error);
-			t_vector	 ret;
-			if (n)
-			{
-				ret = eval_native(n);
-				free_native(n);
-			}
-			else
-			{
-				ret = t_traits::nan();
-			}
-			return ret;
+			const size_t		  scratch_size = batch_scratch_size(bytecode, strides);
+			std::vector<T_VECTOR> scratch(scratch_size * size_t(pool.get_num_threads()));
+
+			pool.parallel_for(count, TP_PARALLEL_GRAIN, [&](int t, size_t begin, size_t end) {
+				eval_bytecode_batch_impl<T_TRAITS, T_ATOM, T_VECTOR>(bytecode, begin, end - begin, column_context, strides, out, &scratch[scratch_size * size_t(t)]);
+			});
 		}
+	} // namespace eval_details
+#endif // #if TP_THREADS_ENABLED
 
-		static void pn(const expr_native* n, int depth)
+#if TP_JIT_ENABLED
+#if !TP_MODERN_CPP
+#error C++ 17 is required for the JIT.
+#endif // #if !TP_MODERN_CPP
+
+	// Machine code translated from a bytecode buffer. The entry point takes the binding array: function addresses are resolved when the
+	// code is generated, variables and closure contexts are loaded through the array on every call.
+	struct jit_function
+	{
+		virtual ~jit_function() = default;
+
+		virtual size_t		get_code_size() const = 0;
+		virtual const void* get_entry() const	  = 0;
+	};
+
+	namespace jit_details
+	{
+		struct executable_code : jit_function
 		{
-			int i, arity;
-			printf("%*s", depth, "");
+			void*  memory = nullptr;
+			size_t size	  = 0;
 
-			const auto t = type_mask(n->type);
+			~executable_code() override
+			{
+				if (memory)
+				{
+#if defined(_WIN32)
+					::VirtualFree(memory, 0, MEM_RELEASE);
+#else
+					::munmap(memory, size);
+#endif // #if defined(_WIN32)
+				}
+			}
 
-			if (t == CONSTANT)
+			size_t get_code_size() const override
 			{
-				printf("%f\n", n->value);
+				return size;
 			}
-			else if (t == VARIABLE)
+
+			const void* get_entry() const override
 			{
-				printf("bound %p\n", n->bound);
+				return memory;
 			}
-			else if ((t >= FUNCTION0 && t < FUNCTION_MAX) || (t >= CLOSURE0 && t < CLOSURE_MAX))
+
+			// Pages are written while read/write and only then made executable.
+			static executable_code* create(const std::vector<unsigned char>& code)
 			{
-				arity = arity(n->type);
-				printf("f%d", arity);
-				for (i = 0; i < arity; i++)
+				if (code.empty())
 				{
-					printf(" %p", n->parameters[i]);
+					return nullptr;
 				}
-				printf("\n");
-				for (i = 0; i < arity; i++)
+
+#if defined(_WIN32)
+				void* memory = ::VirtualAlloc(nullptr, code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+				if (memory == nullptr)
 				{
-					pn((const expr_native*)n->parameters[i], depth + 1);
+					return nullptr;
 				}
-			}
-		}
-
-		static void print(const expr_native* n)
-		{
-			pn(n, 0);
-		}
-	};
 
-	template<typename T_TRAITS>
-	struct portable
-	{
-		using t_traits	  = T_TRAITS;
-		using t_atom	  = typename T_TRAITS::t_atom;
-		using t_vector	  = typename T_TRAITS::t_vector;
-		using expr_native = typename native<t_traits>::expr_native;
+				::memcpy(memory, &code[0], code.size());
 
-		using name_map = std::unordered_map<const void*, std::string>;
+				DWORD old_protect;
+				if (!::VirtualProtect(memory, code.size(), PAGE_EXECUTE_READ, &old_protect))
+				{
+					::VirtualFree(memory, 0, MEM_RELEASE);
+					return nullptr;
+				}
+				::FlushInstructionCache(::GetCurrentProcess(), memory, code.size());
+#else
+				void* memory = ::mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (memory == MAP_FAILED)
+				{
+					return nullptr;
+				}
 
-		using index_map = std::unordered_map<const void*, int>;
+				::memcpy(memory, &code[0], code.size());
 
-		struct expr_portable_expression_build_indexer
-		{
-			name_map  name_map;
-			index_map index_map;
-			int		  index_counter = 0;
+				if (::mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0)
+				{
+					::munmap(memory, code.size());
+					return nullptr;
+				}
+#endif // #if defined(_WIN32)
 
-			std::vector<variable> m_env_variables;
+				auto result	   = new executable_code();
+				result->memory = memory;
+				result->size   = code.size();
+				return result;
+			}
+		};
 
-			std::vector<std::string>				m_declared_variable_names;
-			std::vector<std::unique_ptr<t_atom>>	 m_declared_variable_values;
+		// SSE scalar code generation. Bytecode registers live in 8 byte stack slots above the outgoing argument area,
+		// rbx holds the binding array for the whole function.
+		template<typename T_VECTOR>
+		struct x64_emitter
+		{
+			static constexpr bool is_double		= std::is_same<T_VECTOR, double>::value;
+			static constexpr int  outgoing_size = 64; // Win64 shadow space and up to 4 stack arguments
 
-			void reset()
+			enum
 			{
-				name_map.clear();
-				index_map.clear();
-				index_counter = 0;
-				m_env_variables.clear();
-				m_declared_variable_names.clear();
-				m_declared_variable_values.clear();
-			}
+				rax = 0,
+				rcx = 1,
+				rdi = 7,
+			};
 
-			struct variable_lookup_temp
+			enum
 			{
-				std::vector<variable> data;
-
-				variable_lookup get_lookup() const
-				{
-					return variable_lookup { (data.size() > 0) ? &data[0] : nullptr, int(data.size()) };
-				}
+				op_add = 0x58,
+				op_mul = 0x59,
+				op_sub = 0x5C,
+				op_min = 0x5D,
+				op_div = 0x5E,
+				op_max = 0x5F,
 			};
-			
-			std::unique_ptr<variable_lookup_temp> get_variable_array() const
-			{
-				std::unique_ptr<variable_lookup_temp> combined(new variable_lookup_temp());
-				
-				for (size_t v = 0; v < m_declared_variable_names.size(); ++v)
-				{
-					combined->data.push_back(variable{m_declared_variable_names[v].c_str(), m_declared_variable_values[v].get()});
-				}
 
-				for (auto var : m_env_variables)
-				{
-					combined->data.push_back(var);
-				}
+			std::vector<unsigned char> code;
 
-				return combined;
+			void byte(int b)
+			{
+				code.push_back((unsigned char)b);
 			}
 
-			void add_declared_variable(std::string_view name_view, std::string_view /*scope*/)
+			void dword(uint32_t v)
 			{
-				std::string name(name_view);
-				auto itor = std::find(m_declared_variable_names.begin(), m_declared_variable_names.end(), name);
-				if (itor == m_declared_variable_names.end())
+				for (int i = 0; i < 4; ++i)
 				{
-					m_declared_variable_names.push_back(name);
-					m_declared_variable_values.emplace_back(new t_atom);
+					byte((v >> (i * 8)) & 0xFF);
 				}
 			}
 
-			void add_user_variable(const variable* var)
+			void qword(uint64_t v)
 			{
-				m_env_variables.push_back(*var);
+				dword(uint32_t(v));
+				dword(uint32_t(v >> 32));
 			}
 
-			int add_referenced_variable(const variable* var)
+			void patch_rel32(size_t at, size_t target)
 			{
-				auto itor = index_map.find(var->address);
-				if (itor == index_map.end())
-				{
-					int idx = index_counter++;
-					name_map.insert(std::make_pair(var->address, std::string(var->name)));
-					index_map.insert(std::make_pair(var->address, idx));
-					return idx;
-				}
-				return itor->second;
+				const auto rel = uint32_t(int32_t(target) - int32_t(at + 4));
+				::memcpy(&code[at], &rel, 4);
 			}
 
-			std::vector<std::string> get_binding_table()
+			static int32_t slot(int reg)
 			{
-				std::vector<std::string> t;
-				t.resize(index_counter);
-				for (auto index_map_itor : index_map)
-				{
-					auto name_map_itor		 = name_map.find(index_map_itor.first);
-					t[index_map_itor.second] = name_map_itor->second;
-				}
-
-				return t;
+				return outgoing_size + reg * 8;
 			}
 
-			std::vector<const void*> get_address_table()
+			void scalar_prefix()
 			{
-				std::vector<const void*> t;
-				t.resize(index_counter);
-				for (auto index_map_itor : index_map)
-				{
-					t[index_map_itor.second] = index_map_itor.first;
-				}
-
-				return t;
+				byte(is_double ? 0xF2 : 0xF3);
 			}
-		};
 
-		struct expr_portable_expression_build_bindings
-		{
-			std::vector<const void*> index_to_address; // this contains the native function/value address as originally compiled
-			std::vector<std::string> index_to_name;
-			std::vector<const char*> index_to_name_c_str;
-		};
+			// modrm + sib for [rsp + disp32]
+			void rsp_operand(int xmm, int32_t disp)
+			{
+				byte(0x84 | (xmm << 3));
+				byte(0x24);
+				dword(uint32_t(disp));
+			}
 
-		struct compiled_expr : ::tp::compiled_expr
-		{
-			expr_portable_expression_build_bindings m_bindings;
-			std::unique_ptr<unsigned char>			m_build_buffer;
-			size_t									m_build_buffer_size;
+			// movss/movsd xmm, [rsp + disp]
+			void load(int xmm, int32_t disp)
+			{
+				scalar_prefix();
+				byte(0x0F);
+				byte(0x10);
+				rsp_operand(xmm, disp);
+			}
 
-			virtual size_t get_binding_array_size() const
+			// movss/movsd [rsp + disp], xmm
+			void store(int xmm, int32_t disp)
 			{
-				return m_bindings.index_to_address.size();
+				scalar_prefix();
+				byte(0x0F);
+				byte(0x11);
+				rsp_operand(xmm, disp);
 			}
 
-			virtual const void* const* get_binding_addresses() const
+			// movss/movsd xmm0, [rax]
+			void load_indirect()
 			{
-				return (m_bindings.index_to_address.size() > 0) ? &(*m_bindings.index_to_address.cbegin()) : nullptr;
+				scalar_prefix();
+				byte(0x0F);
+				byte(0x10);
+				byte(0x00);
 			}
 
-			virtual const char* const* get_binding_names() const
+			// movss/movsd [rax], xmm0
+			void store_indirect()
 			{
-				return &(*m_bindings.index_to_name_c_str.cbegin());
+				scalar_prefix();
+				byte(0x0F);
+				byte(0x11);
+				byte(0x00);
 			}
 
-			virtual size_t get_data_size() const
+			// addss/subss/mulss/divss xmm0, [rsp + disp]
+			void arith(int op, int32_t disp)
 			{
-				return m_build_buffer_size;
+				scalar_prefix();
+				byte(0x0F);
+				byte(op);
+				rsp_operand(0, disp);
 			}
 
-			virtual const unsigned char* get_data() const
+			// addss/subss/mulss/divss xmm0, xmm1
+			void arith_xmm1(int op)
 			{
-				return m_build_buffer.get();
+				scalar_prefix();
+				byte(0x0F);
+				byte(op);
+				byte(0xC1);
 			}
-		};
 
-		static size_t export_estimate(const expr_native* n, size_t& export_size, const variable_lookup* lookup, name_map& name_map, index_map& index_map, int& index_counter)
-		{
-			if (!n)
-				return export_size;
-
-			export_size += sizeof(expr_native);
-
-			auto eval_arg = [&](int e) {
-				export_estimate((const expr_native*)n->parameters[e], export_size, lookup, name_map, index_map, index_counter);
-			};
-
-			auto handle_addr = [&](const variable* var) -> bool {
-				if (var)
+			// mov rax, imm; movd/movq xmm, rax
+			void load_immediate(int xmm, T_VECTOR v)
+			{
+				if constexpr (is_double)
 				{
-					auto itor = name_map.find(var->address);
-					if (itor == name_map.end())
-					{
-						name_map.emplace(std::make_pair(var->address, std::string(var->name)));
-						index_map.insert(std::make_pair(var->address, index_counter++));
-					}
-
-					if (var->type >= CLOSURE0 && var->type < CLOSURE_MAX)
-					{
-						auto context_itor = name_map.find(var->context);
-						if (context_itor == name_map.end())
-						{
-							name_map.emplace(std::make_pair(var->context, std::string(var->name) + "_closure"));
-							index_map.insert(std::make_pair(var->context, index_counter++));
-						}
-					}
-
-					return true;
+					uint64_t bits;
+					::memcpy(&bits, &v, sizeof(bits));
+					byte(0x48);
+					byte(0xB8);
+					qword(bits);
+					byte(0x66);
+					byte(0x48);
 				}
-				return false;
-			};
-
-			return eval_details::eval_generic(
-				n->type, [&]() { return export_size; },
-				[&]() {
-					auto res = handle_addr(t_traits::find_by_addr(n->bound, lookup));
-					assert(res);
-					((void)res);
-					return export_size;
-				},
-				[&](int a) {
-					auto res = handle_addr(t_traits::find_by_addr(n->function, lookup));
-					assert(res);
-					((void)res);
-					export_size += sizeof(n->parameters[0]) * a;
-
-					for (int i = 0; i < a; ++i)
-					{
-						eval_arg(i);
-					}
-					return export_size;
-				},
-				[&](int a) {
-					auto res = handle_addr(t_traits::find_by_addr(n->function, lookup));
-					assert(res);
-					((void)res);
-					export_size += sizeof(n->parameters[0]) * a;
-
-					for (int i = 0; i < a; ++i)
-					{
-						eval_arg(i);
-					}
-					return export_size;
-				},
-				[&]() { return export_size; });
-		}
-
-		template<typename T_REGISTER_FUNC>
-		static size_t export_write(const expr_native* n, size_t& export_size, const variable_lookup* lookup, const unsigned char* out_buffer, T_REGISTER_FUNC register_func)
-		{
-			if (!n)
-				return export_size;
-
-			auto n_out = (expr_portable<t_traits>*)(out_buffer + export_size);
-
-			export_size += sizeof(expr_native);
-			n_out->type = n->type;
-
-			auto eval_arg = [&](int e) {
-				return export_write((const expr_native*)n->parameters[e], export_size, lookup, out_buffer, register_func);
-			};
-
-			return eval_details::eval_generic(
-				n->type,
-				[&]() {
-					n_out->value = n->value;
-					return export_size;
-				},
-				[&]() {
-					register_func(n->bound, n_out, t_traits::find_by_addr(n->bound, lookup));
-					return export_size;
-				},
-				[&](int) {
-					register_func(n->function, n_out, t_traits::find_by_addr(n->function, lookup));
-
-					export_size += sizeof(n->parameters[0]) * eval_details::arity(n->type);
-
-					for (int i = 0; i < eval_details::arity(n->type); ++i)
-					{
-						n_out->parameters[i] = export_size;
-						eval_arg(i);
-					}
-					return export_size;
-				},
-				[&](int) {
-					register_func(n->function, n_out, t_traits::find_by_addr(n->function, lookup));
-
-					export_size += sizeof(n->parameters[0]) * eval_details::arity(n->type);
-
-					for (int i = 0; i < eval_details::arity(n->type); ++i)
-					{
-						n_out->parameters[i] = export_size;
-						eval_arg(i);
-					}
-					return export_size;
-				},
-				[&]() { return export_size; });
-		}
-
-		static t_vector eval_compare(const expr_native* n, const expr_portable<t_traits>* n_portable, const unsigned char* expr_buffer, const void* const expr_context[])
-		{
-			if (!n)
-				return t_traits::nan();
-
-			assert(n->type == n_portable->type);
-
-			auto eval_arg = [&](int e) {
-				return eval_compare((const expr_native*)n->parameters[e], (const expr_portable*)&expr_buffer[n_portable->parameters[e]], expr_buffer, expr_context);
-			};
-
-			return eval_details::eval_generic(
-				n->type, [&]() { return n_portable->value; },
-				[&]() {
-					assert(n->bound == expr_context[n_portable->bound]);
-					return t_traits::load_atom(*((const t_atom*)(expr_context[n_portable->bound])));
-				},
-				[&](int a) {
-					assert(n->function == expr_context[n_portable->function]);
-					return eval_details::eval_function<t_vector>(a, expr_context[n_portable->function], t_traits::nan(), eval_arg);
-				},
-				[&](int a) {
-					assert(n->function == expr_context[n_portable->function]);
-					assert(n->parameters[arity(n->type)] == expr_context[n_portable->parameters[arity(n->type)]]);
-
-					return eval_details::eval_closure<t_vector>(
-						a, expr_context[n_portable->function], (void*)expr_context[n_portable->parameters[arity(n->type)]], t_traits::nan(), eval_arg);
-				},
-				[&]() { return t_traits::nan(); });
-		}
-
-		struct portable_compiled_program : compiled_program
-		{
-			std::vector<statement>		   program_statements;
-			std::vector<std::string>	   binding_table;
-			std::vector<const char*>	   binding_table_cstr;
-			std::vector<const void*>	   address_table;
-			std::unique_ptr<unsigned char> program_expression_buffer;
-			size_t						   program_expression_buffer_size = 0;
-
-			virtual size_t get_binding_array_size() const
-			{
-				return address_table.size();
+				else
+				{
+					uint32_t bits;
+					::memcpy(&bits, &v, sizeof(bits));
+					byte(0xB8);
+					dword(bits);
+					byte(0x66);
+				}
+				byte(0x0F);
+				byte(0x6E);
+				byte(0xC0 | (xmm << 3));
 			}
 
-			virtual const void* const* get_binding_addresses() const
+			// mov gpr, [rbx + index * 8]
+			void load_binding(int gpr, int index)
 			{
-				return &address_table[0];
+				byte(0x48);
+				byte(0x8B);
+				byte(0x83 | (gpr << 3));
+				dword(uint32_t(index * 8));
 			}
 
-			virtual const char* const* get_binding_names() const
+			// mov rax, imm64; call rax
+			void call(const void* address)
 			{
-				return &binding_table_cstr[0];
+				byte(0x48);
+				byte(0xB8);
+				qword(uint64_t(uintptr_t(address)));
+				byte(0xFF);
+				byte(0xD0);
 			}
 
-			virtual size_t get_data_size() const
+			// Loads count registers starting at first as floating point arguments, optionally preceded by the closure context.
+			void pass_arguments(int first, int count, bool has_context, int context_index)
 			{
-				return program_expression_buffer_size;
+#if defined(_WIN32)
+				// Win64 arguments are positional, the context takes the first position and everything past the fourth goes on the stack.
+				const int offset = has_context ? 1 : 0;
+				for (int a = 0; a < count; ++a)
+				{
+					const int position = a + offset;
+					if (position >= 4)
+					{
+						load(4, slot(first + a));
+						store(4, 32 + (position - 4) * 8);
+					}
+				}
+				for (int a = 0; a < count; ++a)
+				{
+					const int position = a + offset;
+					if (position < 4)
+					{
+						load(position, slot(first + a));
+					}
+				}
+				if (has_context)
+				{
+					load_binding(rcx, context_index);
+				}
+#else
+				// SysV passes up to 8 floating point arguments in xmm0-xmm7, the context goes to rdi.
+				for (int a = 0; a < count; ++a)
+				{
+					load(a, slot(first + a));
+				}
+				if (has_context)
+				{
+					load_binding(rdi, context_index);
+				}
+#endif // #if defined(_WIN32)
 			}
 
-			virtual const unsigned char* get_data() const
+			// jmp/jcc rel32, returns the position of the displacement
+			size_t jump(int condition)
 			{
-				return program_expression_buffer.get();
+				if (condition < 0)
+				{
+					byte(0xE9);
+				}
+				else
+				{
+					byte(0x0F);
+					byte(condition);
+				}
+				const size_t at = code.size();
+				dword(0);
+				return at;
 			}
 
-			virtual size_t get_statement_array_size() const
-			{
-				return (int)program_statements.size();
+			void prologue(int32_t frame_size)
+			{
+				byte(0x53); // push rbx
+				byte(0x48); // sub rsp, frame_size
+				byte(0x81);
+				byte(0xEC);
+				dword(uint32_t(frame_size));
+				byte(0x48); // mov rbx, first argument
+				byte(0x89);
+#if defined(_WIN32)
+				byte(0xCB);
+#else
+				byte(0xFB);
+#endif // #if defined(_WIN32)
 			}
 
-			virtual const statement* get_statements() const
+			void epilogue(int32_t frame_size)
 			{
-				return &program_statements[0];
+				byte(0x48); // add rsp, frame_size
+				byte(0x81);
+				byte(0xC4);
+				dword(uint32_t(frame_size));
+				byte(0x5B); // pop rbx
+				byte(0xC3); // ret
 			}
 		};
-	};
 
-	namespace expr_details
-	{
+		template<typename T_NATIVE>
+		static inline const void* operator_address(opcode op) noexcept
+		{
+			switch (op)
+			{
+#define TP_JIT_OPERATOR(OP) \
+	case opcode::OP: return (const void*)&T_NATIVE::OP;
+				TP_JIT_OPERATOR(add)
+				TP_JIT_OPERATOR(sub)
+				TP_JIT_OPERATOR(mul)
+				TP_JIT_OPERATOR(divide)
+				TP_JIT_OPERATOR(pow)
+				TP_JIT_OPERATOR(fmod)
+				TP_JIT_OPERATOR(comma)
+				TP_JIT_OPERATOR(greater)
+				TP_JIT_OPERATOR(greater_eq)
+				TP_JIT_OPERATOR(lower)
+				TP_JIT_OPERATOR(lower_eq)
+				TP_JIT_OPERATOR(equal)
+				TP_JIT_OPERATOR(not_equal)
+				TP_JIT_OPERATOR(logical_and)
+				TP_JIT_OPERATOR(logical_or)
+				TP_JIT_OPERATOR(negate)
+				TP_JIT_OPERATOR(logical_not)
+				TP_JIT_OPERATOR(logical_notnot)
+				TP_JIT_OPERATOR(negate_logical_not)
+				TP_JIT_OPERATOR(negate_logical_notnot)
+#undef TP_JIT_OPERATOR
+			default:
+				return nullptr;
+			}
+		}
+
+		// Translates a bytecode buffer, returns nullptr when the traits or an instruction can't be handled so callers fall back to the
+		// interpreter. Only scalar float and double traits are supported.
 		template<typename T_TRAITS>
-		compiled_expr* compile_using_indexer(typename portable<T_TRAITS>::expr_portable_expression_build_indexer& indexer, const char* expression, int* error)
+		static inline jit_function* compile(const unsigned char* bytecode, const void* const expr_context[])
 		{
-			auto			var_array = indexer.get_variable_array();
-			auto variables = var_array->get_lookup();
-
-			typename native<T_TRAITS>::expr_native* native_expr = native<T_TRAITS>::compile_native(expression, &variables, error);
+			using t_atom   = typename T_TRAITS::t_atom;
+			using t_vector = typename T_TRAITS::t_vector;
+			using t_native = typename T_TRAITS::t_native;
 
-			if (native_expr)
+			if constexpr (!std::is_same<t_atom, t_vector>::value || !(std::is_same<t_vector, float>::value || std::is_same<t_vector, double>::value))
 			{
-				auto expr = new typename portable<T_TRAITS>::compiled_expr;
-
-				size_t export_size = 0;
-				portable<T_TRAITS>::export_estimate(native_expr, export_size, &variables, indexer.name_map, indexer.index_map, indexer.index_counter);
-
-				expr->m_bindings.index_to_address.resize(indexer.index_counter);
-				for (const auto& itor : indexer.index_map)
-				{
-					expr->m_bindings.index_to_address[itor.second] = itor.first;
-				}
-
-				expr->m_bindings.index_to_name.resize(indexer.index_counter);
-				expr->m_bindings.index_to_name_c_str.resize(indexer.index_counter);
-				for (int i = 0; i < indexer.index_counter; ++i)
+				return nullptr;
+			}
+			else
+			{
+				if (bytecode == nullptr)
 				{
-					auto itor = indexer.name_map.find(expr->m_bindings.index_to_address[i]);
-					assert(itor != indexer.name_map.end());
-					expr->m_bindings.index_to_name[i]		= itor->second;
-					expr->m_bindings.index_to_name_c_str[i] = expr->m_bindings.index_to_name[i].c_str();
+					return nullptr;
 				}
 
-				expr->m_build_buffer.reset(new uint8_t[export_size]);
-				::memset(expr->m_build_buffer.get(), 0x0, export_size);
-				expr->m_build_buffer_size = export_size;
+				const auto header		= (const bytecode_header*)bytecode;
+				const auto instructions = (const instruction*)(bytecode + sizeof(bytecode_header));
+				const auto constants	= (const t_atom*)(instructions + header->num_instructions);
 
-				size_t actual_export_size = 0;
-				portable<T_TRAITS>::export_write(
-					native_expr, actual_export_size, &variables, expr->m_build_buffer.get(), [&](const void* addr, expr_portable<T_TRAITS>* out, const variable* v) -> void {
-						assert(v != nullptr);
-						auto itor = indexer.index_map.find(addr);
-						assert(itor != indexer.index_map.end());
-						out->function = itor->second;
+				using t_emitter = x64_emitter<t_vector>;
+				t_emitter e;
 
-						if (v->type >= CLOSURE0 && v->type < CLOSURE_MAX)
-						{
-							auto itor2 = indexer.index_map.find(v->context);
-							assert(itor2 != indexer.index_map.end());
-							out->parameters[eval_details::arity(v->type)] = itor2->second;
-						}
-					});
+				// Locals take the slots after the registers.
+				const int num_registers = header->num_registers;
+				const int frame_size	= (t_emitter::outgoing_size + (num_registers + header->num_locals) * 8 + 15) & ~15;
 
-				native<T_TRAITS>::free_native(native_expr);
-				return expr;
-			}
-			return nullptr;
-		}
+				auto in_frame = [&](int reg, int count) { return reg + count <= num_registers; };
 
-		template<typename T_TRAITS>
-		compiled_expr* compile(const char* expression, const variable* variables, int var_count, int* error)
-		{
-			typename portable<T_TRAITS>::expr_portable_expression_build_indexer indexer;
-			for (int v = 0; v < var_count; ++v)
-			{
-				indexer.add_user_variable(variables + v);
-			}
-			return compile_using_indexer<T_TRAITS>(indexer, expression, error);
-		}
+				std::vector<size_t>						offsets(header->num_instructions + 1);
+				std::vector<std::tuple<size_t, size_t>> fixups;
 
-	} // namespace expr_details
+				e.prologue(frame_size);
 
-	namespace program_details
-	{
-		struct parser
-		{
-			static inline std::string_view trim_leading_space(std::string_view v) noexcept
-			{
-				if (v.length() > 0)
+				if (header->num_locals > 0)
 				{
-					for (size_t i = 0; i < v.length(); ++i)
+					e.load_immediate(0, t_vector(0));
+					for (int l = 0; l < header->num_locals; ++l)
 					{
-						if (!::isspace((unsigned char)v[i]))
-						{
-							return std::string_view(&v[i], v.length() - i);
-						}
+						e.store(0, t_emitter::slot(num_registers + l));
 					}
-
-					return std::string_view(&v[v.length()], 0);
 				}
-				return v;
-			}
 
-			static inline std::string_view trim_trailing_space(std::string_view v) noexcept
-			{
-				if (v.length() > 0)
+				for (int index = 0; index < header->num_instructions; ++index)
 				{
-					for (size_t i = v.length(); i > 0; --i)
+					const instruction& i = instructions[index];
+					offsets[index]		 = e.code.size();
+
+					if (i.op >= opcode::call0 && i.op <= opcode::closure7)
 					{
-						if (!::isspace((unsigned char)v[i - 1]))
+						const bool is_closure = i.op >= opcode::closure0;
+						const int  arity	  = int(i.op) - int(is_closure ? opcode::closure0 : opcode::call0);
+						if (!in_frame(i.reg, arity > 0 ? arity : 1) || expr_context[i.arg_a] == nullptr)
 						{
-							return std::string_view(&v[0], i);
+							return nullptr;
 						}
+
+						e.pass_arguments(i.reg, arity, is_closure, i.arg_b);
+						e.call(expr_context[i.arg_a]);
+						e.store(0, t_emitter::slot(i.reg));
+						continue;
 					}
 
-					if (!::isspace((unsigned char)v[0]))
+					switch (i.op)
 					{
-						std::string_view(&v[0], 1);
+					case opcode::load_constant:
+						if (!in_frame(i.reg, 1))
+						{
+							return nullptr;
+						}
+						e.load_immediate(0, constants[i.arg_a]);
+						e.store(0, t_emitter::slot(i.reg));
+						break;
+					case opcode::load_variable:
+						if (!in_frame(i.reg, 1))
+						{
+							return nullptr;
+						}
+						e.load_binding(t_emitter::rax, i.arg_a);
+						e.load_indirect();
+						e.store(0, t_emitter::slot(i.reg));
+						break;
+					case opcode::store_variable:
+						if (!in_frame(i.reg, 1))
+						{
+							return nullptr;
+						}
+						e.load(0, t_emitter::slot(i.reg));
+						e.load_binding(t_emitter::rax, i.arg_a);
+						e.store_indirect();
+						break;
+					case opcode::load_local:
+						if (!in_frame(i.reg, 1) || i.arg_a >= header->num_locals)
+						{
+							return nullptr;
+						}
+						e.load(0, t_emitter::slot(num_registers + i.arg_a));
+						e.store(0, t_emitter::slot(i.reg));
+						break;
+					case opcode::store_local:
+						if (!in_frame(i.reg, 1) || i.arg_a >= header->num_locals)
+						{
+							return nullptr;
+						}
+						e.load(0, t_emitter::slot(i.reg));
+						e.store(0, t_emitter::slot(num_registers + i.arg_a));
+						break;
+					case opcode::select:
+					case opcode::fma:
+					case opcode::clamp:
+					{
+						if (!in_frame(i.reg, 3))
+						{
+							return nullptr;
+						}
+						using t_function3 = t_vector (*)(t_vector, t_vector, t_vector);
+						const t_function3 function =
+							(i.op == opcode::select) ? t_function3(t_native::select) : (i.op == opcode::fma) ? t_function3(t_native::fma) : t_function3(t_native::clamp);
+						e.pass_arguments(i.reg, 3, false, 0);
+						e.call((const void*)function);
+						e.store(0, t_emitter::slot(i.reg));
+						break;
 					}
+					case opcode::jump:
+						fixups.push_back(std::make_tuple(e.jump(-1), size_t(i.arg_a)));
+						break;
+					case opcode::jump_if:
+						// Taken unless the register compares equal to zero, NaN (unordered) counts as true like in the interpreter.
+						if (!in_frame(i.reg, 1))
+						{
+							return nullptr;
+						}
+						e.load(0, t_emitter::slot(i.reg));
+						e.byte(0x0F); // xorps xmm1, xmm1
+						e.byte(0x57);
+						e.byte(0xC9);
+						if constexpr (t_emitter::is_double)
+						{
+							e.byte(0x66);
+						}
+						e.byte(0x0F); // ucomiss/ucomisd xmm0, xmm1
+						e.byte(0x2E);
+						e.byte(0xC1);
+						fixups.push_back(std::make_tuple(e.jump(0x85), size_t(i.arg_a))); // jne
+						fixups.push_back(std::make_tuple(e.jump(0x8A), size_t(i.arg_a))); // jp
+						break;
+					case opcode::ret:
+						if (!in_frame(i.reg, 1))
+						{
+							return nullptr;
+						}
+						e.load(0, t_emitter::slot(i.reg));
+						e.epilogue(frame_size);
+						break;
+					case opcode::ret_nan:
+						e.load_immediate(0, T_TRAITS::nan());
+						e.epilogue(frame_size);
+						break;
+					case opcode::add:
+					case opcode::sub:
+					case opcode::mul:
+					case opcode::divide:
+					case opcode::min:
+					case opcode::max:
+					{
+						if (!in_frame(i.reg, 1) || !in_frame(i.arg_a, 1) || !in_frame(i.arg_b, 1))
+						{
+							return nullptr;
+						}
+						// minss/maxss return the second operand unless the first is lower/greater, like the builtins.
+						const int ops[] = {t_emitter::op_add, t_emitter::op_sub, t_emitter::op_mul, t_emitter::op_div};
+						e.load(0, t_emitter::slot(i.arg_a));
+						e.arith((i.op == opcode::min) ? t_emitter::op_min : (i.op == opcode::max) ? t_emitter::op_max : ops[int(i.op) - int(opcode::add)],
+							t_emitter::slot(i.arg_b));
+						e.store(0, t_emitter::slot(i.reg));
+						break;
+					}
+					case opcode::add_k:
+					case opcode::sub_k:
+					case opcode::mul_k:
+					case opcode::divide_k:
+					{
+						if (!in_frame(i.reg, 1) || !in_frame(i.arg_a, 1))
+						{
+							return nullptr;
+						}
+						const int ops[] = {t_emitter::op_add, t_emitter::op_sub, t_emitter::op_mul, t_emitter::op_div};
+						e.load(0, t_emitter::slot(i.arg_a));
+						e.load_immediate(1, constants[i.arg_b]);
+						e.arith_xmm1(ops[int(i.op) - int(opcode::add_k)]);
+						e.store(0, t_emitter::slot(i.reg));
+						break;
+					}
+					default:
+					{
+						// Remaining builtin operators call the native implementation, one or two arguments in xmm0/xmm1 on both ABIs.
+						const void* address = operator_address<t_native>(i.op);
+						if (address == nullptr || !in_frame(i.reg, 1) || !in_frame(i.arg_a, 1))
+						{
+							return nullptr;
+						}
+						e.load(0, t_emitter::slot(i.arg_a));
+						if (i.op < opcode::negate)
+						{
+							if (!in_frame(i.arg_b, 1))
+							{
+								return nullptr;
+							}
+							e.load(1, t_emitter::slot(i.arg_b));
+						}
+						e.call(address);
+						e.store(0, t_emitter::slot(i.reg));
+						break;
+					}
+					}
+				}
 
-					return std::string_view(&v[0], 0);
-				}
-				return v;
-			}
-
-			static inline std::string_view trim_all_space(std::string_view v) noexcept
-			{
-				return trim_leading_space(trim_trailing_space(v));
-			}
+				// Jumps past the last instruction return nan, matching the statement interpreter.
+				offsets[header->num_instructions] = e.code.size();
+				e.load_immediate(0, T_TRAITS::nan());
+				e.epilogue(frame_size);
 
-			static inline std::tuple<std::string_view, std::string_view> split_at_index(std::string_view s, size_t index)
-			{
-				if (index < s.length())
+				for (auto& fixup : fixups)
 				{
-					return {trim_all_space(std::string_view{&s[0], index}), trim_all_space(std::string_view{&s[index], s.length() - index})};
+					const size_t target = std::get<1>(fixup);
+					e.patch_rel32(std::get<0>(fixup), offsets[(target < header->num_instructions) ? target : header->num_instructions]);
 				}
-				return {s, std::string_view{}};
+
+				return executable_code::create(e.code);
 			}
+		}
+	} // namespace jit_details
+#endif // #if TP_JIT_ENABLED
 
-			static inline std::tuple<std::string_view, std::string_view> split_at_index_excl(std::string_view s, size_t index)
+#if (TP_COMPILER_ENABLED)
+	struct compiled_expr
+	{
+		virtual ~compiled_expr() = default;
+
+		virtual size_t				 get_binding_array_size() const = 0;
+		virtual const void* const*	 get_binding_addresses() const	= 0;
+		virtual const char* const*	 get_binding_names() const		= 0;
+		virtual size_t				 get_data_size() const			= 0;
+		virtual const unsigned char* get_data() const				= 0;
+		virtual size_t				 get_bytecode_size() const		= 0;
+		virtual const unsigned char* get_bytecode() const			= 0;
+
+		// Offset of the root node in get_data(), 0 unless the layout is post_order.
+		virtual size_t			  get_root_offset() const = 0;
+		virtual expression_layout get_layout() const	  = 0;
+	};
+
+	struct compiled_program
+	{
+		virtual ~compiled_program() = default;
+
+		virtual size_t				 get_binding_array_size() const	  = 0;
+		virtual const void* const*	 get_binding_addresses() const	  = 0;
+		virtual const char* const*	 get_binding_names() const		  = 0;
+		virtual size_t				 get_data_size() const			  = 0;
+		virtual const unsigned char* get_data() const				  = 0;
+		virtual size_t				 get_statement_array_size() const = 0;
+		virtual const statement*	 get_statements() const			  = 0;
+		virtual size_t				 get_bytecode_size() const		  = 0;
+		virtual const unsigned char* get_bytecode() const			  = 0;
+
+		// Binding indexes of the variables declared with var:, an execution_context gives each of them its own storage.
+		virtual size_t	   get_num_declared_variables() const = 0;
+		virtual const int* get_declared_variables() const	  = 0;
+
+		// post_order when every expression of the program is.
+		virtual expression_layout get_layout() const = 0;
+	};
+#endif // #if (TP_COMPILER_ENABLED)
+} // namespace tp
+
+#if (TP_COMPILER_ENABLED)
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <vector>
+#include <variant>
+#include <memory>
+#include <array>
+#include <string>
+#include <cstdio>
+#include <cassert>
+#include <cmath>
+
+namespace tp
+{
+	// Variables of a variable_lookup by name and by address. The first of several variables with the same name or address wins, as
+	// in the linear search.
+	struct symbol_table
+	{
+		std::unordered_map<std::string_view, const variable*> by_name;
+		std::unordered_map<const void*, const variable*>	   by_address;
+
+		void build(const variable* vars, int vars_len)
+		{
+			by_name.clear();
+			by_address.clear();
+			by_name.reserve(size_t(vars_len));
+			by_address.reserve(size_t(vars_len));
+			for (int i = 0; i < vars_len; ++i)
 			{
-				auto [l, r] = split_at_index(s, index);
-				if (r.length() > 1)
-				{
-					return {trim_all_space(l), trim_all_space(std::string_view{&r[1], r.length() - 1})};
-				}
-				return {l, std::string_view{}};
+				by_name.emplace(std::string_view(vars[i].name), vars + i);
+				by_address.emplace(vars[i].address, vars + i);
 			}
+		}
 
-			static inline std::tuple<std::string_view, std::string_view> split_at_char(std::string_view program, char c)
+		const variable* find_by_name(const char* name, int len) const
+		{
+			auto itor = by_name.find(std::string_view(name, size_t(len)));
+			return (itor != by_name.end()) ? itor->second : nullptr;
+		}
+
+		const variable* find_by_addr(const void* addr) const
+		{
+			auto itor = by_address.find(addr);
+			return (itor != by_address.end()) ? itor->second : nullptr;
+		}
+	};
+
+	// Where a compile_arena gets its blocks, e.g. a pool kept between compilations. allocate returns nullptr when out of memory.
+	struct arena_backing
+	{
+		void* (*allocate)(size_t size, void* user);
+		void (*release)(void* block, void* user);
+		void* user;
+	};
+
+	// Bump allocator for the parse nodes of a compilation, the nodes are released all at once when the arena goes away or is
+	// reset. While an arena is current on a thread, new nodes come from it and freeing a node does nothing, so a tree built
+	// within a scope must not outlive its arena. A compilation uses the current arena, or its own when there is none.
+	class compile_arena
+	{
+	public:
+		explicit compile_arena(arena_backing backing = {default_allocate, default_release, nullptr}, size_t block_size = TP_ARENA_BLOCK_SIZE)
+			: m_backing(backing)
+			, m_block_size(block_size)
+		{
+		}
+
+		~compile_arena()
+		{
+			while (m_blocks)
 			{
-				for (size_t i = 0; i < program.length(); ++i)
-				{
-					if (program[i] == c)
-					{
-						return split_at_index(program, i);
-					}
-				}
-				return {program, std::string_view{}};
+				block* next = m_blocks->next;
+				m_backing.release(m_blocks, m_backing.user);
+				m_blocks = next;
 			}
+		}
 
-			static inline std::tuple<std::string_view, std::string_view> split_at_char_excl(std::string_view program, char c)
+		compile_arena(const compile_arena&)			   = delete;
+		compile_arena& operator=(const compile_arena&) = delete;
+
+		void* allocate(size_t size) noexcept
+		{
+			size = (size + alignment - 1) & ~(alignment - 1);
+
+			// Blocks kept by reset() are reused in order before taking new ones.
+			while (!m_current || m_used + size > m_current->size)
 			{
-				for (size_t i = 0; i < program.length(); ++i)
+				block* next = m_current ? m_current->next : m_blocks;
+				if (!next || next->size < size)
 				{
-					if (program[i] == c)
+					next = new_block(size);
+					if (!next)
 					{
-						return split_at_index_excl(program, i);
+						return nullptr;
 					}
 				}
-				return {program, std::string_view{}};
+				m_current = next;
+				m_used	  = 0;
 			}
 
-			////
+			void* ret = (unsigned char*)(m_current + 1) + m_used;
+			m_used += size;
+			return ret;
+		}
 
-			static inline const auto keyword_return = std::string_view("return");
-			static inline const auto keyword_jump	= std::string_view("jump");
-			static inline const auto keyword_label	= std::string_view("label");
-			static inline const auto keyword_var	= std::string_view("var");
+		// Releases every node at once, keeping the blocks for the next compilation.
+		void reset() noexcept
+		{
+			m_current = nullptr;
+			m_used	  = 0;
+		}
 
-			template<
-				typename T_ADD_VARIABLE, typename T_ADD_LABEL, typename T_ADD_JUMP, typename T_ADD_JUMP_IF, typename T_ADD_RETURN_VALUE, typename T_ADD_ASSIGN, typename T_ADD_CALL>
-			static inline void parse_statement(
-				std::string_view statement, T_ADD_VARIABLE add_variable, T_ADD_LABEL add_label, T_ADD_JUMP add_jump, T_ADD_JUMP_IF add_jump_if, T_ADD_RETURN_VALUE add_return_value,
-				T_ADD_ASSIGN add_assign, T_ADD_CALL add_call)
-			{
-				auto [operation, expression] = split_at_char_excl(statement, ':');
+		// The arena new nodes come from on this thread, nullptr when they are allocated one by one.
+		static compile_arena*& current() noexcept
+		{
+			static thread_local compile_arena* arena = nullptr;
+			return arena;
+		}
 
-				if (expression.length() == 0)
-				{
-					add_call(operation);
-				}
-				else
-				{
-					if (operation == keyword_var)
-					{
-						auto [var_name, var_scope] = split_at_char_excl(expression, '?');
-						add_variable(var_name, var_scope);
-					}
-					else if (operation == keyword_label)
-					{
-						add_label(expression);
-					}
-					else if (operation == keyword_jump)
-					{
-						auto [jump_label, jump_condition] = split_at_char_excl(expression, '?');
+		// Makes an arena current until the end of the scope.
+		struct scope
+		{
+			explicit scope(compile_arena& arena) noexcept : previous(current())
+			{
+				current() = &arena;
+			}
 
-						if (jump_condition.length() > 0)
-						{
-							add_jump_if(jump_label, jump_condition);
-						}
-						else
-						{
-							add_jump(jump_label);
-						}
-					}
-					else if (operation == keyword_return)
-					{
-						add_return_value(expression);
-					}
-					else
-					{
-						add_assign(operation, expression);
-					}
-				}
+			~scope()
+			{
+				current() = previous;
 			}
+
+			scope(const scope&)			   = delete;
+			scope& operator=(const scope&) = delete;
+
+			compile_arena* previous;
 		};
 
-		struct label_manager
+	private:
+		struct alignas(std::max_align_t) block
 		{
-			using handle								  = int;
-			static inline constexpr int placeholder_index = -1;
-
-			std::vector<int>							 m_label_statement_indexes;
-			std::unordered_map<std::string_view, handle> m_label_handle_map;
+			block* next;
+			size_t size;
+		};
 
-			handle add_label(std::string_view label, int statement_index)
-			{
-				auto itor = m_label_handle_map.find(label);
-				if (itor != m_label_handle_map.end())
-				{
-					handle label_handle = (*itor).second;
+		static constexpr size_t alignment = alignof(std::max_align_t);
 
-					// Placeholder was filled, fill in the program counter
-					if (m_label_statement_indexes[label_handle] != placeholder_index)
-					{
-						// error, label repeated?
-					}
-					else
-					{
-						// The target of the jump label is the next statement of program
-						m_label_statement_indexes[label_handle] = statement_index;
-					}
+		static void* default_allocate(size_t size, void*)
+		{
+			return ::malloc(size);
+		}
 
-					return label_handle;
-				}
-				else
-				{
-					// The target of the jump label is the next statement of program
-					auto label_handle = (handle)m_label_statement_indexes.size();
-					m_label_handle_map.insert(std::make_pair(label, label_handle));
-					m_label_statement_indexes.push_back(statement_index);
-					return label_handle;
-				}
-			}
+		static void default_release(void* block, void*)
+		{
+			::free(block);
+		}
 
-			handle find_label(std::string_view label)
+		// Inserted after the current block, so reset() walks the blocks in the order they were used.
+		block* new_block(size_t size) noexcept
+		{
+			const size_t capacity = std::max(size, m_block_size);
+			block*		 b		  = (block*)m_backing.allocate(sizeof(block) + capacity, m_backing.user);
+			if (b)
 			{
-				auto itor = m_label_handle_map.find(label);
-				if (itor != m_label_handle_map.end())
+				b->size = capacity;
+				if (m_current)
 				{
-					// label exists, use its index
-					return (handle)(*itor).second;
+					b->next			= m_current->next;
+					m_current->next = b;
 				}
 				else
 				{
-					// add a temp label, which will be replaced then when the actual label is encountered
-					auto new_handle = (handle)m_label_statement_indexes.size();
-					m_label_handle_map.insert(std::make_pair(label, new_handle));
-					m_label_statement_indexes.push_back(placeholder_index);
-					return new_handle;
+					b->next	 = m_blocks;
+					m_blocks = b;
 				}
 			}
+			return b;
+		}
 
-			int get_label_statement_index(handle label)
+		arena_backing m_backing;
+		size_t		  m_block_size;
+		block*		  m_blocks	= nullptr;
+		block*		  m_current = nullptr;
+		size_t		  m_used	= 0;
+	};
+
+	template<typename T_TRAITS>
+	struct native
+	{
+		using t_traits = T_TRAITS;
+		using t_atom   = typename T_TRAITS::t_atom;
+		using t_vector = typename T_TRAITS::t_vector;
+
+		struct expr_native
+		{
+			int type;
+			union
 			{
-				return m_label_statement_indexes[label];
-			}
+				t_atom			value;
+				const t_vector* bound;
+				const void*		function;
+			};
+			void* parameters[1];
 		};
 
-		struct variable_manager
-		{
-			int										  m_variable_count = 0;
-			std::unordered_map<std::string_view, int> m_variable_map;
+		typedef t_vector (*te_fun2)(t_vector, t_vector);
 
-			int find_label(std::string_view name)
-			{
-				auto itor = m_variable_map.find(name);
-				if (itor == m_variable_map.end())
-				{
-					auto idx = m_variable_count++;
-					m_variable_map.insert(std::make_pair(name, idx));
-					return idx;
-				}
-				return itor->second;
-			}
+		enum
+		{
+			TOK_NUL = CLOSURE_MAX,
+			TOK_ERROR,
+			TOK_END,
+			TOK_SEP,
+			TOK_OPEN,
+			TOK_CLOSE,
+			TOK_NUMBER,
+			TOK_VARIABLE,
+			TOK_INFIX
 		};
 
-		struct expression_manager
+		struct state
 		{
-			std::vector<std::string_view> m_expressions;
-
-			int add_expression(std::string_view src)
+			const char* start;
+			const char* next;
+			int			type;
+			union
 			{
-				auto idx = (int)m_expressions.size();
-				m_expressions.push_back(src);
-				return idx;
-			}
-		};
+				t_atom			value;
+				const t_vector* bound;
+				const void*		function;
+			};
+			void* context;
 
-		struct jump_statement
-		{
-			label_manager::handle m_target_handle; // Pass 1: index isn't known isn't known until whole program is parsed
-			int					  m_expression_index;
+			variable_lookup lookup;
 
-			int m_target_index; // Pass 2: set from handle to index (of statement immediately following the label)
-			int m_expression_offset;
+			// Address of each builtin_operator, or of the variable of the same name overriding it, see resolve_operators().
+			const void* operators[size_t(builtin_operator::count)];
 		};
 
-		struct return_value_statement
+		static inline bool is_pure(int t) noexcept
 		{
-			int m_expression_index;
+			return (((t)&FLAG_PURE) != 0);
+		}
 
-			int m_expression_offset;
-		};
+		static inline bool is_function(int t) noexcept
+		{
+			return (((t)&FUNCTION0) != 0);
+		}
 
-		struct assign_statement
+		static inline bool is_closure(int t) noexcept
 		{
-			int m_variable_build_index;
-			int m_expression_index;
+			return (((t)&CLOSURE0) != 0);
+		}
 
-			int m_variable_final_index;
-			int m_expression_offset;
-		};
+#define NEW_EXPR(type, ...)                                                                                                                                                        \
+	[&]() {                                                                                                                                                                        \
+		const expr_native* _args[] = {__VA_ARGS__};                                                                                                                                \
+		return new_expr((type), _args);                                                                                                                                            \
+	}()
 
-		struct call_statement
+		static expr_native* new_expr(const int type, const expr_native* parameters[])
 		{
-			int m_expression_index;
-
-			int m_expression_offset;
-		};
+			const int	 arity = eval_details::arity(type);
+			const int	 psize = sizeof(void*) * arity;
+			const int	 size  = (sizeof(expr_native) - sizeof(void*)) + psize + (is_closure(type) ? sizeof(void*) : 0);
+			compile_arena* arena = compile_arena::current();
+			expr_native*   ret	 = (expr_native*)(arena ? arena->allocate(size) : malloc(size));
+			if (ret)
+			{
+				memset(ret, 0, size);
+				if (arity && parameters)
+				{
+					memcpy(ret->parameters, parameters, psize);
+				}
+				ret->type  = type;
+				ret->bound = 0;
+			}
+			return ret;
+		}
 
-		using any_statement = std::variant<jump_statement, return_value_statement, assign_statement, call_statement>;
+		static void free_parameters(expr_native* n)
+		{
+			if (!n)
+				return;
 
-		template<typename T_TRAITS>
-		using t_indexer = typename portable<T_TRAITS>::expr_portable_expression_build_indexer;
+			for (int arity = eval_details::arity(n->type); arity > 0; --arity)
+			{
+				free_native((expr_native*)n->parameters[arity - 1]);
+			}
+		}
 
-		template<typename T_TRAITS>
-		auto compile_using_indexer(const char* text, int* error, typename t_indexer<T_TRAITS>& indexer) -> typename portable<T_TRAITS>::portable_compiled_program*
+		// A single node, its parameters stay.
+		static void free_node(expr_native* n)
 		{
-			auto program_src	   = parser::trim_all_space(std::string_view{text, strlen(text)});
-			auto program_remaining = program_src;
+			if (!compile_arena::current())
+			{
+				free(n);
+			}
+		}
 
-			std::vector<any_statement> program_statements;
-			using program_impl		   = typename portable<T_TRAITS>::portable_compiled_program;
-			auto			   program = new program_impl();
-			label_manager	   lm;
-			variable_manager   vm;
-			expression_manager em;
+		static void free_native(expr_native* n)
+		{
+			if (!n || compile_arena::current())
+				return;
+			free_parameters(n);
+			free(n);
+		}
 
-			while (program_remaining.length() > 0)
+		// Constants, variables and pure functions of them, evaluating n can't have side effects.
+		static bool is_side_effect_free(const expr_native* n)
+		{
+			const auto t = eval_details::type_mask(n->type);
+			if (t == CONSTANT || t == VARIABLE)
 			{
-				auto [statement, remaining] = parser::split_at_char_excl(program_remaining, ';');
-
-				parser::parse_statement(
-					statement,
+				return true;
+			}
 
-					// variable
-					[&](std::string_view name, std::string_view scope) { indexer.add_declared_variable(name, scope); },
+			if (!is_pure(n->type) || is_closure(n->type))
+			{
+				return false;
+			}
 
-					// label
-					[&](std::string_view label) { lm.add_label(label, (int)program_statements.size()); },
+			for (int i = 0; i < eval_details::arity(n->type); ++i)
+			{
+				if (!is_side_effect_free((const expr_native*)n->parameters[i]))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
 
-					// jump
-					[&](std::string_view destination_label) {
-						any_statement s = jump_statement{lm.find_label(destination_label), -1};
-						program_statements.push_back(s);
-					},
+		// The symbol table of the lookup when there is one, the builtins otherwise.
+		static const variable* find_by_name(const char* name, int len, const variable_lookup* lookup)
+		{
+			if (lookup && lookup->symbols)
+			{
+				auto var = lookup->symbols->find_by_name(name, len);
+				return var ? var : t_traits::find_by_name(name, len, nullptr);
+			}
+			return t_traits::find_by_name(name, len, lookup);
+		}
 
-					// jump_if
-					[&](std::string_view destination_label, std::string_view condition) {
-						any_statement s = jump_statement{lm.find_label(destination_label), em.add_expression(condition)};
-						program_statements.push_back(s);
-					},
+		static const variable* find_by_addr(const void* addr, const variable_lookup* lookup)
+		{
+			if (lookup && lookup->symbols)
+			{
+				auto var = lookup->symbols->find_by_addr(addr);
+				return var ? var : t_traits::find_by_addr(addr, nullptr);
+			}
+			return t_traits::find_by_addr(addr, lookup);
+		}
 
-					// return_value
-					[&](std::string_view expression) {
-						any_statement s = return_value_statement{em.add_expression(expression)};
-						program_statements.push_back(s);
-					},
+		static inline const void* find_wrapper(const char* name, state* s)
+		{
+			auto var = find_by_name(name, int(strlen(name)), &s->lookup);
+			return var ? var->address : nullptr;
+		}
 
-					// assign
-					[&](std::string_view destination, std::string_view expression) {
-						any_statement s = assign_statement{vm.find_label(destination), em.add_expression(expression)};
-						program_statements.push_back(s);
-					},
+		// Looks the operators up once per parse, the tokenizer and the parser then compare addresses.
+		static void resolve_operators(state* s)
+		{
+			for (size_t op = 0; op < size_t(builtin_operator::count); ++op)
+			{
+				s->operators[op] = find_wrapper(builtin_operator_names[op], s);
+			}
+		}
 
-					// call
-					[&](std::string_view expression) {
-						any_statement s = call_statement{em.add_expression(expression)};
-						program_statements.push_back(s);
-					});
+		static inline const void* wrapper(builtin_operator op, const state* s) noexcept
+		{
+			return s->operators[size_t(op)];
+		}
 
-				program_remaining = remaining;
-			}
+		static void next_token(state* s)
+		{
+			s->type = (int)TOK_NUL;
 
-			// Fixup jump indices
-			for (auto& s : program_statements)
+			do
 			{
-				if (std::holds_alternative<jump_statement>(s))
+				if (!*s->next || *s->next == ';')
 				{
-					std::get<jump_statement>(s).m_target_index = lm.get_label_statement_index(std::get<jump_statement>(s).m_target_handle);
+					s->type = (int)TOK_END;
+					return;
 				}
-			}
 
-			// Add referenced variables to the lookup dict
-			{
-				auto			var_array_tmp = indexer.get_variable_array();
-				auto var_lookup = var_array_tmp->get_lookup();
-				for (auto itor : vm.m_variable_map)
+				/* Try reading a number. */
+				if ((s->next[0] >= '0' && s->next[0] <= '9') || s->next[0] == '.')
 				{
-					auto name  = itor.first;
-					auto index = itor.second;
-
-					int final_index = -1;
-
-					for (int var_idx = 0; var_idx < var_lookup.lookup_len; ++var_idx)
+					s->value = (t_atom)strtod(s->next, (char**)&s->next);
+					s->type	 = (int)TOK_NUMBER;
+				}
+				else
+				{
+					/* Look for a variable or builtin function call. */
+					if ((s->next[0] >= 'a' && s->next[0] <= 'z') || (s->next[0] == '_'))
 					{
-						const auto& var = var_lookup.lookup[var_idx];
+						const char* start;
+						start = s->next;
+						while ((s->next[0] >= 'a' && s->next[0] <= 'z') || (s->next[0] >= '0' && s->next[0] <= '9') || (s->next[0] == '_'))
+							s->next++;
+
+						const variable* var = find_by_name(start, static_cast<int>(s->next - start), &s->lookup);
 
-						if (name == std::string_view(var.name))
+						if (!var)
 						{
-							final_index = indexer.add_referenced_variable(&var);
-							break;
+							s->type = (int)TOK_ERROR;
 						}
-					}
-
-					if (final_index == -1)
-					{
-						*error = -1; // TODO: variable not found
-						// assert(!"Variable not found.");
-						return nullptr;
-					}
-
-					// Remap all indexes to the indexer value
-					for (auto& s : program_statements)
-					{
-						if (std::holds_alternative<assign_statement>(s))
+						else
 						{
-							if (std::get<assign_statement>(s).m_variable_build_index == index)
+							const auto t = eval_details::type_mask(var->type);
+							if (t == CONSTANT)
 							{
-								std::get<assign_statement>(s).m_variable_final_index = final_index;
+								s->type	 = (int)TOK_VARIABLE;
+								s->bound = (const t_vector*)var->address;
 							}
-						}
-					}
-				}
-			}
-
-			// Compile all the expressions, redirect the statement expression indexes to the compiled buffer offset
-			for (int expr_idx = 0; expr_idx < em.m_expressions.size(); ++expr_idx)
-			{
-				auto expr		   = em.m_expressions[expr_idx];
-				auto compiled_expr = expr_details::compile_using_indexer<T_TRAITS>(indexer, expr.data(), error);
-
-				if (compiled_expr)
-				{
-					const int current_expr_offset = (int)program->program_expression_buffer_size;
-					auto	  compiled_size		  = (int)compiled_expr->get_data_size();
-					const int new_expr_offset	  = (int)program->program_expression_buffer_size + compiled_size;
-
-					auto new_expr_buffer = new unsigned char[new_expr_offset];
+							else if (t == VARIABLE)
+							{
+								s->type	 = (int)TOK_VARIABLE;
+								s->bound = (const t_vector*)var->address;
+							}
+							else if (t >= FUNCTION0)
+							{
+								if (t < FUNCTION_MAX)
+								{
+									s->type		= var->type;
+									s->function = var->address;
+								}
+								else if (t >= CLOSURE0)
+								{
+									if (t < CLOSURE_MAX)
+									{
+										s->context	= var->context;
+										s->type		= var->type;
+										s->function = var->address;
+									}
+								}
+							}
+						}
+					}
+					else
+					{
+						/* Look for an operator or special character. */
+						switch (s->next++[0])
+						{
+						case '+':
+							s->type		= (int)TOK_INFIX;
+							s->function = wrapper(builtin_operator::add, s);
+							break;
+						case '-':
+							s->type		= (int)TOK_INFIX;
+							s->function = wrapper(builtin_operator::sub, s);
+							break;
+						case '*':
+							s->type		= (int)TOK_INFIX;
+							s->function = wrapper(builtin_operator::mul, s);
+							break;
+						case '/':
+							s->type		= (int)TOK_INFIX;
+							s->function = wrapper(builtin_operator::divide, s);
+							break;
+						case '^':
+							s->type		= (int)TOK_INFIX;
+							s->function = wrapper(builtin_operator::pow, s);
+							break;
+						case '%':
+							s->type		= (int)TOK_INFIX;
+							s->function = wrapper(builtin_operator::fmod, s);
+							break;
+						case '!':
+							if (s->next++[0] == '=')
+							{
+								s->type		= (int)TOK_INFIX;
+								s->function = wrapper(builtin_operator::not_equal, s);
+							}
+							else
+							{
+								s->next--;
+								s->type		= (int)TOK_INFIX;
+								s->function = wrapper(builtin_operator::logical_not, s);
+							}
+							break;
+						case '=':
+							if (s->next++[0] == '=')
+							{
+								s->type		= (int)TOK_INFIX;
+								s->function = wrapper(builtin_operator::equal, s);
+							}
+							else
+							{
+								s->type = (int)TOK_ERROR;
+							}
+							break;
+						case '<':
+							if (s->next++[0] == '=')
+							{
+								s->type		= (int)TOK_INFIX;
+								s->function = wrapper(builtin_operator::lower_eq, s);
+							}
+							else
+							{
+								s->next--;
+								s->type		= (int)TOK_INFIX;
+								s->function = wrapper(builtin_operator::lower, s);
+							}
+							break;
+						case '>':
+							if (s->next++[0] == '=')
+							{
+								s->type		= (int)TOK_INFIX;
+								s->function = wrapper(builtin_operator::greater_eq, s);
+							}
+							else
+							{
+								s->next--;
+								s->type		= (int)TOK_INFIX;
+								s->function = wrapper(builtin_operator::greater, s);
+							}
+							break;
+						case '&':
+							if (s->next++[0] == '&')
+							{
+								s->type		= (int)TOK_INFIX;
+								s->function = wrapper(builtin_operator::logical_and, s);
+							}
+							else
+							{
+								s->type = (int)TOK_ERROR;
+							}
+							break;
+						case '|':
+							if (s->next++[0] == '|')
+							{
+								s->type		= (int)TOK_INFIX;
+								s->function = wrapper(builtin_operator::logical_or, s);
+							}
+							else
+							{
+								s->type = (int)TOK_ERROR;
+							}
+							break;
+						case '(':
+							s->type = (int)TOK_OPEN;
+							break;
+						case ')':
+							s->type = (int)TOK_CLOSE;
+							break;
+						case ',':
+							s->type = (int)TOK_SEP;
+							break;
+						case ' ':
+						case '\t':
+						case '\n':
+						case '\r':
+							break;
+						default:
+							s->type = (int)TOK_ERROR;
+							break;
+						}
+					}
+				}
+			} while (s->type == (int)TOK_NUL);
+		}
+
+		static expr_native* base(state* s)
+		{
+			/* <base>      =    <constant> | <variable> | <function-0> {"(" ")"} | <function-1> <power> | <function-X>
+			 * "(" <expr> {"," <expr>} ")" | "(" <list> ")" */
+			expr_native* ret;
+
+			const auto t = eval_details::type_mask(s->type);
+
+			if (t == (int)TOK_NUMBER)
+			{
+				ret		   = new_expr(CONSTANT, 0);
+				ret->value = s->value;
+				next_token(s);
+			}
+			else if (t == (int)TOK_VARIABLE)
+			{
+				ret		   = new_expr(VARIABLE, 0);
+				ret->bound = s->bound;
+				next_token(s);
+			}
+			else if ((t >= FUNCTION0 && t < FUNCTION_MAX) || (t >= CLOSURE0 && t < CLOSURE_MAX))
+			{
+				const auto arity = eval_details::arity(s->type);
+				if (arity == 0)
+				{
+					ret			  = new_expr(s->type, 0);
+					ret->function = s->function;
+					if (is_closure(s->type))
+						ret->parameters[0] = s->context;
+					next_token(s);
+					if (s->type == (int)TOK_OPEN)
+					{
+						next_token(s);
+						if (s->type != (int)TOK_CLOSE)
+						{
+							s->type = (int)TOK_ERROR;
+						}
+						else
+						{
+							next_token(s);
+						}
+					}
+				}
+				else if (arity == 1)
+				{
+					ret			  = new_expr(s->type, 0);
+					ret->function = s->function;
+					if (is_closure(s->type))
+						ret->parameters[1] = s->context;
+					next_token(s);
+					ret->parameters[0] = power(s);
+				}
+				else
+				{
+					ret			  = new_expr(s->type, 0);
+					ret->function = s->function;
+					if (is_closure(s->type))
+						ret->parameters[arity] = s->context;
+					next_token(s);
+
+					if (s->type != (int)TOK_OPEN)
+					{
+						s->type = (int)TOK_ERROR;
+					}
+					else
+					{
+						int i;
+						for (i = 0; i < arity; i++)
+						{
+							next_token(s);
+							ret->parameters[i] = expr(s);
+							if (s->type != (int)TOK_SEP)
+							{
+								break;
+							}
+						}
+						if (s->type != (int)TOK_CLOSE || i != arity - 1)
+						{
+							s->type = (int)TOK_ERROR;
+						}
+						else
+						{
+							next_token(s);
+						}
+					}
+				}
+			}
+			else if (t == (int)TOK_OPEN)
+			{
+				next_token(s);
+				ret = list(s);
+				if (s->type != (int)TOK_CLOSE)
+				{
+					s->type = (int)TOK_ERROR;
+				}
+				else
+				{
+					next_token(s);
+				}
+			}
+			else
+			{
+				ret		   = new_expr(0, 0);
+				s->type	   = (int)TOK_ERROR;
+				ret->value = t_traits::store_atom(t_traits::nan());
+			}
+
+			return ret;
+		}
+
+		static expr_native* power(state* s)
+		{
+			/* <power>     =    {("-" | "+" | "!")} <base> */
+			int sign = 1;
+			while (s->type == (int)TOK_INFIX && (s->function == wrapper(builtin_operator::add, s) || s->function == wrapper(builtin_operator::sub, s)))
+			{
+				if (s->function == wrapper(builtin_operator::sub, s))
+					sign = -sign;
+				next_token(s);
+			}
+
+			int logical = 0;
+			while (s->type == (int)TOK_INFIX && (s->function == wrapper(builtin_operator::add, s) || s->function == wrapper(builtin_operator::sub, s) || s->function == wrapper(builtin_operator::logical_not, s)))
+			{
+				if (s->function == wrapper(builtin_operator::logical_not, s))
+				{
+					if (logical == 0)
+					{
+						logical = -1;
+					}
+					else
+					{
+						logical = -logical;
+					}
+				}
+				next_token(s);
+			}
+
+			expr_native* ret;
+
+			if (sign == 1)
+			{
+				if (logical == 0)
+				{
+					ret = base(s);
+				}
+				else if (logical == -1)
+				{
+					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
+					ret->function = wrapper(builtin_operator::logical_not, s);
+				}
+				else
+				{
+					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
+					ret->function = wrapper(builtin_operator::logical_notnot, s);
+				}
+			}
+			else
+			{
+				if (logical == 0)
+				{
+					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
+					ret->function = wrapper(builtin_operator::negate, s);
+				}
+				else if (logical == -1)
+				{
+					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
+					ret->function = wrapper(builtin_operator::negate_logical_not, s);
+				}
+				else
+				{
+					ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, base(s));
+					ret->function = wrapper(builtin_operator::negate_logical_notnot, s);
+				}
+			}
+
+			return ret;
+		}
+
+#ifdef TP_POW_FROM_RIGHT
+		static expr_native* factor(state* s)
+		{
+			/* <factor>    =    <power> {"^" <power>} */
+			expr_native* ret = power(s);
+
+			const void*	 left_function = NUL;
+			expr_native* insertion	   = 0;
+
+			if (ret->type == (FUNCTION1 | FLAG_PURE) &&
+				(ret->function == wrapper(builtin_operator::negate, s) || ret->function == wrapper(builtin_operator::logical_not, s) || ret->function == wrapper(builtin_operator::logical_notnot, s) ||
+				 ret->function == wrapper(builtin_operator::negate_logical_not, s) || ret->function == wrapper(builtin_operator::negate_logical_notnot, s)))
+			{
+				left_function	= ret->function;
+				expr_native* se = ret->parameters[0];
+				free_node(ret);
+				ret = se;
+			}
+
+			while (s->type == (int)TOK_INFIX && (s->function == wrapper(builtin_operator::pow, s)))
+			{
+				te_fun2 t = s->function;
+				next_token(s);
+
+				if (insertion)
+				{
+					/* Make exponentiation go right-to-left. */
+					expr_native* insert		 = NEW_EXPR(FUNCTION2 | FLAG_PURE, insertion->parameters[1], power(s));
+					insert->function		 = t;
+					insertion->parameters[1] = insert;
+					insertion				 = insert;
+				}
+				else
+				{
+					ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, power(s));
+					ret->function = t;
+					insertion	  = ret;
+				}
+			}
+
+			if (left_function)
+			{
+				ret			  = NEW_EXPR(FUNCTION1 | FLAG_PURE, ret);
+				ret->function = left_function;
+			}
+
+			return ret;
+		}
+#else
+		static expr_native* factor(state* s)
+		{
+			/* <factor>    =    <power> {"^" <power>} */
+			expr_native* ret = power(s);
+
+			while (s->type == (int)TOK_INFIX && (s->function == wrapper(builtin_operator::pow, s)))
+			{
+				te_fun2 t = (te_fun2)s->function;
+				next_token(s);
+				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, power(s));
+				ret->function = t;
+			}
+
+			return ret;
+		}
+#endif
+
+		static expr_native* term(state* s)
+		{
+			/* <term>      =    <factor> {("*" | "/" | "%") <factor>} */
+			expr_native* ret = factor(s);
+
+			while (s->type == (int)TOK_INFIX && (s->function == wrapper(builtin_operator::mul, s) || s->function == wrapper(builtin_operator::divide, s) || s->function == wrapper(builtin_operator::fmod, s)))
+			{
+				te_fun2 t = (te_fun2)s->function;
+				next_token(s);
+				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, factor(s));
+				ret->function = t;
+			}
+
+			return ret;
+		}
+
+		static expr_native* sum_expr(state* s)
+		{
+			/* <expr>      =    <term> {("+" | "-") <term>} */
+			expr_native* ret = term(s);
+
+			while (s->type == (int)TOK_INFIX && (s->function == wrapper(builtin_operator::add, s) || s->function == wrapper(builtin_operator::sub, s)))
+			{
+				te_fun2 t = (te_fun2)s->function;
+				next_token(s);
+				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, term(s));
+				ret->function = t;
+			}
+
+			return ret;
+		}
+
+		static expr_native* test_expr(state* s)
+		{
+			/* <expr>      =    <sum_expr> {(">" | ">=" | "<" | "<=" | "==" | "!=") <sum_expr>} */
+			expr_native* ret = sum_expr(s);
+
+			while (s->type == (int)TOK_INFIX &&
+				   (s->function == wrapper(builtin_operator::greater, s) || s->function == wrapper(builtin_operator::greater_eq, s) || s->function == wrapper(builtin_operator::lower, s) ||
+					s->function == wrapper(builtin_operator::lower_eq, s) || s->function == wrapper(builtin_operator::equal, s) || s->function == wrapper(builtin_operator::not_equal, s)))
+			{
+				te_fun2 t = (te_fun2)s->function;
+				next_token(s);
+				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, sum_expr(s));
+				ret->function = t;
+			}
+
+			return ret;
+		}
+
+		static expr_native* expr(state* s)
+		{
+			/* <expr>      =    <test_expr> {("&&" | "||") <test_expr>} */
+			expr_native* ret = test_expr(s);
+
+			while (s->type == (int)TOK_INFIX && (s->function == wrapper(builtin_operator::logical_and, s) || s->function == wrapper(builtin_operator::logical_or, s)))
+			{
+				te_fun2 t = (te_fun2)s->function;
+				next_token(s);
+				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, test_expr(s));
+				ret->function = t;
+			}
+
+			return ret;
+		}
+
+		static expr_native* list(state* s)
+		{
+			/* <list>      =    <expr> {"," <expr>} */
+			expr_native* ret = expr(s);
+
+			while (s->type == (int)TOK_SEP)
+			{
+				next_token(s);
+
+				// The left hand side of a comma only matters for its side effects.
+				if (ret && is_side_effect_free(ret))
+				{
+					free_native(ret);
+					ret = expr(s);
+					continue;
+				}
+
+				ret			  = NEW_EXPR(FUNCTION2 | FLAG_PURE, ret, expr(s));
+				ret->function = wrapper(builtin_operator::comma, s);
+			}
+
+			return ret;
+		}
+
+		static t_vector eval_native(const expr_native* n)
+		{
+			if (!n)
+				return t_traits::nan();
+
+			auto eval_arg = [&](int e) {
+				return eval_native((const expr_native*)n->parameters[e]);
+			};
+
+			return eval_details::eval_generic(
+				n->type, [&]() { return t_traits::load_atom(n->value); }, [&]() { return *n->bound; },
+				[&](int a) { return eval_details::eval_function<t_vector>(a, n->function, t_traits::nan(), eval_arg); },
+				[&](int a) { return eval_details::eval_closure<t_vector>(a, n->function, (void*)n->parameters[a], t_traits::nan(), eval_arg); }, [&]() { return t_traits::nan(); });
+		}
+
+		static void optimize(expr_native* n)
+		{
+			/* Evaluates as much as possible. */
+			if (n->type == CONSTANT)
+		    {
+				return;
+			}
+			
+			if (n->type == VARIABLE)
+		    {
+				const variable* v = find_by_addr(n->bound, nullptr);
+				if (v && (v->type == CONSTANT))
+				{
+					free_parameters(n);
+					n->type	 = CONSTANT;
+					n->value = t_traits::store_atom(*n->bound);
+				}
+				return;
+			}
+
+			/* Only optimize out functions flagged as pure. */
+			if (is_pure(n->type))
+			{
+				const int arity = eval_details::arity(n->type);
+				int		  known = 1;
+				int		  i;
+				for (i = 0; i < arity; ++i)
+				{
+					optimize((expr_native*)n->parameters[i]);
+					n->parameters[i] = simplify((expr_native*)n->parameters[i]);
+					if (((expr_native*)(n->parameters[i]))->type != CONSTANT)
+					{
+						known = 0;
+					}
+				}
+				if (known)
+				{
+					const t_vector value = eval_native(n);
+					free_parameters(n);
+					n->type	 = CONSTANT;
+					n->value = t_traits::store_atom(value);
+					return;
+				}
+
+				// A constant left hand side that decides && or || on its own leaves the right hand side dead.
+				const int op = (arity == 2) ? t_traits::find_operator(n->function) : -1;
+				if ((op == int(builtin_operator::logical_and) || op == int(builtin_operator::logical_or)) &&
+					((const expr_native*)n->parameters[0])->type == CONSTANT)
+				{
+					const t_vector left	   = t_traits::t_native::logical_notnot(t_traits::load_atom(((const expr_native*)n->parameters[0])->value));
+					const int	   decided = (op == int(builtin_operator::logical_and)) ? 0 : (1 << t_traits::lanes) - 1;
+					if (t_traits::lane_mask(left) == decided)
+					{
+						free_parameters(n);
+						n->type	 = CONSTANT;
+						n->value = t_traits::store_atom(left);
+					}
+				}
+			}
+		}
+
+		static inline const void* builtin_address(const char* name) noexcept
+		{
+			auto var = find_by_name(name, int(strlen(name)), nullptr);
+			return var ? var->address : nullptr;
+		}
+
+		static inline bool is_constant(const expr_native* n, t_atom value) noexcept
+		{
+			return n->type == CONSTANT && n->value == value;
+		}
+
+		static inline bool is_operator(const expr_native* n, builtin_operator op) noexcept
+		{
+			return is_function(n->type) && t_traits::find_operator(n->function) == int(op);
+		}
+
+		// Structural equality of two trees.
+		static bool same(const expr_native* a, const expr_native* b)
+		{
+			if (a->type != b->type)
+			{
+				return false;
+			}
+
+			const auto t = eval_details::type_mask(a->type);
+			if (t == CONSTANT)
+			{
+				return ::memcmp(&a->value, &b->value, sizeof(t_atom)) == 0;
+			}
+			if (t == VARIABLE)
+			{
+				return a->bound == b->bound;
+			}
+
+			const int arity = eval_details::arity(a->type);
+			if (a->function != b->function || (is_closure(a->type) && a->parameters[arity] != b->parameters[arity]))
+			{
+				return false;
+			}
+			for (int i = 0; i < arity; ++i)
+			{
+				if (!same((const expr_native*)a->parameters[i], (const expr_native*)b->parameters[i]))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		static inline expr_native* detach(expr_native* n, int index) noexcept
+		{
+			auto ret			 = (expr_native*)n->parameters[index];
+			n->parameters[index] = nullptr;
+			return ret;
+		}
+
+		// Replaces n by one of its parameters, the others are freed.
+		static expr_native* take_parameter(expr_native* n, int index)
+		{
+			auto ret = detach(n, index);
+			free_native(n);
+			return ret;
+		}
+
+		static expr_native* new_operator(const char* name, expr_native* a, expr_native* b = nullptr, expr_native* c = nullptr)
+		{
+			expr_native* ret = c ? NEW_EXPR(FUNCTION3 | FLAG_PURE, a, b, c) : b ? NEW_EXPR(FUNCTION2 | FLAG_PURE, a, b) : NEW_EXPR(FUNCTION1 | FLAG_PURE, a);
+			ret->function	 = builtin_address(name);
+			return ret;
+		}
+
+		// Replaces n, whose parameter 'inner' is a binary operator, by name(inner's parameters..., other parameter of n).
+		static expr_native* fuse(expr_native* n, int inner, const char* name, expr_native* last)
+		{
+			auto i	 = detach(n, inner);
+			auto ret = new_operator(name, detach(i, 0), detach(i, 1), last);
+			free_native(i);
+			free_native(n);
+			return ret;
+		}
+
+		static expr_native* copy_variable(const expr_native* n)
+		{
+			expr_native* ret = new_expr(VARIABLE, 0);
+			ret->bound		 = n->bound;
+			return ret;
+		}
+
+		// Rewrites a builtin operator node whose parameters are already optimized into a cheaper equivalent, returns the node replacing n.
+		// Rewrites that don't give the same bits for every input are left to TP_FAST_MATH.
+		static expr_native* simplify(expr_native* n)
+		{
+			if (!is_function(n->type) || !is_pure(n->type) || is_closure(n->type))
+			{
+				return n;
+			}
+
+			const int op = t_traits::find_operator(n->function);
+			if (op < 0)
+			{
+				return n;
+			}
+
+			const auto a = (expr_native*)n->parameters[0];
+			const auto b = (eval_details::arity(n->type) > 1) ? (expr_native*)n->parameters[1] : nullptr;
+
+			switch (builtin_operator(op))
+			{
+			case builtin_operator::add:
+				if (TP_FAST_MATH && is_constant(b, t_atom(0)))
+				{
+					return take_parameter(n, 0);
+				}
+				if (TP_FAST_MATH && is_constant(a, t_atom(0)))
+				{
+					return take_parameter(n, 1);
+				}
+				// a*b+c is a single node with TP_FMA_CONTRACT. c+a*b only when swapping the evaluation order can't be seen.
+				if (TP_FMA_CONTRACT && is_operator(a, builtin_operator::mul))
+				{
+					return fuse(n, 0, "fma", detach(n, 1));
+				}
+				if (TP_FMA_CONTRACT && is_operator(b, builtin_operator::mul) && is_side_effect_free(n))
+				{
+					return fuse(n, 1, "fma", detach(n, 0));
+				}
+				break;
+
+			case builtin_operator::sub:
+				if (is_constant(b, t_atom(0)))
+				{
+					return take_parameter(n, 0);
+				}
+				if (TP_FMA_CONTRACT && is_operator(a, builtin_operator::mul))
+				{
+					if (b->type == CONSTANT)
+					{
+						b->value = -b->value;
+						return fuse(n, 0, "fma", detach(n, 1));
+					}
+					return fuse(n, 0, "fma", new_operator("negate", detach(n, 1)));
+				}
+				break;
+
+			case builtin_operator::select:
+				// select(a < b, a, b) is min(a, b) and select(a > b, a, b) is max(a, b), swapping the branches swaps min and max.
+				if ((is_operator(a, builtin_operator::lower) || is_operator(a, builtin_operator::greater)) && is_side_effect_free(n))
+				{
+					const auto on_true	  = (const expr_native*)n->parameters[1];
+					const auto on_false	  = (const expr_native*)n->parameters[2];
+					const auto left		  = (const expr_native*)a->parameters[0];
+					const auto right	  = (const expr_native*)a->parameters[1];
+					const bool same_order = same(left, on_true) && same(right, on_false);
+					if (same_order || (same(left, on_false) && same(right, on_true)))
+					{
+						const bool lower = is_operator(a, builtin_operator::lower);
+						auto	   ret	 = new_operator((lower == same_order) ? "min" : "max", detach(n, 1), detach(n, 2));
+						free_native(n);
+						return simplify(ret);
+					}
+				}
+				break;
+
+			case builtin_operator::min:
+				if (is_operator(a, builtin_operator::max))
+				{
+					return fuse(n, 0, "clamp", detach(n, 1));
+				}
+				break;
+
+			case builtin_operator::mul:
+				if (is_constant(b, t_atom(1)))
+				{
+					return take_parameter(n, 0);
+				}
+				if (is_constant(a, t_atom(1)))
+				{
+					return take_parameter(n, 1);
+				}
+				if (is_constant(b, t_atom(-1)))
+				{
+					return new_operator("negate", take_parameter(n, 0));
+				}
+				break;
+
+			case builtin_operator::divide:
+				if (is_constant(b, t_atom(1)))
+				{
+					return take_parameter(n, 0);
+				}
+				if (is_constant(b, t_atom(-1)))
+				{
+					return new_operator("negate", take_parameter(n, 0));
+				}
+				if (b->type == CONSTANT && b->value != t_atom(0) && std::isfinite(b->value))
+				{
+					// Dividing by a power of two is exact as a multiplication by its reciprocal.
+					int			 exponent;
+					const t_atom reciprocal = t_atom(1) / b->value;
+					if (TP_FAST_MATH || (std::fabs(std::frexp(b->value, &exponent)) == t_atom(0.5) && reciprocal != t_atom(0) && std::isfinite(reciprocal)))
+					{
+						b->value	= reciprocal;
+						n->function = builtin_address("mul");
+					}
+				}
+				break;
+
+			case builtin_operator::pow:
+				if (b->type != CONSTANT)
+				{
+					break;
+				}
+				if (b->value == t_atom(1))
+				{
+					return take_parameter(n, 0);
+				}
+				if (b->value == t_atom(0) && is_side_effect_free(a))
+				{
+					free_parameters(n);
+					n->type	 = CONSTANT;
+					n->value = t_atom(1);
+					return n;
+				}
+				if (b->value == t_atom(-1))
+				{
+					b->value		 = t_atom(1);
+					n->parameters[0] = b;
+					n->parameters[1] = a;
+					n->function		 = builtin_address("divide");
+					return n;
+				}
+				if (TP_FAST_MATH && b->value == t_atom(0.5))
+				{
+					n->parameters[0] = nullptr;
+					free_native(n);
+					return new_operator("sqrt", a);
+				}
+				// Small integer powers of a variable become multiplications, only squares are exact.
+				if (a->type == VARIABLE && (b->value == t_atom(2) || (TP_FAST_MATH && (b->value == t_atom(3) || b->value == t_atom(4)))))
+				{
+					const int	 count = int(b->value);
+					expr_native* ret   = take_parameter(n, 0);
+					for (int i = 1; i < count; ++i)
+					{
+						ret = new_operator("mul", ret, copy_variable(a));
+					}
+					return ret;
+				}
+				break;
+
+			case builtin_operator::negate:
+				if (is_function(a->type) && t_traits::find_operator(a->function) == int(builtin_operator::negate))
+				{
+					n = take_parameter(n, 0);
+					return take_parameter(n, 0);
+				}
+				break;
+
+			default:
+				break;
+			}
+
+			return n;
+		}
+
+		static expr_native* compile_native(const char* expression, const variable_lookup* lookup, int* error)
+		{
+			state s;
+			s.start = s.next	= expression;
+			if (lookup)
+			{
+				s.lookup = *lookup;
+			}
+			else
+			{
+				s.lookup = { 0, 0 };
+			}
+			resolve_operators(&s);
+
+			next_token(&s);
+			expr_native* root = list(&s);
+
+			if (s.type != (int)TOK_END)
+			{
+				free_native(root);
+				if (error)
+				{
+					*error = static_cast<int>(s.next - s.start);
+					if (*error == 0)
+						*error = 1;
+				}
+				return 0;
+			}
+			else
+			{
+				optimize(root);
+				root = simplify(root);
+				if (error)
+					*error = 0;
+
+				return root;
+			}
+		}
+
+		static t_vector interp_native(const char* expression, int* error)
+		{
+			expr_native* n = compile_native(expression, 0, error);
+			t_vector	 ret;
+			if (n)
+			{
+				ret = eval_native(n);
+				free_native(n);
+			}
+			else
+			{
+				ret = t_traits::nan();
+			}
+			return ret;
+		}
+
+		static void pn(const expr_native* n, int depth)
+		{
+			int i, arity;
+			printf("%*s", depth, "");
+
+			const auto t = type_mask(n->type);
+
+			if (t == CONSTANT)
+			{
+				printf("%f\n", n->value);
+			}
+			else if (t == VARIABLE)
+			{
+				printf("bound %p\n", n->bound);
+			}
+			else if ((t >= FUNCTION0 && t < FUNCTION_MAX) || (t >= CLOSURE0 && t < CLOSURE_MAX))
+			{
+				arity = arity(n->type);
+				printf("f%d", arity);
+				for (i = 0; i < arity; i++)
+				{
+					printf(" %p", n->parameters[i]);
+				}
+				printf("\n");
+				for (i = 0; i < arity; i++)
+				{
+					pn((const expr_native*)n->parameters[i], depth + 1);
+				}
+			}
+		}
+
+		static void print(const expr_native* n)
+		{
+			pn(n, 0);
+		}
+	};
+
+	template<typename T_TRAITS>
+	struct portable
+	{
+		using t_traits	  = T_TRAITS;
+		using t_atom	  = typename T_TRAITS::t_atom;
+		using t_vector	  = typename T_TRAITS::t_vector;
+		using expr_native = typename native<t_traits>::expr_native;
+
+		using name_map = std::unordered_map<const void*, std::string>;
+
+		using index_map = std::unordered_map<const void*, int>;
+
+		struct expr_portable_expression_build_indexer
+		{
+			name_map  name_map;
+			index_map index_map;
+			int		  index_counter = 0;
+
+			// Expressions that can't run in post-order (see can_post_order) keep the pre-order layout.
+			expression_layout layout = expression_layout::pre_order;
+
+			std::vector<variable> m_env_variables;
+
+			std::vector<std::string>				m_declared_variable_names;
+			std::vector<std::unique_ptr<t_vector>>	 m_declared_variable_values;
+			std::vector<bool>						 m_declared_variable_local;
+
+			void reset()
+			{
+				name_map.clear();
+				index_map.clear();
+				index_counter = 0;
+				m_env_variables.clear();
+				m_declared_variable_names.clear();
+				m_declared_variable_values.clear();
+				m_declared_variable_local.clear();
+				m_variable_array.reset();
+			}
+
+			struct variable_lookup_temp
+			{
+				std::vector<variable> data;
+				symbol_table		  symbols;
+
+				variable_lookup get_lookup() const
+				{
+					return variable_lookup { (data.size() > 0) ? &data[0] : nullptr, int(data.size()), &symbols };
+				}
+			};
+
+			mutable std::shared_ptr<const variable_lookup_temp> m_variable_array;
+			
+			// Built once and shared by every expression until a variable is added, holders keep their copy alive.
+			std::shared_ptr<const variable_lookup_temp> get_variable_array() const
+			{
+				if (m_variable_array)
+				{
+					return m_variable_array;
+				}
+
+				std::shared_ptr<variable_lookup_temp> combined(new variable_lookup_temp());
+				combined->data.reserve(m_declared_variable_names.size() + m_env_variables.size());
+				
+				for (size_t v = 0; v < m_declared_variable_names.size(); ++v)
+				{
+					combined->data.push_back(variable{m_declared_variable_names[v].c_str(), m_declared_variable_values[v].get()});
+				}
+
+				for (auto var : m_env_variables)
+				{
+					combined->data.push_back(var);
+				}
+
+				combined->symbols.build(combined->data.data(), int(combined->data.size()));
+				m_variable_array = combined;
+				return m_variable_array;
+			}
+
+			// A 'local' scope puts the variable in a frame slot of each invocation, any other scope makes it global.
+			void add_declared_variable(std::string_view name_view, std::string_view scope)
+			{
+				std::string name(name_view);
+				auto itor = std::find(m_declared_variable_names.begin(), m_declared_variable_names.end(), name);
+				if (itor == m_declared_variable_names.end())
+				{
+					m_declared_variable_names.push_back(name);
+					m_declared_variable_values.emplace_back(new t_vector(t_traits::explicit_load_atom(0)));
+					m_declared_variable_local.push_back(scope == "local");
+					m_variable_array.reset();
+				}
+			}
+
+			// Declares and references a local holding a temporary of the optimizer, returns its value and binding index. The parser can't
+			// produce a '$' in a name, and names the application bound are skipped, so a temporary never aliases another variable.
+			std::tuple<const t_vector*, int> add_temporary_variable()
+			{
+				std::string name;
+				for (size_t i = m_declared_variable_names.size();; ++i)
+				{
+					name = "$t" + std::to_string(i);
+					if (std::find(m_declared_variable_names.begin(), m_declared_variable_names.end(), name) == m_declared_variable_names.end() &&
+						std::none_of(m_env_variables.begin(), m_env_variables.end(), [&](const variable& var) { return name == var.name; }))
+					{
+						break;
+					}
+				}
+
+				t_vector* value = new t_vector(t_traits::explicit_load_atom(0));
+				m_declared_variable_values.emplace_back(value);
+				m_declared_variable_names.push_back(name);
+				m_declared_variable_local.push_back(true);
+				m_variable_array.reset();
+
+				const variable temporary{name.c_str(), value};
+				return {value, add_referenced_variable(&temporary)};
+			}
+
+			void add_user_variable(const variable* var)
+			{
+				m_env_variables.push_back(*var);
+				m_variable_array.reset();
+			}
+
+			int add_referenced_variable(const variable* var)
+			{
+				auto itor = index_map.find(var->address);
+				if (itor == index_map.end())
+				{
+					int idx = index_counter++;
+					name_map.insert(std::make_pair(var->address, std::string(var->name)));
+					index_map.insert(std::make_pair(var->address, idx));
+					return idx;
+				}
+				return itor->second;
+			}
+
+			std::vector<std::string> get_binding_table()
+			{
+				std::vector<std::string> t;
+				t.resize(index_counter);
+				for (auto index_map_itor : index_map)
+				{
+					auto name_map_itor		 = name_map.find(index_map_itor.first);
+					t[index_map_itor.second] = name_map_itor->second;
+				}
+
+				return t;
+			}
+
+			std::vector<const void*> get_address_table()
+			{
+				std::vector<const void*> t;
+				t.resize(index_counter);
+				for (auto index_map_itor : index_map)
+				{
+					t[index_map_itor.second] = index_map_itor.first;
+				}
+
+				return t;
+			}
+
+			// For every binding index, whether it is a local declared variable.
+			std::vector<bool> get_local_binding_table()
+			{
+				std::vector<bool> t(index_counter, false);
+				for (size_t v = 0; v < m_declared_variable_values.size(); ++v)
+				{
+					auto itor = index_map.find(m_declared_variable_values[v].get());
+					if (itor != index_map.end())
+					{
+						t[itor->second] = m_declared_variable_local[v];
+					}
+				}
+
+				return t;
+			}
+
+			// Binding indexes of the declared variables referenced so far.
+			std::vector<int> get_declared_variable_table()
+			{
+				std::vector<int> t;
+				for (const auto& value : m_declared_variable_values)
+				{
+					auto itor = index_map.find(value.get());
+					if (itor != index_map.end())
+					{
+						t.push_back(itor->second);
+					}
+				}
+
+				return t;
+			}
+		};
+
+		struct expr_portable_expression_build_bindings
+		{
+			std::vector<const void*> index_to_address; // this contains the native function/value address as originally compiled
+			std::vector<std::string> index_to_name;
+			std::vector<const char*> index_to_name_c_str;
+		};
+
+		struct compiled_expr : ::tp::compiled_expr
+		{
+			expr_portable_expression_build_bindings m_bindings;
+			std::unique_ptr<unsigned char>			m_build_buffer;
+			size_t									m_build_buffer_size;
+			size_t									m_root_offset = 0;
+			expression_layout						m_layout	  = expression_layout::pre_order;
+			std::vector<unsigned char>				m_bytecode;
+
+			virtual size_t get_binding_array_size() const
+			{
+				return m_bindings.index_to_address.size();
+			}
+
+			virtual const void* const* get_binding_addresses() const
+			{
+				return (m_bindings.index_to_address.size() > 0) ? &(*m_bindings.index_to_address.cbegin()) : nullptr;
+			}
+
+			virtual const char* const* get_binding_names() const
+			{
+				return &(*m_bindings.index_to_name_c_str.cbegin());
+			}
+
+			virtual size_t get_data_size() const
+			{
+				return m_build_buffer_size;
+			}
+
+			virtual const unsigned char* get_data() const
+			{
+				return m_build_buffer.get();
+			}
+
+			virtual size_t get_bytecode_size() const
+			{
+				return m_bytecode.size();
+			}
+
+			virtual const unsigned char* get_bytecode() const
+			{
+				return (m_bytecode.size() > 0) ? &m_bytecode[0] : nullptr;
+			}
+
+			virtual size_t get_root_offset() const
+			{
+				return m_root_offset;
+			}
+
+			virtual expression_layout get_layout() const
+			{
+				return m_layout;
+			}
+		};
+
+		// Size of n as a portable node: the header, one word per parameter and the closure context binding.
+		static size_t export_node_size(const expr_native* n)
+		{
+			const int type = eval_details::type_mask(n->type);
+			const int a	   = (type >= FUNCTION0 && type < CLOSURE_MAX) ? eval_details::arity(n->type) : 0;
+			return (sizeof(expr_portable<t_traits>) - sizeof(uint32_t)) + sizeof(uint32_t) * (a + ((type >= CLOSURE0) ? 1 : 0));
+		}
+
+		// Variables and constants are stored inline in their parent's operands, only the root of an expression is always a node.
+		static size_t export_estimate(const expr_native* n, size_t& export_size, const variable_lookup* lookup, name_map& name_map, index_map& index_map, int& index_counter, bool operand = false)
+		{
+			if (!n)
+				return export_size;
+
+			const int type = eval_details::type_mask(n->type);
+			if (!operand || (type != CONSTANT && type != VARIABLE))
+			{
+				export_size += export_node_size(n);
+			}
+
+			auto eval_arg = [&](int e) {
+				export_estimate((const expr_native*)n->parameters[e], export_size, lookup, name_map, index_map, index_counter, true);
+			};
+
+			auto handle_addr = [&](const variable* var) -> bool {
+				if (var)
+				{
+					auto itor = name_map.find(var->address);
+					if (itor == name_map.end())
+					{
+						name_map.emplace(std::make_pair(var->address, std::string(var->name)));
+						index_map.insert(std::make_pair(var->address, index_counter++));
+					}
+
+					if (var->type >= CLOSURE0 && var->type < CLOSURE_MAX)
+					{
+						auto context_itor = name_map.find(var->context);
+						if (context_itor == name_map.end())
+						{
+							name_map.emplace(std::make_pair(var->context, std::string(var->name) + "_closure"));
+							index_map.insert(std::make_pair(var->context, index_counter++));
+						}
+					}
+
+					return true;
+				}
+				return false;
+			};
+
+			return eval_details::eval_generic(
+				n->type,
+				[&]() {
+					export_size += sizeof(t_atom);
+					return export_size;
+				},
+				[&]() {
+					auto res = handle_addr(native<t_traits>::find_by_addr(n->bound, lookup));
+					assert(res);
+					((void)res);
+					return export_size;
+				},
+				[&](int a) {
+					// Builtin operators are executed inline and don't need a binding
+					if (t_traits::find_operator(n->function) < 0)
+					{
+						auto res = handle_addr(native<t_traits>::find_by_addr(n->function, lookup));
+						assert(res);
+						((void)res);
+					}
+
+					for (int i = 0; i < a; ++i)
+					{
+						eval_arg(i);
+					}
+					return export_size;
+				},
+				[&](int a) {
+					auto res = handle_addr(native<t_traits>::find_by_addr(n->function, lookup));
+					assert(res);
+					((void)res);
+
+					for (int i = 0; i < a; ++i)
+					{
+						eval_arg(i);
+					}
+					return export_size;
+				},
+				[&]() { return export_size; });
+		}
+
+		// Writes the constant's value at export_size and returns its offset.
+		static uint32_t export_constant(const expr_native* n, size_t& export_size, unsigned char* out_buffer)
+		{
+			const uint32_t offset = uint32_t(export_size);
+			::memcpy(out_buffer + export_size, &n->value, sizeof(t_atom));
+			export_size += sizeof(t_atom);
+			return offset;
+		}
+
+		// register_func(address) returns the binding index of a variable, function or closure context.
+		template<typename T_REGISTER_FUNC>
+		static uint32_t export_operand(const expr_native* n, size_t& export_size, const variable_lookup* lookup, unsigned char* out_buffer, T_REGISTER_FUNC register_func)
+		{
+			switch (eval_details::type_mask(n->type))
+			{
+			case CONSTANT:
+				return (export_constant(n, export_size, out_buffer) << OPERAND_TAG_BITS) | OPERAND_CONSTANT;
+			case VARIABLE:
+				return (uint32_t(register_func(n->bound)) << OPERAND_TAG_BITS) | OPERAND_VARIABLE;
+			default:
+				const uint32_t offset = uint32_t(export_size);
+				export_write(n, export_size, lookup, out_buffer, register_func);
+				return (offset << OPERAND_TAG_BITS) | OPERAND_NODE;
+			}
+		}
+
+		// Writes the type, the binding or builtin operator and a closure's context binding of n.
+		template<typename T_REGISTER_FUNC>
+		static void export_node(const expr_native* n, expr_portable<t_traits>* n_out, const variable_lookup* lookup, T_REGISTER_FUNC register_func)
+		{
+			n_out->type = uint32_t(n->type);
+
+			eval_details::eval_generic(
+				n->type, [&]() { return 0; },
+				[&]() {
+					n_out->bound = uint32_t(register_func(n->bound));
+					return 0;
+				},
+				[&](int) {
+					const int op = t_traits::find_operator(n->function);
+					if (op >= 0)
+					{
+						n_out->type		= uint32_t(n->type | FLAG_OPERATOR);
+						n_out->function = uint32_t(op);
+					}
+					else
+					{
+						n_out->function = uint32_t(register_func(n->function));
+					}
+					return 0;
+				},
+				[&](int a) {
+					const variable* v = native<t_traits>::find_by_addr(n->function, lookup);
+					assert(v != nullptr);
+					n_out->function		 = uint32_t(register_func(n->function));
+					n_out->parameters[a] = uint32_t(register_func(v->context));
+					return 0;
+				},
+				[&]() { return 0; });
+		}
+
+		// Pre-order, the root at offset 0.
+		template<typename T_REGISTER_FUNC>
+		static size_t export_write(const expr_native* n, size_t& export_size, const variable_lookup* lookup, unsigned char* out_buffer, T_REGISTER_FUNC register_func)
+		{
+			if (!n)
+				return export_size;
+
+			auto n_out = (expr_portable<t_traits>*)(out_buffer + export_size);
+
+			export_size += export_node_size(n);
+			export_node(n, n_out, lookup, register_func);
+
+			if (eval_details::type_mask(n->type) == CONSTANT)
+			{
+				n_out->constant = int32_t(export_constant(n, export_size, out_buffer));
+			}
+
+			for (int i = 0; i < eval_details::arity(n->type); ++i)
+			{
+				n_out->parameters[i] = export_operand((const expr_native*)n->parameters[i], export_size, lookup, out_buffer, register_func);
+			}
+			return export_size;
+		}
+
+		// A post-order scan evaluates every node, which only matches the lazy operators when what they may skip has no side effects.
+		static bool can_post_order(const expr_native* n)
+		{
+			using t_native = native<t_traits>;
+
+			const bool lazy = t_native::is_operator(n, builtin_operator::logical_and) || t_native::is_operator(n, builtin_operator::logical_or) ||
+				t_native::is_operator(n, builtin_operator::select);
+			for (int i = 0; i < eval_details::arity(n->type); ++i)
+			{
+				const auto p = (const expr_native*)n->parameters[i];
+				if ((lazy && i > 0 && !t_native::is_side_effect_free(p)) || !can_post_order(p))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		static bool is_leaf(const expr_native* n) noexcept
+		{
+			const int type = eval_details::type_mask(n->type);
+			return type == CONSTANT || type == VARIABLE;
+		}
+
+		// Stack slots eval_post_order needs for n, 0 for a leaf operand.
+		static int post_order_depth(const expr_native* n, bool root = true)
+		{
+			if (!root && is_leaf(n))
+				return 0;
+
+			int depth = 1, operands = 0;
+			for (int i = 0; i < eval_details::arity(n->type); ++i)
+			{
+				const int operand_depth = post_order_depth((const expr_native*)n->parameters[i], false);
+				if (operand_depth > 0)
+				{
+					depth = std::max(depth, operands++ + operand_depth);
+				}
+			}
+			return depth;
+		}
+
+		// Bytes taken by the nodes of n, without the constants.
+		static size_t post_order_nodes_size(const expr_native* n, bool root = true)
+		{
+			if (!root && is_leaf(n))
+				return 0;
+
+			size_t size = export_node_size(n);
+			for (int i = 0; i < eval_details::arity(n->type); ++i)
+			{
+				size += post_order_nodes_size((const expr_native*)n->parameters[i], false);
+			}
+			return size;
+		}
+
+		// Post-order: the nodes are written at node_offset, the root last at root_offset, the constants at constant_offset after it.
+		// Returns the operand of n, offsets are relative to the root.
+		template<typename T_REGISTER_FUNC>
+		static uint32_t export_post_order(const expr_native* n, size_t& node_offset, size_t& constant_offset, size_t root_offset, const variable_lookup* lookup,
+			unsigned char* out_buffer, T_REGISTER_FUNC register_func, bool root = true)
+		{
+			auto relative = [&](size_t offset) { return uint32_t(int32_t(offset) - int32_t(root_offset)); };
+
+			const int type = eval_details::type_mask(n->type);
+			if (!root && type == VARIABLE)
+			{
+				return (uint32_t(register_func(n->bound)) << OPERAND_TAG_BITS) | OPERAND_VARIABLE;
+			}
+			if (!root && type == CONSTANT)
+			{
+				return (relative(export_constant(n, constant_offset, out_buffer)) << OPERAND_TAG_BITS) | OPERAND_CONSTANT;
+			}
+
+			uint32_t operands[8];
+			for (int i = 0; i < eval_details::arity(n->type); ++i)
+			{
+				operands[i] = export_post_order((const expr_native*)n->parameters[i], node_offset, constant_offset, root_offset, lookup, out_buffer, register_func, false);
+			}
+
+			const size_t offset = node_offset;
+			auto		 n_out	= (expr_portable<t_traits>*)(out_buffer + offset);
+			node_offset += export_node_size(n);
+			export_node(n, n_out, lookup, register_func);
+
+			if (type == CONSTANT)
+			{
+				n_out->constant = int32_t(relative(export_constant(n, constant_offset, out_buffer)));
+			}
+
+			for (int i = 0; i < eval_details::arity(n->type); ++i)
+			{
+				n_out->parameters[i] = operands[i];
+			}
+			return (relative(offset) << OPERAND_TAG_BITS) | OPERAND_NODE;
+		}
+
+		struct bytecode_builder
+		{
+			std::vector<instruction> code;
+			std::vector<t_atom>		 constants;
+			int						 num_registers = 0;
+			int						 num_locals	   = 0;
+
+			int add_constant(t_atom value)
+			{
+				for (size_t i = 0; i < constants.size(); ++i)
+				{
+					if (::memcmp(&constants[i], &value, sizeof(t_atom)) == 0)
+					{
+						return int(i);
+					}
+				}
+				constants.push_back(value);
+				return int(constants.size() - 1);
+			}
+
+			int emit(opcode op, int reg, int arg_a, int arg_b)
+			{
+				code.push_back(instruction{op, uint16_t(reg), uint16_t(arg_a), uint16_t(arg_b)});
+				return int(code.size() - 1);
+			}
+
+			void use_registers(int count)
+			{
+				num_registers = std::max(num_registers, count);
+			}
+
+			bool valid() const
+			{
+				return (num_registers <= TP_MAX_REGISTERS) && (num_locals <= TP_MAX_LOCALS) && (code.size() <= 0xffff) && (constants.size() <= 0xffff);
+			}
+
+			// Appends the code of a standalone bytecode buffer, minus its trailing ret. Returns the register holding the result.
+			int append(const unsigned char* bytecode)
+			{
+				const auto header	 = (const bytecode_header*)bytecode;
+				const auto src_code	 = (const instruction*)(bytecode + sizeof(bytecode_header));
+				const auto src_const = (const t_atom*)(src_code + header->num_instructions);
+
+				const int code_base = int(code.size());
+				int		  result	= 0;
+
+				for (int i = 0; i < header->num_instructions; ++i)
+				{
+					instruction ins = src_code[i];
+					if (ins.op == opcode::ret && i == header->num_instructions - 1)
+					{
+						result = ins.reg;
+						break;
+					}
+					if (ins.op == opcode::load_constant)
+					{
+						ins.arg_a = uint16_t(add_constant(src_const[ins.arg_a]));
+					}
+					else if (ins.op >= opcode::add_k && ins.op <= opcode::divide_k)
+					{
+						ins.arg_b = uint16_t(add_constant(src_const[ins.arg_b]));
+					}
+					else if (ins.op == opcode::jump || ins.op == opcode::jump_if)
+					{
+						ins.arg_a = uint16_t(ins.arg_a + code_base);
+					}
+					code.push_back(ins);
+				}
+
+				use_registers(header->num_registers);
+				return result;
+			}
+
+			std::vector<unsigned char> finish() const
+			{
+				bytecode_header header;
+				header.num_registers	= uint16_t(num_registers);
+				header.num_instructions = uint16_t(code.size());
+				header.num_constants	= uint16_t(constants.size());
+				header.num_locals		= uint16_t(num_locals);
+
+				std::vector<unsigned char> out;
+				out.resize(sizeof(bytecode_header) + sizeof(instruction) * code.size() + sizeof(t_atom) * constants.size());
+				::memcpy(&out[0], &header, sizeof(bytecode_header));
+				if (code.size() > 0)
+				{
+					::memcpy(&out[sizeof(bytecode_header)], &code[0], sizeof(instruction) * code.size());
+				}
+				if (constants.size() > 0)
+				{
+					::memcpy(&out[sizeof(bytecode_header) + sizeof(instruction) * code.size()], &constants[0], sizeof(t_atom) * constants.size());
+				}
+				return out;
+			}
+		};
+
+		// True when n calls a function or closure other than a builtin operator.
+		static bool has_call(const expr_native* n)
+		{
+			const auto t = n ? eval_details::type_mask(n->type) : int(VARIABLE);
+			if (t < FUNCTION0)
+			{
+				return false;
+			}
+
+			if (t >= CLOSURE0 || t_traits::find_operator(n->function) < 0)
+			{
+				return true;
+			}
+
+			for (int i = 0; i < eval_details::arity(n->type); ++i)
+			{
+				if (has_call((const expr_native*)n->parameters[i]))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		template<typename T_RESOLVE>
+		static void export_bytecode_operator(const expr_native* n, int op, int reg, bytecode_builder& builder, const variable_lookup* lookup, T_RESOLVE resolve)
+		{
+			const auto left = (const expr_native*)n->parameters[0];
+
+			// select jumps over the branch it doesn't take when a scalar branch calls functions, otherwise both branches are evaluated and
+			// blended without branching.
+			if (op == int(builtin_operator::select))
+			{
+				const auto on_true	= (const expr_native*)n->parameters[1];
+				const auto on_false = (const expr_native*)n->parameters[2];
+
+				builder.use_registers(reg + 3);
+				export_bytecode(left, reg, builder, lookup, resolve);
+				if (t_traits::lanes == 1 && (has_call(on_true) || has_call(on_false)))
+				{
+					const int taken = builder.emit(opcode::jump_if, reg, 0, 0);
+					export_bytecode(on_false, reg, builder, lookup, resolve);
+					const int done			 = builder.emit(opcode::jump, 0, 0, 0);
+					builder.code[taken].arg_a = uint16_t(builder.code.size());
+					export_bytecode(on_true, reg, builder, lookup, resolve);
+					builder.code[done].arg_a = uint16_t(builder.code.size());
+					return;
+				}
+
+				export_bytecode(on_true, reg + 1, builder, lookup, resolve);
+				export_bytecode(on_false, reg + 2, builder, lookup, resolve);
+				builder.emit(opcode::select, reg, 0, 0);
+				return;
+			}
+
+			const auto code = operator_opcode(builtin_operator(op));
+
+			if (code == opcode::fma || code == opcode::clamp)
+			{
+				builder.use_registers(reg + 3);
+				for (int i = 0; i < 3; ++i)
+				{
+					export_bytecode((const expr_native*)n->parameters[i], reg + i, builder, lookup, resolve);
+				}
+				builder.emit(code, reg, 0, 0);
+				return;
+			}
+
+			if (eval_details::arity(n->type) == 1)
+			{
+				export_bytecode(left, reg, builder, lookup, resolve);
+				builder.emit(code, reg, reg, 0);
+				return;
+			}
+
+			// Unary nodes only have room for one parameter.
+			const auto right = (const expr_native*)n->parameters[1];
+
+			// && and || jump over a right hand side that calls functions once the left one decides, cheaper ones stay branch free.
+			if ((code == opcode::logical_and || code == opcode::logical_or) && has_call(right))
+			{
+				builder.use_registers(reg + 2);
+				export_bytecode(left, reg, builder, lookup, resolve);
+				builder.emit(opcode::logical_notnot, reg, reg, 0);
+
+				int skip;
+				if (code == opcode::logical_and)
+				{
+					builder.emit(opcode::logical_not, reg + 1, reg, 0);
+					skip = builder.emit(opcode::jump_if, reg + 1, 0, 0);
+				}
+				else
+				{
+					skip = builder.emit(opcode::jump_if, reg, 0, 0);
+				}
+
+				export_bytecode(right, reg + 1, builder, lookup, resolve);
+				builder.emit(code, reg, reg, reg + 1);
+				builder.code[skip].arg_a = uint16_t(builder.code.size());
+				return;
+			}
+
+			// The common arithmetic operators take a constant right hand side directly from the constant pool
+			if (right->type == CONSTANT && (code == opcode::add || code == opcode::sub || code == opcode::mul || code == opcode::divide))
+			{
+				export_bytecode(left, reg, builder, lookup, resolve);
+				builder.emit(opcode(int(opcode::add_k) + (int(code) - int(opcode::add))), reg, reg, builder.add_constant(right->value));
+				return;
+			}
+
+			builder.use_registers(reg + 2);
+			export_bytecode(left, reg, builder, lookup, resolve);
+			export_bytecode(right, reg + 1, builder, lookup, resolve);
+			builder.emit(code, reg, reg, reg + 1);
+		}
+
+		// Emits n so that its result ends up in register reg. Function arguments are evaluated into consecutive registers starting at reg,
+		// so the register file behaves like a stack and the register count is bounded by the depth of the tree.
+		template<typename T_RESOLVE>
+		static void export_bytecode(const expr_native* n, int reg, bytecode_builder& builder, const variable_lookup* lookup, T_RESOLVE resolve)
+		{
+			if (!n)
+				return;
+
+			builder.use_registers(reg + 1);
+
+			auto eval_arg = [&](int e) {
+				export_bytecode((const expr_native*)n->parameters[e], reg + e, builder, lookup, resolve);
+			};
+
+			eval_details::eval_generic(
+				n->type,
+				[&]() {
+					builder.emit(opcode::load_constant, reg, builder.add_constant(n->value), 0);
+					return 0;
+				},
+				[&]() {
+					builder.emit(opcode::load_variable, reg, resolve(n->bound), 0);
+					return 0;
+				},
+				[&](int a) {
+					const int op = t_traits::find_operator(n->function);
+					if (op >= 0)
+					{
+						export_bytecode_operator(n, op, reg, builder, lookup, resolve);
+						return 0;
+					}
+
+					builder.use_registers(reg + a);
+					for (int i = 0; i < a; ++i)
+					{
+						eval_arg(i);
+					}
+					builder.emit(opcode(int(opcode::call0) + a), reg, resolve(n->function), 0);
+					return 0;
+				},
+				[&](int a) {
+					builder.use_registers(reg + a);
+					for (int i = 0; i < a; ++i)
+					{
+						eval_arg(i);
+					}
+					const variable* v = native<t_traits>::find_by_addr(n->function, lookup);
+					assert(v != nullptr);
+					builder.emit(opcode(int(opcode::closure0) + a), reg, resolve(n->function), resolve(v->context));
+					return 0;
+				},
+				[&]() { return 0; });
+		}
+
+		static t_vector eval_compare(const expr_native* n, const expr_portable<t_traits>* n_portable, const unsigned char* expr_buffer, const void* const expr_context[])
+		{
+			if (!n)
+				return t_traits::nan();
+
+			assert(eval_details::type_mask(n->type) == eval_details::type_mask(int(n_portable->type)));
+
+			auto eval_arg = [&](int e) {
+				const auto	   child   = (const expr_native*)n->parameters[e];
+				const uint32_t operand = n_portable->parameters[e];
+				switch (operand & OPERAND_TAG_MASK)
+				{
+				case OPERAND_CONSTANT:
+					assert(eval_details::type_mask(child->type) == CONSTANT);
+					return eval_details::load_portable_constant<t_traits>(expr_buffer, eval_details::operand_value(operand));
+				case OPERAND_VARIABLE:
+					assert(child->bound == expr_context[eval_details::operand_value(operand)]);
+					return *((const t_vector*)(expr_context[eval_details::operand_value(operand)]));
+				default:
+					return eval_compare(child, (const expr_portable<t_traits>*)(expr_buffer + eval_details::operand_value(operand)), expr_buffer, expr_context);
+				}
+			};
+
+			if (n_portable->type & FLAG_OPERATOR)
+			{
+				assert(t_traits::find_operator(n->function) == int(n_portable->function));
+				return eval_details::eval_operator<typename t_traits::t_native, t_vector>(int(n_portable->function), eval_arg);
+			}
+
+			return eval_details::eval_generic(
+				n->type, [&]() { return eval_details::load_portable_constant<t_traits>(expr_buffer, n_portable->constant); },
+				[&]() {
+					assert(n->bound == expr_context[n_portable->bound]);
+					return *((const t_vector*)(expr_context[n_portable->bound]));
+				},
+				[&](int a) {
+					assert(n->function == expr_context[n_portable->function]);
+					return eval_details::eval_function<t_vector>(a, expr_context[n_portable->function], t_traits::nan(), eval_arg);
+				},
+				[&](int a) {
+					assert(n->function == expr_context[n_portable->function]);
+					assert(n->parameters[a] == expr_context[n_portable->parameters[a]]);
+
+					return eval_details::eval_closure<t_vector>(a, expr_context[n_portable->function], (void*)expr_context[n_portable->parameters[a]], t_traits::nan(), eval_arg);
+				},
+				[&]() { return t_traits::nan(); });
+		}
+
+		struct portable_compiled_program : compiled_program
+		{
+			std::vector<statement>		   program_statements;
+			std::vector<std::string>	   binding_table;
+			std::vector<const char*>	   binding_table_cstr;
+			std::vector<const void*>	   address_table;
+			std::unique_ptr<unsigned char> program_expression_buffer;
+			size_t						   program_expression_buffer_size = 0;
+			std::vector<unsigned char>	   program_bytecode;
+			std::vector<int>			   declared_variables;
+			expression_layout			   layout = expression_layout::pre_order;
+
+			// Storage of the declared variables when the program was compiled with its own indexer, address_table points into it.
+			std::vector<std::unique_ptr<t_vector>> declared_variable_values;
+
+			virtual size_t get_binding_array_size() const
+			{
+				return address_table.size();
+			}
+
+			virtual const void* const* get_binding_addresses() const
+			{
+				return &address_table[0];
+			}
+
+			virtual const char* const* get_binding_names() const
+			{
+				return &binding_table_cstr[0];
+			}
+
+			virtual size_t get_data_size() const
+			{
+				return program_expression_buffer_size;
+			}
+
+			virtual const unsigned char* get_data() const
+			{
+				return program_expression_buffer.get();
+			}
+
+			virtual size_t get_statement_array_size() const
+			{
+				return (int)program_statements.size();
+			}
+
+			virtual const statement* get_statements() const
+			{
+				return &program_statements[0];
+			}
+
+			virtual size_t get_bytecode_size() const
+			{
+				return program_bytecode.size();
+			}
+
+			virtual const unsigned char* get_bytecode() const
+			{
+				return (program_bytecode.size() > 0) ? &program_bytecode[0] : nullptr;
+			}
+
+			virtual size_t get_num_declared_variables() const
+			{
+				return declared_variables.size();
+			}
+
+			virtual const int* get_declared_variables() const
+			{
+				return (declared_variables.size() > 0) ? &declared_variables[0] : nullptr;
+			}
+
+			virtual expression_layout get_layout() const
+			{
+				return layout;
+			}
+		};
+	};
+
+	namespace expr_details
+	{
+		template<typename T_TRAITS>
+		typename native<T_TRAITS>::expr_native* compile_native_using_indexer(
+			typename portable<T_TRAITS>::expr_portable_expression_build_indexer& indexer, const char* expression, int* error)
+		{
+			auto var_array = indexer.get_variable_array();
+			auto variables = var_array->get_lookup();
+			return native<T_TRAITS>::compile_native(expression, &variables, error);
+		}
+
+		// Exports a tree parsed by compile_native_using_indexer, the tree stays with the caller.
+		template<typename T_TRAITS>
+		compiled_expr* export_using_indexer(typename portable<T_TRAITS>::expr_portable_expression_build_indexer& indexer, const typename native<T_TRAITS>::expr_native* native_expr)
+		{
+			auto var_array = indexer.get_variable_array();
+			auto variables = var_array->get_lookup();
+
+			auto expr = new typename portable<T_TRAITS>::compiled_expr;
+
+			size_t export_size = 0;
+			portable<T_TRAITS>::export_estimate(native_expr, export_size, &variables, indexer.name_map, indexer.index_map, indexer.index_counter);
+
+			expr->m_bindings.index_to_address.resize(indexer.index_counter);
+			for (const auto& itor : indexer.index_map)
+			{
+				expr->m_bindings.index_to_address[itor.second] = itor.first;
+			}
+
+			expr->m_bindings.index_to_name.resize(indexer.index_counter);
+			expr->m_bindings.index_to_name_c_str.resize(indexer.index_counter);
+			for (int i = 0; i < indexer.index_counter; ++i)
+			{
+				auto itor = indexer.name_map.find(expr->m_bindings.index_to_address[i]);
+				assert(itor != indexer.name_map.end());
+				expr->m_bindings.index_to_name[i]		= itor->second;
+				expr->m_bindings.index_to_name_c_str[i] = expr->m_bindings.index_to_name[i].c_str();
+			}
+
+			expr->m_build_buffer.reset(new uint8_t[export_size]);
+			::memset(expr->m_build_buffer.get(), 0x0, export_size);
+			expr->m_build_buffer_size = export_size;
+
+			auto register_func = [&](const void* addr) -> int {
+				auto itor = indexer.index_map.find(addr);
+				assert(itor != indexer.index_map.end());
+				return itor->second;
+			};
+
+			if (indexer.layout == expression_layout::post_order && portable<T_TRAITS>::can_post_order(native_expr) &&
+				portable<T_TRAITS>::post_order_depth(native_expr) <= TP_MAX_REGISTERS)
+			{
+				size_t node_offset	   = 0;
+				size_t constant_offset = portable<T_TRAITS>::post_order_nodes_size(native_expr);
+				expr->m_root_offset	   = constant_offset - portable<T_TRAITS>::export_node_size(native_expr);
+				expr->m_layout		   = expression_layout::post_order;
+				portable<T_TRAITS>::export_post_order(
+					native_expr, node_offset, constant_offset, expr->m_root_offset, &variables, expr->m_build_buffer.get(), register_func);
+				assert(constant_offset == export_size);
+			}
+			else
+			{
+				size_t actual_export_size = 0;
+				portable<T_TRAITS>::export_write(native_expr, actual_export_size, &variables, expr->m_build_buffer.get(), register_func);
+				assert(actual_export_size == export_size);
+			}
+
+			typename portable<T_TRAITS>::bytecode_builder builder;
+			portable<T_TRAITS>::export_bytecode(native_expr, 0, builder, &variables, [&](const void* addr) -> int {
+				auto itor = indexer.index_map.find(addr);
+				assert(itor != indexer.index_map.end());
+				return itor->second;
+			});
+			builder.emit(opcode::ret, 0, 0, 0);
+
+			// Expressions too deep for the register file only get the tree representation.
+			if (builder.valid())
+			{
+				expr->m_bytecode = builder.finish();
+			}
+
+			return expr;
+		}
+
+		template<typename T_TRAITS>
+		compiled_expr* compile_using_indexer(typename portable<T_TRAITS>::expr_portable_expression_build_indexer& indexer, const char* expression, int* error)
+		{
+			compile_arena		 own_arena;
+			compile_arena::scope use_arena(compile_arena::current() ? *compile_arena::current() : own_arena);
+
+			auto native_expr = compile_native_using_indexer<T_TRAITS>(indexer, expression, error);
+			if (native_expr)
+			{
+				auto expr = export_using_indexer<T_TRAITS>(indexer, native_expr);
+				native<T_TRAITS>::free_native(native_expr);
+				return expr;
+			}
+			return nullptr;
+		}
+
+		template<typename T_TRAITS>
+		compiled_expr* compile(const char* expression, const variable* variables, int var_count, int* error, expression_layout layout)
+		{
+			typename portable<T_TRAITS>::expr_portable_expression_build_indexer indexer;
+			indexer.layout = layout;
+			for (int v = 0; v < var_count; ++v)
+			{
+				indexer.add_user_variable(variables + v);
+			}
+			return compile_using_indexer<T_TRAITS>(indexer, expression, error);
+		}
+
+	} // namespace expr_details
+
+	namespace program_details
+	{
+		struct parser
+		{
+			static inline std::string_view trim_leading_space(std::string_view v) noexcept
+			{
+				if (v.length() > 0)
+				{
+					for (size_t i = 0; i < v.length(); ++i)
+					{
+						if (!::isspace((unsigned char)v[i]))
+						{
+							return std::string_view(&v[i], v.length() - i);
+						}
+					}
+
+					return std::string_view(&v[v.length()], 0);
+				}
+				return v;
+			}
+
+			static inline std::string_view trim_trailing_space(std::string_view v) noexcept
+			{
+				if (v.length() > 0)
+				{
+					for (size_t i = v.length(); i > 0; --i)
+					{
+						if (!::isspace((unsigned char)v[i - 1]))
+						{
+							return std::string_view(&v[0], i);
+						}
+					}
+
+					if (!::isspace((unsigned char)v[0]))
+					{
+						std::string_view(&v[0], 1);
+					}
+
+					return std::string_view(&v[0], 0);
+				}
+				return v;
+			}
+
+			static inline std::string_view trim_all_space(std::string_view v) noexcept
+			{
+				return trim_leading_space(trim_trailing_space(v));
+			}
+
+			static inline std::tuple<std::string_view, std::string_view> split_at_index(std::string_view s, size_t index)
+			{
+				if (index < s.length())
+				{
+					return {trim_all_space(std::string_view{&s[0], index}), trim_all_space(std::string_view{&s[index], s.length() - index})};
+				}
+				return {s, std::string_view{}};
+			}
+
+			static inline std::tuple<std::string_view, std::string_view> split_at_index_excl(std::string_view s, size_t index)
+			{
+				auto [l, r] = split_at_index(s, index);
+				if (r.length() > 1)
+				{
+					return {trim_all_space(l), trim_all_space(std::string_view{&r[1], r.length() - 1})};
+				}
+				return {l, std::string_view{}};
+			}
+
+			static inline std::tuple<std::string_view, std::string_view> split_at_char(std::string_view program, char c)
+			{
+				for (size_t i = 0; i < program.length(); ++i)
+				{
+					if (program[i] == c)
+					{
+						return split_at_index(program, i);
+					}
+				}
+				return {program, std::string_view{}};
+			}
+
+			static inline std::tuple<std::string_view, std::string_view> split_at_char_excl(std::string_view program, char c)
+			{
+				for (size_t i = 0; i < program.length(); ++i)
+				{
+					if (program[i] == c)
+					{
+						return split_at_index_excl(program, i);
+					}
+				}
+				return {program, std::string_view{}};
+			}
+
+			////
+
+			static inline const auto keyword_return = std::string_view("return");
+			static inline const auto keyword_jump	= std::string_view("jump");
+			static inline const auto keyword_label	= std::string_view("label");
+			static inline const auto keyword_var	= std::string_view("var");
+
+			template<
+				typename T_ADD_VARIABLE, typename T_ADD_LABEL, typename T_ADD_JUMP, typename T_ADD_JUMP_IF, typename T_ADD_RETURN_VALUE, typename T_ADD_ASSIGN, typename T_ADD_CALL>
+			static inline void parse_statement(
+				std::string_view statement, T_ADD_VARIABLE add_variable, T_ADD_LABEL add_label, T_ADD_JUMP add_jump, T_ADD_JUMP_IF add_jump_if, T_ADD_RETURN_VALUE add_return_value,
+				T_ADD_ASSIGN add_assign, T_ADD_CALL add_call)
+			{
+				auto [operation, expression] = split_at_char_excl(statement, ':');
+
+				if (expression.length() == 0)
+				{
+					add_call(operation);
+				}
+				else
+				{
+					if (operation == keyword_var)
+					{
+						auto [var_name, var_scope] = split_at_char_excl(expression, '?');
+						add_variable(var_name, var_scope);
+					}
+					else if (operation == keyword_label)
+					{
+						add_label(expression);
+					}
+					else if (operation == keyword_jump)
+					{
+						auto [jump_label, jump_condition] = split_at_char_excl(expression, '?');
+
+						if (jump_condition.length() > 0)
+						{
+							add_jump_if(jump_label, jump_condition);
+						}
+						else
+						{
+							add_jump(jump_label);
+						}
+					}
+					else if (operation == keyword_return)
+					{
+						add_return_value(expression);
+					}
+					else
+					{
+						add_assign(operation, expression);
+					}
+				}
+			}
+		};
+
+		struct label_manager
+		{
+			using handle								  = int;
+			static inline constexpr int placeholder_index = -1;
+
+			std::vector<int>							 m_label_statement_indexes;
+			std::unordered_map<std::string_view, handle> m_label_handle_map;
+
+			handle add_label(std::string_view label, int statement_index)
+			{
+				auto itor = m_label_handle_map.find(label);
+				if (itor != m_label_handle_map.end())
+				{
+					handle label_handle = (*itor).second;
+
+					// Placeholder was filled, fill in the program counter
+					if (m_label_statement_indexes[label_handle] != placeholder_index)
+					{
+						// error, label repeated?
+					}
+					else
+					{
+						// The target of the jump label is the next statement of program
+						m_label_statement_indexes[label_handle] = statement_index;
+					}
+
+					return label_handle;
+				}
+				else
+				{
+					// The target of the jump label is the next statement of program
+					auto label_handle = (handle)m_label_statement_indexes.size();
+					m_label_handle_map.insert(std::make_pair(label, label_handle));
+					m_label_statement_indexes.push_back(statement_index);
+					return label_handle;
+				}
+			}
+
+			handle find_label(std::string_view label)
+			{
+				auto itor = m_label_handle_map.find(label);
+				if (itor != m_label_handle_map.end())
+				{
+					// label exists, use its index
+					return (handle)(*itor).second;
+				}
+				else
+				{
+					// add a temp label, which will be replaced then when the actual label is encountered
+					auto new_handle = (handle)m_label_statement_indexes.size();
+					m_label_handle_map.insert(std::make_pair(label, new_handle));
+					m_label_statement_indexes.push_back(placeholder_index);
+					return new_handle;
+				}
+			}
+
+			int get_label_statement_index(handle label)
+			{
+				return m_label_statement_indexes[label];
+			}
+		};
+
+		struct variable_manager
+		{
+			int										  m_variable_count = 0;
+			std::unordered_map<std::string_view, int> m_variable_map;
+
+			int find_label(std::string_view name)
+			{
+				auto itor = m_variable_map.find(name);
+				if (itor == m_variable_map.end())
+				{
+					auto idx = m_variable_count++;
+					m_variable_map.insert(std::make_pair(name, idx));
+					return idx;
+				}
+				return itor->second;
+			}
+		};
+
+		struct expression_manager
+		{
+			std::vector<std::string_view> m_expressions;
+
+			int add_expression(std::string_view src)
+			{
+				auto idx = (int)m_expressions.size();
+				m_expressions.push_back(src);
+				return idx;
+			}
+		};
+
+		struct jump_statement
+		{
+			label_manager::handle m_target_handle; // Pass 1: index isn't known isn't known until whole program is parsed
+			int					  m_expression_index;
+
+			int m_target_index; // Pass 2: set from handle to index (of statement immediately following the label)
+			int m_expression_offset;
+		};
+
+		struct return_value_statement
+		{
+			int m_expression_index;
+
+			int m_expression_offset;
+		};
+
+		struct assign_statement
+		{
+			int m_variable_build_index;
+			int m_expression_index;
+
+			int m_variable_final_index;
+			int m_expression_offset;
+		};
+
+		struct call_statement
+		{
+			int m_expression_index;
+
+			int m_expression_offset;
+		};
+
+		using any_statement = std::variant<jump_statement, return_value_statement, assign_statement, call_statement>;
+
+		template<typename T_TRAITS>
+		using t_indexer = typename portable<T_TRAITS>::expr_portable_expression_build_indexer;
+
+		// Constant propagation and dead code elimination over the statements of a program. A variable assigned a constant keeps it until
+		// it is assigned again or, unless it is local, until a statement that isn't side effect free; a label keeps the constants all the
+		// statements reaching it agree on. Jumps whose condition becomes constant are folded, statements no path reaches are dropped and
+		// so are assignments nothing reads: locals are private to a run, any other variable is still read once the program returns.
+		template<typename T_TRAITS>
+		struct dataflow_manager
+		{
+			using t_native	  = native<T_TRAITS>;
+			using t_atom	  = typename T_TRAITS::t_atom;
+			using expr_native = typename t_native::expr_native;
+			using t_facts	  = std::map<const void*, t_atom>;
+
+			std::set<const void*> m_locals;
+			std::set<const void*> m_globals;
+
+			static int expression_index(const any_statement& s)
+			{
+				return std::visit([](const auto& typed) { return typed.m_expression_index; }, s);
+			}
+
+			// The statement a jump lands on, the end of the program for an unresolved label.
+			static int jump_target(const any_statement& s, int size)
+			{
+				const int target = std::get<jump_statement>(s).m_target_index;
+				return (target >= 0 && target <= size) ? target : size;
+			}
+
+			// A copy of n with the variables of facts replaced by their constant.
+			static expr_native* copy(const expr_native* n, const t_facts& facts)
+			{
+				const auto t = eval_details::type_mask(n->type);
+				if (t == VARIABLE)
+				{
+					auto itor = facts.find(n->bound);
+					if (itor == facts.end())
+					{
+						return t_native::copy_variable(n);
+					}
+					expr_native* ret = t_native::new_expr(CONSTANT, 0);
+					ret->value		 = itor->second;
+					return ret;
+				}
+
+				expr_native* ret = t_native::new_expr(n->type, 0);
+				if (t == CONSTANT)
+				{
+					ret->value = n->value;
+					return ret;
+				}
+
+				const int arity = eval_details::arity(n->type);
+				ret->function	= n->function;
+				if (t_native::is_closure(n->type))
+				{
+					ret->parameters[arity] = n->parameters[arity];
+				}
+				for (int i = 0; i < arity; ++i)
+				{
+					ret->parameters[i] = copy((const expr_native*)n->parameters[i], facts);
+				}
+				return ret;
+			}
+
+			// The copy folded as far as it goes.
+			static expr_native* fold(const expr_native* n, const t_facts& facts)
+			{
+				expr_native* ret = copy(n, facts);
+				t_native::optimize(ret);
+				return t_native::simplify(ret);
+			}
+
+			static void collect_reads(const expr_native* n, std::set<const void*>& reads)
+			{
+				if (eval_details::type_mask(n->type) == VARIABLE)
+				{
+					reads.insert(n->bound);
+				}
+				for (int i = 0; i < eval_details::arity(n->type); ++i)
+				{
+					collect_reads((const expr_native*)n->parameters[i], reads);
+				}
+			}
+
+			// Drops the statements not kept, jumps to a dropped statement land on the next one kept.
+			static void compact(std::vector<any_statement>& statements, const std::vector<bool>& keep)
+			{
+				const int				   size = int(statements.size());
+				std::vector<any_statement> kept;
+				std::vector<int>		   remap(size + 1);
+				for (int i = 0; i < size; ++i)
+				{
+					remap[i] = int(kept.size());
+					if (keep[i])
+					{
+						kept.push_back(statements[i]);
+					}
+				}
+				remap[size] = int(kept.size());
+
+				for (auto& s : kept)
+				{
+					if (std::holds_alternative<jump_statement>(s))
+					{
+						auto& jump = std::get<jump_statement>(s);
+						if (jump.m_target_index >= 0 && jump.m_target_index <= size)
+						{
+							jump.m_target_index = remap[jump.m_target_index];
+						}
+					}
+				}
+
+				statements = std::move(kept);
+			}
+
+			// Frees the expressions no statement refers to anymore, the others are renumbered in order of use.
+			static void drop_unused_expressions(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions)
+			{
+				std::vector<expr_native*> used;
+				std::vector<int>		  remap(expressions.size(), -1);
+				for (auto& s : statements)
+				{
+					std::visit(
+						[&](auto& typed) {
+							if (typed.m_expression_index >= 0)
+							{
+								if (remap[typed.m_expression_index] == -1)
+								{
+									remap[typed.m_expression_index] = int(used.size());
+									used.push_back(expressions[typed.m_expression_index]);
+									expressions[typed.m_expression_index] = nullptr;
+								}
+								typed.m_expression_index = remap[typed.m_expression_index];
+							}
+						},
+						s);
+				}
+
+				for (auto n : expressions)
+				{
+					t_native::free_native(n);
+				}
+				expressions = std::move(used);
+			}
+
+			// Forward pass: the constants known entering every statement, rewrites the reached ones and drops the rest.
+			void propagate(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions, const std::vector<const void*>& addresses)
+			{
+				const int				  size = int(statements.size());
+				std::vector<t_facts>	  in(size + 1);
+				std::vector<bool>		  reached(size + 1, false);
+				std::vector<int>		  pending{0};
+				std::vector<expr_native*> folded(size, nullptr);
+				reached[0] = (size > 0);
+
+				auto forget_globals = [&](t_facts& facts) {
+					for (auto itor = facts.begin(); itor != facts.end();)
+					{
+						itor = m_locals.count(itor->first) ? std::next(itor) : facts.erase(itor);
+					}
+				};
+
+				auto flow = [&](int target, const t_facts& facts) {
+					if (target >= size)
+					{
+						return;
+					}
+					if (!reached[target])
+					{
+						reached[target] = true;
+						in[target]		= facts;
+						pending.push_back(target);
+						return;
+					}
+
+					bool changed = false;
+					for (auto itor = in[target].begin(); itor != in[target].end();)
+					{
+						auto other = facts.find(itor->first);
+						if (other == facts.end() || ::memcmp(&other->second, &itor->second, sizeof(t_atom)) != 0)
+						{
+							itor	= in[target].erase(itor);
+							changed = true;
+						}
+						else
+						{
+							++itor;
+						}
+					}
+					if (changed)
+					{
+						pending.push_back(target);
+					}
+				};
+
+				while (size > 0 && !pending.empty())
+				{
+					const int i = pending.back();
+					pending.pop_back();
+
+					t_facts	   facts = in[i];
+					const int  e	 = expression_index(statements[i]);
+					const auto s	 = statements[i];
+
+					// A statement with side effects could change a global halfway, only its locals are replaced.
+					t_native::free_native(folded[i]);
+					folded[i] = nullptr;
+					if (e >= 0 && t_native::is_side_effect_free(expressions[e]))
+					{
+						folded[i] = fold(expressions[e], facts);
+					}
+					else if (e >= 0)
+					{
+						forget_globals(facts);
+						folded[i] = fold(expressions[e], facts);
+					}
+
+					if (std::holds_alternative<jump_statement>(s))
+					{
+						const bool known = !folded[i] || folded[i]->type == CONSTANT;
+						const bool taken = !folded[i] || T_TRAITS::lane_mask(T_TRAITS::load_atom(folded[i]->value)) != 0;
+						if (!known || taken)
+						{
+							flow(jump_target(s, size), facts);
+						}
+						if (!known || !taken)
+						{
+							flow(i + 1, facts);
+						}
+					}
+					else if (std::holds_alternative<assign_statement>(s))
+					{
+						const void* variable = addresses[std::get<assign_statement>(s).m_variable_final_index];
+						if (folded[i]->type == CONSTANT)
+						{
+							facts[variable] = folded[i]->value;
+						}
+						else
+						{
+							facts.erase(variable);
+						}
+						flow(i + 1, facts);
+					}
+					else if (std::holds_alternative<call_statement>(s))
+					{
+						flow(i + 1, facts);
+					}
+				}
+
+				std::vector<bool> keep(size, false);
+				for (int i = 0; i < size; ++i)
+				{
+					const int e = expression_index(statements[i]);
+					keep[i]		= reached[i];
+					if (!reached[i] || e < 0)
+					{
+						continue;
+					}
+
+					std::swap(expressions[e], folded[i]);
+					if (std::holds_alternative<jump_statement>(statements[i]) && expressions[e]->type == CONSTANT)
+					{
+						// Always taken becomes an unconditional jump, never taken goes away.
+						keep[i] = T_TRAITS::lane_mask(T_TRAITS::load_atom(expressions[e]->value)) != 0;
+						std::get<jump_statement>(statements[i]).m_expression_index = -1;
+					}
+				}
+
+				for (auto n : folded)
+				{
+					t_native::free_native(n);
+				}
+
+				compact(statements, keep);
+			}
+
+			// Backward pass: drops an assignment when no path from it reads the variable before assigning it again, returns whether a statement
+			// went.
+			bool eliminate_dead(std::vector<any_statement>& statements, const std::vector<expr_native*>& expressions, const std::vector<const void*>& addresses)
+			{
+				const int						   size = int(statements.size());
+				std::vector<std::set<const void*>> live(size + 1);
+				live[size] = m_globals;
+
+				for (bool changed = true; changed;)
+				{
+					changed = false;
+					for (int i = size - 1; i >= 0; --i)
+					{
+						const auto&			  s = statements[i];
+						const int			  e = expression_index(s);
+						std::set<const void*> now;
+
+						if (std::holds_alternative<jump_statement>(s))
+						{
+							now = live[jump_target(s, size)];
+							if (e >= 0)
+							{
+								now.insert(live[i + 1].begin(), live[i + 1].end());
+							}
+						}
+						else if (std::holds_alternative<return_value_statement>(s))
+						{
+							now = m_globals;
+						}
+						else
+						{
+							now = live[i + 1];
+						}
+
+						if (std::holds_alternative<assign_statement>(s))
+						{
+							now.erase(addresses[std::get<assign_statement>(s).m_variable_final_index]);
+						}
+
+						if (e >= 0)
+						{
+							collect_reads(expressions[e], now);
+							if (!t_native::is_side_effect_free(expressions[e]))
+							{
+								now.insert(m_globals.begin(), m_globals.end());
+							}
+						}
+
+						if (now != live[i])
+						{
+							live[i] = std::move(now);
+							changed = true;
+						}
+					}
+				}
+
+				std::vector<bool> keep(size, true);
+				bool			  dropped = false;
+				for (int i = 0; i < size; ++i)
+				{
+					// So does a jump to the statement right after it, unless its condition has side effects.
+					const int e = expression_index(statements[i]);
+					if (std::holds_alternative<jump_statement>(statements[i]) && jump_target(statements[i], size) == i + 1 &&
+						(e < 0 || t_native::is_side_effect_free(expressions[e])))
+					{
+						keep[i] = false;
+						dropped = true;
+					}
+
+					if (std::holds_alternative<assign_statement>(statements[i]))
+					{
+						const auto& assign = std::get<assign_statement>(statements[i]);
+						if (!live[i + 1].count(addresses[assign.m_variable_final_index]))
+						{
+							if (t_native::is_side_effect_free(expressions[assign.m_expression_index]))
+							{
+								keep[i]	= false;
+								dropped = true;
+							}
+							else
+							{
+								statements[i] = call_statement{assign.m_expression_index, 0};
+							}
+						}
+					}
+				}
+
+				compact(statements, keep);
+				return dropped;
+			}
+
+			void run(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions, t_indexer<T_TRAITS>& indexer)
+			{
+				const auto addresses = indexer.get_address_table();
+				const auto is_local	 = indexer.get_local_binding_table();
+				for (size_t b = 0; b < addresses.size(); ++b)
+				{
+					(is_local[b] ? m_locals : m_globals).insert(addresses[b]);
+				}
+
+				propagate(statements, expressions, addresses);
+				while (eliminate_dead(statements, expressions, addresses))
+				{
+				}
+
+				drop_unused_expressions(statements, expressions);
+			}
+		};
+
+		// Locals start at 0 on every run. The bytecode frame starts zeroed, the statements get an assignment of 0 to every local the program
+		// uses ahead of the first one, so the statement path resets the local's binding too. Jumps to the first statement land after them.
+		template<typename T_TRAITS>
+		struct frame_manager
+		{
+			using t_native	  = native<T_TRAITS>;
+			using t_atom	  = typename T_TRAITS::t_atom;
+			using expr_native = typename t_native::expr_native;
+
+			void run(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions, t_indexer<T_TRAITS>& indexer)
+			{
+				std::set<const void*> used;
+				for (auto n : expressions)
+				{
+					dataflow_manager<T_TRAITS>::collect_reads(n, used);
+				}
+
+				const auto addresses = indexer.get_address_table();
+				for (const auto& s : statements)
+				{
+					if (std::holds_alternative<assign_statement>(s))
+					{
+						used.insert(addresses[std::get<assign_statement>(s).m_variable_final_index]);
+					}
+				}
+
+				std::vector<any_statement> prologue;
+				for (size_t v = 0; v < indexer.m_declared_variable_values.size(); ++v)
+				{
+					const auto value = indexer.m_declared_variable_values[v].get();
+					if (indexer.m_declared_variable_local[v] && used.count(value))
+					{
+						const variable local{indexer.m_declared_variable_names[v].c_str(), value};
+						expr_native*   zero = t_native::new_expr(CONSTANT, 0);
+						zero->value			= t_atom(0);
+						prologue.push_back(assign_statement{-1, int(expressions.size()), indexer.add_referenced_variable(&local), -1});
+						expressions.push_back(zero);
+					}
+				}
+
+				if (prologue.empty())
+				{
+					return;
+				}
+
+				for (auto& s : statements)
+				{
+					if (std::holds_alternative<jump_statement>(s) && std::get<jump_statement>(s).m_target_index >= 0)
+					{
+						std::get<jump_statement>(s).m_target_index += int(prologue.size());
+					}
+				}
+				statements.insert(statements.begin(), prologue.begin(), prologue.end());
+			}
+		};
+
+		// Basic blocks of a program: runs of statements entered at the top and left at the bottom. A jump to an unconditional jump goes
+		// straight to where the chain ends, an unconditional jump to a short return becomes a copy of it and a conditional jump over an
+		// unconditional one is inverted. Then the blocks are laid out so that a block no statement falls into follows the unconditional
+		// jump to it, which makes the jump go away.
+		template<typename T_TRAITS>
+		struct control_flow_manager
+		{
+			using t_dataflow  = dataflow_manager<T_TRAITS>;
+			using t_native	  = native<T_TRAITS>;
+			using expr_native = typename t_native::expr_native;
+
+			// Returns of up to this many nodes are copied into the jumps landing on them.
+			static constexpr int max_copied_nodes = 16;
+
+			static int count_nodes(const expr_native* n)
+			{
+				int count = 1;
+				for (int i = 0; i < eval_details::arity(n->type); ++i)
+				{
+					count += count_nodes((const expr_native*)n->parameters[i]);
+				}
+				return count;
+			}
+
+			static bool is_unconditional_jump(const any_statement& s)
+			{
+				return std::holds_alternative<jump_statement>(s) && std::get<jump_statement>(s).m_expression_index < 0;
+			}
+
+			// Whether the statement after s never runs right after it.
+			static bool ends_flow(const any_statement& s)
+			{
+				return is_unconditional_jump(s) || std::holds_alternative<return_value_statement>(s);
+			}
+
+			static void thread(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions)
+			{
+				const int size = int(statements.size());
+				for (int i = 0; i < size; ++i)
+				{
+					if (!std::holds_alternative<jump_statement>(statements[i]))
+					{
+						continue;
+					}
+
+					// A chain looping on itself stops once it went through every statement.
+					int target = t_dataflow::jump_target(statements[i], size);
+					for (int hops = 0; target < size && is_unconditional_jump(statements[target]) && hops < size; ++hops)
+					{
+						target = t_dataflow::jump_target(statements[target], size);
+					}
+					std::get<jump_statement>(statements[i]).m_target_index = target;
+
+					if (is_unconditional_jump(statements[i]) && target < size && std::holds_alternative<return_value_statement>(statements[target]))
+					{
+						const auto returned = expressions[std::get<return_value_statement>(statements[target]).m_expression_index];
+						if (count_nodes(returned) <= max_copied_nodes)
+						{
+							statements[i] = return_value_statement{int(expressions.size()), 0};
+							expressions.push_back(t_dataflow::copy(returned, {}));
+						}
+					}
+				}
+			}
+
+			// 'jump: a ? c; jump: b; label: a;' becomes 'jump: b ? !c;' when no other jump lands on the second one.
+			static void invert(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions)
+			{
+				const int		  size = int(statements.size());
+				std::vector<bool> landed(size + 1, false);
+				for (const auto& s : statements)
+				{
+					if (std::holds_alternative<jump_statement>(s))
+					{
+						landed[t_dataflow::jump_target(s, size)] = true;
+					}
+				}
+
+				std::vector<bool> keep(size, true);
+				for (int i = 0; i + 1 < size; ++i)
+				{
+					const auto& s = statements[i];
+					if (!std::holds_alternative<jump_statement>(s) || is_unconditional_jump(s) || t_dataflow::jump_target(s, size) != i + 2 ||
+						!is_unconditional_jump(statements[i + 1]) || landed[i + 1])
+					{
+						continue;
+					}
+
+					auto& jump							 = std::get<jump_statement>(statements[i]);
+					expressions[jump.m_expression_index] = t_native::new_operator("logical_not", expressions[jump.m_expression_index]);
+					jump.m_target_index					 = t_dataflow::jump_target(statements[i + 1], size);
+					keep[i + 1]							 = false;
+				}
+
+				t_dataflow::compact(statements, keep);
+			}
+
+			static void drop_unreachable(std::vector<any_statement>& statements)
+			{
+				const int		  size = int(statements.size());
+				std::vector<bool> reached(size, false);
+				std::vector<int>  pending{0};
+				while (!pending.empty())
+				{
+					const int i = pending.back();
+					pending.pop_back();
+					if (i >= size || reached[i])
+					{
+						continue;
+					}
+
+					reached[i] = true;
+					if (std::holds_alternative<jump_statement>(statements[i]))
+					{
+						pending.push_back(t_dataflow::jump_target(statements[i], size));
+					}
+					if (!ends_flow(statements[i]))
+					{
+						pending.push_back(i + 1);
+					}
+				}
+
+				t_dataflow::compact(statements, reached);
+			}
+
+			static void layout(std::vector<any_statement>& statements)
+			{
+				const int size = int(statements.size());
+
+				std::vector<bool> leader(size + 1, false);
+				leader[0] = leader[size] = true;
+				for (int i = 0; i < size; ++i)
+				{
+					if (std::holds_alternative<jump_statement>(statements[i]))
+					{
+						leader[t_dataflow::jump_target(statements[i], size)] = true;
+					}
+					if (std::holds_alternative<jump_statement>(statements[i]) || std::holds_alternative<return_value_statement>(statements[i]))
+					{
+						leader[i + 1] = true;
+					}
+				}
+
+				// Block b runs from starts[b] to starts[b + 1], the end of the program counts as one more block.
+				std::vector<int> starts;
+				std::vector<int> block_of(size + 1);
+				for (int i = 0; i <= size; ++i)
+				{
+					if (leader[i])
+					{
+						starts.push_back(i);
+					}
+					block_of[i] = int(starts.size()) - 1;
+				}
+
+				const int blocks = int(starts.size()) - 1;
+				auto	  last	 = [&](int b) -> const any_statement& { return statements[starts[b + 1] - 1]; };
+
+				// Each block is followed by the block it falls into, or by the target of its unconditional jump when nothing else falls there.
+				std::vector<bool> placed(blocks, false);
+				std::vector<int>  order;
+				for (int seed = 0; seed < blocks; ++seed)
+				{
+					for (int b = seed; b >= 0 && b < blocks && !placed[b];)
+					{
+						placed[b] = true;
+						order.push_back(b);
+
+						const auto& s = last(b);
+						if (is_unconditional_jump(s))
+						{
+							const int c = block_of[t_dataflow::jump_target(s, size)];
+							b			= (c > 0 && c < blocks && ends_flow(last(c - 1))) ? c : -1;
+						}
+						else
+						{
+							b = std::holds_alternative<return_value_statement>(s) ? -1 : b + 1;
+						}
+					}
+				}
+
+				std::vector<any_statement> laid_out;
+				std::vector<int>		   remap(size + 1, 0);
+				for (size_t k = 0; k < order.size(); ++k)
+				{
+					const int b	   = order[k];
+					const int next = (k + 1 < order.size()) ? order[k + 1] : blocks;
+
+					remap[starts[b]] = int(laid_out.size());
+					laid_out.insert(laid_out.end(), statements.begin() + starts[b], statements.begin() + starts[b + 1]);
+
+					const auto& s = last(b);
+					if (is_unconditional_jump(s) && block_of[t_dataflow::jump_target(s, size)] == next)
+					{
+						laid_out.pop_back();
+					}
+					else if (!ends_flow(s) && b + 1 != next)
+					{
+						laid_out.push_back(jump_statement{-1, -1, starts[b + 1], 0});
+					}
+				}
+				remap[size] = int(laid_out.size());
+
+				for (auto& s : laid_out)
+				{
+					if (std::holds_alternative<jump_statement>(s))
+					{
+						auto& jump			= std::get<jump_statement>(s);
+						jump.m_target_index = remap[t_dataflow::jump_target(s, size)];
+					}
+				}
+
+				statements = std::move(laid_out);
+			}
+
+			void run(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions)
+			{
+				thread(statements, expressions);
+				invert(statements, expressions);
+				drop_unreachable(statements);
+				layout(statements);
+				t_dataflow::drop_unused_expressions(statements, expressions);
+			}
+		};
+
+		// If-conversion: a conditional jump around short side effect free statements becomes a select of what they compute, so nothing
+		// branches on the data. 'jump: l ? c; return: a; ... label: l; return: b;' returns select(c, b, a), and
+		// 'jump: l ? c; v: a; jump: m; label: l; v: b; label: m;' assigns it to v; with only the first side, v is kept when c holds.
+		template<typename T_TRAITS>
+		struct if_conversion_manager
+		{
+			using t_dataflow	 = dataflow_manager<T_TRAITS>;
+			using t_control_flow = control_flow_manager<T_TRAITS>;
+			using t_native		 = native<T_TRAITS>;
+			using t_vector		 = typename T_TRAITS::t_vector;
+			using expr_native	 = typename t_native::expr_native;
+
+			static bool is_short(const expr_native* a, const expr_native* b)
+			{
+				return t_native::is_side_effect_free(a) && t_native::is_side_effect_free(b) &&
+					   (t_control_flow::count_nodes(a) + t_control_flow::count_nodes(b) <= TP_SELECT_MAX_NODES);
+			}
+
+			// The select statement i computes instead of jumping, or null.
+			static expr_native* convert(int i, std::vector<any_statement>& statements, std::vector<expr_native*>& expressions, const std::vector<const void*>& addresses,
+				const std::vector<bool>& landed)
+			{
+				const int size	 = int(statements.size());
+				const int target = t_dataflow::jump_target(statements[i], size);
+				if (landed[i + 1])
+				{
+					return nullptr;
+				}
+
+				const auto& next = statements[i + 1];
+				if (!std::holds_alternative<return_value_statement>(next) && !std::holds_alternative<assign_statement>(next))
+				{
+					return nullptr;
+				}
+
+				const auto a = expressions[t_dataflow::expression_index(next)];
+				if (std::holds_alternative<return_value_statement>(next))
+				{
+					if (target < size && std::holds_alternative<return_value_statement>(statements[target]))
+					{
+						const auto b = expressions[t_dataflow::expression_index(statements[target])];
+						return is_short(a, b) ? t_native::new_operator("select", nullptr, t_dataflow::copy(b, {}), t_dataflow::copy(a, {})) : nullptr;
+					}
+					return nullptr;
+				}
+
+				const int binding = std::get<assign_statement>(next).m_variable_final_index;
+				if (target == i + 2)
+				{
+					expr_native* kept = t_native::new_expr(VARIABLE, 0);
+					kept->bound		  = (const t_vector*)addresses[binding];
+					if (is_short(a, kept))
+					{
+						return t_native::new_operator("select", nullptr, kept, t_dataflow::copy(a, {}));
+					}
+					t_native::free_native(kept);
+					return nullptr;
+				}
+
+				if (target == i + 3 && target < size && t_control_flow::is_unconditional_jump(statements[i + 2]) && !landed[i + 2] &&
+					t_dataflow::jump_target(statements[i + 2], size) == i + 4 && std::holds_alternative<assign_statement>(statements[target]) &&
+					std::get<assign_statement>(statements[target]).m_variable_final_index == binding)
+				{
+					const auto b = expressions[t_dataflow::expression_index(statements[target])];
+					return is_short(a, b) ? t_native::new_operator("select", nullptr, t_dataflow::copy(b, {}), t_dataflow::copy(a, {})) : nullptr;
+				}
+
+				return nullptr;
+			}
+
+			void run(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions, t_indexer<T_TRAITS>& indexer)
+			{
+				const auto addresses = indexer.get_address_table();
+				for (bool converted = true; converted;)
+				{
+					converted = false;
+
+					const int		  size = int(statements.size());
+					std::vector<bool> landed(size + 1, false);
+					for (const auto& s : statements)
+					{
+						if (std::holds_alternative<jump_statement>(s))
+						{
+							landed[t_dataflow::jump_target(s, size)] = true;
+						}
+					}
+
+					for (int i = 0; i + 1 < size; ++i)
+					{
+						if (!std::holds_alternative<jump_statement>(statements[i]) || t_control_flow::is_unconditional_jump(statements[i]))
+						{
+							continue;
+						}
+
+						expr_native* select = convert(i, statements, expressions, addresses, landed);
+						if (!select)
+						{
+							continue;
+						}
+
+						// The condition moves into the select, statement i + 1 now goes to where both sides met.
+						auto& condition		  = expressions[std::get<jump_statement>(statements[i]).m_expression_index];
+						select->parameters[0] = condition;
+						condition			  = nullptr;
+
+						const auto& next = statements[i + 1];
+						const int	rest = std::holds_alternative<return_value_statement>(next) ? -1 : (t_dataflow::jump_target(statements[i], size) == i + 2) ? i + 2 : i + 4;
+						if (rest < 0)
+						{
+							statements[i] = return_value_statement{int(expressions.size()), 0};
+						}
+						else
+						{
+							statements[i]	  = assign_statement{-1, int(expressions.size()), std::get<assign_statement>(next).m_variable_final_index, 0};
+							statements[i + 1] = jump_statement{-1, -1, rest, 0};
+						}
+						expressions.push_back(t_native::simplify(select));
+						converted = true;
+					}
+
+					if (converted)
+					{
+						t_control_flow::drop_unreachable(statements);
+						t_control_flow::layout(statements);
+						t_dataflow::drop_unused_expressions(statements, expressions);
+					}
+				}
+			}
+		};
+
+		// Loop invariant code motion. A jump from statement j back to statement h makes h..j a loop when no jump from outside lands past h.
+		// Pure subtrees in it reading no variable a statement of the loop assigns are computed once, into a local declared variable
+		// assigned right before h; jumps to h from outside the loop land on these assignments instead. When the loop calls a closure or
+		// an impure function only the subtrees reading nothing but locals are moved. Inner loops go first.
+		template<typename T_TRAITS>
+		struct loop_manager
+		{
+			using t_dataflow  = dataflow_manager<T_TRAITS>;
+			using t_native	  = native<T_TRAITS>;
+			using t_vector	  = typename T_TRAITS::t_vector;
+			using expr_native = typename t_native::expr_native;
+
+			std::set<const void*>		 m_assigned;	// written in the loop
+			std::set<const void*>		 m_locals;
+			bool						 m_impure = false; // the loop could write any variable that isn't local
+			std::vector<expr_native*>	 m_hoisted;		// per temporary, the subtree moved out of the loop
+			std::vector<const t_vector*> m_temporaries; // per temporary, its variable
+			std::vector<int>			 m_bindings;	// per temporary, its binding index
+
+			bool is_invariant(const expr_native* n) const
+			{
+				const auto t = eval_details::type_mask(n->type);
+				if (t == CONSTANT)
+				{
+					return true;
+				}
+				if (t == VARIABLE)
+				{
+					return !m_assigned.count(n->bound) && (!m_impure || m_locals.count(n->bound));
+				}
+
+				if (!t_native::is_pure(n->type) || t_native::is_closure(n->type))
+				{
+					return false;
+				}
+				for (int i = 0; i < eval_details::arity(n->type); ++i)
+				{
+					if (!is_invariant((const expr_native*)n->parameters[i]))
+					{
+						return false;
+					}
+				}
+				return true;
+			}
+
+			// Replaces the largest invariant subtrees of n by the variable of their temporary, returns the node replacing n.
+			expr_native* hoist(expr_native* n, t_indexer<T_TRAITS>& indexer)
+			{
+				if (t_native::is_function(n->type) && is_invariant(n))
+				{
+					int k = 0;
+					while (k < int(m_hoisted.size()) && !t_native::same(m_hoisted[k], n))
+					{
+						++k;
+					}
+
+					if (k == int(m_hoisted.size()))
+					{
+						const auto [value, binding] = indexer.add_temporary_variable();
+						m_hoisted.push_back(n);
+						m_temporaries.push_back(value);
+						m_locals.insert(value);
+						m_bindings.push_back(binding);
+					}
+					else
+					{
+						t_native::free_native(n);
+					}
+
+					expr_native* ret = t_native::new_expr(VARIABLE, 0);
+					ret->bound		 = m_temporaries[k];
+					return ret;
+				}
+
+				for (int i = 0; i < eval_details::arity(n->type); ++i)
+				{
+					n->parameters[i] = hoist((expr_native*)n->parameters[i], indexer);
+				}
+				return n;
+			}
+
+			// Moves what is invariant in the loop h..j before it, returns whether anything moved.
+			bool move(int h, int j, std::vector<any_statement>& statements, std::vector<expr_native*>& expressions, t_indexer<T_TRAITS>& indexer)
+			{
+				const int size = int(statements.size());
+				for (int k = 0; k < size; ++k)
+				{
+					if ((k < h || k > j) && std::holds_alternative<jump_statement>(statements[k]))
+					{
+						const int target = t_dataflow::jump_target(statements[k], size);
+						if (target > h && target <= j)
+						{
+							return false;
+						}
+					}
+				}
+
+				const auto addresses = indexer.get_address_table();
+
+				m_assigned.clear();
+				m_impure = false;
+				for (int k = h; k <= j; ++k)
+				{
+					const int e = t_dataflow::expression_index(statements[k]);
+					if (std::holds_alternative<assign_statement>(statements[k]))
+					{
+						m_assigned.insert(addresses[std::get<assign_statement>(statements[k]).m_variable_final_index]);
+					}
+					m_impure |= (e >= 0 && !t_native::is_side_effect_free(expressions[e]));
+				}
+
+				m_hoisted.clear();
+				m_temporaries.clear();
+				m_bindings.clear();
+				for (int k = h; k <= j; ++k)
+				{
+					const int e = t_dataflow::expression_index(statements[k]);
+					if (e >= 0 && t_native::is_side_effect_free(expressions[e]))
+					{
+						expressions[e] = hoist(expressions[e], indexer);
+					}
+				}
+
+				const int count = int(m_hoisted.size());
+				if (count == 0)
+				{
+					return false;
+				}
+
+				std::vector<any_statement> moved(statements.begin(), statements.begin() + h);
+				for (int t = 0; t < count; ++t)
+				{
+					moved.push_back(assign_statement{-1, int(expressions.size()), m_bindings[t], 0});
+					expressions.push_back(m_hoisted[t]);
+				}
+				moved.insert(moved.end(), statements.begin() + h, statements.end());
+
+				// Jumps to h from the loop skip the new assignments, the others run them.
+				for (int k = 0; k < size; ++k)
+				{
+					if (std::holds_alternative<jump_statement>(statements[k]))
+					{
+						const int target = t_dataflow::jump_target(statements[k], size);
+						auto&	  jump	 = std::get<jump_statement>(moved[(k < h) ? k : k + count]);
+						jump.m_target_index = (target < h || (target == h && (k < h || k > j))) ? target : target + count;
+					}
+				}
+
+				statements = std::move(moved);
+				return true;
+			}
+
+			void run(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions, t_indexer<T_TRAITS>& indexer)
+			{
+				for (size_t v = 0; v < indexer.m_declared_variable_values.size(); ++v)
+				{
+					if (indexer.m_declared_variable_local[v])
+					{
+						m_locals.insert(indexer.m_declared_variable_values[v].get());
+					}
+				}
+
+				for (bool moved = true; moved;)
+				{
+					moved = false;
+
+					const int						  size = int(statements.size());
+					std::vector<std::tuple<int, int>> loops;
+					for (int k = 0; k < size; ++k)
+					{
+						if (std::holds_alternative<jump_statement>(statements[k]) && t_dataflow::jump_target(statements[k], size) <= k)
+						{
+							loops.push_back({t_dataflow::jump_target(statements[k], size), k});
+						}
+					}
+					std::stable_sort(loops.begin(), loops.end(), [](const auto& a, const auto& b) {
+						return std::get<1>(a) - std::get<0>(a) < std::get<1>(b) - std::get<0>(b);
+					});
+
+					for (auto [h, j] : loops)
+					{
+						if (move(h, j, statements, expressions, indexer))
+						{
+							moved = true;
+							break;
+						}
+					}
+				}
+			}
+		};
+
+		// Common subexpression elimination over the expression trees of a program. Subtrees are numbered by value, a variable by its
+		// address and the number of assignments to it so far. Pure subtrees with the same number that repeat within a run of statements
+		// no label lands in are computed once, into a local declared variable assigned right before the statement of the first
+		// occurrence. Closures and impure functions aren't merged, statements calling them end the run.
+		template<typename T_TRAITS>
+		struct subexpression_manager
+		{
+			using t_native	  = native<T_TRAITS>;
+			using t_vector	  = typename T_TRAITS::t_vector;
+			using expr_native = typename t_native::expr_native;
+
+			std::map<std::vector<uint64_t>, int>		m_numbers;
+			std::unordered_map<const expr_native*, int> m_node_numbers;
+			std::unordered_map<const void*, uint64_t>	m_versions;
+			std::vector<int>							m_uses;		   // per number, occurrences not inside another occurrence
+			std::vector<const t_vector*>				m_temporaries; // per number, the variable holding it once assigned
+
+			int number(const expr_native* n)
+			{
+				std::vector<uint64_t> key{uint64_t(n->type)};
+
+				const auto t = eval_details::type_mask(n->type);
+				if (t == CONSTANT)
+				{
+					static_assert(sizeof(n->value) <= sizeof(uint64_t), "constants are keyed by their bits");
+					uint64_t bits = 0;
+					::memcpy(&bits, &n->value, sizeof(n->value));
+					key.push_back(bits);
+				}
+				else if (t == VARIABLE)
+				{
+					key.push_back(uint64_t(uintptr_t(n->bound)));
+					key.push_back(m_versions[n->bound]);
+				}
+				else
+				{
+					key.push_back(uint64_t(uintptr_t(n->function)));
+					for (int i = 0; i < eval_details::arity(n->type); ++i)
+					{
+						key.push_back(uint64_t(number((const expr_native*)n->parameters[i])));
+					}
+				}
+
+				auto itor = m_numbers.find(key);
+				if (itor == m_numbers.end())
+				{
+					itor = m_numbers.insert(std::make_pair(std::move(key), int(m_uses.size()))).first;
+					m_uses.push_back(0);
+					m_temporaries.push_back(nullptr);
+				}
+
+				m_node_numbers[n] = itor->second;
+				return itor->second;
+			}
+
+			// Only the first occurrence of a number counts what is inside it.
+			void count(const expr_native* n)
+			{
+				if (m_uses[m_node_numbers[n]]++ == 0)
+				{
+					for (int i = 0; i < eval_details::arity(n->type); ++i)
+					{
+						count((const expr_native*)n->parameters[i]);
+					}
+				}
+			}
+
+			// Turns the repeated subtrees of n into their temporary. The first occurrence moves into an assignment of the temporary, its
+			// own repeated subtrees are assigned before it.
+			void rewrite(expr_native* n, t_indexer<T_TRAITS>& indexer, std::vector<std::tuple<int, expr_native*>>& assignments)
+			{
+				const auto t = eval_details::type_mask(n->type);
+				if (t == CONSTANT || t == VARIABLE)
+				{
+					return;
+				}
+
+				const int v = m_node_numbers[n];
+				if (m_uses[v] > 1 && m_temporaries[v])
+				{
+					t_native::free_parameters(n);
+					n->type	 = VARIABLE;
+					n->bound = m_temporaries[v];
+					return;
+				}
+
+				for (int i = 0; i < eval_details::arity(n->type); ++i)
+				{
+					rewrite((expr_native*)n->parameters[i], indexer, assignments);
+				}
+
+				if (m_uses[v] > 1)
+				{
+					expr_native* moved = t_native::new_expr(n->type, (const expr_native**)n->parameters);
+					moved->function	   = n->function;
+
+					const auto [value, binding] = indexer.add_temporary_variable();
+					m_temporaries[v]			= value;
+					assignments.push_back({binding, moved});
+
+					n->type	 = VARIABLE;
+					n->bound = m_temporaries[v];
+				}
+			}
+
+			void eliminate(std::vector<any_statement>& statements, std::vector<expr_native*>& expressions, t_indexer<T_TRAITS>& indexer)
+			{
+				auto expression_index = [](const any_statement& s) {
+					return std::visit([](const auto& typed) { return typed.m_expression_index; }, s);
+				};
+
+				const int size = int(statements.size());
+
+				std::vector<bool> targets(size + 1, false);
+				for (const auto& s : statements)
+				{
+					if (std::holds_alternative<jump_statement>(s))
+					{
+						const int target = std::get<jump_statement>(s).m_target_index;
+						if (target >= 0 && target <= size)
+						{
+							targets[target] = true;
+						}
+					}
+				}
+
+				const auto		  addresses = indexer.get_address_table();
+				std::vector<bool> numbered(size, false);
+				for (int i = 0; i < size; ++i)
+				{
+					const int e = expression_index(statements[i]);
+					if (targets[i])
+					{
+						m_numbers.clear();
+					}
+
+					if (e < 0)
+					{
+						continue;
+					}
+
+					if (!t_native::is_side_effect_free(expressions[e]))
+					{
+						m_numbers.clear();
+						continue;
+					}
+
+					number(expressions[e]);
+					count(expressions[e]);
+					numbered[i] = true;
+
+					if (std::holds_alternative<assign_statement>(statements[i]))
+					{
+						++m_versions[addresses[std::get<assign_statement>(statements[i]).m_variable_final_index]];
+					}
+				}
+
+				std::vector<any_statement> rewritten;
+				std::vector<int>		   remap(size + 1);
+				for (int i = 0; i < size; ++i)
+				{
+					remap[i] = int(rewritten.size());
+					if (numbered[i])
+					{
+						std::vector<std::tuple<int, expr_native*>> assignments;
+						rewrite(expressions[expression_index(statements[i])], indexer, assignments);
+						for (auto [binding, moved] : assignments)
+						{
+							rewritten.push_back(assign_statement{-1, int(expressions.size()), binding, 0});
+							expressions.push_back(moved);
+						}
+					}
+					rewritten.push_back(statements[i]);
+				}
+				remap[size] = int(rewritten.size());
+
+				for (auto& s : rewritten)
+				{
+					if (std::holds_alternative<jump_statement>(s))
+					{
+						auto& jump = std::get<jump_statement>(s);
+						if (jump.m_target_index >= 0 && jump.m_target_index <= size)
+						{
+							jump.m_target_index = remap[jump.m_target_index];
+						}
+					}
+				}
+
+				statements = std::move(rewritten);
+			}
+		};
+
+		template<typename T_TRAITS>
+		auto compile_using_indexer(const char* text, int* error, typename t_indexer<T_TRAITS>& indexer) -> typename portable<T_TRAITS>::portable_compiled_program*
+		{
+			// Parse nodes come from the caller's arena, or from one released when this returns.
+			compile_arena		 own_arena;
+			compile_arena::scope use_arena(compile_arena::current() ? *compile_arena::current() : own_arena);
+
+			auto program_src	   = parser::trim_all_space(std::string_view{text, strlen(text)});
+			auto program_remaining = program_src;
+
+			std::vector<any_statement> program_statements;
+			using program_impl		   = typename portable<T_TRAITS>::portable_compiled_program;
+			auto			   program = new program_impl();
+			label_manager	   lm;
+			variable_manager   vm;
+			expression_manager em;
+
+			while (program_remaining.length() > 0)
+			{
+				auto [statement, remaining] = parser::split_at_char_excl(program_remaining, ';');
+
+				parser::parse_statement(
+					statement,
+
+					// variable
+					[&](std::string_view name, std::string_view scope) { indexer.add_declared_variable(name, scope); },
+
+					// label
+					[&](std::string_view label) { lm.add_label(label, (int)program_statements.size()); },
+
+					// jump
+					[&](std::string_view destination_label) {
+						any_statement s = jump_statement{lm.find_label(destination_label), -1};
+						program_statements.push_back(s);
+					},
+
+					// jump_if
+					[&](std::string_view destination_label, std::string_view condition) {
+						any_statement s = jump_statement{lm.find_label(destination_label), em.add_expression(condition)};
+						program_statements.push_back(s);
+					},
+
+					// return_value
+					[&](std::string_view expression) {
+						any_statement s = return_value_statement{em.add_expression(expression)};
+						program_statements.push_back(s);
+					},
+
+					// assign
+					[&](std::string_view destination, std::string_view expression) {
+						any_statement s = assign_statement{vm.find_label(destination), em.add_expression(expression)};
+						program_statements.push_back(s);
+					},
+
+					// call
+					[&](std::string_view expression) {
+						any_statement s = call_statement{em.add_expression(expression)};
+						program_statements.push_back(s);
+					});
+
+				program_remaining = remaining;
+			}
+
+			// Fixup jump indices
+			for (auto& s : program_statements)
+			{
+				if (std::holds_alternative<jump_statement>(s))
+				{
+					std::get<jump_statement>(s).m_target_index = lm.get_label_statement_index(std::get<jump_statement>(s).m_target_handle);
+				}
+			}
+
+			// Add referenced variables to the lookup dict
+			{
+				auto			var_array_tmp = indexer.get_variable_array();
+				auto var_lookup = var_array_tmp->get_lookup();
+				for (auto itor : vm.m_variable_map)
+				{
+					auto name  = itor.first;
+					auto index = itor.second;
+
+					int		   final_index = -1;
+					const auto var		   = var_lookup.symbols->find_by_name(name.data(), int(name.size()));
+					if (var)
+					{
+						final_index = indexer.add_referenced_variable(var);
+					}
+
+					if (final_index == -1)
+					{
+						*error = -1; // TODO: variable not found
+						// assert(!"Variable not found.");
+						return nullptr;
+					}
+
+					// Remap all indexes to the indexer value
+					for (auto& s : program_statements)
+					{
+						if (std::holds_alternative<assign_statement>(s))
+						{
+							if (std::get<assign_statement>(s).m_variable_build_index == index)
+							{
+								std::get<assign_statement>(s).m_variable_final_index = final_index;
+							}
+						}
+					}
+				}
+			}
+
+			// Parse all the expressions, propagate constants between statements, thread the jumps, turn short branches into selects, move
+			// loop invariants out, then merge repeated subexpressions
+			std::vector<typename native<T_TRAITS>::expr_native*> expressions;
+			for (auto expr : em.m_expressions)
+			{
+				expressions.push_back(expr_details::compile_native_using_indexer<T_TRAITS>(indexer, expr.data(), error));
+				if (!expressions.back())
+				{
+					break;
+				}
+			}
+
+			if (expressions.empty() || expressions.back())
+			{
+				// Threading turns the jump ending one side of an assignment diamond into a return, and exposes return diamonds behind jumps.
+				frame_manager<T_TRAITS>().run(program_statements, expressions, indexer);
+				dataflow_manager<T_TRAITS>().run(program_statements, expressions, indexer);
+				if_conversion_manager<T_TRAITS>().run(program_statements, expressions, indexer);
+				control_flow_manager<T_TRAITS>().run(program_statements, expressions);
+				if_conversion_manager<T_TRAITS>().run(program_statements, expressions, indexer);
+				loop_manager<T_TRAITS>().run(program_statements, expressions, indexer);
+				subexpression_manager<T_TRAITS>().eliminate(program_statements, expressions, indexer);
+			}
+
+			// Compile all the expressions, redirect the statement expression indexes to the compiled buffer offset
+			std::vector<std::vector<unsigned char>> expression_bytecode;
+			expression_bytecode.resize(expressions.size());
+			program->layout = indexer.layout;
+
+			for (int expr_idx = 0; expr_idx < int(expressions.size()); ++expr_idx)
+			{
+				auto compiled_expr = std::unique_ptr<::tp::compiled_expr>(
+					expressions[expr_idx] ? expr_details::export_using_indexer<T_TRAITS>(indexer, expressions[expr_idx]) : nullptr);
+
+				if (compiled_expr)
+				{
+					if (compiled_expr->get_layout() != expression_layout::post_order)
+					{
+						program->layout = expression_layout::pre_order;
+					}
+
+					if (compiled_expr->get_bytecode_size() > 0)
+					{
+						expression_bytecode[expr_idx].assign(compiled_expr->get_bytecode(), compiled_expr->get_bytecode() + compiled_expr->get_bytecode_size());
+					}
+
+					const int current_expr_offset = (int)(program->program_expression_buffer_size + compiled_expr->get_root_offset());
+					auto	  compiled_size		  = (int)compiled_expr->get_data_size();
+					const int new_expr_offset	  = (int)program->program_expression_buffer_size + compiled_size;
+
+					auto new_expr_buffer = new unsigned char[new_expr_offset];
 					::memcpy(new_expr_buffer, program->program_expression_buffer.get(), program->program_expression_buffer_size);
 					::memcpy(new_expr_buffer + program->program_expression_buffer_size, compiled_expr->get_data(), compiled_size);
 
-					program->program_expression_buffer_size = new_expr_offset;
+					program->program_expression_buffer_size = new_expr_offset;
+
+					program->program_expression_buffer.reset(new_expr_buffer);
+
+					// Fixup any expression indexes
+					for (auto& s : program_statements)
+					{
+						if (std::holds_alternative<call_statement>(s))
+						{
+							if (std::get<call_statement>(s).m_expression_index == expr_idx)
+							{
+								std::get<call_statement>(s).m_expression_offset = current_expr_offset;
+							}
+						}
+
+						if (std::holds_alternative<assign_statement>(s))
+						{
+							if (std::get<assign_statement>(s).m_expression_index == expr_idx)
+							{
+								std::get<assign_statement>(s).m_expression_offset = current_expr_offset;
+							}
+						}
+
+						if (std::holds_alternative<return_value_statement>(s))
+						{
+							if (std::get<return_value_statement>(s).m_expression_index == expr_idx)
+							{
+								std::get<return_value_statement>(s).m_expression_offset = current_expr_offset;
+							}
+						}
+
+						if (std::holds_alternative<jump_statement>(s))
+						{
+							if (std::get<jump_statement>(s).m_expression_index == expr_idx)
+							{
+								std::get<jump_statement>(s).m_expression_offset = current_expr_offset;
+							}
+						}
+					}
+				}
+				else
+				{
+					*error = -1; // TODO: handle error
+					break;
+				}
+			}
+
+			for (auto expr : expressions)
+			{
+				native<T_TRAITS>::free_native(expr);
+			}
+
+			for (auto s_in : program_statements)
+			{
+				statement s_out;
+
+				if (std::holds_alternative<call_statement>(s_in))
+				{
+					s_out.type	= statement_type::call;
+					s_out.arg_a = std::get<call_statement>(s_in).m_expression_offset;
+					s_out.arg_b = -1;
+				}
+				else if (std::holds_alternative<assign_statement>(s_in))
+				{
+					s_out.type	= statement_type::assign;
+					s_out.arg_a = std::get<assign_statement>(s_in).m_variable_final_index;
+					s_out.arg_b = std::get<assign_statement>(s_in).m_expression_offset;
+				}
+				else if (std::holds_alternative<return_value_statement>(s_in))
+				{
+					s_out.type	= statement_type::return_value;
+					s_out.arg_a = std::get<return_value_statement>(s_in).m_expression_offset;
+					s_out.arg_b = -1;
+				}
+				else if (std::holds_alternative<jump_statement>(s_in))
+				{
+					s_out.type	= statement_type::jump;
+					// Jumps the optimizer made unconditional keep their stale offset, only the index says there's no condition.
+					const auto& jump = std::get<jump_statement>(s_in);
+					s_out.arg_a		 = jump.m_target_index;
+					s_out.arg_b		 = (jump.m_expression_index < 0) ? -1 : jump.m_expression_offset;
+				}
+
+				program->program_statements.push_back(s_out);
+			}
+
+			// Link the expression bytecode into a single stream, statements become stores, jumps and returns.
+			{
+				typename portable<T_TRAITS>::bytecode_builder builder;
+				std::vector<int>							  statement_to_instruction;
+				std::vector<std::tuple<int, int>>			  jump_fixups; // instruction, target statement
+				bool										  linked = true;
+
+				for (const auto& s_in : program_statements)
+				{
+					statement_to_instruction.push_back(int(builder.code.size()));
+
+					auto append_expression = [&](int expr_idx) -> int {
+						if (expression_bytecode[expr_idx].size() == 0)
+						{
+							linked = false;
+							return 0;
+						}
+						return builder.append(&expression_bytecode[expr_idx][0]);
+					};
+
+					if (std::holds_alternative<call_statement>(s_in))
+					{
+						append_expression(std::get<call_statement>(s_in).m_expression_index);
+					}
+					else if (std::holds_alternative<assign_statement>(s_in))
+					{
+						const auto& assign = std::get<assign_statement>(s_in);
+						const int	reg	   = append_expression(assign.m_expression_index);
+						builder.emit(opcode::store_variable, reg, assign.m_variable_final_index, 0);
+					}
+					else if (std::holds_alternative<return_value_statement>(s_in))
+					{
+						const int reg = append_expression(std::get<return_value_statement>(s_in).m_expression_index);
+						builder.emit(opcode::ret, reg, 0, 0);
+					}
+					else if (std::holds_alternative<jump_statement>(s_in))
+					{
+						const auto& jump = std::get<jump_statement>(s_in);
+						if (jump.m_expression_index == -1)
+						{
+							jump_fixups.push_back({builder.emit(opcode::jump, 0, 0, 0), jump.m_target_index});
+						}
+						else
+						{
+							const int reg = append_expression(jump.m_expression_index);
+							jump_fixups.push_back({builder.emit(opcode::jump_if, reg, 0, 0), jump.m_target_index});
+						}
+					}
+				}
+
+				// Running off the end of the program (or jumping to an unresolved label) returns nan
+				const int end_instruction = builder.emit(opcode::ret_nan, 0, 0, 0);
+				statement_to_instruction.push_back(end_instruction);
+
+				for (auto [fixup, target] : jump_fixups)
+				{
+					const bool resolved		  = (target >= 0 && target < int(statement_to_instruction.size()));
+					builder.code[fixup].arg_a = uint16_t(resolved ? statement_to_instruction[target] : end_instruction);
+				}
+
+				// Local variables move from their binding to a frame slot, in order of first use. The binding stays for the statement path.
+				{
+					const auto		 is_local = indexer.get_local_binding_table();
+					std::vector<int> slots(is_local.size(), -1);
+					for (auto& ins : builder.code)
+					{
+						if ((ins.op == opcode::load_variable || ins.op == opcode::store_variable) && is_local[ins.arg_a])
+						{
+							if (slots[ins.arg_a] == -1 && builder.num_locals < TP_MAX_LOCALS)
+							{
+								slots[ins.arg_a] = builder.num_locals++;
+							}
+							if (slots[ins.arg_a] != -1)
+							{
+								ins.op	  = (ins.op == opcode::load_variable) ? opcode::load_local : opcode::store_local;
+								ins.arg_a = uint16_t(slots[ins.arg_a]);
+							}
+						}
+					}
+				}
+
+				if (linked && builder.valid())
+				{
+					program->program_bytecode = builder.finish();
+				}
+			}
+
+			program->binding_table = indexer.get_binding_table();
+			for (const auto& n : program->binding_table)
+			{
+				program->binding_table_cstr.push_back(n.c_str());
+			}
+
+			program->address_table		= indexer.get_address_table();
+			program->declared_variables = indexer.get_declared_variable_table();
+
+			return program;
+		}
+
+		template<typename T_TRAITS>
+		auto compile(const char* text, const variable* variables, int var_count, int* error, expression_layout layout)
+			-> typename portable<T_TRAITS>::portable_compiled_program*
+		{
+			t_indexer<T_TRAITS> indexer;
+			indexer.layout = layout;
+			for (int v = 0; v < var_count; ++v)
+			{
+				indexer.add_user_variable(variables + v);
+			}
+
+			// The indexer goes away, the program keeps the declared variables its bindings point to.
+			auto program = compile_using_indexer<T_TRAITS>(text, error, indexer);
+			if (program)
+			{
+				program->declared_variable_values = std::move(indexer.m_declared_variable_values);
+			}
+			return program;
+		}
+
+	} // namespace program_details
+} // namespace tp
+#endif // #if (TP_COMPILER_ENABLED)
+
+namespace tp
+{
+	namespace details
+	{
+#if TP_MODERN_CPP
+		template<typename T_VAL>
+		struct variable_helper
+		{
+			static inline constexpr variable readonly_var(const char* name, const T_VAL* v) noexcept
+			{
+				return {name, v}; // TODO: make distinction between rw and ro
+			}
+
+			static inline constexpr variable readwrite_var(const char* name, T_VAL* v) noexcept
+			{
+				return {name, v}; // TODO: make distinction between rw and ro
+			}
+
+			template<typename T_FUNC>
+			static inline constexpr variable function0(const char* name, T_FUNC func)
+			{
+				typedef T_VAL (*zeroargfn)();
+				return {name, zeroargfn{func}, tp::FUNCTION0 | tp::FLAG_PURE, 0};
+			}
+
+			template<typename T_FUNC>
+			static inline constexpr variable function1(const char* name, T_FUNC func)
+			{
+				typedef T_VAL (*oneargfn)(T_VAL);
+				return {name, oneargfn{func}, tp::FUNCTION1 | tp::FLAG_PURE, 0};
+			}
+
+			template<typename T_FUNC>
+			static inline constexpr variable function2(const char* name, T_FUNC func)
+			{
+				typedef T_VAL (*twoargfn)(T_VAL, T_VAL);
+				return {name, twoargfn{func}, tp::FUNCTION2 | tp::FLAG_PURE, 0};
+			}
+
+			template<typename T_FUNC>
+			static inline constexpr variable function3(const char* name, T_FUNC func)
+			{
+				typedef T_VAL (*threeargfn)(T_VAL, T_VAL, T_VAL);
+				return {name, threeargfn{func}, tp::FUNCTION3 | tp::FLAG_PURE, 0};
+			}
+
+			template<typename T_FUNC>
+			static inline constexpr variable function4(const char* name, T_FUNC func)
+			{
+				typedef T_VAL (*fourargfn)(T_VAL, T_VAL, T_VAL, T_VAL);
+				return {name, fourargfn{func}, tp::FUNCTION4 | tp::FLAG_PURE, 0};
+			}
+
+			template<typename T_FUNC>
+			static inline constexpr variable function5(const char* name, T_FUNC func)
+			{
+				typedef T_VAL (*fiveargfn)(T_VAL, T_VAL, T_VAL, T_VAL, T_VAL);
+				return {name, fiveargfn{func}, tp::FUNCTION5 | tp::FLAG_PURE, 0};
+			}
+
+			template<typename T_FUNC>
+			static inline constexpr variable function6(const char* name, T_FUNC func)
+			{
+				typedef T_VAL (*sixargfn)(T_VAL, T_VAL, T_VAL, T_VAL, T_VAL, T_VAL);
+				return {name, sixargfn{func}, tp::FUNCTION6 | tp::FLAG_PURE, 0};
+			}
+
+			template<typename T_FUNC>
+			static inline constexpr variable function7(const char* name, T_FUNC func)
+			{
+				typedef T_VAL (*sevenargfn)(T_VAL, T_VAL, T_VAL, T_VAL, T_VAL, T_VAL, T_VAL);
+				return {name, sevenargfn{func}, tp::FUNCTION7 | tp::FLAG_PURE, 0};
+			}
+		};
+#endif
+
+		struct serialized_program
+		{
+#pragma pack(push, 1)
+			struct header_chunk
+			{
+				uint16_t magic;
+				uint16_t version;
+				uint16_t num_binding_names;
+				uint16_t num_subprograms;
+			};
+
+			struct chunk_header
+			{
+				uint16_t size;
+				uint16_t padding;
+			};
+
+			struct chunk : chunk_header
+			{
+				using header = chunk_header;
+				char data[1];
+			};
+
+			using program_chunk	  = chunk;
+			using statement_chunk = chunk;
+			using data_chunk	  = chunk;
+			using string_chunk	  = chunk;
+			using user_var_chunk  = chunk;
+			using bytecode_chunk  = chunk;
+#pragma pack(pop)
+
+			static inline constexpr uint16_t magic			  = 0x1010;
+			static inline constexpr uint16_t version_bytecode = 0x0002; // adds a bytecode chunk after each subprogram's data chunk
+			static inline constexpr uint16_t version_compact  = 0x0003; // expression nodes packed in 32 bit words, leaves inline
+			static inline constexpr uint16_t version_layout	  = 0x0004; // the padding of a data chunk holds its expression_layout
+			static inline constexpr uint16_t version		  = version_layout;
+
+			template<typename T>
+			static inline constexpr T round_up_to_multiple(T value, T multiple) noexcept
+			{
+				return ((value + multiple - 1) / multiple) * multiple;
+			}
+
+			static inline uint16_t alignment()
+			{
+				return 4;
+			}
+
+			struct subprogram
+			{
+				const statement_chunk* statements{nullptr};
+				const data_chunk*	   data{nullptr};
+				const bytecode_chunk*  bytecode{nullptr};
+			};
+
+			bool has_bytecode() const noexcept
+			{
+				return header->version >= version_bytecode;
+			}
+
+			// False for buffers that aren't a program of a version this loader reads, those have no subprograms or bindings.
+			bool is_valid() const noexcept
+			{
+				return valid;
+			}
+
+			const string_chunk*	   strings{nullptr};
+			const user_var_chunk*  user_vars{nullptr};
+			void*				   raw_data{nullptr};
+			size_t				   raw_data_size{0};
+			const header_chunk*	   header{nullptr};
+			const statement_chunk* first_subprogram{nullptr};
+			bool				   valid{false};
+
+#if (TP_COMPILER_ENABLED)
+			serialized_program(const compiled_program* const* programs, int num_programs, std::vector<std::string>& user_vars_in)
+			{
+				std::vector<subprogram> subprograms;
+				subprograms.resize(num_programs);
+
+				auto user_var_count = user_vars_in.size();
+
+				auto binding_name_count = programs[0]->get_binding_array_size();
+				auto binding_names		= programs[0]->get_binding_names();
+				auto most_bindings_idx	= 0;
+				for (int subprogram_idx = 1; subprogram_idx < num_programs; ++subprogram_idx)
+				{
+					auto next_binding_name_count = programs[subprogram_idx]->get_binding_array_size();
+					auto next_binding_names		 = programs[subprogram_idx]->get_binding_names();
+
+					for (auto i = std::min(binding_name_count, next_binding_name_count); i > 0; --i)
+					{
+						if (strcmp(binding_names[i - 1], next_binding_names[i - 1]) != 0)
+						{
+							assert(false);
+						}
+					}
+
+					if (binding_name_count < next_binding_name_count)
+					{
+						most_bindings_idx  = subprogram_idx;
+						binding_name_count = next_binding_name_count;
+						binding_names	   = next_binding_names;
+					}
+				}
+
+				struct program_state
+				{
+					statement_chunk statement_data;
+					data_chunk		expression_data;
+					bytecode_chunk	bytecode_data;
+					size_t			statement_data_data_size;
+					size_t			expression_data_data_size;
+					size_t			bytecode_data_data_size;
+				};
+
+				auto [total_program_size, out_header, program_states, strs, user_var_indexes, user_var_data, user_var_data_data_size] =
+					[&]() -> std::tuple<size_t, header_chunk, std::vector<program_state>, std::vector<string_chunk>, std::vector<int>, user_var_chunk, size_t> {
+					std::vector<program_state> program_states;
+					program_states.resize(num_programs);
+
+					size_t total_program_size = 0;
+
+					header_chunk out_header;
+					out_header.magic			 = magic;
+					out_header.version			 = version;
+					out_header.num_binding_names = uint16_t(binding_name_count);
+					out_header.num_subprograms	 = uint16_t(num_programs);
+
+					total_program_size += sizeof(header_chunk);
+
+					for (int subprogram_idx = 0; subprogram_idx < num_programs; ++subprogram_idx)
+					{
+						auto& prog_state	  = program_states[subprogram_idx];
+						auto  prog			  = programs[subprogram_idx];
+						auto  expression_size = prog->get_data_size();
+						auto  num_statements  = prog->get_statement_array_size();
+						auto  statement_src	  = prog->get_statements();
+
+						prog_state.statement_data.size = uint16_t(num_statements * sizeof(statement_src[0]));
+						total_program_size += sizeof(chunk_header);
+						prog_state.statement_data_data_size = round_up_to_multiple(prog_state.statement_data.size, alignment());
+						total_program_size += prog_state.statement_data_data_size;
+
+						prog_state.expression_data.size	   = uint16_t(expression_size);
+						prog_state.expression_data.padding = uint16_t(prog->get_layout());
+						total_program_size += sizeof(chunk_header);
+						prog_state.expression_data_data_size = round_up_to_multiple(prog_state.expression_data.size, alignment());
+						total_program_size += prog_state.expression_data_data_size;
+
+						// Bytecode that doesn't fit a chunk is left out, that subprogram then runs on the statements.
+						const auto bytecode_size	  = prog->get_bytecode_size();
+						prog_state.bytecode_data.size = (bytecode_size <= 0xffff) ? uint16_t(bytecode_size) : 0;
+						total_program_size += sizeof(chunk_header);
+						prog_state.bytecode_data_data_size = round_up_to_multiple(prog_state.bytecode_data.size, alignment());
+						total_program_size += prog_state.bytecode_data_data_size;
+					}
+
+					std::vector<string_chunk> strs;
+					for (size_t i = 0; i < binding_name_count; ++i)
+					{
+						string_chunk chonk;
+						chonk.size = uint16_t(::strlen(binding_names[i]) + 1);
+						total_program_size += sizeof(chunk_header);
+						total_program_size += round_up_to_multiple(chonk.size, uint16_t(alignment()));
+						strs.push_back(chonk);
+					}
+
+					std::vector<int> user_var_indexes;
+					user_var_indexes.resize(user_var_count);
+					std::fill(std::begin(user_var_indexes), std::end(user_var_indexes), -1);
+					for (size_t i = 0; i < binding_name_count; ++i)
+					{
+						for (size_t j = 0; j < user_var_count; ++j)
+						{
+							if (user_var_indexes[j] == -1)
+							{
+								if (_stricmp(binding_names[i], user_vars_in[j].c_str()) == 0)
+								{
+									user_var_indexes[j] = int(i);
+									break;
+								}
+							}
+						}
+					}
+
+					user_var_chunk user_var_data;
+					user_var_data.size = uint16_t(sizeof(int) * user_var_count);
+					total_program_size += sizeof(chunk_header);
+					const auto user_var_data_data_size = round_up_to_multiple(user_var_data.size, alignment());
+					total_program_size += user_var_data_data_size;
+
+					return {total_program_size, out_header, program_states, strs, user_var_indexes, user_var_data, user_var_data_data_size};
+				}();
+
+				//
+
+				if (total_program_size > sizeof(out_header))
+				{
+					assert(total_program_size > sizeof(header_chunk) + user_var_data_data_size + sizeof(chunk_header));
+					char* const serialized_program = (char*)::malloc(total_program_size);
+					char*		p				   = serialized_program;
+					if (p != nullptr)
+					{
+						//
+
+						this->header = (header_chunk*)p;
+						::memcpy(p, &out_header, sizeof(out_header));
+						p += sizeof(header_chunk);
+
+						first_subprogram = (statement_chunk*)p;
+
+						for (int subprogram_idx = 0; subprogram_idx < num_programs; ++subprogram_idx)
+						{
+							auto& prog_state = program_states[subprogram_idx];
+							auto& subprogram = subprograms[subprogram_idx];
+
+							auto prog		   = programs[subprogram_idx];
+							auto statement_src = prog->get_statements();
+
+							auto expression_src = prog->get_data();
+
+							subprogram.statements = (statement_chunk*)p;
+							::memcpy(p, &prog_state.statement_data, sizeof(chunk_header));
+							p += sizeof(chunk_header);
+							::memcpy(p, &statement_src[0], prog_state.statement_data.size);
+							p += prog_state.statement_data_data_size;
+
+							subprogram.data = (data_chunk*)p;
+							::memcpy(p, &prog_state.expression_data, sizeof(chunk_header));
+							p += sizeof(chunk_header);
+							::memcpy(p, &expression_src[0], prog_state.expression_data.size);
+							p += prog_state.expression_data_data_size;
+
+							subprogram.bytecode = (bytecode_chunk*)p;
+							::memcpy(p, &prog_state.bytecode_data, sizeof(chunk_header));
+							p += sizeof(chunk_header);
+							if (prog_state.bytecode_data.size > 0)
+							{
+								::memcpy(p, prog->get_bytecode(), prog_state.bytecode_data.size);
+							}
+							p += prog_state.bytecode_data_data_size;
+						}
+
+						this->strings = (string_chunk*)p;
+
+						for (size_t i = 0; i < binding_name_count; ++i)
+						{
+							::memcpy(p, &strs[i], sizeof(chunk_header));
+							p += sizeof(chunk_header);
+
+							::memcpy(p, binding_names[i], strs[i].size - 1);
+							p[strs[i].size - 1] = '\0';
+							p += round_up_to_multiple(strs[i].size, alignment());
+						}
+
+						this->user_vars = (user_var_chunk*)p;
+						::memcpy(p, &user_var_data, sizeof(chunk_header));
+						p += sizeof(chunk_header);
+						::memcpy(p, &user_var_indexes[0], user_var_data.size);
+						p += user_var_data_data_size;
+
+						//
+
+						this->raw_data		= serialized_program;
+						this->raw_data_size = total_program_size;
+						this->valid			= true;
+					}
+				}
+			}
+#endif // #if (TP_COMPILER_ENABLED)
+
+			serialized_program(const void* data, size_t data_size)
+			{
+				this->raw_data		= nullptr;
+				this->raw_data_size = data_size;
+
+				const char* p = (const char*)data;
+
+				if (data_size < sizeof(header_chunk))
+				{
+					return;
+				}
+
+				this->header = (header_chunk*)p;
+				p += sizeof(header_chunk);
+
+				// Files before version_compact hold 64 bit nodes the evaluators can't read, they have to be serialized again.
+				if (header->magic != magic || header->version < version_compact || header->version > version)
+				{
+					return;
+				}
+
+				first_subprogram = (statement_chunk*)p;
+
+				for (int subprogram_idx = 0; subprogram_idx < this->header->num_subprograms; ++subprogram_idx)
+				{
+					auto subprogram_statements = (statement_chunk*)p;
+					p += sizeof(statement_chunk::header);
+					p += round_up_to_multiple(subprogram_statements->size, alignment());
+
+					auto subprogram_data = (data_chunk*)p;
+					p += sizeof(data_chunk::header);
+					p += round_up_to_multiple(subprogram_data->size, alignment());
+
+					if (has_bytecode())
+					{
+						auto subprogram_bytecode = (bytecode_chunk*)p;
+						p += sizeof(bytecode_chunk::header);
+						p += round_up_to_multiple(subprogram_bytecode->size, alignment());
+					}
+				}
+
+				this->strings = (string_chunk*)p;
+
+				for (size_t i = 0; i < header->num_binding_names; ++i)
+				{
+					auto chonk = (const string_chunk*)p;
+					p += sizeof(string_chunk::header);
+					p += round_up_to_multiple(chonk->size, alignment());
+				}
+
+				this->user_vars = (user_var_chunk*)p;
+				p += sizeof(user_var_chunk::header);
+				p += round_up_to_multiple(this->user_vars->size, alignment());
+
+				this->valid = true;
+			}
+
+			serialized_program(std::tuple<const void*, size_t> args) : serialized_program(std::get<0>(args), std::get<1>(args)) {}
+
+			static inline serialized_program* create_using_buffer(void* data, size_t data_size)
+			{
+				auto prog	   = new serialized_program(data, data_size);
+				prog->raw_data = data;
+				return prog;
+			}
+
+			~serialized_program()
+			{
+				if (raw_data)
+				{
+					::free(raw_data);
+				}
+			}
+
+			const std::tuple<statement_chunk*, data_chunk*, bytecode_chunk*> get_subprogram_data(int subprogram_index) const noexcept
+			{
+				const char* p = (const char*)first_subprogram;
+
+				for (int i = 0; i < get_num_subprograms(); ++i)
+				{
+					auto statements = (statement_chunk*)p;
+					p += sizeof(statement_chunk::header);
+					p += round_up_to_multiple(statements->size, alignment());
+
+					auto subprogram_data = (data_chunk*)p;
+					p += sizeof(data_chunk::header);
+					p += round_up_to_multiple(subprogram_data->size, alignment());
+
+					bytecode_chunk* subprogram_bytecode = nullptr;
+					if (has_bytecode())
+					{
+						subprogram_bytecode = (bytecode_chunk*)p;
+						p += sizeof(bytecode_chunk::header);
+						p += round_up_to_multiple(subprogram_bytecode->size, alignment());
+					}
+
+					if (i == subprogram_index)
+					{
+						return std::tuple<statement_chunk*, data_chunk*, bytecode_chunk*>(statements, subprogram_data, subprogram_bytecode);
+					}
+				}
+
+				return std::tuple<statement_chunk*, data_chunk*, bytecode_chunk*>(nullptr, nullptr, nullptr);
+			}
+
+			const statement* get_statements_array(int subprogram_index) const noexcept
+			{
+				auto  tup		 = get_subprogram_data(subprogram_index);
+				auto& statements = std::get<0>(tup);
+				return reinterpret_cast<const statement*>(&statements->data[0]);
+			}
+
+			size_t get_statements_array_size(int subprogram_index) const noexcept
+			{
+				auto  tup		 = get_subprogram_data(subprogram_index);
+				auto& statements = std::get<0>(tup);
+				return statements->size / sizeof(statement);
+			}
+
+			const void* get_expression_data(int subprogram_index) const noexcept
+			{
+				auto  tup			  = get_subprogram_data(subprogram_index);
+				auto& subprogram_data = std::get<1>(tup);
+				return &subprogram_data->data[0];
+			}
+
+			expression_layout get_expression_layout(int subprogram_index) const noexcept
+			{
+				if (header->version < version_layout)
+				{
+					return expression_layout::pre_order;
+				}
+				auto  tup			  = get_subprogram_data(subprogram_index);
+				auto& subprogram_data = std::get<1>(tup);
+				return expression_layout(subprogram_data->padding);
+			}
+
+			size_t get_expression_size(int subprogram_index) const noexcept
+			{
+				auto  tup			  = get_subprogram_data(subprogram_index);
+				auto& subprogram_data = std::get<1>(tup);
+				return subprogram_data->size;
+			}
+
+			const void* get_bytecode(int subprogram_index) const noexcept
+			{
+				auto  tup				  = get_subprogram_data(subprogram_index);
+				auto& subprogram_bytecode = std::get<2>(tup);
+				return (subprogram_bytecode != nullptr && subprogram_bytecode->size > 0) ? &subprogram_bytecode->data[0] : nullptr;
+			}
+
+			size_t get_bytecode_size(int subprogram_index) const noexcept
+			{
+				auto  tup				  = get_subprogram_data(subprogram_index);
+				auto& subprogram_bytecode = std::get<2>(tup);
+				return (subprogram_bytecode != nullptr) ? subprogram_bytecode->size : 0;
+			}
+
+			size_t get_num_bindings() const noexcept
+			{
+				return valid ? this->header->num_binding_names : 0;
+			}
+
+			const char* get_binding_string(uint16_t index) const noexcept
+			{
+				if (get_num_bindings() > index)
+				{
+					auto p = (const char*)this->strings;
+					for (size_t i = 0; i < this->header->num_binding_names; ++i)
+					{
+						auto chonk = (const string_chunk*)p;
+						if (i == index)
+						{
+							return &chonk->data[0];
+						}
+
+						p += sizeof(string_chunk::header);
+						p += round_up_to_multiple(chonk->size, alignment());
+					}
+				}
+				return nullptr;
+			}
+
+			size_t get_raw_data_size() const noexcept
+			{
+				return raw_data_size;
+			}
+
+			const void* get_raw_data() const noexcept
+			{
+				return raw_data;
+			}
+
+			size_t get_num_user_vars() const noexcept
+			{
+				return (user_vars != nullptr) ? user_vars->size / sizeof(int) : 0;
+			}
+
+			const int* get_user_vars() const noexcept
+			{
+				return (user_vars != nullptr) ? (int*)&user_vars->data[0] : nullptr;
+			}
+
+			uint16_t get_num_subprograms() const noexcept
+			{
+				return valid ? header->num_subprograms : 0;
+			}
+		};
+	} // namespace details
+
+#if (TP_COMPILER_ENABLED)
+	namespace aot_details
+	{
+		template<typename T_ATOM>
+		static inline std::string atom_literal(T_ATOM v)
+		{
+			if (v != v)
+			{
+				return "std::numeric_limits<t_atom>::quiet_NaN()";
+			}
+			if (v == std::numeric_limits<T_ATOM>::infinity())
+			{
+				return "std::numeric_limits<t_atom>::infinity()";
+			}
+			if (v == -std::numeric_limits<T_ATOM>::infinity())
+			{
+				return "-std::numeric_limits<t_atom>::infinity()";
+			}
+
+			// Hex floats round trip exactly.
+			char buffer[64];
+			::snprintf(buffer, sizeof(buffer), "%a", double(v));
+			return std::string("t_atom(") + buffer + ")";
+		}
+
+		// The T_NATIVE member a builtin function of native_builtins::functions points at, nullptr for any other address.
+		template<typename T_NATIVE>
+		static inline const char* native_function_name(const void* address)
+		{
+#define TP_NATIVE_FUNCTION(fn) {(const void*)&T_NATIVE::fn, #fn}
+			static const std::pair<const void*, const char*> functions[] = {
+				TP_NATIVE_FUNCTION(fabs),  TP_NATIVE_FUNCTION(acos), TP_NATIVE_FUNCTION(asin), TP_NATIVE_FUNCTION(atan), TP_NATIVE_FUNCTION(atan2),
+				TP_NATIVE_FUNCTION(ceil),  TP_NATIVE_FUNCTION(cos),	 TP_NATIVE_FUNCTION(cosh), TP_NATIVE_FUNCTION(e),	 TP_NATIVE_FUNCTION(exp),
+				TP_NATIVE_FUNCTION(fac),   TP_NATIVE_FUNCTION(floor), TP_NATIVE_FUNCTION(log), TP_NATIVE_FUNCTION(log10), TP_NATIVE_FUNCTION(ncr),
+				TP_NATIVE_FUNCTION(npr),   TP_NATIVE_FUNCTION(pi),	 TP_NATIVE_FUNCTION(pow),  TP_NATIVE_FUNCTION(sin),	 TP_NATIVE_FUNCTION(sinh),
+				TP_NATIVE_FUNCTION(sqrt),  TP_NATIVE_FUNCTION(tan),	 TP_NATIVE_FUNCTION(tanh),
+			};
+#undef TP_NATIVE_FUNCTION
+
+			for (const auto& f : functions)
+			{
+				if (f.first == address)
+				{
+					return f.second;
+				}
+			}
+			return nullptr;
+		}
 
-					program->program_expression_buffer.reset(new_expr_buffer);
+		// Translates one subprogram's bytecode into a function body, registers become locals and jumps become gotos. Calls of a
+		// binding of prog named after a builtin function call t_native directly.
+		template<typename T_TRAITS>
+		static inline bool write_subprogram(std::string& out, const unsigned char* bytecode, const std::string& name, const details::serialized_program& prog)
+		{
+			using t_atom = typename T_TRAITS::t_atom;
 
-					// Fixup any expression indexes
-					for (auto& s : program_statements)
+			if (bytecode == nullptr)
+			{
+				return false;
+			}
+
+			const auto header		= (const bytecode_header*)bytecode;
+			const auto instructions = (const instruction*)(bytecode + sizeof(bytecode_header));
+			const auto constants	= (const t_atom*)(instructions + header->num_instructions);
+			const int  count		= header->num_instructions;
+
+			auto reg	 = [](int r) { return "r" + std::to_string(r); };
+			auto label	 = [](int l) { return "l" + std::to_string(l); };
+			auto binding = [](int b) { return "bindings[" + std::to_string(b) + "]"; };
+			auto local	 = [](int l) { return "v" + std::to_string(l); };
+			auto target	 = [&](int t) { return (t < count) ? t : count; };
+
+			std::vector<bool> is_target(count + 1, false);
+			for (int index = 0; index < count; ++index)
+			{
+				if (instructions[index].op == opcode::jump || instructions[index].op == opcode::jump_if)
+				{
+					is_target[target(instructions[index].arg_a)] = true;
+				}
+			}
+
+			out += "\tstatic inline t_vector " + name + "(const void* const* bindings) noexcept\n\t{\n";
+
+			if (header->num_registers > 0)
+			{
+				out += "\t\tt_vector ";
+				for (int r = 0; r < header->num_registers; ++r)
+				{
+					out += ((r > 0) ? ", " : "") + reg(r) + "{}";
+				}
+				out += ";\n";
+			}
+
+			if (header->num_locals > 0)
+			{
+				out += "\t\tt_vector ";
+				for (int l = 0; l < header->num_locals; ++l)
+				{
+					out += ((l > 0) ? ", " : "") + local(l) + " = T_TRAITS::explicit_load_atom(0)";
+				}
+				out += ";\n";
+			}
+
+			for (int index = 0; index < count; ++index)
+			{
+				const instruction& i = instructions[index];
+
+				if (is_target[index])
+				{
+					out += "\t" + label(index) + ":\n";
+				}
+
+				out += "\t\t";
+
+				if (i.op >= opcode::call0 && i.op <= opcode::closure7)
+				{
+					const bool is_closure = i.op >= opcode::closure0;
+					const int  arity	  = int(i.op) - int(is_closure ? opcode::closure0 : opcode::call0);
+
+					std::string signature = is_closure ? "const void*" : "";
+					std::string arguments = is_closure ? binding(i.arg_b) : "";
+					for (int a = 0; a < arity; ++a)
 					{
-						if (std::holds_alternative<call_statement>(s))
-						{
-							if (std::get<call_statement>(s).m_expression_index == expr_idx)
-							{
-								std::get<call_statement>(s).m_expression_offset = current_expr_offset;
-							}
-						}
+						const bool first = (a == 0) && !is_closure;
+						signature += (first ? "" : ", ") + std::string("t_vector");
+						arguments += (first ? "" : ", ") + reg(i.reg + a);
+					}
 
-						if (std::holds_alternative<assign_statement>(s))
-						{
-							if (std::get<assign_statement>(s).m_expression_index == expr_idx)
-							{
-								std::get<assign_statement>(s).m_expression_offset = current_expr_offset;
-							}
-						}
+					const std::string call = "((t_vector(*)(" + signature + "))" + binding(i.arg_a) + ")(" + arguments + ")";
 
-						if (std::holds_alternative<return_value_statement>(s))
+					// The host decides at load time whether a name resolves to a user function or the builtin, so a builtin is only
+					// called directly, where it can be inlined, while the binding still points at it.
+					const char* native = nullptr;
+					if (!is_closure && size_t(i.arg_a) < prog.get_num_bindings())
+					{
+						const char* binding_name = prog.get_binding_string(uint16_t(i.arg_a));
+						const auto	builtin		 = T_TRAITS::t_vector_builtins::find_by_name(binding_name, int(strlen(binding_name)), nullptr);
+						if (builtin && eval_details::type_mask(builtin->type) == FUNCTION0 + arity)
 						{
-							if (std::get<return_value_statement>(s).m_expression_index == expr_idx)
-							{
-								std::get<return_value_statement>(s).m_expression_offset = current_expr_offset;
-							}
+							native = native_function_name<typename T_TRAITS::t_native>(builtin->address);
 						}
+					}
 
-						if (std::holds_alternative<jump_statement>(s))
-						{
-							if (std::get<jump_statement>(s).m_expression_index == expr_idx)
-							{
-								std::get<jump_statement>(s).m_expression_offset = current_expr_offset;
-							}
-						}
+					if (native)
+					{
+						const std::string fn = std::string("t_native::") + native;
+						out += reg(i.reg) + " = (" + binding(i.arg_a) + " == (const void*)&" + fn + ") ? " + fn + "(" + arguments + ") : " + call + ";\n";
 					}
+					else
+					{
+						out += reg(i.reg) + " = " + call + ";\n";
+					}
+					continue;
 				}
-				else
+
+				if (i.op >= opcode::add && i.op <= opcode::negate_logical_notnot)
 				{
-					*error = -1; // TODO: handle error
+					const std::string fn = builtin_operator_names[int(i.op) - int(opcode::add)];
+					if (i.op < opcode::negate)
+					{
+						out += reg(i.reg) + " = t_native::" + fn + "(" + reg(i.arg_a) + ", " + reg(i.arg_b) + ");\n";
+					}
+					else
+					{
+						out += reg(i.reg) + " = t_native::" + fn + "(" + reg(i.arg_a) + ");\n";
+					}
+					continue;
+				}
+
+				if (i.op >= opcode::add_k && i.op <= opcode::divide_k)
+				{
+					const std::string fn = builtin_operator_names[int(i.op) - int(opcode::add_k)];
+					out += reg(i.reg) + " = t_native::" + fn + "(" + reg(i.arg_a) + ", T_TRAITS::load_atom(" + atom_literal(constants[i.arg_b]) + "));\n";
+					continue;
+				}
+
+				switch (i.op)
+				{
+				case opcode::load_constant:
+					out += reg(i.reg) + " = T_TRAITS::load_atom(" + atom_literal(constants[i.arg_a]) + ");\n";
+					break;
+				case opcode::load_variable:
+					out += reg(i.reg) + " = *((const t_vector*)" + binding(i.arg_a) + ");\n";
+					break;
+				case opcode::store_variable:
+					out += "*((t_vector*)" + binding(i.arg_a) + ") = " + reg(i.reg) + ";\n";
+					break;
+				case opcode::load_local:
+					out += reg(i.reg) + " = " + local(i.arg_a) + ";\n";
+					break;
+				case opcode::store_local:
+					out += local(i.arg_a) + " = " + reg(i.reg) + ";\n";
+					break;
+				case opcode::select:
+				case opcode::fma:
+				case opcode::clamp:
+				{
+					const std::string fn = (i.op == opcode::select) ? "select" : (i.op == opcode::fma) ? "fma" : "clamp";
+					out += reg(i.reg) + " = t_native::" + fn + "(" + reg(i.reg) + ", " + reg(i.reg + 1) + ", " + reg(i.reg + 2) + ");\n";
+					break;
+				}
+				case opcode::min:
+				case opcode::max:
+					out += reg(i.reg) + " = t_native::" + ((i.op == opcode::min) ? "min" : "max") + "(" + reg(i.arg_a) + ", " + reg(i.arg_b) + ");\n";
+					break;
+				case opcode::jump:
+					out += "goto " + label(target(i.arg_a)) + ";\n";
+					break;
+				case opcode::jump_if:
+					out += "if (T_TRAITS::lane_mask(" + reg(i.reg) + ")) goto " + label(target(i.arg_a)) + ";\n";
+					break;
+				case opcode::ret:
+					out += "return " + reg(i.reg) + ";\n";
 					break;
+				case opcode::ret_nan:
+					out += "return T_TRAITS::nan();\n";
+					break;
+				default:
+					return false;
 				}
 			}
 
-			for (auto s_in : program_statements)
+			const bool falls_through = (count == 0) || (instructions[count - 1].op != opcode::ret && instructions[count - 1].op != opcode::ret_nan &&
+														   instructions[count - 1].op != opcode::jump);
+			if (is_target[count])
 			{
-				statement s_out;
+				out += "\t" + label(count) + ":\n";
+			}
+			if (is_target[count] || falls_through)
+			{
+				out += "\t\treturn T_TRAITS::nan();\n";
+			}
+			out += "\t}\n\n";
+			return true;
+		}
 
-				if (std::holds_alternative<call_statement>(s_in))
-				{
-					s_out.type	= statement_type::call;
-					s_out.arg_a = std::get<call_statement>(s_in).m_expression_offset;
-					s_out.arg_b = -1;
-				}
-				else if (std::holds_alternative<assign_statement>(s_in))
+		// Emits a header declaring 'template<typename T_TRAITS> struct name' with one static function per subprogram. Each function takes
+		// the same binding array eval_program_bytecode would, builtin operators and functions call T_TRAITS::t_native directly.
+		template<typename T_TRAITS>
+		static inline bool generate_cpp(const details::serialized_program& prog, const char* name, const char* name_space, std::string& out)
+		{
+			if (!prog.is_valid())
+			{
+				return false;
+			}
+
+			std::string body;
+
+			const int num_subprograms = prog.get_num_subprograms();
+			for (int s = 0; s < num_subprograms; ++s)
+			{
+				if (!write_subprogram<T_TRAITS>(body, (const unsigned char*)prog.get_bytecode(s), "subprogram_" + std::to_string(s), prog))
 				{
-					s_out.type	= statement_type::assign;
-					s_out.arg_a = std::get<assign_statement>(s_in).m_variable_final_index;
-					s_out.arg_b = std::get<assign_statement>(s_in).m_expression_offset;
+					return false;
 				}
-				else if (std::holds_alternative<return_value_statement>(s_in))
+			}
+
+			const std::string indent = name_space ? "\t" : "";
+			auto			  indented = [&](const std::string& text) {
+				  std::string result;
+				  size_t	  begin = 0;
+				  while (begin < text.size())
+				  {
+					  auto end = text.find('\n', begin);
+					  end	   = (end == std::string::npos) ? text.size() : end + 1;
+					  if (end - begin > 1)
+					  {
+						  result += indent;
+					  }
+					  result.append(text, begin, end - begin);
+					  begin = end;
+				  }
+				  return result;
+			};
+
+			std::string s;
+			s += "template<typename T_TRAITS>\n";
+			s += "struct " + std::string(name) + "\n{\n";
+			s += "\tusing t_atom\t = typename T_TRAITS::t_atom;\n";
+			s += "\tusing t_vector\t = typename T_TRAITS::t_vector;\n";
+			s += "\tusing t_native\t = typename T_TRAITS::t_native;\n";
+			s += "\tusing t_function = t_vector (*)(const void* const* bindings);\n\n";
+
+			s += "\tstatic constexpr int num_subprograms = " + std::to_string(num_subprograms) + ";\n";
+			s += "\tstatic constexpr int num_bindings\t = " + std::to_string(prog.get_num_bindings()) + ";\n\n";
+
+			s += "\t// Binding names in binding array order, set up the array exactly as for the serialized program.\n";
+			s += "\tstatic constexpr const char* binding_names[] = {";
+			for (size_t b = 0; b < prog.get_num_bindings(); ++b)
+			{
+				s += "\"" + std::string(prog.get_binding_string(uint16_t(b))) + "\", ";
+			}
+			s += "nullptr};\n\n";
+
+			s += "\t// Binding indexes of declared variables, terminated by -1.\n";
+			s += "\tstatic constexpr int user_vars[] = {";
+			for (size_t v = 0; v < prog.get_num_user_vars(); ++v)
+			{
+				s += std::to_string(prog.get_user_vars()[v]) + ", ";
+			}
+			s += "-1};\n\n";
+
+			s += body;
+
+			s += "\tstatic inline t_function get_subprogram(int index) noexcept\n\t{\n";
+			s += "\t\tconstexpr t_function subprograms[] = {";
+			for (int sp = 0; sp < num_subprograms; ++sp)
+			{
+				s += "subprogram_" + std::to_string(sp) + ", ";
+			}
+			s += "nullptr};\n";
+			s += "\t\treturn (index >= 0 && index < num_subprograms) ? subprograms[index] : nullptr;\n\t}\n";
+			s += "};\n";
+
+			out = "// Generated by tinyprog, do not edit.\n#pragma once\n\n#include <limits>\n\n";
+			if (name_space)
+			{
+				out += "namespace " + std::string(name_space) + "\n{\n" + indented(s) + "} // namespace " + name_space + "\n";
+			}
+			else
+			{
+				out += s;
+			}
+			return true;
+		}
+	} // namespace aot_details
+#endif // #if (TP_COMPILER_ENABLED)
+
+	template<typename T_TRAITS>
+	struct impl
+	{
+		using env_traits	  = T_TRAITS;
+		using variable		  = ::tp::variable;
+		using variable_lookup = ::tp::variable_lookup;
+		using t_atom		  = typename env_traits::t_atom;
+		using t_vector		  = typename env_traits::t_vector;
+#if TP_MODERN_CPP
+		using variable_factory = details::variable_helper<t_vector>;
+#endif // #if TP_MODERN_CPP
+		using serialized_program = details::serialized_program;
+#if (TP_COMPILER_ENABLED)
+		using t_indexer = program_details::t_indexer<T_TRAITS>;
+#endif // #if (TP_COMPILER_ENABLED)
+
+		// Storage for one invocation of a program: a private copy of the binding array whose declared variables point into a
+		// frame owned by the context. The program is only read, so one program can run on many threads with a context each.
+		class execution_context
+		{
+		public:
+			execution_context(const void* const* bindings, size_t num_bindings, const int* declared_variables, size_t num_declared_variables)
+				: m_bindings(num_bindings, nullptr)
+				, m_declared(declared_variables, declared_variables + num_declared_variables)
+				, m_frame(num_declared_variables, env_traits::explicit_load_atom(0))
+			{
+				if (bindings)
 				{
-					s_out.type	= statement_type::return_value;
-					s_out.arg_a = std::get<return_value_statement>(s_in).m_expression_offset;
-					s_out.arg_b = -1;
+					std::copy(bindings, bindings + num_bindings, m_bindings.begin());
 				}
-				else if (std::holds_alternative<jump_statement>(s_in))
+
+				for (size_t v = 0; v < m_declared.size(); ++v)
 				{
-					s_out.type	= statement_type::jump;
-					s_out.arg_a = std::get<jump_statement>(s_in).m_target_index;
-					s_out.arg_b = std::get<jump_statement>(s_in).m_expression_offset;
+					// Declared variables a subprogram never references have no binding.
+					if (m_declared[v] >= 0 && size_t(m_declared[v]) < m_bindings.size())
+					{
+						m_bindings[m_declared[v]] = &m_frame[v];
+					}
 				}
+			}
 
-				program->program_statements.push_back(s_out);
+			// The bindings of a serialized program that aren't declared variables still have to be bound, by bind() or in bindings.
+			execution_context(const serialized_program& prog, const void* const* bindings = nullptr)
+				: execution_context(bindings, prog.get_num_bindings(), prog.get_user_vars(), prog.get_num_user_vars())
+			{
 			}
 
-			program->binding_table = indexer.get_binding_table();
-			for (const auto& n : program->binding_table)
+#if (TP_COMPILER_ENABLED)
+			execution_context(const compiled_program* prog)
+				: execution_context(prog->get_binding_addresses(), prog->get_binding_array_size(), prog->get_declared_variables(), prog->get_num_declared_variables())
 			{
-				program->binding_table_cstr.push_back(n.c_str());
 			}
+#endif // #if (TP_COMPILER_ENABLED)
 
-			program->address_table = indexer.get_address_table();
+			execution_context(const execution_context&)			   = delete;
+			execution_context& operator=(const execution_context&) = delete;
 
-			return program;
-		}
+			void bind(size_t index, const void* address) noexcept
+			{
+				m_bindings[index] = address;
+			}
 
-		template<typename T_TRAITS>
-		auto compile(const char* text, const variable* variables, int var_count, int* error) -> typename portable<T_TRAITS>::portable_compiled_program*
+			const void* const* get_bindings() const noexcept
+			{
+				return m_bindings.data();
+			}
+
+			size_t get_num_bindings() const noexcept
+			{
+				return m_bindings.size();
+			}
+
+			size_t get_num_declared_variables() const noexcept
+			{
+				return m_frame.size();
+			}
+
+			// Current value of the i-th declared variable of this invocation.
+			t_vector* get_declared_variable(size_t i) noexcept
+			{
+				return &m_frame[i];
+			}
+
+			// Declared variables start from zero again.
+			void reset() noexcept
+			{
+				std::fill(m_frame.begin(), m_frame.end(), env_traits::explicit_load_atom(0));
+			}
+
+		private:
+			std::vector<const void*> m_bindings;
+			std::vector<int>		 m_declared;
+			std::vector<t_vector>	 m_frame; // never resized, m_bindings points into it
+		};
+
+		// Re-evaluates an expression or a program, keeping the result of every subtree until one of the variables it reads is marked
+		// dirty. Variables written by the program's assign statements are marked automatically, anything else that changes between runs
+		// has to go through mark_dirty(). Calls of functions that aren't pure, closures and the nodes above them always run. The binding
+		// array is not copied and has to outlive the context.
+		class incremental_context
 		{
-			t_indexer<T_TRAITS> indexer;
-			for (int v = 0; v < var_count; ++v)
+		public:
+			// The root node of an expression, e.g. compiled_expr::get_data() + get_root_offset().
+			incremental_context(const void* expr_buffer, const void* const* bindings, size_t num_bindings)
+				: incremental_context(nullptr, 0, expr_buffer, bindings, num_bindings)
 			{
-				indexer.add_user_variable(variables + v);
 			}
-			return compile_using_indexer<T_TRAITS>(text, error, indexer);
-		}
 
-	} // namespace program_details
-} // namespace tp
+			// A program, every statement's expression gets its own cached tree.
+			incremental_context(const statement* statements, int num_statements, const void* expr_buffer, const void* const* bindings, size_t num_bindings)
+				: m_statements(statements)
+				, m_num_statements(num_statements)
+				, m_bindings(bindings)
+				, m_num_bindings(num_bindings)
+				, m_roots(statements ? num_statements : 1)
+				, m_variable_first(num_bindings + 1, 0)
+			{
+				// Sizes first, then the nodes in pre-order.
+				auto for_each_root = [&](auto&& f) {
+					for (size_t r = 0; r < m_roots.size(); ++r)
+					{
+						const int offset = statements ? expression_offset(statements[r]) : 0;
+						m_roots[r]		 = (offset >= 0) ? f((const unsigned char*)expr_buffer + offset) : -1;
+					}
+				};
+				int num_nodes = 0, num_children = 0, num_variables = 0;
+				for_each_root([&](const unsigned char* base) { return count(OPERAND_NODE, base, num_nodes, num_children, num_variables); });
+
+				m_nodes.resize(num_nodes);
+				m_children.resize(num_children);
+				m_variable_nodes.resize(num_variables);
+				int next_node  = 0;
+				int next_child = 0;
+				for_each_root([&](const unsigned char* base) { return build(OPERAND_NODE, base, -1, next_node, next_child); });
+
+				// Variable nodes grouped by binding.
+				for (const auto& n : m_nodes)
+				{
+					if (n.binding >= 0)
+					{
+						++m_variable_first[n.binding + 1];
+					}
+				}
+				for (size_t b = 0; b < num_bindings; ++b)
+				{
+					m_variable_first[b + 1] += m_variable_first[b];
+				}
+				std::vector<int> fill(m_variable_first);
+				for (int i = 0; i < num_nodes; ++i)
+				{
+					if (m_nodes[i].binding >= 0)
+					{
+						m_variable_nodes[fill[m_nodes[i].binding]++] = i;
+					}
+				}
+			}
+
+			incremental_context(serialized_program& prog, int subprogram, const void* const* bindings)
+				: incremental_context(prog.get_statements_array(subprogram), (int)prog.get_statements_array_size(subprogram), prog.get_expression_data(subprogram), bindings,
+					  prog.get_num_bindings())
+			{
+			}
+
+#if (TP_COMPILER_ENABLED)
+			incremental_context(const compiled_expr* n)
+				: incremental_context(n->get_data() + n->get_root_offset(), n->get_binding_addresses(), n->get_binding_array_size())
+			{
+			}
+
+			incremental_context(const compiled_program* prog)
+				: incremental_context(prog->get_statements(), (int)prog->get_statement_array_size(), prog->get_data(), prog->get_binding_addresses(),
+					  prog->get_binding_array_size())
+			{
+			}
 #endif // #if (TP_COMPILER_ENABLED)
 
-namespace tp
-{
-	namespace details
-	{
-#if TP_MODERN_CPP
-		template<typename T_VAL>
-		struct variable_helper
-		{
-			static inline constexpr variable readonly_var(const char* name, const T_VAL* v) noexcept
+			incremental_context(const incremental_context&)			   = delete;
+			incremental_context& operator=(const incremental_context&) = delete;
+
+			// The value bound at index changed since the last eval().
+			void mark_dirty(int binding) noexcept
+			{
+				// Every ancestor is cleared, a lazy operator may have left a child uncomputed below a cached parent.
+				for (int k = m_variable_first[binding]; k < m_variable_first[binding + 1]; ++k)
+				{
+					for (int i = m_variable_nodes[k]; i >= 0; i = m_nodes[i].parent)
+					{
+						m_nodes[i].valid = false;
+					}
+				}
+			}
+
+			void mark_dirty(const void* address) noexcept
+			{
+				for (size_t b = 0; b < m_num_bindings; ++b)
+				{
+					if (m_bindings[b] == address)
+					{
+						mark_dirty(int(b));
+					}
+				}
+			}
+
+			void mark_all_dirty() noexcept
+			{
+				for (auto& n : m_nodes)
+				{
+					n.valid = false;
+				}
+			}
+
+			t_vector eval()
 			{
-				return {name, v}; // TODO: make distinction between rw and ro
+				m_num_evaluated = 0;
+				if (!m_statements)
+				{
+					return eval_node(m_roots[0]);
+				}
+				return run_statements(
+					m_statements, m_num_statements, m_bindings, [&](int statement_index, int) { return eval_node(m_roots[statement_index]); },
+					[&](int binding) { mark_dirty(binding); });
 			}
 
-			static inline constexpr variable readwrite_var(const char* name, T_VAL* v) noexcept
+			// Nodes the last eval() computed instead of taking from the cache.
+			int get_num_evaluated() const noexcept
 			{
-				return {name, v}; // TODO: make distinction between rw and ro
+				return m_num_evaluated;
 			}
 
-			template<typename T_FUNC>
-			static inline constexpr variable function0(const char* name, T_FUNC func)
+			int get_num_nodes() const noexcept
 			{
-				typedef T_VAL (*zeroargfn)();
-				return {name, zeroargfn{func}, tp::FUNCTION0 | tp::FLAG_PURE, 0};
+				return int(m_nodes.size());
 			}
 
-			template<typename T_FUNC>
-			static inline constexpr variable function1(const char* name, T_FUNC func)
+		private:
+			// Leaf operands get a node too, so a variable marks its parents dirty.
+			struct node
+			{
+				const expr_portable<env_traits>* expr; // nullptr for a leaf operand
+				const unsigned char*			 base;
+				uint32_t						 operand;
+				int								 parent;
+				int								 first_child;
+				int								 binding; // variables only, -1 otherwise
+				bool							 valid;
+				bool							 always;
+				t_vector						 value;
+			};
+
+			static int expression_offset(const statement& s) noexcept
 			{
-				typedef T_VAL (*oneargfn)(T_VAL);
-				return {name, oneargfn{func}, tp::FUNCTION1 | tp::FLAG_PURE, 0};
+				return (s.type == statement_type::jump) ? s.arg_b : (s.type == statement_type::assign) ? s.arg_b : s.arg_a;
 			}
 
-			template<typename T_FUNC>
-			static inline constexpr variable function2(const char* name, T_FUNC func)
+			static int arity(const expr_portable<env_traits>* n) noexcept
 			{
-				typedef T_VAL (*twoargfn)(T_VAL, T_VAL);
-				return {name, twoargfn{func}, tp::FUNCTION2 | tp::FLAG_PURE, 0};
+				return n ? eval_details::arity(int(n->type)) : 0;
 			}
 
-			template<typename T_FUNC>
-			static inline constexpr variable function3(const char* name, T_FUNC func)
+			static const expr_portable<env_traits>* operand_node(uint32_t operand, const unsigned char* base) noexcept
 			{
-				typedef T_VAL (*threeargfn)(T_VAL, T_VAL, T_VAL);
-				return {name, threeargfn{func}, tp::FUNCTION3 | tp::FLAG_PURE, 0};
+				return ((operand & OPERAND_TAG_MASK) == OPERAND_NODE) ? (const expr_portable<env_traits>*)(base + eval_details::operand_value(operand)) : nullptr;
 			}
 
-			template<typename T_FUNC>
-			static inline constexpr variable function4(const char* name, T_FUNC func)
+			// Binding index of a variable operand or node, -1 otherwise.
+			static int operand_binding(uint32_t operand, const expr_portable<env_traits>* n) noexcept
 			{
-				typedef T_VAL (*fourargfn)(T_VAL, T_VAL, T_VAL, T_VAL);
-				return {name, fourargfn{func}, tp::FUNCTION4 | tp::FLAG_PURE, 0};
+				if ((operand & OPERAND_TAG_MASK) == OPERAND_VARIABLE)
+				{
+					return int(eval_details::operand_value(operand));
+				}
+				return (n && eval_details::type_mask(n->type) == VARIABLE) ? int(n->bound) : -1;
 			}
 
-			template<typename T_FUNC>
-			static inline constexpr variable function5(const char* name, T_FUNC func)
+			static int count(uint32_t operand, const unsigned char* base, int& num_nodes, int& num_children, int& num_variables)
 			{
-				typedef T_VAL (*fiveargfn)(T_VAL, T_VAL, T_VAL, T_VAL, T_VAL);
-				return {name, fiveargfn{func}, tp::FUNCTION5 | tp::FLAG_PURE, 0};
+				const auto n = operand_node(operand, base);
+				++num_nodes;
+				num_variables += (operand_binding(operand, n) >= 0) ? 1 : 0;
+				num_children += arity(n);
+				for (int e = 0; e < arity(n); ++e)
+				{
+					count(n->parameters[e], base, num_nodes, num_children, num_variables);
+				}
+				return 0;
 			}
 
-			template<typename T_FUNC>
-			static inline constexpr variable function6(const char* name, T_FUNC func)
+			int build(uint32_t operand, const unsigned char* base, int parent, int& next_node, int& next_child)
 			{
-				typedef T_VAL (*sixargfn)(T_VAL, T_VAL, T_VAL, T_VAL, T_VAL, T_VAL);
-				return {name, sixargfn{func}, tp::FUNCTION6 | tp::FLAG_PURE, 0};
+				const auto n	 = operand_node(operand, base);
+				const int  index = next_node++;
+				const int  t	 = n ? eval_details::type_mask(int(n->type)) : VARIABLE;
+				auto&	   out	 = m_nodes[index];
+
+				out.expr		= n;
+				out.base		= base;
+				out.operand		= operand;
+				out.parent		= parent;
+				out.first_child = next_child;
+				out.binding		= operand_binding(operand, n);
+				out.valid		= false;
+				out.always		= n && ((t >= CLOSURE0) || (t >= FUNCTION0 && !(n->type & (FLAG_PURE | FLAG_OPERATOR))));
+
+				next_child += arity(n);
+				for (int e = 0; e < arity(n); ++e)
+				{
+					const int child				   = build(n->parameters[e], base, index, next_node, next_child);
+					m_children[out.first_child + e] = child;
+					m_nodes[index].always |= m_nodes[child].always;
+				}
+				return index;
 			}
 
-			template<typename T_FUNC>
-			static inline constexpr variable function7(const char* name, T_FUNC func)
+			t_vector eval_node(int index)
 			{
-				typedef T_VAL (*sevenargfn)(T_VAL, T_VAL, T_VAL, T_VAL, T_VAL, T_VAL, T_VAL);
-				return {name, sevenargfn{func}, tp::FUNCTION7 | tp::FLAG_PURE, 0};
+				auto& n = m_nodes[index];
+				if (n.valid)
+				{
+					return n.value;
+				}
+
+				++m_num_evaluated;
+				if (!n.expr)
+				{
+					n.value = eval_details::eval_portable_leaf<env_traits, t_vector>(n.operand, n.base, m_bindings);
+				}
+				else
+				{
+					n.value = eval_details::eval_portable_node<env_traits, t_atom, t_vector>(
+						n.expr, n.base, m_bindings, [&](int e) { return eval_node(m_children[n.first_child + e]); });
+				}
+				n.valid = !n.always;
+				return n.value;
 			}
+
+			const statement*   m_statements;
+			int				   m_num_statements;
+			const void* const* m_bindings;
+			size_t			   m_num_bindings;
+
+			std::vector<int>  m_roots;
+			std::vector<node> m_nodes;
+			std::vector<int>  m_children;
+			std::vector<int>  m_variable_first; // per binding, its first entry in m_variable_nodes
+			std::vector<int>  m_variable_nodes;
+			int				  m_num_evaluated = 0;
 		};
-#endif
 
-		struct serialized_program
+		static inline t_vector eval(const void* expr_buffer, const void* const expr_context[]) noexcept
 		{
-#pragma pack(push, 1)
-			struct header_chunk
+			return eval_details::eval_portable_impl<env_traits, t_atom, t_vector>((const expr_portable<env_traits>*)expr_buffer, (const unsigned char*)expr_buffer, expr_context);
+		}
+
+		// Runs an expression exported with expression_layout::post_order, expr_buffer points to its root.
+		static inline t_vector eval_post_order(const void* expr_buffer, const void* const expr_context[]) noexcept
+		{
+			return eval_details::eval_post_order_impl<env_traits, t_atom, t_vector>((const unsigned char*)expr_buffer, expr_context);
+		}
+
+		static inline t_vector eval_program(const statement* statement_array, int statement_array_size, const void* expr_buffer, const void* const expr_context[],
+			expression_layout layout = expression_layout::pre_order)
+		{
+			if (layout == expression_layout::post_order)
 			{
-				uint16_t magic;
-				uint16_t version;
-				uint16_t num_binding_names;
-				uint16_t num_subprograms;
-			};
+				return run_statements(
+					statement_array, statement_array_size, expr_context,
+					[&](int, int offset) { return eval_post_order(((const char*)expr_buffer) + offset, expr_context); }, [](int) {});
+			}
+			return run_statements(
+				statement_array, statement_array_size, expr_context, [&](int, int offset) { return eval(((const char*)expr_buffer) + offset, expr_context); },
+				[](int) {});
+		}
 
-			struct chunk_header
+		// The statement loop of eval_program: evaluate(statement_index, offset) runs the expression at offset in the expression buffer,
+		// assigned(binding) follows every assign statement.
+		template<typename T_EVALUATE, typename T_ASSIGNED>
+		static inline t_vector run_statements(
+			const statement* statement_array, int statement_array_size, const void* const expr_context[], T_EVALUATE evaluate, T_ASSIGNED assigned)
+		{
+			if constexpr (env_traits::lanes > 1)
 			{
-				uint16_t size;
-				uint16_t padding;
-			};
+				return run_statements_masked(statement_array, statement_array_size, expr_context, evaluate, assigned);
+			}
 
-			struct chunk : chunk_header
+			for (int statement_index = 0; statement_index < statement_array_size;)
 			{
-				using header = chunk_header;
-				char data[1];
-			};
+				auto& statement = statement_array[statement_index];
+				
+				if (statement.type == statement_type::jump)
+			    {
+					if (statement.arg_b == -1 || env_traits::lane_mask(evaluate(statement_index, statement.arg_b)))
+					{
+						statement_index = statement.arg_a;
+						continue;
+					}
+					else
+					{
+						++statement_index;
+					}
+				}
+				else if (statement.type == statement_type::return_value)
+				{
+					return evaluate(statement_index, statement.arg_a);
+				}
+				else if (statement.type == statement_type::assign)
+				{
+					auto dest = (t_vector*)expr_context[statement.arg_a];
+					*dest	  = evaluate(statement_index, statement.arg_b);
+					assigned(statement.arg_a);
+					++statement_index;
+				}
+				else if (statement.type == statement_type::call)
+				{
+					evaluate(statement_index, statement.arg_a);
+					++statement_index;
+				}
+				else
+				{
+					// fatal, unknown statement
+					assert(0);
+					return env_traits::nan();
+				}
+			}
+			
+			// TODO: should probably make this a std::optional or something to indicate success or faillure
+			return env_traits::nan();
+		}
 
-			using program_chunk	  = chunk;
-			using statement_chunk = chunk;
-			using data_chunk	  = chunk;
-			using string_chunk	  = chunk;
-			using user_var_chunk  = chunk;
-#pragma pack(pop)
+		// run_statements for packed traits. Every lane has its own statement index; the lanes at the lowest index run together, assign
+		// only writes those lanes and return_value retires them. Lanes that split on a jump run both paths in turn and merge again at the
+		// first statement they share. Calls and closures still see every lane.
+		template<typename T_EVALUATE, typename T_ASSIGNED>
+		static inline t_vector run_statements_masked(
+			const statement* statement_array, int statement_array_size, const void* const expr_context[], T_EVALUATE evaluate, T_ASSIGNED assigned)
+		{
+			constexpr int lanes	   = env_traits::lanes;
+			constexpr int finished = 0x7fffffff;
 
-			template<typename T>
-			static inline constexpr T round_up_to_multiple(T value, T multiple) noexcept
+			int		 lane_index[lanes] = {};
+			t_vector result			   = env_traits::nan();
+
+			for (;;)
 			{
-				return ((value + multiple - 1) / multiple) * multiple;
+				int statement_index = finished;
+				for (int l = 0; l < lanes; ++l)
+				{
+					statement_index = (lane_index[l] < statement_index) ? lane_index[l] : statement_index;
+				}
+
+				if (statement_index >= statement_array_size)
+				{
+					// Lanes that ran off the end return nan, like the scalar version.
+					return result;
+				}
+
+				int active = 0;
+				for (int l = 0; l < lanes; ++l)
+				{
+					active |= (lane_index[l] == statement_index) ? (1 << l) : 0;
+				}
+
+				auto& statement = statement_array[statement_index];
+				int	  taken		= 0;
+
+				if (statement.type == statement_type::jump)
+				{
+					taken = (statement.arg_b == -1) ? active : (env_traits::lane_mask(evaluate(statement_index, statement.arg_b)) & active);
+				}
+				else if (statement.type == statement_type::return_value)
+				{
+					result = env_traits::select_lanes(active, evaluate(statement_index, statement.arg_a), result);
+				}
+				else if (statement.type == statement_type::assign)
+				{
+					auto dest = (t_vector*)expr_context[statement.arg_a];
+					*dest	  = env_traits::select_lanes(active, evaluate(statement_index, statement.arg_b), *dest);
+					assigned(statement.arg_a);
+				}
+				else if (statement.type == statement_type::call)
+				{
+					evaluate(statement_index, statement.arg_a);
+				}
+				else
+				{
+					// fatal, unknown statement
+					assert(0);
+					return env_traits::nan();
+				}
+
+				for (int l = 0; l < lanes; ++l)
+				{
+					if (active & (1 << l))
+					{
+						lane_index[l] = (statement.type == statement_type::return_value) ? finished
+										: (taken & (1 << l))							 ? statement.arg_a
+																						 : statement_index + 1;
+					}
+				}
 			}
+		}
 
-			static inline uint16_t alignment()
+		static inline t_vector eval_program(serialized_program& prog, int subprogram, const void* const* binding_addrs)
+		{
+			return eval_program(prog.get_statements_array(subprogram), (int)prog.get_statements_array_size(subprogram), prog.get_expression_data(subprogram), binding_addrs,
+				prog.get_expression_layout(subprogram));
+		}
+
+		static inline t_vector eval_program(serialized_program& prog, int subprogram, execution_context& ctx)
+		{
+			return eval_program(prog, subprogram, ctx.get_bindings());
+		}
+
+		// Runs a bytecode buffer, either a single expression or a whole (sub)program.
+		static inline t_vector eval_bytecode(const void* bytecode, const void* const expr_context[]) noexcept
+		{
+			return eval_details::eval_bytecode_impl<env_traits, t_atom, t_vector>((const unsigned char*)bytecode, expr_context);
+		}
+
+		static inline t_vector eval_program_bytecode(serialized_program& prog, int subprogram, const void* const* binding_addrs)
+		{
+			auto bytecode = prog.get_bytecode(subprogram);
+			if (bytecode)
 			{
-				return 4;
+				return eval_bytecode(bytecode, binding_addrs);
 			}
+			return eval_program(prog, subprogram, binding_addrs);
+		}
 
-			struct subprogram
+		static inline t_vector eval_program_bytecode(serialized_program& prog, int subprogram, execution_context& ctx)
+		{
+			return eval_program_bytecode(prog, subprogram, ctx.get_bindings());
+		}
+
+		// Evaluates count rows at once, see eval_details::eval_bytecode_batch_impl for the column binding layout.
+		static inline void eval_batch(const void* bytecode, size_t count, const void* const column_bindings[], t_vector* out, const size_t* strides = nullptr) noexcept
+		{
+			eval_details::eval_bytecode_batch_impl<env_traits, t_atom, t_vector>((const unsigned char*)bytecode, 0, count, column_bindings, strides, out);
+		}
+
+		static inline bool eval_program_batch(
+			serialized_program& prog, int subprogram, size_t count, const void* const* column_bindings, t_vector* out, const size_t* strides = nullptr) noexcept
+		{
+			auto bytecode = prog.get_bytecode(subprogram);
+			if (bytecode)
 			{
-				const statement_chunk* statements{nullptr};
-				const data_chunk*	   data{nullptr};
-			};
+				eval_batch(bytecode, count, column_bindings, out, strides);
+				return true;
+			}
+			return false;
+		}
 
-			const string_chunk*	   strings{nullptr};
-			const user_var_chunk*  user_vars{nullptr};
-			void*				   raw_data{nullptr};
-			size_t				   raw_data_size{0};
-			const header_chunk*	   header{nullptr};
-			const statement_chunk* first_subprogram{nullptr};
+#if TP_THREADS_ENABLED
+		// eval_batch spread over the threads of pool, the rows and the results are split between threads.
+		static inline void eval_parallel(
+			thread_pool& pool, const void* bytecode, size_t count, const void* const column_bindings[], t_vector* out, const size_t* strides = nullptr)
+		{
+			eval_details::eval_bytecode_parallel_impl<env_traits, t_atom, t_vector>(pool, (const unsigned char*)bytecode, count, column_bindings, strides, out);
+		}
 
-#if (TP_COMPILER_ENABLED)
-			serialized_program(const compiled_program* const* programs, int num_programs, std::vector<std::string>& user_vars_in)
+		static inline bool eval_program_parallel(thread_pool& pool, serialized_program& prog, int subprogram, size_t count, const void* const* column_bindings,
+			t_vector* out, const size_t* strides = nullptr)
+		{
+			auto bytecode = prog.get_bytecode(subprogram);
+			if (bytecode)
 			{
-				std::vector<subprogram> subprograms;
-				subprograms.resize(num_programs);
+				eval_parallel(pool, bytecode, count, column_bindings, out, strides);
+				return true;
+			}
+			return false;
+		}
+#endif // #if TP_THREADS_ENABLED
 
-				auto user_var_count = user_vars_in.size();
+#if TP_JIT_ENABLED
+		// Returns nullptr when the traits or the bytecode can't be translated, the eval_jit overloads then fall back to the interpreter.
+		// The function slots of expr_context are resolved here, the binding array passed to eval_jit must use the same functions.
+		static jit_function* jit(const void* bytecode, const void* const expr_context[])
+		{
+			return jit_details::compile<env_traits>((const unsigned char*)bytecode, expr_context);
+		}
 
-				auto binding_name_count = programs[0]->get_binding_array_size();
-				auto binding_names		= programs[0]->get_binding_names();
-				auto most_bindings_idx	= 0;
-				for (int subprogram_idx = 1; subprogram_idx < num_programs; ++subprogram_idx)
-				{
-					auto next_binding_name_count = programs[subprogram_idx]->get_binding_array_size();
-					auto next_binding_names		 = programs[subprogram_idx]->get_binding_names();
+		static jit_function* jit_program(serialized_program& prog, int subprogram, const void* const* binding_addrs)
+		{
+			return jit(prog.get_bytecode(subprogram), binding_addrs);
+		}
 
-					for (auto i = std::min(binding_name_count, next_binding_name_count); i > 0; --i)
-					{
-						if (strcmp(binding_names[i - 1], next_binding_names[i - 1]) != 0)
-						{
-							assert(false);
-						}
-					}
+		static inline t_vector eval_jit(const jit_function* fn, const void* const expr_context[]) noexcept
+		{
+			return ((t_vector(*)(const void* const*))fn->get_entry())(expr_context);
+		}
+
+		static inline t_vector eval_program_jit(const jit_function* fn, serialized_program& prog, int subprogram, const void* const* binding_addrs)
+		{
+			if (fn)
+			{
+				return eval_jit(fn, binding_addrs);
+			}
+			return eval_program_bytecode(prog, subprogram, binding_addrs);
+		}
+#endif // #if TP_JIT_ENABLED
+
+#if (TP_COMPILER_ENABLED)
+		static compiled_expr* compile(
+			const char* expression, const variable* variables, int var_count, int* error, expression_layout layout = expression_layout::pre_order)
+		{
+			return expr_details::compile<env_traits>(expression, variables, var_count, error, layout);
+		}
+
+		static compiled_program* compile_program(
+			const char* program, const variable* variables, int var_count, int* error, expression_layout layout = expression_layout::pre_order)
+		{
+			return (compiled_program*)program_details::compile<env_traits>(program, variables, var_count, error, layout);
+		}
+
+		static compiled_program* compile_program_using_indexer(const char* program, int* error, program_details::t_indexer<env_traits>& indexer)
+		{
+			return (compiled_program*)program_details::compile_using_indexer<env_traits>(program, error, indexer);
+		}
 
-					if (binding_name_count < next_binding_name_count)
-					{
-						most_bindings_idx  = subprogram_idx;
-						binding_name_count = next_binding_name_count;
-						binding_names	   = next_binding_names;
-					}
-				}
+		static inline t_vector eval(const compiled_expr* n)
+		{
+			const auto root = n->get_data() + n->get_root_offset();
+			if (n->get_layout() == expression_layout::post_order)
+			{
+				return eval_post_order(root, n->get_binding_addresses());
+			}
+			return eval(root, n->get_binding_addresses());
+		}
 
-				struct program_state
-				{
-					statement_chunk statement_data;
-					data_chunk		expression_data;
-					size_t			statement_data_data_size;
-					size_t			expression_data_data_size;
-				};
+		static inline t_vector eval_bytecode(const compiled_expr* n)
+		{
+			auto bytecode = n->get_bytecode();
+			if (bytecode)
+			{
+				return eval_bytecode(bytecode, n->get_binding_addresses());
+			}
+			return eval(n);
+		}
 
-				auto [total_program_size, out_header, program_states, strs, user_var_indexes, user_var_data, user_var_data_data_size] =
-					[&]() -> std::tuple<size_t, header_chunk, std::vector<program_state>, std::vector<string_chunk>, std::vector<int>, user_var_chunk, size_t> {
-					std::vector<program_state> program_states;
-					program_states.resize(num_programs);
+		// Column bindings follow the layout of n->get_binding_addresses(), with variable slots pointing to arrays. Returns false when
+		// the expression has no bytecode.
+		static inline bool eval_batch(const compiled_expr* n, size_t count, const void* const column_bindings[], t_vector* out, const size_t* strides = nullptr)
+		{
+			auto bytecode = n->get_bytecode();
+			if (bytecode)
+			{
+				eval_batch(bytecode, count, column_bindings, out, strides);
+				return true;
+			}
+			return false;
+		}
 
-					size_t total_program_size = 0;
+		static inline bool eval_program_batch(
+			const compiled_program* prog, size_t count, const void* const column_bindings[], t_vector* out, const size_t* strides = nullptr)
+		{
+			auto bytecode = prog->get_bytecode();
+			if (bytecode)
+			{
+				eval_batch(bytecode, count, column_bindings, out, strides);
+				return true;
+			}
+			return false;
+		}
 
-					header_chunk out_header;
-					out_header.magic			 = uint16_t(0x1010);
-					out_header.version			 = uint16_t(0x0001);
-					out_header.num_binding_names = uint16_t(binding_name_count);
-					out_header.num_subprograms	 = uint16_t(num_programs);
+#if TP_THREADS_ENABLED
+		static inline bool eval_parallel(
+			thread_pool& pool, const compiled_expr* n, size_t count, const void* const column_bindings[], t_vector* out, const size_t* strides = nullptr)
+		{
+			auto bytecode = n->get_bytecode();
+			if (bytecode)
+			{
+				eval_parallel(pool, bytecode, count, column_bindings, out, strides);
+				return true;
+			}
+			return false;
+		}
 
-					total_program_size += sizeof(header_chunk);
+		static inline bool eval_program_parallel(
+			thread_pool& pool, const compiled_program* prog, size_t count, const void* const column_bindings[], t_vector* out, const size_t* strides = nullptr)
+		{
+			auto bytecode = prog->get_bytecode();
+			if (bytecode)
+			{
+				eval_parallel(pool, bytecode, count, column_bindings, out, strides);
+				return true;
+			}
+			return false;
+		}
+#endif // #if TP_THREADS_ENABLED
 
-					for (int subprogram_idx = 0; subprogram_idx < num_programs; ++subprogram_idx)
-					{
-						auto& prog_state	  = program_states[subprogram_idx];
-						auto  prog			  = programs[subprogram_idx];
-						auto  expression_size = prog->get_data_size();
-						auto  num_statements  = prog->get_statement_array_size();
-						auto  statement_src	  = prog->get_statements();
+		static inline t_vector interp(const char* expression, int* error)
+		{
+			compiled_expr* n = compile(expression, 0, 0, error);
+			t_vector	   ret;
+			if (n)
+			{
+				ret = eval(n);
+				delete n;
+			}
+			else
+			{
+				ret = env_traits::nan();
+			}
+			return ret;
+		}
 
-						prog_state.statement_data.size = uint16_t(num_statements * sizeof(statement_src[0]));
-						total_program_size += sizeof(chunk_header);
-						prog_state.statement_data_data_size = round_up_to_multiple(prog_state.statement_data.size, alignment());
-						total_program_size += prog_state.statement_data_data_size;
+		static inline t_vector eval_program(compiled_program* prog)
+		{
+			auto array_size		= prog->get_binding_array_size();
+			auto binding_addrs	= prog->get_binding_addresses();
+			auto binding_names	= prog->get_binding_names();
+			auto data_size		= prog->get_data_size();
+			auto data			= prog->get_data();
+			auto num_statements = prog->get_statement_array_size();
+			auto statements		= prog->get_statements();
 
-						prog_state.expression_data.size = uint16_t(expression_size);
-						total_program_size += sizeof(chunk_header);
-						prog_state.expression_data_data_size = round_up_to_multiple(prog_state.expression_data.size, alignment());
-						total_program_size += prog_state.expression_data_data_size;
-					}
+			return eval_program(statements, (int)num_statements, data, binding_addrs, prog->get_layout());
+		}
 
-					std::vector<string_chunk> strs;
-					for (size_t i = 0; i < binding_name_count; ++i)
-					{
-						string_chunk chonk;
-						chonk.size = uint16_t(::strlen(binding_names[i]) + 1);
-						total_program_size += sizeof(chunk_header);
-						total_program_size += round_up_to_multiple(chonk.size, uint16_t(alignment()));
-						strs.push_back(chonk);
-					}
+		// Runs prog with the bindings and declared variables of ctx, safe to call on several threads with a context each.
+		static inline t_vector eval_program(const compiled_program* prog, execution_context& ctx)
+		{
+			return eval_program(prog->get_statements(), (int)prog->get_statement_array_size(), prog->get_data(), ctx.get_bindings(), prog->get_layout());
+		}
 
-					std::vector<int> user_var_indexes;
-					user_var_indexes.resize(user_var_count);
-					std::fill(std::begin(user_var_indexes), std::end(user_var_indexes), -1);
-					for (size_t i = 0; i < binding_name_count; ++i)
-					{
-						for (size_t j = 0; j < user_var_count; ++j)
-						{
-							if (user_var_indexes[j] == -1)
-							{
-								if (_stricmp(binding_names[i], user_vars_in[j].c_str()) == 0)
-								{
-									user_var_indexes[j] = int(i);
-									break;
-								}
-							}
-						}
-					}
+		static inline t_vector eval_program_bytecode(compiled_program* prog)
+		{
+			auto bytecode = prog->get_bytecode();
+			if (bytecode)
+			{
+				return eval_bytecode(bytecode, prog->get_binding_addresses());
+			}
+			return eval_program(prog);
+		}
 
-					user_var_chunk user_var_data;
-					user_var_data.size = uint16_t(sizeof(int) * user_var_count);
-					total_program_size += sizeof(chunk_header);
-					const auto user_var_data_data_size = round_up_to_multiple(user_var_data.size, alignment());
-					total_program_size += user_var_data_data_size;
+		static inline t_vector eval_program_bytecode(const compiled_program* prog, execution_context& ctx)
+		{
+			auto bytecode = prog->get_bytecode();
+			if (bytecode)
+			{
+				return eval_bytecode(bytecode, ctx.get_bindings());
+			}
+			return eval_program(prog, ctx);
+		}
 
-					return {total_program_size, out_header, program_states, strs, user_var_indexes, user_var_data, user_var_data_data_size};
-				}();
+#if TP_JIT_ENABLED
+		static jit_function* jit(const compiled_expr* n)
+		{
+			return jit(n->get_bytecode(), n->get_binding_addresses());
+		}
 
-				//
+		static jit_function* jit(const compiled_program* prog)
+		{
+			return jit(prog->get_bytecode(), prog->get_binding_addresses());
+		}
 
-				if (total_program_size > sizeof(out_header))
-				{
-					assert(total_program_size > sizeof(header_chunk) + user_var_data_data_size + sizeof(chunk_header));
-					char* const serialized_program = (char*)::malloc(total_program_size);
-					char*		p				   = serialized_program;
-					if (p != nullptr)
-					{
-						//
+		static inline t_vector eval_jit(const jit_function* fn, const compiled_expr* n)
+		{
+			if (fn)
+			{
+				return eval_jit(fn, n->get_binding_addresses());
+			}
+			return eval_bytecode(n);
+		}
 
-						this->header = (header_chunk*)p;
-						::memcpy(p, &out_header, sizeof(out_header));
-						p += sizeof(header_chunk);
+		static inline t_vector eval_program_jit(const jit_function* fn, compiled_program* prog)
+		{
+			if (fn)
+			{
+				return eval_jit(fn, prog->get_binding_addresses());
+			}
+			return eval_program_bytecode(prog);
+		}
+#endif // #if TP_JIT_ENABLED
 
-						first_subprogram = (statement_chunk*)p;
+		// Ahead of time translation of a serialized program to C++, name_space may be null. Fails when a subprogram has no bytecode or prog isn't valid.
+		static bool generate_cpp(const serialized_program& prog, const char* name, const char* name_space, std::string& out)
+		{
+			return aot_details::generate_cpp<env_traits>(prog, name, name_space, out);
+		}
+#endif // #if (TP_COMPILER_ENABLED)
+	};
+} // namespace tp
 
-						for (int subprogram_idx = 0; subprogram_idx < num_programs; ++subprogram_idx)
-						{
-							auto& prog_state = program_states[subprogram_idx];
-							auto& subprogram = subprograms[subprogram_idx];
+#if TP_STANDARD_LIBRARY
+#if TP_SIMD_SSE || TP_SIMD_AVX2
+#include <immintrin.h>
+#include <type_traits>
+#endif // #if TP_SIMD_SSE || TP_SIMD_AVX2
 
-							auto prog		   = programs[subprogram_idx];
-							auto statement_src = prog->get_statements();
+namespace tp_stdlib
+{
+	template<typename T_ATOM>
+	struct native_builtins_impl;
 
-							auto expression_src = prog->get_data();
+	template<>
+	struct native_builtins_impl<double>
+	{
+		static double pi(void)
+		{
+			return 3.14159265358979323846;
+		}
 
-							subprogram.statements = (statement_chunk*)p;
-							::memcpy(p, &prog_state.statement_data, sizeof(chunk_header));
-							p += sizeof(chunk_header);
-							::memcpy(p, &statement_src[0], prog_state.statement_data.size);
-							p += prog_state.statement_data_data_size;
+		static double e(void)
+		{
+			return 2.71828182845904523536;
+		}
 
-							subprogram.data = (data_chunk*)p;
-							::memcpy(p, &prog_state.expression_data, sizeof(chunk_header));
-							p += sizeof(chunk_header);
-							::memcpy(p, &expression_src[0], prog_state.expression_data.size);
-							p += prog_state.expression_data_data_size;
-						}
+		static double fac(double a)
+		{ /* simplest version of fac */
+			if (a < 0.0)
+				return nan();
+			if (a > UINT_MAX)
+				return INFINITY;
+			unsigned int	  ua	 = (unsigned int)(a);
+			unsigned long int result = 1, i;
+			for (i = 1; i <= ua; i++)
+			{
+				if (i > ULONG_MAX / result)
+					return INFINITY;
+				result *= i;
+			}
+			return (double)result;
+		}
 
-						this->strings = (string_chunk*)p;
+		static double ncr(double n, double r)
+		{
+			if (n < 0.0 || r < 0.0 || n < r)
+				return nan();
+			if (n > UINT_MAX || r > UINT_MAX)
+				return INFINITY;
+			unsigned long int un = (unsigned int)(n), ur = (unsigned int)(r), i;
+			unsigned long int result = 1;
+			if (ur > un / 2)
+				ur = un - ur;
+			for (i = 1; i <= ur; i++)
+			{
+				if (result > ULONG_MAX / (un - ur + i))
+					return INFINITY;
+				result *= un - ur + i;
+				result /= i;
+			}
+			return result;
+		}
 
-						for (size_t i = 0; i < binding_name_count; ++i)
-						{
-							::memcpy(p, &strs[i], sizeof(chunk_header));
-							p += sizeof(chunk_header);
+		static double npr(double n, double r)
+		{
+			return ncr(n, r) * fac(r);
+		}
 
-							::memcpy(p, binding_names[i], strs[i].size - 1);
-							p[strs[i].size - 1] = '\0';
-							p += round_up_to_multiple(strs[i].size, alignment());
-						}
+		static double fabs(double n)
+		{
+			return ::fabs(n);
+		}
 
-						this->user_vars = (user_var_chunk*)p;
-						::memcpy(p, &user_var_data, sizeof(chunk_header));
-						p += sizeof(chunk_header);
-						::memcpy(p, &user_var_indexes[0], user_var_data.size);
-						p += user_var_data_data_size;
+		static double acos(double n)
+		{
+			return ::acos(n);
+		}
 
-						//
+		static double cosh(double n)
+		{
+			return ::cosh(n);
+		}
 
-						this->raw_data		= serialized_program;
-						this->raw_data_size = total_program_size;
-					}
-				}
-			}
-#endif // #if (TP_COMPILER_ENABLED)
+		static double cos(double n)
+		{
+			return ::cos(n);
+		}
 
-			serialized_program(const void* data, size_t data_size)
-			{
-				this->raw_data		= nullptr;
-				this->raw_data_size = data_size;
+		static double exp(double n)
+		{
+			return ::exp(n);
+		}
 
-				const char* p = (const char*)data;
+		static double asin(double n)
+		{
+			return ::asin(n);
+		}
 
-				this->header = (header_chunk*)p;
-				p += sizeof(header_chunk);
+		static double sinh(double n)
+		{
+			return ::sinh(n);
+		}
 
-				first_subprogram = (statement_chunk*)p;
+		static double sin(double n)
+		{
+			return ::sin(n);
+		}
 
-				for (int subprogram_idx = 0; subprogram_idx < this->header->num_subprograms; ++subprogram_idx)
-				{
-					auto subprogram_statements = (statement_chunk*)p;
-					p += sizeof(statement_chunk::header);
-					p += round_up_to_multiple(subprogram_statements->size, alignment());
+		static double sqrt(double n)
+		{
+			return ::sqrt(n);
+		}
 
-					auto subprogram_data = (data_chunk*)p;
-					p += sizeof(data_chunk::header);
-					p += round_up_to_multiple(subprogram_data->size, alignment());
-				}
+		static double log(double n)
+		{
+			return ::log(n);
+		}
 
-				this->strings = (string_chunk*)p;
+		static double log10(double n)
+		{
+			return ::log10(n);
+		}
 
-				for (size_t i = 0; i < header->num_binding_names; ++i)
-				{
-					auto chonk = (const string_chunk*)p;
-					p += sizeof(string_chunk::header);
-					p += round_up_to_multiple(chonk->size, alignment());
-				}
+		static double atan(double n)
+		{
+			return ::atan(n);
+		}
 
-				this->user_vars = (user_var_chunk*)p;
-				p += sizeof(user_var_chunk::header);
-				p += round_up_to_multiple(this->user_vars->size, alignment());
-			}
+		static double tanh(double n)
+		{
+			return ::tanh(n);
+		}
 
-			serialized_program(std::tuple<const void*, size_t> args) : serialized_program(std::get<0>(args), std::get<1>(args)) {}
+		static double fmod(double n, double m)
+		{
+			return ::fmod(n, m);
+		}
 
-			static inline serialized_program* create_using_buffer(void* data, size_t data_size)
-			{
-				auto prog	   = new serialized_program(data, data_size);
-				prog->raw_data = data;
-				return prog;
-			}
+		static double tan(double n)
+		{
+			return ::tan(n);
+		}
 
-			~serialized_program()
-			{
-				if (raw_data)
-				{
-					::free(raw_data);
-				}
-			}
+		static double atan2(double n, double m)
+		{
+			return ::atan2(n, m);
+		}
 
-			const std::tuple<statement_chunk*, data_chunk*> get_subprogram_data(int subprogram_index) const noexcept
-			{
-				const char* p = (const char*)first_subprogram;
+		static double pow(double n, double m)
+		{
+			return ::pow(n, m);
+		}
 
-				for (int i = 0; i < this->header->num_subprograms; ++i)
-				{
-					auto statements = (statement_chunk*)p;
-					p += sizeof(statement_chunk::header);
-					p += round_up_to_multiple(statements->size, alignment());
+		static double floor(double d)
+		{
+			return ::floor(d);
+		}
 
-					auto subprogram_data = (data_chunk*)p;
-					p += sizeof(data_chunk::header);
-					p += round_up_to_multiple(subprogram_data->size, alignment());
+		static double ceil(double d)
+		{
+			return ::ceil(d);
+		}
 
-					if (i == subprogram_index)
-					{
-						return std::tuple<statement_chunk*, data_chunk*>(statements, subprogram_data);
-					}
-				}
+		static double add(double a, double b)
+		{
+			return a + b;
+		}
 
-				return std::tuple<statement_chunk*, data_chunk*>(nullptr, nullptr);
-			}
+		static double sub(double a, double b)
+		{
+			return a - b;
+		}
 
-			const statement* get_statements_array(int subprogram_index) const noexcept
-			{
-				auto  tup		 = get_subprogram_data(subprogram_index);
-				auto& statements = std::get<0>(tup);
-				return reinterpret_cast<const statement*>(&statements->data[0]);
-			}
+		static double mul(double a, double b)
+		{
+			return a * b;
+		}
 
-			size_t get_statements_array_size(int subprogram_index) const noexcept
-			{
-				auto  tup		 = get_subprogram_data(subprogram_index);
-				auto& statements = std::get<0>(tup);
-				return statements->size / sizeof(statement);
-			}
+		static double divide(double a, double b)
+		{
+			return a / b;
+		}
 
-			const void* get_expression_data(int subprogram_index) const noexcept
-			{
-				auto  tup			  = get_subprogram_data(subprogram_index);
-				auto& subprogram_data = std::get<1>(tup);
-				return &subprogram_data->data[0];
-			}
+		static double negate(double a)
+		{
+			return -a;
+		}
 
-			size_t get_expression_size(int subprogram_index) const noexcept
-			{
-				auto  tup			  = get_subprogram_data(subprogram_index);
-				auto& subprogram_data = std::get<1>(tup);
-				return subprogram_data->size;
-			}
+		static double comma(double a, double b)
+		{
+			(void)a;
+			return b;
+		}
 
-			size_t get_num_bindings() const noexcept
-			{
-				return this->header->num_binding_names;
-			}
+		static double greater(double a, double b)
+		{
+			return a > b;
+		}
 
-			const char* get_binding_string(uint16_t index) const noexcept
-			{
-				if (this->header->num_binding_names > index)
-				{
-					auto p = (const char*)this->strings;
-					for (size_t i = 0; i < this->header->num_binding_names; ++i)
-					{
-						auto chonk = (const string_chunk*)p;
-						if (i == index)
-						{
-							return &chonk->data[0];
-						}
+		static double greater_eq(double a, double b)
+		{
+			return a >= b;
+		}
 
-						p += sizeof(string_chunk::header);
-						p += round_up_to_multiple(chonk->size, alignment());
-					}
-				}
-				return nullptr;
-			}
+		static double lower(double a, double b)
+		{
+			return a < b;
+		}
 
-			size_t get_raw_data_size() const noexcept
-			{
-				return raw_data_size;
-			}
+		static double lower_eq(double a, double b)
+		{
+			return a <= b;
+		}
 
-			const void* get_raw_data() const noexcept
-			{
-				return raw_data;
-			}
+		static double equal(double a, double b)
+		{
+			return a == b;
+		}
 
-			size_t get_num_user_vars() const noexcept
-			{
-				return (user_vars != nullptr) ? user_vars->size / sizeof(int) : 0;
-			}
+		static double not_equal(double a, double b)
+		{
+			return a != b;
+		}
 
-			const int* get_user_vars() const noexcept
-			{
-				return (user_vars != nullptr) ? (int*)&user_vars->data[0] : nullptr;
-			}
+		static double logical_and(double a, double b)
+		{
+			return a != 0.0 && b != 0.0;
+		}
 
-			uint16_t get_num_subprograms() const noexcept
-			{
-				return header->num_subprograms;
-			}
-		};
-	} // namespace details
+		static double logical_or(double a, double b)
+		{
+			return a != 0.0 || b != 0.0;
+		}
 
-	template<typename T_TRAITS>
-	struct impl
-	{
-		using env_traits	  = T_TRAITS;
-		using variable		  = ::tp::variable;
-		using variable_lookup = ::tp::variable_lookup;
-		using t_atom		  = typename env_traits::t_atom;
-		using t_vector		  = typename env_traits::t_vector;
-#if TP_MODERN_CPP
-		using variable_factory = details::variable_helper<t_vector>;
-#endif // #if TP_MODERN_CPP
-		using serialized_program = details::serialized_program;
-#if (TP_COMPILER_ENABLED)
-		using t_indexer = program_details::t_indexer<T_TRAITS>;
-#endif // #if (TP_COMPILER_ENABLED)
+		static double logical_not(double a)
+		{
+			return a == 0.0;
+		}
 
-		static inline t_vector eval(const void* expr_buffer, const void* const expr_context[]) noexcept
+		static double logical_notnot(double a)
 		{
-			return eval_details::eval_portable_impl<env_traits, t_atom, t_vector>((const expr_portable<env_traits>*)expr_buffer, (const unsigned char*)expr_buffer, expr_context);
+			return a != 0.0;
 		}
 
-		static inline t_vector eval_program(const statement* statement_array, int statement_array_size, const void* expr_buffer, const void* const expr_context[])
+		static double negate_logical_not(double a)
 		{
-			for (int statement_index = 0; statement_index < statement_array_size;)
-			{
-				auto& statement = statement_array[statement_index];
-				
-				if (statement.type == statement_type::jump)
-			    {
-					if (statement.arg_b == -1 ||
-						(0.0f != eval(((const char*)expr_buffer) + statement.arg_b, expr_context))) // TODO: traits function like nan for zero, or compare function?
-					{
-						statement_index = statement.arg_a;
-						continue;
-					}
-					else
-					{
-						++statement_index;
-					}
-				}
-				else if (statement.type == statement_type::return_value)
-				{
-					return eval(((const char*)expr_buffer) + statement.arg_a, expr_context);
-				}
-				else if (statement.type == statement_type::assign)
-				{
-					auto dest = (t_vector*)expr_context[statement.arg_a];
-					*dest	  = eval(((const char*)expr_buffer) + statement.arg_b, expr_context);
-					++statement_index;
-				}
-				else if (statement.type == statement_type::call)
-				{
-					eval(((const char*)expr_buffer) + statement.arg_a, expr_context);
-					++statement_index;
-				}
-				else
-				{
-					// fatal, unknown statement
-					assert(0);
-					return env_traits::nan();
-				}
-			}
-			
-			// TODO: should probably make this a std::optional or something to indicate success or faillure
-			return env_traits::nan();
+			return -(a == 0.0);
 		}
 
-		static inline t_vector eval_program(serialized_program& prog, int subprogram, const void* const* binding_addrs)
+		static double negate_logical_notnot(double a)
 		{
-			return eval_program(prog.get_statements_array(subprogram), (int)prog.get_statements_array_size(subprogram), prog.get_expression_data(subprogram), binding_addrs);
+			return -(a != 0.0);
 		}
 
-#if (TP_COMPILER_ENABLED)
-		static compiled_expr* compile(const char* expression, const variable* variables, int var_count, int* error)
+		static double select(double c, double a, double b)
 		{
-			return expr_details::compile<env_traits>(expression, variables, var_count, error);
+			return (c != 0.0) ? a : b;
 		}
 
-		static compiled_program* compile_program(const char* program, const variable* variables, int var_count, int* error)
+		static double fma(double a, double b, double c)
 		{
-			return (compiled_program*)program_details::compile<env_traits>(program, variables, var_count, error);
+#if TP_FMA
+			return std::fma(a, b, c);
+#else
+			return a * b + c;
+#endif // #if TP_FMA
 		}
 
-		static compiled_program* compile_program_using_indexer(const char* program, int* error, program_details::t_indexer<env_traits>& indexer)
+		// The second operand unless the first one is lower (greater), like minss/maxss.
+		static double min(double a, double b)
 		{
-			return (compiled_program*)program_details::compile_using_indexer<env_traits>(program, error, indexer);
+			return (a < b) ? a : b;
 		}
 
-		static inline t_vector eval(const compiled_expr* n)
+		static double max(double a, double b)
 		{
-			return eval(n->get_data(), n->get_binding_addresses());
+			return (a > b) ? a : b;
 		}
 
-		static inline t_vector interp(const char* expression, int* error)
+		static double clamp(double x, double lo, double hi)
 		{
-			compiled_expr* n = compile(expression, 0, 0, error);
-			t_vector	   ret;
-			if (n)
-			{
-				ret = eval(n);
-				delete n;
-			}
-			else
-			{
-				ret = env_traits::nan();
-			}
-			return ret;
+			return min(max(x, lo), hi);
 		}
 
-		static inline t_vector eval_program(compiled_program* prog)
+		static double nul()
 		{
-			auto array_size		= prog->get_binding_array_size();
-			auto binding_addrs	= prog->get_binding_addresses();
-			auto binding_names	= prog->get_binding_names();
-			auto data_size		= prog->get_data_size();
-			auto data			= prog->get_data();
-			auto num_statements = prog->get_statement_array_size();
-			auto statements		= prog->get_statements();
+			return 0.0f;
+		}
 
-			return eval_program(statements, (int)num_statements, data, binding_addrs);
+		static double nan()
+		{
+			return std::numeric_limits<double>::quiet_NaN();
 		}
-#endif // #if (TP_COMPILER_ENABLED)
 	};
-} // namespace tp
-
-#if TP_STANDARD_LIBRARY
-namespace tp_stdlib
-{
-	template<typename T_ATOM>
-	struct native_builtins_impl;
 
 	template<>
-	struct native_builtins_impl<double>
+	struct native_builtins_impl<float>
 	{
-		static double pi(void)
+		static float pi(void)
 		{
-			return 3.14159265358979323846;
+			return 3.14159265358979323846f;
 		}
 
-		static double e(void)
+		static float e(void)
 		{
-			return 2.71828182845904523536;
+			return 2.71828182845904523536f;
 		}
 
-		static double fac(double a)
+		static float fac(float a)
 		{ /* simplest version of fac */
-			if (a < 0.0)
+			if (a < 0.0f)
 				return nan();
 			if (a > UINT_MAX)
 				return INFINITY;
@@ -2636,12 +8543,12 @@ namespace tp_stdlib
 					return INFINITY;
 				result *= i;
 			}
-			return (double)result;
+			return (float)result;
 		}
 
-		static double ncr(double n, double r)
+		static float ncr(float n, float r)
 		{
-			if (n < 0.0 || r < 0.0 || n < r)
+			if (n < 0.0f || r < 0.0f || n < r)
 				return nan();
 			if (n > UINT_MAX || r > UINT_MAX)
 				return INFINITY;
@@ -2656,731 +8563,1380 @@ namespace tp_stdlib
 				result *= un - ur + i;
 				result /= i;
 			}
-			return result;
+			return (float)result;
 		}
 
-		static double npr(double n, double r)
+		static float npr(float n, float r)
 		{
 			return ncr(n, r) * fac(r);
 		}
 
-		static double fabs(double n)
+		static float fabs(float n)
 		{
-			return ::fabs(n);
+			return ::fabsf(n);
 		}
 
-		static double acos(double n)
+		static float acos(float n)
 		{
-			return ::acos(n);
+			return ::acosf(n);
 		}
 
-		static double cosh(double n)
+		static float cosh(float n)
 		{
-			return ::cosh(n);
+			return ::coshf(n);
 		}
 
-		static double cos(double n)
+		static float cos(float n)
 		{
-			return ::cos(n);
+			return ::cosf(n);
 		}
 
-		static double exp(double n)
+		static float exp(float n)
 		{
-			return ::exp(n);
+			return ::expf(n);
 		}
 
-		static double asin(double n)
+		static float asin(float n)
 		{
-			return ::asin(n);
+			return ::asinf(n);
 		}
 
-		static double sinh(double n)
+		static float sinh(float n)
 		{
-			return ::sinh(n);
+			return ::sinhf(n);
 		}
 
-		static double sin(double n)
+		static float sin(float n)
 		{
-			return ::sin(n);
+			return ::sinf(n);
 		}
 
-		static double sqrt(double n)
+		static float sqrt(float n)
 		{
-			return ::sqrt(n);
+			return ::sqrtf(n);
 		}
 
-		static double log(double n)
+		static float log(float n)
 		{
-			return ::log(n);
+			return ::logf(n);
 		}
 
-		static double log10(double n)
+		static float log10(float n)
 		{
-			return ::log10(n);
+			return ::log10f(n);
 		}
 
-		static double atan(double n)
+		static float atan(float n)
 		{
-			return ::atan(n);
+			return ::atanf(n);
 		}
 
-		static double tanh(double n)
+		static float tanh(float n)
 		{
-			return ::tanh(n);
+			return ::tanhf(n);
 		}
 
-		static double fmod(double n, double m)
+		static float fmod(float n, float m)
 		{
-			return ::fmod(n, m);
+			return ::fmodf(n, m);
 		}
 
-		static double tan(double n)
+		static float tan(float n)
 		{
-			return ::tan(n);
+			return ::tanf(n);
 		}
 
-		static double atan2(double n, double m)
+		static float atan2(float n, float m)
 		{
-			return ::atan2(n, m);
+			return ::atan2f(n, m);
 		}
 
-		static double pow(double n, double m)
+		static float pow(float n, float m)
 		{
-			return ::pow(n, m);
+			return ::powf(n, m);
 		}
 
-		static double floor(double d)
+		static float floor(float d)
 		{
-			return ::floor(d);
+			return ::floorf(d);
 		}
 
-		static double ceil(double d)
+		static float ceil(float d)
 		{
-			return ::ceil(d);
+			return ::ceilf(d);
 		}
 
-		static double add(double a, double b)
+		static float add(float a, float b)
 		{
 			return a + b;
 		}
 
-		static double sub(double a, double b)
+		static float sub(float a, float b)
 		{
 			return a - b;
 		}
 
-		static double mul(double a, double b)
+		static float mul(float a, float b)
 		{
 			return a * b;
 		}
 
-		static double divide(double a, double b)
+		static float divide(float a, float b)
 		{
 			return a / b;
 		}
 
-		static double negate(double a)
+		static float negate(float a)
 		{
 			return -a;
 		}
 
-		static double comma(double a, double b)
+		static float comma(float a, float b)
 		{
 			(void)a;
 			return b;
 		}
 
-		static double greater(double a, double b)
+		static float greater(float a, float b)
 		{
 			return a > b;
 		}
 
-		static double greater_eq(double a, double b)
+		static float greater_eq(float a, float b)
 		{
 			return a >= b;
 		}
 
-		static double lower(double a, double b)
+		static float lower(float a, float b)
 		{
 			return a < b;
 		}
 
-		static double lower_eq(double a, double b)
+		static float lower_eq(float a, float b)
 		{
 			return a <= b;
 		}
 
-		static double equal(double a, double b)
+		static float equal(float a, float b)
 		{
 			return a == b;
 		}
 
-		static double not_equal(double a, double b)
+		static float not_equal(float a, float b)
 		{
 			return a != b;
 		}
 
-		static double logical_and(double a, double b)
+		static float logical_and(float a, float b)
+		{
+			return a != 0.0f && b != 0.0f;
+		}
+
+		static float logical_or(float a, float b)
+		{
+			return a != 0.0f || b != 0.0f;
+		}
+
+		static float logical_not(float a)
+		{
+			return a == 0.0f;
+		}
+
+		static float logical_notnot(float a)
+		{
+			return a != 0.0f;
+		}
+
+		static float negate_logical_not(float a)
+		{
+			return (float)-(a == 0.0f);
+		}
+
+		static float negate_logical_notnot(float a)
 		{
-			return a != 0.0 && b != 0.0;
+			return (float)-(a != 0.0f);
 		}
 
-		static double logical_or(double a, double b)
+		static float select(float c, float a, float b)
 		{
-			return a != 0.0 || b != 0.0;
+			return (c != 0.0f) ? a : b;
 		}
 
-		static double logical_not(double a)
+		static float fma(float a, float b, float c)
 		{
-			return a == 0.0;
+#if TP_FMA
+			return std::fma(a, b, c);
+#else
+			return a * b + c;
+#endif // #if TP_FMA
 		}
 
-		static double logical_notnot(double a)
+		// The second operand unless the first one is lower (greater), like minss/maxss.
+		static float min(float a, float b)
 		{
-			return a != 0.0;
+			return (a < b) ? a : b;
 		}
 
-		static double negate_logical_not(double a)
+		static float max(float a, float b)
 		{
-			return -(a == 0.0);
+			return (a > b) ? a : b;
 		}
 
-		static double negate_logical_notnot(double a)
+		static float clamp(float x, float lo, float hi)
 		{
-			return -(a != 0.0);
+			return min(max(x, lo), hi);
 		}
 
-		static double nul()
+		static float nul()
 		{
 			return 0.0f;
 		}
 
-		static double nan()
+		static float nan()
 		{
-			return std::numeric_limits<double>::quiet_NaN();
+			return std::numeric_limits<float>::quiet_NaN();
 		}
 	};
 
-	template<>
-	struct native_builtins_impl<float>
+	template<typename T_ATOM>
+	struct native_builtins : native_builtins_impl<T_ATOM>
 	{
-		static float pi(void)
+		using t_impl = native_builtins_impl<T_ATOM>;
+
+		static /*inline*/ constexpr tp::variable functions[] = {/* must be in alphabetical order */
+																{"abs", t_impl::fabs, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"acos", t_impl::acos, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"asin", t_impl::asin, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"atan", t_impl::atan, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"atan2", t_impl::atan2, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"ceil", t_impl::ceil, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"cos", t_impl::cos, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"cosh", t_impl::cosh, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"e", t_impl::e, tp::FUNCTION0 | tp::FLAG_PURE, 0},
+																{"exp", t_impl::exp, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"fac", t_impl::fac, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"floor", t_impl::floor, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"ln", t_impl::log, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+#ifdef TP_NAT_LOG
+																{"log", t_impl::log, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+#else
+																{"log", t_impl::log10, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+#endif
+																{"log10", t_impl::log10, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"ncr", t_impl::ncr, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"npr", t_impl::npr, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"pi", t_impl::pi, tp::FUNCTION0 | tp::FLAG_PURE, 0},
+																{"pow", t_impl::pow, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"sin", t_impl::sin, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"sinh", t_impl::sinh, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"sqrt", t_impl::sqrt, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"tan", t_impl::tan, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"tanh", t_impl::tanh, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{0, 0, 0, 0}};
+
+		static /*inline*/ constexpr tp::variable operators[] = {/* must be in alphabetical order */
+																{"add", t_impl::add, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"clamp", t_impl::clamp, tp::FUNCTION3 | tp::FLAG_PURE, 0},
+																{"comma", t_impl::comma, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"divide", t_impl::divide, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"equal", t_impl::equal, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"fma", t_impl::fma, tp::FUNCTION3 | tp::FLAG_PURE, 0},
+																{"fmod", t_impl::fmod, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"greater", t_impl::greater, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"greater_eq", t_impl::greater_eq, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"logical_and", t_impl::logical_and, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"logical_not", t_impl::logical_not, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"logical_notnot", t_impl::logical_notnot, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"logical_or", t_impl::logical_or, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"lower", t_impl::lower, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"lower_eq", t_impl::lower_eq, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"max", t_impl::max, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"min", t_impl::min, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"mul", t_impl::mul, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"negate", t_impl::negate, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"negate_logical_not", t_impl::negate_logical_not, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"negate_logical_notnot", t_impl::negate_logical_notnot, tp::FUNCTION1 | tp::FLAG_PURE, 0},
+																{"not_equal", t_impl::not_equal, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"pow", t_impl::pow, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{"select", t_impl::select, tp::FUNCTION3 | tp::FLAG_PURE, 0},
+																{"sub", t_impl::sub, tp::FUNCTION2 | tp::FLAG_PURE, 0},
+																{0, 0, 0, 0}};
+	};
+
+	template<typename T_NATIVE>
+	struct compiler_builtins : T_NATIVE
+	{
+		using t_base = T_NATIVE;
+
+		static inline int name_compare(const char* a, const char* b, size_t n)
 		{
-			return 3.14159265358979323846f;
+			while (n && *a && (*a == *b))
+			{
+				++a;
+				++b;
+				--n;
+			}
+			if (n == 0)
+			{
+				return 0;
+			}
+			else
+			{
+				return (*(unsigned char*)a - *(unsigned char*)b);
+			}
 		}
 
-		static float e(void)
+		static inline const ::tp::variable* find_in_sorted_array(const char* name, int len, const ::tp::variable* vars, int vars_len)
 		{
-			return 2.71828182845904523536f;
-		}
+			int imin = 0;
+			int imax = vars_len - 2;
 
-		static float fac(float a)
-		{ /* simplest version of fac */
-			if (a < 0.0f)
-				return nan();
-			if (a > UINT_MAX)
-				return INFINITY;
-			unsigned int	  ua	 = (unsigned int)(a);
-			unsigned long int result = 1, i;
-			for (i = 1; i <= ua; i++)
+			/*Binary search.*/
+			while (imax >= imin)
 			{
-				if (i > ULONG_MAX / result)
-					return INFINITY;
-				result *= i;
+				const int i = (imin + ((imax - imin) / 2));
+				int		  c = name_compare(name, vars[i].name, len);
+				if (!c)
+					c = '\0' - vars[i].name[len];
+				if (c == 0)
+				{
+					return vars + i;
+				}
+				else if (c > 0)
+				{
+					imin = i + 1;
+				}
+				else
+				{
+					imax = i - 1;
+				}
 			}
-			return (float)result;
+			return nullptr;
 		}
 
-		static float ncr(float n, float r)
+		static inline const ::tp::variable* find_by_name(const char* name, int len, const ::tp::variable_lookup* lookup)
 		{
-			if (n < 0.0f || r < 0.0f || n < r)
-				return nan();
-			if (n > UINT_MAX || r > UINT_MAX)
-				return INFINITY;
-			unsigned long int un = (unsigned int)(n), ur = (unsigned int)(r), i;
-			unsigned long int result = 1;
-			if (ur > un / 2)
-				ur = un - ur;
-			for (i = 1; i <= ur; i++)
+			if (lookup)
 			{
-				if (result > ULONG_MAX / (un - ur + i))
-					return INFINITY;
-				result *= un - ur + i;
-				result /= i;
+				const ::tp::variable* var	= lookup->lookup;
+				int					  iters = lookup->lookup_len;
+				for (; iters; ++var, --iters)
+				{
+					if (name_compare(name, var->name, len) == 0 && var->name[len] == '\0')
+					{
+						return var;
+					}
+				}
 			}
-			return (float)result;
-		}
 
-		static float npr(float n, float r)
-		{
-			return ncr(n, r) * fac(r);
+			auto res = find_in_sorted_array(name, len, t_base::functions, int(sizeof(t_base::functions) / sizeof(::tp::variable)));
+			if (!res)
+			{
+				res = find_in_sorted_array(name, len, t_base::operators, int(sizeof(t_base::operators) / sizeof(::tp::variable)));
+			}
+			return res;
 		}
 
-		static float fabs(float n)
+		// Returns the builtin_operator implemented by addr, or -1 when addr is not one of the builtin operators (e.g. user overrides).
+		static inline int find_operator_by_addr(const void* addr)
 		{
-			return ::fabsf(n);
-		}
+			static const auto operator_addresses = []() {
+				std::array<const void*, size_t(::tp::builtin_operator::count)> addresses;
+				for (size_t op = 0; op < addresses.size(); ++op)
+				{
+					const char* name = ::tp::builtin_operator_names[op];
+					auto		var	 = find_in_sorted_array(name, int(strlen(name)), t_base::operators, int(sizeof(t_base::operators) / sizeof(::tp::variable)));
+					addresses[op]	 = var ? var->address : nullptr;
+				}
+				return addresses;
+			}();
 
-		static float acos(float n)
-		{
-			return ::acosf(n);
+			for (size_t op = 0; op < operator_addresses.size(); ++op)
+			{
+				if (operator_addresses[op] == addr)
+				{
+					return int(op);
+				}
+			}
+			return -1;
 		}
 
-		static float cosh(float n)
+		static const ::tp::variable* find_by_addr(const void* addr, const ::tp::variable_lookup* lookup)
 		{
-			return ::coshf(n);
-		}
+			if (lookup)
+			{
+				for (int i = 0; i < lookup->lookup_len; ++i)
+				{
+					if (lookup->lookup[i].address == addr)
+					{
+						return &lookup->lookup[i];
+					}
+				}
+			}
 
-		static float cos(float n)
-		{
-			return ::cosf(n);
-		}
+			for (auto var = &t_base::functions[0]; var->name != 0; ++var)
+			{
+				if (var->address == addr)
+				{
+					return var;
+				}
+			}
 
-		static float exp(float n)
-		{
-			return ::expf(n);
-		}
+			for (auto var = &t_base::operators[0]; var->name != 0; ++var)
+			{
+				if (var->address == addr)
+				{
+					return var;
+				}
+			}
 
-		static float asin(float n)
-		{
-			return ::asinf(n);
+			return nullptr;
 		}
+	};
 
-		static float sinh(float n)
-		{
-			return ::sinhf(n);
-		}
+	struct env_traits_f32
+	{
+		using t_atom	   = float;
+		using t_vector	   = float;
+		using t_vector_int = int;
+		using t_native	   = native_builtins_impl<t_vector>;
 
-		static float sin(float n)
-		{
-			return ::sinf(n);
-		}
+#if TP_COMPILER_ENABLED
+		using t_vector_builtins = compiler_builtins<native_builtins<t_vector>>;
+#endif
 
-		static float sqrt(float n)
-		{
-			return ::sqrtf(n);
-		}
+		static constexpr int lanes = 1;
 
-		static float log(float n)
+		static inline t_vector load_atom(t_atom a) noexcept
 		{
-			return ::logf(n);
+			return a;
 		}
 
-		static float log10(float n)
+		static inline t_atom store_atom(t_vector a) noexcept
 		{
-			return ::log10f(n);
+			return a;
 		}
 
-		static float atan(float n)
+		static inline t_vector as_truth(t_vector a) noexcept
 		{
-			return ::atanf(n);
+			return (a != 0.0f) ? 1.0f : 0.0f;
 		}
 
-		static float tanh(float n)
+		// Bit i is set when lane i is non-zero, NaN counts as true.
+		static inline int lane_mask(t_vector a) noexcept
 		{
-			return ::tanhf(n);
+			return (a != 0.0f) ? 1 : 0;
 		}
 
-		static float fmod(float n, float m)
+		static inline t_vector explicit_load_atom(double a) noexcept
 		{
-			return ::fmodf(n, m);
+			return (t_vector)a;
 		}
 
-		static float tan(float n)
+		static inline t_vector explicit_load_atom(int a) noexcept
 		{
-			return ::tanf(n);
+			return (t_vector)a;
 		}
 
-		static float atan2(float n, float m)
+		static inline double explicit_store_double(t_vector a)
 		{
-			return ::atan2f(n, m);
+			return (double)a;
 		}
 
-		static float pow(float n, float m)
+		static inline int explicit_store_int(t_vector a)
 		{
-			return ::powf(n, m);
+			return (int)a;
 		}
 
-		static float floor(float d)
+		static inline t_vector nan()
 		{
-			return ::floorf(d);
+			return std::numeric_limits<float>::quiet_NaN();
 		}
 
-		static float ceil(float d)
+#if TP_COMPILER_ENABLED
+		static inline const ::tp::variable* find_by_name(const char* name, int len, const ::tp::variable_lookup* lookup)
 		{
-			return ::ceilf(d);
+			return t_vector_builtins::find_by_name(name, len, lookup);
 		}
 
-		static float add(float a, float b)
+		static const ::tp::variable* find_by_addr(const void* addr, const ::tp::variable_lookup* lookup)
 		{
-			return a + b;
+			return t_vector_builtins::find_by_addr(addr, lookup);
 		}
 
-		static float sub(float a, float b)
+		static inline int find_operator(const void* addr)
 		{
-			return a - b;
+			return t_vector_builtins::find_operator_by_addr(addr);
 		}
+#endif // #if TP_COMPILER_ENABLED
+	};
 
-		static float mul(float a, float b)
+	struct env_traits_d64
+	{
+		using t_atom	   = double;
+		using t_vector	   = double;
+		using t_vector_int = int;
+		using t_native	   = native_builtins_impl<t_vector>;
+
+#if TP_COMPILER_ENABLED
+		using t_vector_builtins = compiler_builtins<native_builtins<t_vector>>;
+#endif
+
+		static constexpr int lanes = 1;
+
+		static inline t_vector load_atom(t_atom a) noexcept
 		{
-			return a * b;
+			return a;
 		}
 
-		static float divide(float a, float b)
+		static inline t_atom store_atom(t_vector a) noexcept
 		{
-			return a / b;
+			return a;
 		}
 
-		static float negate(float a)
+		static inline t_vector as_truth(t_vector a) noexcept
 		{
-			return -a;
+			return (a != 0.0f) ? 1.0f : 0.0f;
 		}
 
-		static float comma(float a, float b)
+		// Bit i is set when lane i is non-zero, NaN counts as true.
+		static inline int lane_mask(t_vector a) noexcept
 		{
-			(void)a;
-			return b;
+			return (a != 0.0f) ? 1 : 0;
 		}
 
-		static float greater(float a, float b)
+		static inline t_vector explicit_load_atom(double a) noexcept
 		{
-			return a > b;
+			return (t_vector)a;
 		}
 
-		static float greater_eq(float a, float b)
+		static inline t_vector explicit_load_atom(int a) noexcept
 		{
-			return a >= b;
+			return (t_vector)a;
 		}
 
-		static float lower(float a, float b)
+		static inline double explicit_store_double(t_vector a)
 		{
-			return a < b;
+			return (double)a;
 		}
 
-		static float lower_eq(float a, float b)
+		static inline int explicit_store_int(t_vector a)
 		{
-			return a <= b;
+			return (int)a;
 		}
 
-		static float equal(float a, float b)
+		static inline t_vector nan()
 		{
-			return a == b;
+			return std::numeric_limits<double>::quiet_NaN();
 		}
 
-		static float not_equal(float a, float b)
+#if TP_COMPILER_ENABLED
+		static inline const ::tp::variable* find_by_name(const char* name, int len, const ::tp::variable_lookup* lookup)
 		{
-			return a != b;
+			return t_vector_builtins::find_by_name(name, len, lookup);
 		}
 
-		static float logical_and(float a, float b)
+		static const ::tp::variable* find_by_addr(const void* addr, const ::tp::variable_lookup* lookup)
 		{
-			return a != 0.0f && b != 0.0f;
+			return t_vector_builtins::find_by_addr(addr, lookup);
 		}
 
-		static float logical_or(float a, float b)
+		static inline int find_operator(const void* addr)
 		{
-			return a != 0.0f || b != 0.0f;
+			return t_vector_builtins::find_operator_by_addr(addr);
 		}
+#endif // #if TP_COMPILER_ENABLED
+	};
 
-		static float logical_not(float a)
+#if TP_SIMD_SSE || TP_SIMD_AVX2
+	// Packed vectors, one register per t_vector. Lanes are bound like scalars: a variable points to a whole vector.
+	namespace simd_details
+	{
+#if TP_SIMD_SSE
+		struct sse_f32
+		{
+			using t_atom	 = float;
+			using t_register = __m128;
+			using t_int		 = __m128i;
+
+			static constexpr int lanes = 4;
+
+			static inline t_register set1(t_atom a) noexcept { return _mm_set1_ps(a); }
+			static inline t_register load(const t_atom* p) noexcept { return _mm_loadu_ps(p); }
+			static inline void store(t_atom* p, t_register a) noexcept { _mm_storeu_ps(p, a); }
+
+			static inline t_register add(t_register a, t_register b) noexcept { return _mm_add_ps(a, b); }
+			static inline t_register sub(t_register a, t_register b) noexcept { return _mm_sub_ps(a, b); }
+			static inline t_register mul(t_register a, t_register b) noexcept { return _mm_mul_ps(a, b); }
+			static inline t_register div(t_register a, t_register b) noexcept { return _mm_div_ps(a, b); }
+			static inline t_register min(t_register a, t_register b) noexcept { return _mm_min_ps(a, b); }
+			static inline t_register max(t_register a, t_register b) noexcept { return _mm_max_ps(a, b); }
+#if TP_FMA
+			static inline t_register fmadd(t_register a, t_register b, t_register c) noexcept { return _mm_fmadd_ps(a, b, c); }
+#endif // #if TP_FMA
+			static inline t_register sqrt(t_register a) noexcept { return _mm_sqrt_ps(a); }
+			static inline t_register floor(t_register a) noexcept { return _mm_floor_ps(a); }
+			static inline t_register ceil(t_register a) noexcept { return _mm_ceil_ps(a); }
+
+			static inline t_register and_(t_register a, t_register b) noexcept { return _mm_and_ps(a, b); }
+			static inline t_register or_(t_register a, t_register b) noexcept { return _mm_or_ps(a, b); }
+			static inline t_register xor_(t_register a, t_register b) noexcept { return _mm_xor_ps(a, b); }
+			static inline t_register andnot(t_register a, t_register b) noexcept { return _mm_andnot_ps(a, b); }
+			static inline t_register blend(t_register mask, t_register a, t_register b) noexcept { return _mm_blendv_ps(b, a, mask); }
+			static inline int		 movemask(t_register a) noexcept { return _mm_movemask_ps(a); }
+			static inline t_register from_movemask(int m) noexcept
+			{
+				const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+				return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(m), bits), bits));
+			}
+
+			static inline t_register cmp_eq(t_register a, t_register b) noexcept { return _mm_cmpeq_ps(a, b); }
+			static inline t_register cmp_neq(t_register a, t_register b) noexcept { return _mm_cmpneq_ps(a, b); }
+			static inline t_register cmp_lt(t_register a, t_register b) noexcept { return _mm_cmplt_ps(a, b); }
+			static inline t_register cmp_le(t_register a, t_register b) noexcept { return _mm_cmple_ps(a, b); }
+			static inline t_register cmp_gt(t_register a, t_register b) noexcept { return _mm_cmpgt_ps(a, b); }
+			static inline t_register cmp_ge(t_register a, t_register b) noexcept { return _mm_cmpge_ps(a, b); }
+
+			static inline t_int		 to_int(t_register a) noexcept { return _mm_cvttps_epi32(a); }
+			static inline t_register to_float(t_int a) noexcept { return _mm_cvtepi32_ps(a); }
+			static inline t_int		 as_int(t_register a) noexcept { return _mm_castps_si128(a); }
+			static inline t_register as_float(t_int a) noexcept { return _mm_castsi128_ps(a); }
+			static inline t_int		 int_set1(int a) noexcept { return _mm_set1_epi32(a); }
+			static inline t_int		 int_add(t_int a, t_int b) noexcept { return _mm_add_epi32(a, b); }
+			static inline t_int		 int_sub(t_int a, t_int b) noexcept { return _mm_sub_epi32(a, b); }
+			static inline t_int		 int_and(t_int a, t_int b) noexcept { return _mm_and_si128(a, b); }
+			static inline t_int		 int_andnot(t_int a, t_int b) noexcept { return _mm_andnot_si128(a, b); }
+			static inline t_int		 int_cmp_eq(t_int a, t_int b) noexcept { return _mm_cmpeq_epi32(a, b); }
+			template<int N>
+			static inline t_int int_shl(t_int a) noexcept { return _mm_slli_epi32(a, N); }
+			template<int N>
+			static inline t_int int_shr(t_int a) noexcept { return _mm_srli_epi32(a, N); }
+		};
+#endif // #if TP_SIMD_SSE
+
+#if TP_SIMD_AVX2
+		struct avx_f32
+		{
+			using t_atom	 = float;
+			using t_register = __m256;
+			using t_int		 = __m256i;
+
+			static constexpr int lanes = 8;
+
+			static inline t_register set1(t_atom a) noexcept { return _mm256_set1_ps(a); }
+			static inline t_register load(const t_atom* p) noexcept { return _mm256_loadu_ps(p); }
+			static inline void store(t_atom* p, t_register a) noexcept { _mm256_storeu_ps(p, a); }
+
+			static inline t_register add(t_register a, t_register b) noexcept { return _mm256_add_ps(a, b); }
+			static inline t_register sub(t_register a, t_register b) noexcept { return _mm256_sub_ps(a, b); }
+			static inline t_register mul(t_register a, t_register b) noexcept { return _mm256_mul_ps(a, b); }
+			static inline t_register div(t_register a, t_register b) noexcept { return _mm256_div_ps(a, b); }
+			static inline t_register min(t_register a, t_register b) noexcept { return _mm256_min_ps(a, b); }
+			static inline t_register max(t_register a, t_register b) noexcept { return _mm256_max_ps(a, b); }
+#if TP_FMA
+			static inline t_register fmadd(t_register a, t_register b, t_register c) noexcept { return _mm256_fmadd_ps(a, b, c); }
+#endif // #if TP_FMA
+			static inline t_register sqrt(t_register a) noexcept { return _mm256_sqrt_ps(a); }
+			static inline t_register floor(t_register a) noexcept { return _mm256_floor_ps(a); }
+			static inline t_register ceil(t_register a) noexcept { return _mm256_ceil_ps(a); }
+
+			static inline t_register and_(t_register a, t_register b) noexcept { return _mm256_and_ps(a, b); }
+			static inline t_register or_(t_register a, t_register b) noexcept { return _mm256_or_ps(a, b); }
+			static inline t_register xor_(t_register a, t_register b) noexcept { return _mm256_xor_ps(a, b); }
+			static inline t_register andnot(t_register a, t_register b) noexcept { return _mm256_andnot_ps(a, b); }
+			static inline t_register blend(t_register mask, t_register a, t_register b) noexcept { return _mm256_blendv_ps(b, a, mask); }
+			static inline int		 movemask(t_register a) noexcept { return _mm256_movemask_ps(a); }
+			static inline t_register from_movemask(int m) noexcept
+			{
+				const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+				return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(m), bits), bits));
+			}
+
+			static inline t_register cmp_eq(t_register a, t_register b) noexcept { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+			static inline t_register cmp_neq(t_register a, t_register b) noexcept { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+			static inline t_register cmp_lt(t_register a, t_register b) noexcept { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+			static inline t_register cmp_le(t_register a, t_register b) noexcept { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+			static inline t_register cmp_gt(t_register a, t_register b) noexcept { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+			static inline t_register cmp_ge(t_register a, t_register b) noexcept { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+
+			static inline t_int		 to_int(t_register a) noexcept { return _mm256_cvttps_epi32(a); }
+			static inline t_register to_float(t_int a) noexcept { return _mm256_cvtepi32_ps(a); }
+			static inline t_int		 as_int(t_register a) noexcept { return _mm256_castps_si256(a); }
+			static inline t_register as_float(t_int a) noexcept { return _mm256_castsi256_ps(a); }
+			static inline t_int		 int_set1(int a) noexcept { return _mm256_set1_epi32(a); }
+			static inline t_int		 int_add(t_int a, t_int b) noexcept { return _mm256_add_epi32(a, b); }
+			static inline t_int		 int_sub(t_int a, t_int b) noexcept { return _mm256_sub_epi32(a, b); }
+			static inline t_int		 int_and(t_int a, t_int b) noexcept { return _mm256_and_si256(a, b); }
+			static inline t_int		 int_andnot(t_int a, t_int b) noexcept { return _mm256_andnot_si256(a, b); }
+			static inline t_int		 int_cmp_eq(t_int a, t_int b) noexcept { return _mm256_cmpeq_epi32(a, b); }
+			template<int N>
+			static inline t_int int_shl(t_int a) noexcept { return _mm256_slli_epi32(a, N); }
+			template<int N>
+			static inline t_int int_shr(t_int a) noexcept { return _mm256_srli_epi32(a, N); }
+		};
+
+		struct avx_f64
+		{
+			using t_atom	 = double;
+			using t_register = __m256d;
+
+			static constexpr int lanes = 4;
+
+			static inline t_register set1(t_atom a) noexcept { return _mm256_set1_pd(a); }
+			static inline t_register load(const t_atom* p) noexcept { return _mm256_loadu_pd(p); }
+			static inline void store(t_atom* p, t_register a) noexcept { _mm256_storeu_pd(p, a); }
+
+			static inline t_register add(t_register a, t_register b) noexcept { return _mm256_add_pd(a, b); }
+			static inline t_register sub(t_register a, t_register b) noexcept { return _mm256_sub_pd(a, b); }
+			static inline t_register mul(t_register a, t_register b) noexcept { return _mm256_mul_pd(a, b); }
+			static inline t_register div(t_register a, t_register b) noexcept { return _mm256_div_pd(a, b); }
+			static inline t_register min(t_register a, t_register b) noexcept { return _mm256_min_pd(a, b); }
+			static inline t_register max(t_register a, t_register b) noexcept { return _mm256_max_pd(a, b); }
+#if TP_FMA
+			static inline t_register fmadd(t_register a, t_register b, t_register c) noexcept { return _mm256_fmadd_pd(a, b, c); }
+#endif // #if TP_FMA
+			static inline t_register sqrt(t_register a) noexcept { return _mm256_sqrt_pd(a); }
+			static inline t_register floor(t_register a) noexcept { return _mm256_floor_pd(a); }
+			static inline t_register ceil(t_register a) noexcept { return _mm256_ceil_pd(a); }
+
+			static inline t_register and_(t_register a, t_register b) noexcept { return _mm256_and_pd(a, b); }
+			static inline t_register or_(t_register a, t_register b) noexcept { return _mm256_or_pd(a, b); }
+			static inline t_register xor_(t_register a, t_register b) noexcept { return _mm256_xor_pd(a, b); }
+			static inline t_register andnot(t_register a, t_register b) noexcept { return _mm256_andnot_pd(a, b); }
+			static inline t_register blend(t_register mask, t_register a, t_register b) noexcept { return _mm256_blendv_pd(b, a, mask); }
+			static inline int		 movemask(t_register a) noexcept { return _mm256_movemask_pd(a); }
+			static inline t_register from_movemask(int m) noexcept
+			{
+				const __m256i bits = _mm256_setr_epi64x(1, 2, 4, 8);
+				return _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(m), bits), bits));
+			}
+
+			static inline t_register cmp_eq(t_register a, t_register b) noexcept { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+			static inline t_register cmp_neq(t_register a, t_register b) noexcept { return _mm256_cmp_pd(a, b, _CMP_NEQ_UQ); }
+			static inline t_register cmp_lt(t_register a, t_register b) noexcept { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+			static inline t_register cmp_le(t_register a, t_register b) noexcept { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+			static inline t_register cmp_gt(t_register a, t_register b) noexcept { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+			static inline t_register cmp_ge(t_register a, t_register b) noexcept { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+		};
+#endif // #if TP_SIMD_AVX2
+	} // namespace simd_details
+
+#if TP_SIMD_SSE
+	struct f32x4
+	{
+		using t_ops = simd_details::sse_f32;
+		__m128 v;
+
+		static inline f32x4 load(const float* p) noexcept
 		{
-			return a == 0.0f;
+			return {_mm_loadu_ps(p)};
 		}
 
-		static float logical_notnot(float a)
+		inline void store(float* p) const noexcept
 		{
-			return a != 0.0f;
+			_mm_storeu_ps(p, v);
 		}
+	};
+#endif // #if TP_SIMD_SSE
 
-		static float negate_logical_not(float a)
+#if TP_SIMD_AVX2
+	struct f32x8
+	{
+		using t_ops = simd_details::avx_f32;
+		__m256 v;
+
+		static inline f32x8 load(const float* p) noexcept
 		{
-			return (float)-(a == 0.0f);
+			return {_mm256_loadu_ps(p)};
 		}
 
-		static float negate_logical_notnot(float a)
+		inline void store(float* p) const noexcept
 		{
-			return (float)-(a != 0.0f);
+			_mm256_storeu_ps(p, v);
 		}
+	};
 
-		static float nul()
+	struct f64x4
+	{
+		using t_ops = simd_details::avx_f64;
+		__m256d v;
+
+		static inline f64x4 load(const double* p) noexcept
 		{
-			return 0.0f;
+			return {_mm256_loadu_pd(p)};
 		}
 
-		static float nan()
+		inline void store(double* p) const noexcept
 		{
-			return std::numeric_limits<float>::quiet_NaN();
+			_mm256_storeu_pd(p, v);
 		}
 	};
+#endif // #if TP_SIMD_AVX2
 
-	template<typename T_ATOM>
-	struct native_builtins : native_builtins_impl<T_ATOM>
+	namespace simd_details
 	{
-		using t_impl = native_builtins_impl<T_ATOM>;
+		// The builtins on top of the register primitives. Comparisons and logic produce lane masks and turn them into the 1/0 (or -1/0)
+		// values the scalar builtins return, so packed and scalar programs agree lane by lane. Float lanes get vectorized exp, log,
+		// sin and cos (Cephes polynomials), everything else without a packed instruction runs the scalar builtin per lane.
+		template<typename T_VECTOR>
+		struct simd_builtins_impl
+		{
+			using t_vector	 = T_VECTOR;
+			using t_ops		 = typename T_VECTOR::t_ops;
+			using t_atom	 = typename t_ops::t_atom;
+			using t_register = typename t_ops::t_register;
+			using t_scalar	 = native_builtins_impl<t_atom>;
 
-		static /*inline*/ constexpr tp::variable functions[] = {/* must be in alphabetical order */
-																{"abs", t_impl::fabs, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"acos", t_impl::acos, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"asin", t_impl::asin, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"atan", t_impl::atan, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"atan2", t_impl::atan2, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"ceil", t_impl::ceil, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"cos", t_impl::cos, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"cosh", t_impl::cosh, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"e", t_impl::e, tp::FUNCTION0 | tp::FLAG_PURE, 0},
-																{"exp", t_impl::exp, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"fac", t_impl::fac, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"floor", t_impl::floor, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"ln", t_impl::log, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-#ifdef TP_NAT_LOG
-																{"log", t_impl::log, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-#else
-																{"log", t_impl::log10, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-#endif
-																{"log10", t_impl::log10, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"ncr", t_impl::ncr, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"npr", t_impl::npr, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"pi", t_impl::pi, tp::FUNCTION0 | tp::FLAG_PURE, 0},
-																{"pow", t_impl::pow, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"sin", t_impl::sin, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"sinh", t_impl::sinh, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"sqrt", t_impl::sqrt, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"tan", t_impl::tan, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"tanh", t_impl::tanh, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{0, 0, 0, 0}};
+			static constexpr int  lanes	   = t_ops::lanes;
+			static constexpr bool is_float = std::is_same<t_atom, float>::value;
 
-		static /*inline*/ constexpr tp::variable operators[] = {/* must be in alphabetical order */
-																{"add", t_impl::add, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"comma", t_impl::comma, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"divide", t_impl::divide, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"equal", t_impl::equal, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"fmod", t_impl::fmod, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"greater", t_impl::greater, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"greater_eq", t_impl::greater_eq, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"logical_and", t_impl::logical_and, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"logical_not", t_impl::logical_not, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"logical_notnot", t_impl::logical_notnot, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"logical_or", t_impl::logical_or, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"lower", t_impl::lower, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"lower_eq", t_impl::lower_eq, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"mul", t_impl::mul, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"negate", t_impl::negate, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"negate_logical_not", t_impl::negate_logical_not, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"negate_logical_notnot", t_impl::negate_logical_notnot, tp::FUNCTION1 | tp::FLAG_PURE, 0},
-																{"not_equal", t_impl::not_equal, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"pow", t_impl::pow, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{"sub", t_impl::sub, tp::FUNCTION2 | tp::FLAG_PURE, 0},
-																{0, 0, 0, 0}};
-	};
+			static inline t_vector wrap(t_register a) noexcept
+			{
+				return {a};
+			}
 
-	template<typename T_NATIVE>
-	struct compiler_builtins : T_NATIVE
-	{
-		using t_base = T_NATIVE;
+			static inline t_vector splat(t_atom a) noexcept
+			{
+				return {t_ops::set1(a)};
+			}
+
+			static inline t_atom lane(t_vector a, int index) noexcept
+			{
+				t_atom l[lanes];
+				t_ops::store(l, a.v);
+				return l[index];
+			}
+
+			template<typename T_FUNC>
+			static inline t_vector per_lane(t_vector a, T_FUNC f)
+			{
+				t_atom l[lanes];
+				t_ops::store(l, a.v);
+				for (int i = 0; i < lanes; ++i)
+				{
+					l[i] = f(l[i]);
+				}
+				return {t_ops::load(l)};
+			}
+
+			template<typename T_FUNC>
+			static inline t_vector per_lane(t_vector a, t_vector b, T_FUNC f)
+			{
+				t_atom la[lanes], lb[lanes];
+				t_ops::store(la, a.v);
+				t_ops::store(lb, b.v);
+				for (int i = 0; i < lanes; ++i)
+				{
+					la[i] = f(la[i], lb[i]);
+				}
+				return {t_ops::load(la)};
+			}
+
+			static inline t_vector truth(t_register mask) noexcept
+			{
+				return {t_ops::and_(mask, t_ops::set1(t_atom(1)))};
+			}
+
+			static inline t_vector negative_truth(t_register mask) noexcept
+			{
+				return {t_ops::and_(mask, t_ops::set1(t_atom(-1)))};
+			}
+
+			static inline t_register non_zero(t_vector a) noexcept
+			{
+				return t_ops::cmp_neq(a.v, t_ops::set1(t_atom(0)));
+			}
+
+			static inline t_register zero(t_vector a) noexcept
+			{
+				return t_ops::cmp_eq(a.v, t_ops::set1(t_atom(0)));
+			}
+
+			static inline t_register is_finite(t_register a) noexcept
+			{
+				return t_ops::cmp_lt(t_ops::andnot(t_ops::set1(t_atom(-0.0)), a), t_ops::set1(std::numeric_limits<t_atom>::infinity()));
+			}
+
+			static inline t_register exp_f32(t_register x) noexcept
+			{
+				const t_register in = x;
+
+				x				= t_ops::min(x, t_ops::set1(88.3762626647949f));
+				x				= t_ops::max(x, t_ops::set1(-88.3762626647949f));
+				t_register fx	= t_ops::floor(t_ops::add(t_ops::mul(x, t_ops::set1(1.44269504088896341f)), t_ops::set1(0.5f)));
+				x				= t_ops::sub(x, t_ops::mul(fx, t_ops::set1(0.693359375f)));
+				x				= t_ops::sub(x, t_ops::mul(fx, t_ops::set1(-2.12194440e-4f)));
+				const auto z	= t_ops::mul(x, x);
+				t_register y	= t_ops::set1(1.9875691500E-4f);
+				y				= t_ops::add(t_ops::mul(y, x), t_ops::set1(1.3981999507E-3f));
+				y				= t_ops::add(t_ops::mul(y, x), t_ops::set1(8.3334519073E-3f));
+				y				= t_ops::add(t_ops::mul(y, x), t_ops::set1(4.1665795894E-2f));
+				y				= t_ops::add(t_ops::mul(y, x), t_ops::set1(1.6666665459E-1f));
+				y				= t_ops::add(t_ops::mul(y, x), t_ops::set1(5.0000001201E-1f));
+				y				= t_ops::add(t_ops::add(t_ops::mul(y, z), x), t_ops::set1(1.0f));
+				const auto pow2 = t_ops::as_float(t_ops::template int_shl<23>(t_ops::int_add(t_ops::to_int(fx), t_ops::int_set1(0x7f))));
+				y				= t_ops::mul(y, pow2);
+
+				// Past the clamp the scalar builtin overflows to inf or underflows to 0, NaN stays NaN.
+				y = t_ops::blend(t_ops::cmp_gt(in, t_ops::set1(88.7228391f)), t_ops::set1(std::numeric_limits<float>::infinity()), y);
+				y = t_ops::blend(t_ops::cmp_lt(in, t_ops::set1(-103.972084f)), t_ops::set1(0.0f), y);
+				return t_ops::blend(t_ops::cmp_neq(in, in), in, y);
+			}
+
+			static inline t_register log_f32(t_register x) noexcept
+			{
+				const t_register in	 = x;
+				const t_register one = t_ops::set1(1.0f);
+
+				x					= t_ops::max(x, t_ops::as_float(t_ops::int_set1(0x00800000))); // smallest normal
+				const auto bits		= t_ops::as_int(x);
+				t_register e		= t_ops::to_float(t_ops::int_sub(t_ops::template int_shr<23>(bits), t_ops::int_set1(0x7f)));
+				x					= t_ops::as_float(t_ops::int_add(t_ops::int_andnot(t_ops::int_set1(0x7f800000), bits), t_ops::int_set1(0x3f000000)));
+				e					= t_ops::add(e, one);
+				const auto small	= t_ops::cmp_lt(x, t_ops::set1(0.707106781186547524f));
+				const auto tmp		= t_ops::and_(small, x);
+				x					= t_ops::sub(x, one);
+				e					= t_ops::sub(e, t_ops::and_(small, one));
+				x					= t_ops::add(x, tmp);
+				const auto z		= t_ops::mul(x, x);
+				t_register y		= t_ops::set1(7.0376836292E-2f);
+				y					= t_ops::add(t_ops::mul(y, x), t_ops::set1(-1.1514610310E-1f));
+				y					= t_ops::add(t_ops::mul(y, x), t_ops::set1(1.1676998740E-1f));
+				y					= t_ops::add(t_ops::mul(y, x), t_ops::set1(-1.2420140846E-1f));
+				y					= t_ops::add(t_ops::mul(y, x), t_ops::set1(1.4249322787E-1f));
+				y					= t_ops::add(t_ops::mul(y, x), t_ops::set1(-1.6668057665E-1f));
+				y					= t_ops::add(t_ops::mul(y, x), t_ops::set1(2.0000714765E-1f));
+				y					= t_ops::add(t_ops::mul(y, x), t_ops::set1(-2.4999993993E-1f));
+				y					= t_ops::add(t_ops::mul(y, x), t_ops::set1(3.3333331174E-1f));
+				y					= t_ops::mul(t_ops::mul(y, x), z);
+				y					= t_ops::add(y, t_ops::mul(e, t_ops::set1(-2.12194440e-4f)));
+				y					= t_ops::sub(y, t_ops::mul(z, t_ops::set1(0.5f)));
+				x					= t_ops::add(x, y);
+				x					= t_ops::add(x, t_ops::mul(e, t_ops::set1(0.693359375f)));
+
+				// log(0) = -inf, log(inf) = inf, negative or NaN input gives NaN.
+				const auto inf = t_ops::set1(std::numeric_limits<float>::infinity());
+				x			   = t_ops::blend(t_ops::cmp_eq(in, inf), inf, x);
+				x			   = t_ops::blend(t_ops::cmp_eq(in, t_ops::set1(0.0f)), t_ops::set1(-std::numeric_limits<float>::infinity()), x);
+				return t_ops::blend(t_ops::cmp_ge(in, t_ops::set1(0.0f)), x, t_ops::set1(std::numeric_limits<float>::quiet_NaN()));
+			}
+
+			static inline t_register sincos_f32(t_register x, bool cosine) noexcept
+			{
+				const t_register in		  = x;
+				const t_register sign_bit = t_ops::set1(-0.0f);
+
+				t_register sign = cosine ? t_ops::set1(0.0f) : t_ops::and_(x, sign_bit);
+				x				= t_ops::andnot(sign_bit, x);
+
+				auto j = t_ops::to_int(t_ops::mul(x, t_ops::set1(1.27323954473516f))); // 4 / pi
+				j	   = t_ops::int_and(t_ops::int_add(j, t_ops::int_set1(1)), t_ops::int_set1(~1));
+				t_register y = t_ops::to_float(j);
+
+				if (cosine)
+				{
+					j	 = t_ops::int_sub(j, t_ops::int_set1(2));
+					sign = t_ops::as_float(t_ops::template int_shl<29>(t_ops::int_andnot(j, t_ops::int_set1(4))));
+				}
+				else
+				{
+					sign = t_ops::xor_(sign, t_ops::as_float(t_ops::template int_shl<29>(t_ops::int_and(j, t_ops::int_set1(4)))));
+				}
+				const auto use_sin = t_ops::as_float(t_ops::int_cmp_eq(t_ops::int_and(j, t_ops::int_set1(2)), t_ops::int_set1(0)));
+
+				x = t_ops::add(x, t_ops::mul(y, t_ops::set1(-0.78515625f)));
+				x = t_ops::add(x, t_ops::mul(y, t_ops::set1(-2.4187564849853515625e-4f)));
+				x = t_ops::add(x, t_ops::mul(y, t_ops::set1(-3.77489497744594108e-8f)));
+
+				const auto z = t_ops::mul(x, x);
+
+				t_register c = t_ops::set1(2.443315711809948E-005f);
+				c			 = t_ops::add(t_ops::mul(c, z), t_ops::set1(-1.388731625493765E-003f));
+				c			 = t_ops::add(t_ops::mul(c, z), t_ops::set1(4.166664568298827E-002f));
+				c			 = t_ops::mul(t_ops::mul(c, z), z);
+				c			 = t_ops::sub(c, t_ops::mul(z, t_ops::set1(0.5f)));
+				c			 = t_ops::add(c, t_ops::set1(1.0f));
+
+				t_register s = t_ops::set1(-1.9515295891E-4f);
+				s			 = t_ops::add(t_ops::mul(s, z), t_ops::set1(8.3321608736E-3f));
+				s			 = t_ops::add(t_ops::mul(s, z), t_ops::set1(-1.6666654611E-1f));
+				s			 = t_ops::add(t_ops::mul(t_ops::mul(s, z), x), x);
+
+				y = t_ops::xor_(t_ops::blend(use_sin, s, c), sign);
+				return t_ops::blend(is_finite(in), y, t_ops::set1(std::numeric_limits<float>::quiet_NaN()));
+			}
+
+			static t_vector pi(void)
+			{
+				return splat(t_scalar::pi());
+			}
+
+			static t_vector e(void)
+			{
+				return splat(t_scalar::e());
+			}
+
+			static t_vector fac(t_vector a)
+			{
+				return per_lane(a, t_scalar::fac);
+			}
+
+			static t_vector ncr(t_vector n, t_vector r)
+			{
+				return per_lane(n, r, t_scalar::ncr);
+			}
 
-		static inline int name_compare(const char* a, const char* b, size_t n)
-		{
-			while (n && *a && (*a == *b))
+			static t_vector npr(t_vector n, t_vector r)
 			{
-				++a;
-				++b;
-				--n;
+				return per_lane(n, r, t_scalar::npr);
 			}
-			if (n == 0)
+
+			static t_vector fabs(t_vector n)
 			{
-				return 0;
+				return {t_ops::andnot(t_ops::set1(t_atom(-0.0)), n.v)};
 			}
-			else
+
+			static t_vector acos(t_vector n)
 			{
-				return (*(unsigned char*)a - *(unsigned char*)b);
+				return per_lane(n, t_scalar::acos);
 			}
-		}
 
-		static inline const ::tp::variable* find_in_sorted_array(const char* name, int len, const ::tp::variable* vars, int vars_len)
-		{
-			int imin = 0;
-			int imax = vars_len - 2;
+			static t_vector cosh(t_vector n)
+			{
+				return per_lane(n, t_scalar::cosh);
+			}
 
-			/*Binary search.*/
-			while (imax >= imin)
+			static t_vector cos(t_vector n)
 			{
-				const int i = (imin + ((imax - imin) / 2));
-				int		  c = name_compare(name, vars[i].name, len);
-				if (!c)
-					c = '\0' - vars[i].name[len];
-				if (c == 0)
-				{
-					return vars + i;
-				}
-				else if (c > 0)
+				if constexpr (is_float)
 				{
-					imin = i + 1;
+					return {sincos_f32(n.v, true)};
 				}
 				else
 				{
-					imax = i - 1;
+					return per_lane(n, t_scalar::cos);
 				}
 			}
-			return nullptr;
-		}
 
-		static inline const ::tp::variable* find_by_name(const char* name, int len, const ::tp::variable_lookup* lookup)
-		{
-			if (lookup)
+			static t_vector exp(t_vector n)
 			{
-				const ::tp::variable* var	= lookup->lookup;
-				int					  iters = lookup->lookup_len;
-				for (; iters; ++var, --iters)
+				if constexpr (is_float)
 				{
-					if (name_compare(name, var->name, len) == 0 && var->name[len] == '\0')
-					{
-						return var;
-					}
+					return {exp_f32(n.v)};
+				}
+				else
+				{
+					return per_lane(n, t_scalar::exp);
 				}
 			}
 
-			auto res = find_in_sorted_array(name, len, t_base::functions, int(sizeof(t_base::functions) / sizeof(::tp::variable)));
-			if (!res)
+			static t_vector asin(t_vector n)
 			{
-				res = find_in_sorted_array(name, len, t_base::operators, int(sizeof(t_base::operators) / sizeof(::tp::variable)));
+				return per_lane(n, t_scalar::asin);
 			}
-			return res;
-		}
 
-		static const ::tp::variable* find_by_addr(const void* addr, const ::tp::variable_lookup* lookup)
-		{
-			if (lookup)
+			static t_vector sinh(t_vector n)
 			{
-				for (int i = 0; i < lookup->lookup_len; ++i)
+				return per_lane(n, t_scalar::sinh);
+			}
+
+			static t_vector sin(t_vector n)
+			{
+				if constexpr (is_float)
 				{
-					if (lookup->lookup[i].address == addr)
-					{
-						return &lookup->lookup[i];
-					}
+					return {sincos_f32(n.v, false)};
+				}
+				else
+				{
+					return per_lane(n, t_scalar::sin);
 				}
 			}
 
-			for (auto var = &t_base::functions[0]; var->name != 0; ++var)
+			static t_vector sqrt(t_vector n)
 			{
-				if (var->address == addr)
+				return {t_ops::sqrt(n.v)};
+			}
+
+			static t_vector log(t_vector n)
+			{
+				if constexpr (is_float)
 				{
-					return var;
+					return {log_f32(n.v)};
+				}
+				else
+				{
+					return per_lane(n, t_scalar::log);
 				}
 			}
 
-			for (auto var = &t_base::operators[0]; var->name != 0; ++var)
+			static t_vector log10(t_vector n)
 			{
-				if (var->address == addr)
+				if constexpr (is_float)
 				{
-					return var;
+					return {t_ops::mul(log_f32(n.v), t_ops::set1(0.434294481903251827651f))};
+				}
+				else
+				{
+					return per_lane(n, t_scalar::log10);
 				}
 			}
 
-			return nullptr;
-		}
-	};
+			static t_vector atan(t_vector n)
+			{
+				return per_lane(n, t_scalar::atan);
+			}
 
-	struct env_traits_f32
-	{
-		using t_atom	   = float;
-		using t_vector	   = float;
-		using t_vector_int = int;
+			static t_vector tanh(t_vector n)
+			{
+				return per_lane(n, t_scalar::tanh);
+			}
 
-#if TP_COMPILER_ENABLED
-		using t_vector_builtins = compiler_builtins<native_builtins<t_vector>>;
-#endif
+			static t_vector fmod(t_vector n, t_vector m)
+			{
+				return per_lane(n, m, t_scalar::fmod);
+			}
 
-		static inline t_vector load_atom(t_atom a) noexcept
-		{
-			return a;
-		}
+			static t_vector tan(t_vector n)
+			{
+				return per_lane(n, t_scalar::tan);
+			}
 
-		static inline t_vector as_truth(t_vector a) noexcept
-		{
-			return (a != 0.0f) ? 1.0f : 0.0f;
-		}
+			static t_vector atan2(t_vector n, t_vector m)
+			{
+				return per_lane(n, m, t_scalar::atan2);
+			}
 
-		static inline t_vector explicit_load_atom(double a) noexcept
-		{
-			return (t_vector)a;
-		}
+			static t_vector pow(t_vector n, t_vector m)
+			{
+				return per_lane(n, m, t_scalar::pow);
+			}
 
-		static inline t_vector explicit_load_atom(int a) noexcept
-		{
-			return (t_vector)a;
-		}
+			static t_vector floor(t_vector d)
+			{
+				return {t_ops::floor(d.v)};
+			}
 
-		static inline double explicit_store_double(t_vector a)
-		{
-			return (double)a;
-		}
+			static t_vector ceil(t_vector d)
+			{
+				return {t_ops::ceil(d.v)};
+			}
 
-		static inline int explicit_store_int(t_vector a)
-		{
-			return (int)a;
-		}
+			static t_vector add(t_vector a, t_vector b)
+			{
+				return {t_ops::add(a.v, b.v)};
+			}
 
-		static inline t_vector nan()
-		{
-			return std::numeric_limits<float>::quiet_NaN();
-		}
+			static t_vector sub(t_vector a, t_vector b)
+			{
+				return {t_ops::sub(a.v, b.v)};
+			}
 
-#if TP_COMPILER_ENABLED
-		static inline const ::tp::variable* find_by_name(const char* name, int len, const ::tp::variable_lookup* lookup)
-		{
-			return t_vector_builtins::find_by_name(name, len, lookup);
-		}
+			static t_vector mul(t_vector a, t_vector b)
+			{
+				return {t_ops::mul(a.v, b.v)};
+			}
 
-		static const ::tp::variable* find_by_addr(const void* addr, const ::tp::variable_lookup* lookup)
-		{
-			return t_vector_builtins::find_by_addr(addr, lookup);
-		}
-#endif // #if TP_COMPILER_ENABLED
+			static t_vector divide(t_vector a, t_vector b)
+			{
+				return {t_ops::div(a.v, b.v)};
+			}
+
+			static t_vector negate(t_vector a)
+			{
+				return {t_ops::xor_(a.v, t_ops::set1(t_atom(-0.0)))};
+			}
+
+			static t_vector comma(t_vector a, t_vector b)
+			{
+				(void)a;
+				return b;
+			}
+
+			static t_vector greater(t_vector a, t_vector b)
+			{
+				return truth(t_ops::cmp_gt(a.v, b.v));
+			}
+
+			static t_vector greater_eq(t_vector a, t_vector b)
+			{
+				return truth(t_ops::cmp_ge(a.v, b.v));
+			}
+
+			static t_vector lower(t_vector a, t_vector b)
+			{
+				return truth(t_ops::cmp_lt(a.v, b.v));
+			}
+
+			static t_vector lower_eq(t_vector a, t_vector b)
+			{
+				return truth(t_ops::cmp_le(a.v, b.v));
+			}
+
+			static t_vector equal(t_vector a, t_vector b)
+			{
+				return truth(t_ops::cmp_eq(a.v, b.v));
+			}
+
+			static t_vector not_equal(t_vector a, t_vector b)
+			{
+				return truth(t_ops::cmp_neq(a.v, b.v));
+			}
+
+			static t_vector logical_and(t_vector a, t_vector b)
+			{
+				return truth(t_ops::and_(non_zero(a), non_zero(b)));
+			}
+
+			static t_vector logical_or(t_vector a, t_vector b)
+			{
+				return truth(t_ops::or_(non_zero(a), non_zero(b)));
+			}
+
+			static t_vector logical_not(t_vector a)
+			{
+				return truth(zero(a));
+			}
+
+			static t_vector logical_notnot(t_vector a)
+			{
+				return truth(non_zero(a));
+			}
+
+			static t_vector negate_logical_not(t_vector a)
+			{
+				return negative_truth(zero(a));
+			}
+
+			static t_vector negate_logical_notnot(t_vector a)
+			{
+				return negative_truth(non_zero(a));
+			}
+
+			static t_vector select(t_vector c, t_vector a, t_vector b)
+			{
+				return {t_ops::blend(non_zero(c), a.v, b.v)};
+			}
+
+			static t_vector fma(t_vector a, t_vector b, t_vector c)
+			{
+#if TP_FMA
+				return {t_ops::fmadd(a.v, b.v, c.v)};
+#else
+				return {t_ops::add(t_ops::mul(a.v, b.v), c.v)};
+#endif // #if TP_FMA
+			}
+
+			static t_vector min(t_vector a, t_vector b)
+			{
+				return {t_ops::min(a.v, b.v)};
+			}
+
+			static t_vector max(t_vector a, t_vector b)
+			{
+				return {t_ops::max(a.v, b.v)};
+			}
+
+			static t_vector clamp(t_vector x, t_vector lo, t_vector hi)
+			{
+				return {t_ops::min(t_ops::max(x.v, lo.v), hi.v)};
+			}
+
+			static t_vector nul()
+			{
+				return splat(t_atom(0));
+			}
+
+			static t_vector nan()
+			{
+				return splat(std::numeric_limits<t_atom>::quiet_NaN());
+			}
+		};
+	} // namespace simd_details
+
+#if TP_SIMD_SSE
+	template<>
+	struct native_builtins_impl<f32x4> : simd_details::simd_builtins_impl<f32x4>
+	{
 	};
+#endif // #if TP_SIMD_SSE
 
-	struct env_traits_d64
+#if TP_SIMD_AVX2
+	template<>
+	struct native_builtins_impl<f32x8> : simd_details::simd_builtins_impl<f32x8>
 	{
-		using t_atom	   = double;
-		using t_vector	   = double;
+	};
+
+	template<>
+	struct native_builtins_impl<f64x4> : simd_details::simd_builtins_impl<f64x4>
+	{
+	};
+#endif // #if TP_SIMD_AVX2
+
+	template<typename T_VECTOR>
+	struct env_traits_simd
+	{
+		using t_ops		   = typename T_VECTOR::t_ops;
+		using t_atom	   = typename t_ops::t_atom;
+		using t_vector	   = T_VECTOR;
 		using t_vector_int = int;
+		using t_native	   = native_builtins_impl<t_vector>;
 
 #if TP_COMPILER_ENABLED
 		using t_vector_builtins = compiler_builtins<native_builtins<t_vector>>;
 #endif
 
+		static constexpr int lanes = t_ops::lanes;
+
 		static inline t_vector load_atom(t_atom a) noexcept
 		{
-			return a;
+			return t_native::splat(a);
+		}
+
+		// Constants are uniform, the first lane stands for all of them.
+		static inline t_atom store_atom(t_vector a) noexcept
+		{
+			return t_native::lane(a, 0);
 		}
 
 		static inline t_vector as_truth(t_vector a) noexcept
 		{
-			return (a != 0.0f) ? 1.0f : 0.0f;
+			return t_native::logical_notnot(a);
+		}
+
+		static inline int lane_mask(t_vector a) noexcept
+		{
+			return t_ops::movemask(t_native::non_zero(a));
+		}
+
+		// Lanes set in mask (as returned by lane_mask) come from a, the others from b.
+		static inline t_vector select_lanes(int mask, t_vector a, t_vector b) noexcept
+		{
+			return {t_ops::blend(t_ops::from_movemask(mask), a.v, b.v)};
 		}
 
 		static inline t_vector explicit_load_atom(double a) noexcept
 		{
-			return (t_vector)a;
+			return t_native::splat((t_atom)a);
 		}
 
 		static inline t_vector explicit_load_atom(int a) noexcept
 		{
-			return (t_vector)a;
+			return t_native::splat((t_atom)a);
 		}
 
 		static inline double explicit_store_double(t_vector a)
 		{
-			return (double)a;
+			return (double)store_atom(a);
 		}
 
 		static inline int explicit_store_int(t_vector a)
 		{
-			return (int)a;
+			return (int)store_atom(a);
 		}
 
 		static inline t_vector nan()
 		{
-			return std::numeric_limits<double>::quiet_NaN();
+			return t_native::nan();
 		}
 
 #if TP_COMPILER_ENABLED
@@ -3393,8 +9949,23 @@ namespace tp_stdlib
 		{
 			return t_vector_builtins::find_by_addr(addr, lookup);
 		}
+
+		static inline int find_operator(const void* addr)
+		{
+			return t_vector_builtins::find_operator_by_addr(addr);
+		}
 #endif // #if TP_COMPILER_ENABLED
 	};
+
+#if TP_SIMD_SSE
+	using env_traits_f32x4 = env_traits_simd<f32x4>;
+#endif // #if TP_SIMD_SSE
+
+#if TP_SIMD_AVX2
+	using env_traits_f32x8 = env_traits_simd<f32x8>;
+	using env_traits_f64x4 = env_traits_simd<f64x4>;
+#endif // #if TP_SIMD_AVX2
+#endif // #if TP_SIMD_SSE || TP_SIMD_AVX2
 } // namespace tp_stdlib
 #endif // #if TP_STANDARD_LIBRARY
 
@@ -1,8 +1,124 @@
 #include <cstdint>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define TP_COMPILER_ENABLED 1
+#define TP_STANDARD_LIBRARY 1
 #include <tinyprog.h>
 
+namespace
+{
+	int usage()
+	{
+		::fprintf(stderr,
+			"usage: tinyprog aot <program.tpp> <output.h> [--name <struct>] [--namespace <namespace>] [--double]\n"
+			"\n"
+			"Generates a C++ header with one function per subprogram of a serialized program. The functions take the same\n"
+			"binding array as eval_program_bytecode; --double reads programs serialized with the double precision traits.\n");
+		return 1;
+	}
+
+	tp::details::serialized_program* load_program(const char* file_name)
+	{
+		FILE* f = ::fopen(file_name, "rb");
+		if (!f)
+		{
+			return nullptr;
+		}
+
+		::fseek(f, 0, SEEK_END);
+		auto size = ::ftell(f);
+		::fseek(f, 0, SEEK_SET);
+
+		tp::details::serialized_program* prog = nullptr;
+		if (size > 0)
+		{
+			auto mem = ::malloc(size);
+			if (mem && ::fread(mem, 1, size, f) == size_t(size))
+			{
+				prog = tp::details::serialized_program::create_using_buffer(mem, size);
+			}
+			else
+			{
+				::free(mem);
+			}
+		}
+
+		::fclose(f);
+		return prog;
+	}
+
+	int aot(int argc, char** argv)
+	{
+		if (argc < 4)
+		{
+			return usage();
+		}
+
+		const char* input	   = argv[2];
+		const char* output	   = argv[3];
+		const char* name	   = "tinyprog_program";
+		const char* name_space = nullptr;
+		bool		use_double = false;
+
+		for (int i = 4; i < argc; ++i)
+		{
+			if (::strcmp(argv[i], "--name") == 0 && i + 1 < argc)
+			{
+				name = argv[++i];
+			}
+			else if (::strcmp(argv[i], "--namespace") == 0 && i + 1 < argc)
+			{
+				name_space = argv[++i];
+			}
+			else if (::strcmp(argv[i], "--double") == 0)
+			{
+				use_double = true;
+			}
+			else
+			{
+				return usage();
+			}
+		}
+
+		auto prog = load_program(input);
+		if (!prog)
+		{
+			::fprintf(stderr, "tinyprog: can't read '%s'\n", input);
+			return 1;
+		}
+
+		std::string code;
+		const bool	ok = use_double ? tp::impl<tp_stdlib::env_traits_d64>::generate_cpp(*prog, name, name_space, code)
+								   : tp::impl<tp_stdlib::env_traits_f32>::generate_cpp(*prog, name, name_space, code);
+		delete prog;
+
+		if (!ok)
+		{
+			::fprintf(stderr, "tinyprog: '%s' has no bytecode, re-serialize it with a current compiler\n", input);
+			return 1;
+		}
+
+		FILE* f = ::fopen(output, "wb");
+		if (!f)
+		{
+			::fprintf(stderr, "tinyprog: can't write '%s'\n", output);
+			return 1;
+		}
+		::fwrite(code.data(), 1, code.size(), f);
+		::fclose(f);
+		return 0;
+	}
+} // namespace
 
-int main(int argc, char** argv) {
-  return 0;
+int main(int argc, char** argv)
+{
+	if (argc >= 2 && ::strcmp(argv[1], "aot") == 0)
+	{
+		return aot(argc, argv);
+	}
+	return usage();
 }
@@ -0,0 +1,188 @@
+#include <doctest/doctest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define TP_COMPILER_ENABLED 1
+#define TP_STANDARD_LIBRARY 1
+#include <tinyprog.h>
+
+// Generated from TP_AOT_PROGRAMS by tinyprog_generate_cpp, see test/CMakeLists.txt.
+#include "aot_programs.h"
+
+using te	   = tp::impl<tp_stdlib::env_traits_f32>;
+using builtins = tp_stdlib::compiler_builtins<tp_stdlib::native_builtins<float>>;
+using aot	   = generated::aot_programs<te::env_traits>;
+
+namespace
+{
+	te::serialized_program* load_programs()
+	{
+		FILE* f = ::fopen(TP_AOT_PROGRAMS, "rb");
+		if (!f)
+		{
+			return nullptr;
+		}
+
+		::fseek(f, 0, SEEK_END);
+		auto size = ::ftell(f);
+		::fseek(f, 0, SEEK_SET);
+
+		te::serialized_program* prog = nullptr;
+		auto					mem	 = (size > 0) ? ::malloc(size) : nullptr;
+		if (mem && ::fread(mem, 1, size, f) == size_t(size))
+		{
+			prog = te::serialized_program::create_using_buffer(mem, size);
+		}
+		else
+		{
+			::free(mem);
+		}
+
+		::fclose(f);
+		return prog;
+	}
+
+	// Declared variables are already bound by the context, x and y come from the test and everything else is a builtin.
+	void bind(te::execution_context& ctx, const te::env_traits::t_atom* x, const te::env_traits::t_atom* y)
+	{
+		std::vector<bool> declared(ctx.get_num_bindings(), false);
+		for (int v = 0; aot::user_vars[v] >= 0; ++v)
+		{
+			declared[aot::user_vars[v]] = true;
+		}
+
+		for (int b = 0; b < aot::num_bindings; ++b)
+		{
+			const char* name = aot::binding_names[b];
+			if (declared[b])
+			{
+				continue;
+			}
+
+			if (::strcmp(name, "x") == 0)
+			{
+				ctx.bind(b, x);
+			}
+			else if (::strcmp(name, "y") == 0)
+			{
+				ctx.bind(b, y);
+			}
+			else
+			{
+				auto var = builtins::find_by_name(name, int(::strlen(name)), nullptr);
+				REQUIRE(var);
+				ctx.bind(b, var->address);
+			}
+		}
+	}
+
+	bool same(float a, float b)
+	{
+		return (a != a && b != b) || a == doctest::Approx(b).epsilon(1e-5);
+	}
+
+	float shadowed_sqrt(float a)
+	{
+		return a * 10;
+	}
+} // namespace
+
+TEST_CASE("aot")
+{
+	te::serialized_program* prog = load_programs();
+	REQUIRE(prog);
+	REQUIRE(prog->is_valid());
+
+	// The generated header describes the program it was generated from.
+	REQUIRE(aot::num_subprograms == prog->get_num_subprograms());
+	REQUIRE(size_t(aot::num_bindings) == prog->get_num_bindings());
+	for (int b = 0; b < aot::num_bindings; ++b)
+	{
+		CHECK(::strcmp(aot::binding_names[b], prog->get_binding_string(uint16_t(b))) == 0);
+	}
+	CHECK(aot::binding_names[aot::num_bindings] == nullptr);
+	for (size_t v = 0; v < prog->get_num_user_vars(); ++v)
+	{
+		CHECK(aot::user_vars[v] == prog->get_user_vars()[v]);
+	}
+	CHECK(aot::user_vars[prog->get_num_user_vars()] == -1);
+	CHECK(aot::get_subprogram(-1) == nullptr);
+	CHECK(aot::get_subprogram(aot::num_subprograms) == nullptr);
+
+	const float inputs[][2] = {{0, 0}, {1, 2}, {-3, 0.5f}, {2.5f, -4}, {-0.25f, -1}, {7, 1}};
+	for (auto& input : inputs)
+	{
+		te::env_traits::t_atom x = input[0], y = input[1];
+
+		te::execution_context tree_ctx(*prog), bytecode_ctx(*prog), aot_ctx(*prog);
+		bind(tree_ctx, &x, &y);
+		bind(bytecode_ctx, &x, &y);
+		bind(aot_ctx, &x, &y);
+
+		// Subprograms run in order on one context each, so declared variables carry over between them as well.
+		for (int s = 0; s < aot::num_subprograms; ++s)
+		{
+			CAPTURE(x);
+			CAPTURE(y);
+			CAPTURE(s);
+
+			const float expected = te::eval_program(*prog, s, tree_ctx);
+			const float bytecode = te::eval_program_bytecode(*prog, s, bytecode_ctx);
+			const float compiled = aot::get_subprogram(s)(aot_ctx.get_bindings());
+
+			CHECK(same(bytecode, expected));
+			CHECK(same(compiled, expected));
+		}
+
+		// Locals live in the generated functions, only the frame slot of acc is written by both.
+		for (size_t v = 0; v < tree_ctx.get_num_declared_variables(); ++v)
+		{
+			if (::strcmp(aot::binding_names[aot::user_vars[v]], "acc") == 0)
+			{
+				CHECK(same(*aot_ctx.get_declared_variable(v), *tree_ctx.get_declared_variable(v)));
+			}
+		}
+	}
+
+	delete prog;
+}
+
+TEST_CASE("aot shadowed builtins")
+{
+	te::serialized_program* prog = load_programs();
+	REQUIRE(prog);
+
+	// Builtins are called directly only while their binding points at the builtin, a host function bound to the name still runs.
+	te::env_traits::t_atom x = 2, y = 3;
+	te::execution_context  tree_ctx(*prog), aot_ctx(*prog);
+	bind(tree_ctx, &x, &y);
+	bind(aot_ctx, &x, &y);
+
+	bool shadowed = false;
+	for (int b = 0; b < aot::num_bindings; ++b)
+	{
+		if (::strcmp(aot::binding_names[b], "sqrt") == 0)
+		{
+			tree_ctx.bind(b, (const void*)shadowed_sqrt);
+			aot_ctx.bind(b, (const void*)shadowed_sqrt);
+			shadowed = true;
+		}
+	}
+	REQUIRE(shadowed);
+
+	for (int s = 0; s < aot::num_subprograms; ++s)
+	{
+		CAPTURE(s);
+		CHECK(same(aot::get_subprogram(s)(aot_ctx.get_bindings()), te::eval_program(*prog, s, tree_ctx)));
+	}
+
+	// Subprogram 1 sums sqrt(abs(i * x + y)) for i < 5.
+	tree_ctx.reset();
+	CHECK(same(te::eval_program(*prog, 1, tree_ctx), 10 * (3 + 5 + 7 + 9 + 11)));
+
+	delete prog;
+}
@@ -0,0 +1,88 @@
+// Serializes the programs tinyprogAotTests runs through tinyprog_generate_cpp.
+//
+// usage: tinyprogAotPrograms <output.tpp>
+
+#include <cstdio>
+#include <vector>
+
+#define TP_COMPILER_ENABLED 1
+#define TP_STANDARD_LIBRARY 1
+#include <tinyprog.h>
+
+using te = tp::impl<tp_stdlib::env_traits_f32>;
+
+int main(int argc, char** argv)
+{
+	if (argc != 2)
+	{
+		::fprintf(stderr, "usage: tinyprogAotPrograms <output.tpp>\n");
+		return 1;
+	}
+
+	// Loops, jumps, locals, declared variables, short circuits and builtins, the test runs each subprogram on several inputs.
+	const char* prog_texts[] = {
+		"var: acc;"
+		"acc: acc + x;"
+		"return: acc * 2 + max(x, y);",
+
+		"var: i ? local;"
+		"var: s ? local;"
+		"label: loop;"
+		"s: s + sqrt(abs(i * x + y));"
+		"i: i + 1;"
+		"jump: loop ? i < 5;"
+		"return: s;",
+
+		"jump: negative ? x < 0;"
+		"return: pow(x, 1.5) + y;"
+		"label: negative;"
+		"return: select(y > 0, -x, x * y);",
+
+		"return: (x < y && y > 1 || !x) + clamp(x, -1, 1) * floor(y);",
+
+		"var: acc;"
+		"var: t ? local;"
+		"t: x * x + y;"
+		"acc: acc - t;"
+		"return: select(t > acc, t, acc) + exp(-abs(y));",
+	};
+	const int num_prog_texts = int(sizeof(prog_texts) / sizeof(prog_texts[0]));
+
+	te::env_traits::t_atom x = 0, y = 0;
+	te::variable		   vars[] = {{"x", &x}, {"y", &y}};
+
+	te::t_indexer indexer;
+	for (auto& var : vars)
+	{
+		indexer.add_user_variable(&var);
+	}
+
+	std::vector<tp::compiled_program*> subprograms;
+	for (int i = 0; i < num_prog_texts; ++i)
+	{
+		int	 error = 0;
+		auto prog  = te::compile_program_using_indexer(prog_texts[i], &error, indexer);
+		if (!prog)
+		{
+			::fprintf(stderr, "tinyprogAotPrograms: subprogram %d doesn't compile, error at %d\n", i, error);
+			return 1;
+		}
+		subprograms.push_back(prog);
+	}
+
+	te::serialized_program prog(subprograms.data(), num_prog_texts, indexer.m_declared_variable_names);
+	for (auto subprogram : subprograms)
+	{
+		delete subprogram;
+	}
+
+	FILE* f = ::fopen(argv[1], "wb");
+	if (!f)
+	{
+		::fprintf(stderr, "tinyprogAotPrograms: can't write '%s'\n", argv[1]);
+		return 1;
+	}
+	::fwrite(prog.get_raw_data(), 1, prog.get_raw_data_size(), f);
+	::fclose(f);
+	return 0;
+}
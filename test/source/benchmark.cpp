@@ -32,6 +32,9 @@
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
 
 #define TP_TESTING 1
 #include "tinyprog.h"
@@ -80,7 +83,6 @@ void bench(const char* expr, function1 func)
 			d += te::eval(n);
 		}
 	const int eelapsed = (clock() - start) * 1000 / CLOCKS_PER_SEC;
-	delete n;
 
 	/*Million floats per second input.*/
 	printf(" %.5g", d);
@@ -91,8 +93,176 @@ void bench(const char* expr, function1 func)
 
 	printf("%.2f%% longer\n", (((te::env_traits::t_atom)eelapsed / nelapsed) - 1.0) * 100.0);
 
+	printf("bytecode ");
+	start = clock();
+	d	  = 0;
+	for (j = 0; j < loops; ++j)
+		for (i = 0; i < loops; ++i)
+		{
+			tmp = (te::env_traits::t_atom)i;
+			d += te::eval_bytecode(n);
+		}
+	const int belapsed = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+
+	/*Million floats per second input.*/
+	printf(" %.5g", d);
+	if (belapsed)
+		printf("\t%5dms\t%5dmfps\n", belapsed, loops * loops / belapsed / 1000);
+	else
+		printf("\tinf\n");
+
+	printf("%.2f%% longer\n", (((te::env_traits::t_atom)belapsed / nelapsed) - 1.0) * 100.0);
+
+	printf("batch    ");
+	{
+		static te::env_traits::t_atom column[loops], out[loops];
+		for (i = 0; i < loops; ++i)
+		{
+			column[i] = (te::env_traits::t_atom)i;
+		}
+
+		// The only variable binding is 'a', redirect it to the column.
+		std::vector<const void*> columns(n->get_binding_addresses(), n->get_binding_addresses() + n->get_binding_array_size());
+		std::replace(columns.begin(), columns.end(), (const void*)&tmp, (const void*)column);
+
+		start = clock();
+		d	  = 0;
+		for (j = 0; j < loops; ++j)
+		{
+			te::eval_batch(n, loops, &columns[0], out);
+			for (i = 0; i < loops; ++i)
+			{
+				d += out[i];
+			}
+		}
+	}
+	const int telapsed = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+
+	/*Million floats per second input.*/
+	printf(" %.5g", d);
+	if (telapsed)
+		printf("\t%5dms\t%5dmfps\n", telapsed, loops * loops / telapsed / 1000);
+	else
+		printf("\tinf\n");
+
+	printf("%.2f%% longer\n", (((te::env_traits::t_atom)telapsed / nelapsed) - 1.0) * 100.0);
+
+#if TP_JIT_ENABLED
+	auto fn = te::jit(n);
+
+	printf("jit      ");
+	start = clock();
+	d	  = 0;
+	for (j = 0; j < loops; ++j)
+		for (i = 0; i < loops; ++i)
+		{
+			tmp = (te::env_traits::t_atom)i;
+			d += te::eval_jit(fn, n);
+		}
+	const int jelapsed = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+	delete fn;
+
+	/*Million floats per second input.*/
+	printf(" %.5g", d);
+	if (jelapsed)
+		printf("\t%5dms\t%5dmfps\n", jelapsed, loops * loops / jelapsed / 1000);
+	else
+		printf("\tinf\n");
+
+	printf("%.2f%% longer\n", (((te::env_traits::t_atom)jelapsed / nelapsed) - 1.0) * 100.0);
+#endif // #if TP_JIT_ENABLED
+	delete n;
+
+	printf("\n");
+}
+
+#if TP_THREADS_ENABLED
+// Throughput of eval_parallel over one large column from 1 thread up to the hardware thread count.
+void bench_parallel(const char* expr)
+{
+	static constexpr size_t rows = size_t(loops) * 100;
+
+	te::env_traits::t_atom tmp;
+	te::variable		   lk = {"a", &tmp};
+
+	std::vector<te::env_traits::t_atom> column(rows), out(rows);
+	for (size_t i = 0; i < rows; ++i)
+	{
+		column[i] = (te::env_traits::t_atom)(i % loops);
+	}
+
+	auto n = te::compile(expr, &lk, 1, 0);
+	std::vector<const void*> columns(n->get_binding_addresses(), n->get_binding_addresses() + n->get_binding_array_size());
+	std::replace(columns.begin(), columns.end(), (const void*)&tmp, (const void*)&column[0]);
+
+	printf("Expression: %s, %zu rows\n", expr, rows);
+
+	const int max_threads = int(std::thread::hardware_concurrency());
+	int		  base_mrps	  = 0;
+	for (int threads = 1;; threads = (threads * 2 < max_threads) ? threads * 2 : max_threads)
+	{
+		tp::thread_pool pool(threads);
+
+		// clock() adds up the time of every thread, measure wall time instead.
+		const auto start = std::chrono::steady_clock::now();
+		for (int j = 0; j < 10; ++j)
+		{
+			te::eval_parallel(pool, n, rows, &columns[0], &out[0]);
+		}
+		const auto elapsed = int(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+
+		/*Million rows per second.*/
+		const int mrps = elapsed ? int(rows * 10 / 1000 / elapsed) : 0;
+		base_mrps	   = (threads == 1) ? mrps : base_mrps;
+		printf("%3d threads\t%5dms\t%5dmrps\t%.2fx\n", threads, elapsed, mrps, base_mrps ? double(mrps) / base_mrps : 0.0);
+
+		if (threads >= max_threads)
+		{
+			break;
+		}
+	}
+	delete n;
+
 	printf("\n");
 }
+#endif // #if TP_THREADS_ENABLED
+
+// eval against an incremental_context when only 'a' changes between runs and the other variables are static.
+void bench_incremental(const char* expr)
+{
+	te::env_traits::t_atom vars[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	te::variable		   lk[]	   = {{"a", &vars[0]}, {"b", &vars[1]}, {"c", &vars[2]}, {"d", &vars[3]}, {"e", &vars[4]}, {"f", &vars[5]}, {"g", &vars[6]},
+		   {"h", &vars[7]}};
+
+	auto n = te::compile(expr, lk, 8, 0);
+	te::incremental_context inc(n);
+
+	printf("Expression: %s\n", expr);
+
+	volatile te::env_traits::t_atom d = 0;
+
+	clock_t start = clock();
+	for (int j = 0; j < loops * 10; ++j)
+	{
+		vars[0] = (te::env_traits::t_atom)(j % 16);
+		d += te::eval(n);
+	}
+	const int full = (int)((clock() - start) * 1000 / CLOCKS_PER_SEC);
+
+	start = clock();
+	for (int j = 0; j < loops * 10; ++j)
+	{
+		vars[0] = (te::env_traits::t_atom)(j % 16);
+		inc.mark_dirty(&vars[0]);
+		d += inc.eval();
+	}
+	const int incremental = (int)((clock() - start) * 1000 / CLOCKS_PER_SEC);
+
+	printf("full\t\t%5dms\nincremental\t%5dms\t%d of %d nodes\t%.2fx\n\n", full, incremental, inc.get_num_evaluated(), inc.get_num_nodes(),
+		incremental ? double(full) / incremental : 0.0);
+
+	delete n;
+}
 
 te::env_traits::t_atom a5(te::env_traits::t_atom a)
 {
@@ -127,4 +297,9 @@ TEST_CASE("Bench")
 //	bench("a+(5*2)", a10);
 //	bench("(a+5)*2", a52);
 //	bench("(1/(a+1)+2/(a+2)+3/(a+3))", al);
+//	bench_incremental("sqrt(a^1.5+b^2.5) + sin(c)*cos(d) + exp(e/10)*ln(f+1) + atan2(g, h)*(b+c)/(d+e)");
+#if TP_THREADS_ENABLED
+//	bench_parallel("sqrt(a^1.5+a^2.5)");
+//	bench_parallel("(1/(a+1)+2/(a+2)+3/(a+3))");
+#endif // #if TP_THREADS_ENABLED
 }
@@ -220,6 +220,27 @@ TEST_CASE("example_program")
 			assert(results[i] == last_result);
 		}
 
+		// The bytecode stored alongside the statements must agree
+		for (int i = 0; i < prog->get_num_subprograms(); ++i)
+		{
+			assert(prog->get_bytecode(i) != nullptr);
+			const float r = te::eval_program_bytecode(*prog, i, &binding_array[0]);
+			assert((r == results[i]) || (r != r && results[i] != results[i]));
+		}
+
+#if TP_COMPILER_ENABLED
+		// Ahead of time translation, one function per subprogram. tinyprogAotTests compiles and runs generated code.
+		{
+			std::string code;
+			const bool	generated = te::generate_cpp(*prog, "example_programs", "generated", code);
+			CHECK(generated);
+			CHECK(code.find("struct example_programs") != std::string::npos);
+			CHECK(code.find("subprogram_2(const void* const* bindings)") != std::string::npos);
+			CHECK(code.find("t_native::lower") != std::string::npos);
+			CHECK(code.find("v0 = ") == std::string::npos); // x_tmp is a constant, propagated into its uses
+		}
+#endif // #if TP_COMPILER_ENABLED
+
 		assert(x == 255.0f); // x should have been initialized to 255 in the constructor
 		assert(y == -1.0f);	 // y should have been overridden by the declared var
 
@@ -33,6 +33,9 @@
 #include "tinyprog.h"
 
 #include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
 #include "minctest.h"
 
 typedef struct
@@ -447,6 +450,31 @@ te::env_traits::t_vector sum7(te::env_traits::t_vector a,
 	return a + b + c + d + e + f + g;
 }
 
+te::env_traits::t_vector subtract(te::env_traits::t_vector a, te::env_traits::t_vector b)
+{
+	return a - b;
+}
+
+void test_operator_override()
+{
+	// A variable named like an operator replaces it for the whole expression.
+	te::env_traits::t_vector x = 5;
+	te::variable			 lookup[] = {{"x", &x}, {"add", subtract, tp::FUNCTION2}};
+
+	int	 err;
+	auto ex = te::compile("x + 1 + (x + 2)", lookup, 2, &err);
+	lok(ex);
+	lfequal(te::eval(ex), 1);
+	lfequal(te::eval_bytecode(ex), 1);
+	delete ex;
+
+	// Other operators still resolve to the builtins.
+	ex = te::compile("x * 2 - 1", lookup, 2, &err);
+	lok(ex);
+	lfequal(te::eval(ex), 9);
+	delete ex;
+}
+
 void test_dynamic()
 {
 	te::env_traits::t_vector x, f;
@@ -587,6 +615,1601 @@ void test_closure()
 	}
 }
 
+te::env_traits::t_vector counted(void* context, te::env_traits::t_vector a)
+{
+	++*((int*)context);
+	return a;
+}
+
+te::env_traits::t_vector assigned(void* context, te::env_traits::t_vector a)
+{
+	*((te::env_traits::t_vector*)context) = a;
+	return a;
+}
+
+void test_short_circuit()
+{
+	te::env_traits::t_vector x;
+	int						 calls	  = 0;
+	te::variable			 lookup[] = {{"x", &x}, {"f", counted, tp::CLOSURE1, &calls}, {"setx", assigned, tp::CLOSURE1, &x}};
+
+	struct
+	{
+		const char*				 expr;
+		te::env_traits::t_vector x;
+		te::env_traits::t_vector answer;
+		int						 calls;
+	} cases[] = {
+		{"x > 1 && f(x)", 0, 0, 0},
+		{"x > 1 && f(x)", 2, 1, 1},
+		{"x > 1 && f(x - 2)", 2, 0, 1},
+		{"x > 1 || f(x)", 2, 1, 0},
+		{"x > 1 || f(x)", 0, 0, 1},
+		{"x > 1 || f(x + 1)", 0, 1, 1},
+		{"x && f(x) && f(x + 1)", 0, 0, 0},
+		{"(x || f(x)) + (x && f(x))", 3, 2, 1},
+		{"0 && f(x)", 2, 0, 0},
+		{"1 || f(x)", 2, 1, 0},
+		{"(x * 3, f(x))", 2, 2, 1},
+		{"(f(x), x * 3)", 2, 6, 1},
+		{"(x, sqrt(x), x + 1)", 3, 4, 0},
+		{"select(x > 1, f(x), 0)", 2, 2, 1},
+		{"select(x > 1, f(x), 0)", 0, 0, 0},
+		{"select(x, x * 2, f(x + 1))", 0, 1, 1},
+		{"select(x, sqrt(x), -x) + 1", 4, 3, 0},
+		{"select(x < 0, -x, x)", -3, 3, 0},
+		{"select(1, x, f(x))", 5, 5, 0},
+		// Operands run left to right on every path.
+		{"(x, setx(4), x + 1)", -1, 5, 0},
+		{"setx(7) + x", -1, 14, 0},
+		{"x + setx(7)", -1, 6, 0},
+		{"f(x) + setx(x + 2) * x", 1, 10, 1},
+	};
+
+	for (const auto& c : cases)
+	{
+		int	 err;
+		auto ex = te::compile(c.expr, lookup, 3, &err);
+		lok(ex);
+		lok(ex->get_bytecode_size() > 0);
+
+		x	  = c.x;
+		calls = 0;
+		lfequal(te::eval(ex), c.answer);
+		lequal(calls, c.calls);
+
+		x	  = c.x;
+		calls = 0;
+		lfequal(te::eval_bytecode(ex), c.answer);
+		lequal(calls, c.calls);
+
+#if TP_JIT_ENABLED
+		auto fn = te::jit(ex);
+		x		= c.x;
+		calls	= 0;
+		lfequal(te::eval_jit(fn, ex), c.answer);
+		lequal(calls, c.calls);
+		delete fn;
+#endif // #if TP_JIT_ENABLED
+
+		delete ex;
+	}
+
+	// Rows that skip the call and rows that make it share a batch.
+	struct
+	{
+		const char* expr;
+		int			calls;
+	} batches[] = {
+		{"x > 1 && f(x - 2) || x < -1", 3},
+		{"x > 1 && f(x - 2) || select(x < -1, 1, f(x) * 0)", 7},
+	};
+
+	for (const auto& b : batches)
+	{
+		int	 err;
+		auto ex = te::compile(b.expr, lookup, 3, &err);
+		lok(ex);
+
+		te::env_traits::t_vector xs[9], out[9];
+		for (int i = 0; i < 9; ++i)
+		{
+			xs[i] = te::env_traits::t_vector(i - 4);
+		}
+
+		std::vector<const void*> columns(ex->get_binding_addresses(), ex->get_binding_addresses() + ex->get_binding_array_size());
+		std::replace(columns.begin(), columns.end(), (const void*)&x, (const void*)xs);
+		calls = 0;
+		lok(te::eval_batch(ex, 9, &columns[0], out));
+		lequal(calls, b.calls);
+		for (int i = 0; i < 9; ++i)
+		{
+			x = xs[i];
+			lfequal(out[i], te::eval(ex));
+		}
+
+		delete ex;
+	}
+}
+
+void test_bytecode()
+{
+	te::env_traits::t_vector x, y;
+	te::variable			 lookup[] = {
+		{"x", &x},
+		{"y", &y},
+		{"sum3", sum3, tp::FUNCTION3},
+		{"c2", clo2, tp::CLOSURE2, &y},
+	};
+
+	const char* exprs[] = {
+		"x+5",
+		"x+(5*2)",
+		"(x+5)*2",
+		"sqrt(x^1.5+x^2.5)",
+		"(1/(x+1)+2/(x+2)+3/(x+3))",
+		"sum3(x, y, 2) * c2(x, y)",
+		"x < y && y > 1 || !x",
+		"-(x,(y,3))",
+		"pi * sum3(sum3(x, 1, 2), sum3(y, 3, 4), sum3(x, y, 5))",
+	};
+
+	int i;
+	for (i = 0; i < sizeof(exprs) / sizeof(const char*); ++i)
+	{
+		int	 err;
+		auto ex = te::compile(exprs[i], lookup, sizeof(lookup) / sizeof(te::variable), &err);
+		lok(ex);
+		lok(ex->get_bytecode_size() > 0);
+
+		for (x = 0; x < 5; x += 0.5f)
+		{
+			for (y = 0; y < 3; y += 0.5f)
+			{
+				lfequal(te::eval_bytecode(ex), te::eval(ex));
+			}
+		}
+
+		delete ex;
+	}
+
+	const char* program =
+		"r: 0;"
+		"label: loop;"
+		"r: r + x;"
+		"x: x - 1;"
+		"jump: loop ? x > 0;"
+		"jump: is_big ? r > 10;"
+		"return: r;"
+		"label: is_big;"
+		"return: -r;";
+
+	te::env_traits::t_vector r;
+	te::variable			 program_lookup[] = {{"x", &x}, {"r", &r}};
+
+	int	 err  = 0;
+	auto prog = te::compile_program(program, program_lookup, 2, &err);
+	lok(prog);
+	lok(prog->get_bytecode_size() > 0);
+
+	for (i = 0; i < 8; ++i)
+	{
+		x				   = te::env_traits::t_vector(i);
+		const auto by_tree = te::eval_program(prog);
+		x				   = te::env_traits::t_vector(i);
+		lfequal(te::eval_program_bytecode(prog), by_tree);
+	}
+
+	delete prog;
+
+	// Bytecode chunks hold at most 0xffff bytes, past that a serialized subprogram runs on its statements.
+	for (int num_jumps : {900, 1000})
+	{
+		std::string big_program = "r: 0;";
+		for (i = 0; i < num_jumps; ++i)
+		{
+			big_program += "r: r + x; jump: done ? r > " + std::to_string(i * 7 + 3) + ";";
+		}
+		big_program += "return: r; label: done; return: -r;";
+
+		auto big = te::compile_program(big_program.c_str(), program_lookup, 2, &err);
+		lok(big);
+		lok(big->get_bytecode() != nullptr);
+
+		std::vector<std::string>	user_vars;
+		const tp::compiled_program* programs[] = {big};
+		te::serialized_program		serialized(programs, 1, user_vars);
+		lequal(int(serialized.get_bytecode(0) != nullptr), int(big->get_bytecode_size() <= 0xffff));
+
+		for (x = 0; x < 8; x += 1)
+		{
+			const auto by_tree = te::eval_program(big);
+			lfequal(te::eval_program_bytecode(serialized, 0, big->get_binding_addresses()), by_tree);
+			lfequal(te::eval_program(serialized, 0, big->get_binding_addresses()), by_tree);
+		}
+
+		delete big;
+	}
+}
+
+void test_bytecode_operators()
+{
+	te::env_traits::t_vector x, y, z;
+	te::variable			 lookup[] = {{"x", &x}, {"y", &y}, {"z", &z}};
+
+	// One expression per builtin operator, in builtin_operator order.
+	const char* exprs[] = {
+		"x+y",
+		"x-y",
+		"x*y",
+		"x/y",
+		"(x+3)^y",
+		"x%y",
+		"(x,y)",
+		"x>y",
+		"x>=y",
+		"x<y",
+		"x<=y",
+		"x==y",
+		"x!=y",
+		"x&&y",
+		"x||y",
+		"-x",
+		"!x",
+		"!!x",
+		"-!x",
+		"-!!x",
+		"select(x, y, z)",
+		"fma(x, y, z)",
+		"min(x, y)",
+		"max(x, y)",
+		"clamp(x, y, z)",
+	};
+	static_assert(sizeof(exprs) / sizeof(const char*) == size_t(tp::builtin_operator::count), "one expression per builtin operator");
+
+	for (const char* expr : exprs)
+	{
+		int	 err;
+		auto ex = te::compile(expr, lookup, 3, &err);
+		lok(ex);
+
+		for (x = -2; x < 2; x += 0.5f)
+		{
+			for (y = 0.5f; y < 3; y += 0.5f)
+			{
+				z = x + y;
+				lfequal(te::eval_bytecode(ex), te::eval(ex));
+			}
+		}
+
+		delete ex;
+	}
+}
+
+void test_encoding()
+{
+	te::env_traits::t_vector x = 2, y = 3;
+	te::variable			 lookup[] = {
+		{"x", &x},
+		{"y", &y},
+		{"c2", clo2, tp::CLOSURE2, &y},
+	};
+
+	// Words for the type, the function or binding, and each operand; constants add their value.
+	const size_t word = sizeof(uint32_t), atom = sizeof(te::env_traits::t_atom);
+	struct
+	{
+		const char*				 expr;
+		size_t					 size;
+		te::env_traits::t_vector answer;
+	} cases[] = {
+		{"x", 2 * word, 2},
+		{"x+5", 4 * word + atom, 7},
+		{"(x+5)*y", 8 * word + atom, 21},
+		{"c2(x, 1)", 5 * word + atom, 6},
+	};
+
+	for (const auto& c : cases)
+	{
+		int	 err;
+		auto ex = te::compile(c.expr, lookup, sizeof(lookup) / sizeof(te::variable), &err);
+		lok(ex);
+		lequal(int(ex->get_data_size()), int(c.size));
+		lfequal(te::eval(ex), c.answer);
+		delete ex;
+	}
+
+	// A constant root stays a node.
+	int	 err;
+	auto ex = te::compile("5", lookup, 0, &err);
+	lok(ex);
+	lequal(int(ex->get_data_size()), int(2 * word + atom));
+	lfequal(te::eval(ex), 5);
+	delete ex;
+
+	// Files written before the packed encoding are rejected instead of being read as packed nodes.
+	auto prog = te::compile_program("return: x + y;", lookup, 2, &err);
+	lok(prog);
+
+	std::vector<std::string>	user_vars;
+	const tp::compiled_program* programs[] = {prog};
+	te::serialized_program		serialized(programs, 1, user_vars);
+	lok(serialized.is_valid());
+
+	std::vector<char> buffer((const char*)serialized.get_raw_data(), (const char*)serialized.get_raw_data() + serialized.get_raw_data_size());
+	auto			  header = (te::serialized_program::header_chunk*)buffer.data();
+
+	te::serialized_program current(buffer.data(), buffer.size());
+	lok(current.is_valid());
+	lequal(int(current.get_num_subprograms()), 1);
+	lfequal(te::eval_program(current, 0, prog->get_binding_addresses()), 5);
+
+	header->version = te::serialized_program::version_bytecode;
+	te::serialized_program old_version(buffer.data(), buffer.size());
+	lok(!old_version.is_valid());
+	lequal(int(old_version.get_num_subprograms()), 0);
+	lequal(int(old_version.get_num_bindings()), 0);
+
+	header->version = te::serialized_program::version;
+	header->magic	= 0;
+	te::serialized_program bad_magic(buffer.data(), buffer.size());
+	lok(!bad_magic.is_valid());
+
+	te::serialized_program truncated(buffer.data(), 2);
+	lok(!truncated.is_valid());
+
+	delete prog;
+}
+
+void test_layout()
+{
+	te::env_traits::t_vector x, y;
+	te::variable			 lookup[] = {
+		{"x", &x},
+		{"y", &y},
+		{"sum3", sum3, tp::FUNCTION3},
+		{"c2", clo2, tp::CLOSURE2, &y},
+	};
+	const int num_lookup = sizeof(lookup) / sizeof(te::variable);
+
+	const char* exprs[] = {
+		"5",
+		"x",
+		"x+5",
+		"(x+5)*2",
+		"sqrt(x^1.5+x^2.5)",
+		"(1/(x+1)+2/(x+2)+3/(x+3))",
+		"sum3(x, y, 2) * c2(x, y)",
+		"x < y && y > 1 || !x",
+		"select(x < y, x * 2, sqrt(y))",
+		"pi * sum3(sum3(x, 1, 2), sum3(y, 3, 4), sum3(x, y, 5))",
+	};
+
+	int i;
+	for (i = 0; i < sizeof(exprs) / sizeof(const char*); ++i)
+	{
+		int	 err;
+		auto pre  = te::compile(exprs[i], lookup, num_lookup, &err);
+		auto post = te::compile(exprs[i], lookup, num_lookup, &err, tp::expression_layout::post_order);
+		lok(pre && post);
+		lequal(int(post->get_layout()), int(tp::expression_layout::post_order));
+		lequal(int(post->get_data_size()), int(pre->get_data_size()));
+
+		te::incremental_context incremental(post);
+		for (x = 0; x < 5; x += 0.5f)
+		{
+			for (y = 0; y < 3; y += 0.5f)
+			{
+				incremental.mark_all_dirty();
+				lfequal(te::eval(post), te::eval(pre));
+				lfequal(incremental.eval(), te::eval(pre));
+			}
+		}
+
+		delete pre;
+		delete post;
+	}
+
+	// A post-order scan runs both sides of a select, so an impure one keeps the pre-order layout.
+	{
+		int	 err;
+		auto ex = te::compile("select(x < y, x, sum3(x, y, 1))", lookup, num_lookup, &err, tp::expression_layout::post_order);
+		lok(ex);
+		lequal(int(ex->get_layout()), int(tp::expression_layout::pre_order));
+		delete ex;
+	}
+
+	const char* program =
+		"r: 0;"
+		"label: loop;"
+		"r: r + x;"
+		"x: x - 1;"
+		"jump: loop ? x > 0;"
+		"jump: is_big ? r > 10;"
+		"return: r;"
+		"label: is_big;"
+		"return: -r;";
+
+	te::env_traits::t_vector r;
+	te::variable			 program_lookup[] = {{"x", &x}, {"r", &r}};
+
+	int	 err  = 0;
+	auto pre  = te::compile_program(program, program_lookup, 2, &err);
+	auto post = te::compile_program(program, program_lookup, 2, &err, tp::expression_layout::post_order);
+	lok(pre && post);
+	lequal(int(post->get_layout()), int(tp::expression_layout::post_order));
+
+	std::vector<std::string>		user_vars;
+	const tp::compiled_program*		programs[] = {post};
+	te::serialized_program			serialized(programs, 1, user_vars);
+	lequal(int(serialized.get_expression_layout(0)), int(tp::expression_layout::post_order));
+
+	for (i = 0; i < 8; ++i)
+	{
+		x				 = te::env_traits::t_vector(i);
+		const auto by_pre = te::eval_program(pre);
+		x				 = te::env_traits::t_vector(i);
+		lfequal(te::eval_program(post), by_pre);
+		x = te::env_traits::t_vector(i);
+		lfequal(te::eval_program(serialized, 0, post->get_binding_addresses()), by_pre);
+	}
+
+	delete pre;
+	delete post;
+}
+
+void test_arena()
+{
+	struct block_counts
+	{
+		int allocated = 0;
+		int released  = 0;
+	} counts;
+
+	const tp::arena_backing backing = {
+		[](size_t size, void* user) -> void* {
+			++((block_counts*)user)->allocated;
+			return ::malloc(size);
+		},
+		[](void* block, void* user) {
+			++((block_counts*)user)->released;
+			::free(block);
+		},
+		&counts};
+
+	te::env_traits::t_vector x = 3, r = 0;
+	te::variable			 lookup[] = {{"x", &x}, {"r", &r}};
+
+	const char* program =
+		"r: 0;"
+		"label: loop;"
+		"r: r + sqrt(x) * (x + 1) / (x + 2);"
+		"x: x - 1;"
+		"jump: loop ? x > 0;"
+		"return: r + select(r > 10, 1, 2);";
+
+	te::env_traits::t_vector expected;
+	{
+		int	 err;
+		auto prog = te::compile_program(program, lookup, 2, &err);
+		lok(prog);
+		expected = te::eval_program(prog);
+		delete prog;
+	}
+
+	{
+		tp::compile_arena		 arena(backing, 256);
+		tp::compile_arena::scope use(arena);
+
+		int	 err;
+		auto prog = te::compile_program(program, lookup, 2, &err);
+		lok(prog);
+		lok(counts.allocated > 1);
+		lequal(counts.released, 0);
+
+		// The nodes of the first compilation are gone, the blocks are reused.
+		const int allocated = counts.allocated;
+		arena.reset();
+		auto again = te::compile_program(program, lookup, 2, &err);
+		lok(again);
+		lequal(counts.allocated, allocated);
+
+		x = 3;
+		lfequal(te::eval_program(prog), expected);
+		x = 3;
+		lfequal(te::eval_program(again), expected);
+
+		delete prog;
+		delete again;
+	}
+	lequal(counts.released, counts.allocated);
+}
+
+void test_symbols()
+{
+	// Thousands of bound variables, found through the hashed lookup the indexer builds once.
+	const int								 num_vars = 2000;
+	std::vector<te::env_traits::t_vector> values(num_vars);
+	std::vector<std::string>				 names(num_vars);
+	te::t_indexer							 indexer;
+	for (int i = 0; i < num_vars; ++i)
+	{
+		values[i]			   = te::env_traits::t_vector(i);
+		names[i]			   = "v" + std::to_string(i);
+		const te::variable var = {names[i].c_str(), &values[i]};
+		indexer.add_user_variable(&var);
+	}
+
+	std::string program = "var: total; total: 0;";
+	for (int i = 0; i < num_vars; i += 100)
+	{
+		program += "total: total + v" + std::to_string(i) + ";";
+	}
+	program += "return: total;";
+
+	int	 err  = 0;
+	auto prog = te::compile_program_using_indexer(program.c_str(), &err, indexer);
+	lok(prog);
+	lfequal(te::eval_program(prog), 19000);
+
+	// A variable added afterwards is found by the next compilation.
+	te::env_traits::t_vector late	  = 5;
+	const te::variable		 late_var = {"late", &late};
+	indexer.add_user_variable(&late_var);
+	auto later = te::compile_program_using_indexer("return: late + v1999;", &err, indexer);
+	lok(later);
+	lfequal(te::eval_program(later), 2004);
+
+	delete prog;
+	delete later;
+}
+
+void test_batch()
+{
+	static constexpr size_t rows = 300; // not a multiple of the block size
+
+	te::env_traits::t_vector x, y, r, extra = 3;
+	te::env_traits::t_vector xs[rows], ys[rows], rs[rows], out[rows];
+	for (size_t i = 0; i < rows; ++i)
+	{
+		xs[i] = te::env_traits::t_vector(i % 17) * 0.5f;
+		ys[i] = te::env_traits::t_vector(i % 5);
+	}
+
+	te::variable lookup[] = {
+		{"x", &x},
+		{"y", &y},
+		{"r", &r},
+		{"sum3", sum3, tp::FUNCTION3},
+		{"c2", clo2, tp::CLOSURE2, &extra},
+	};
+
+	// Same layout as the compiled bindings, with the variables redirected to their columns.
+	auto make_columns = [&](const void* const* addresses, size_t size) {
+		std::vector<const void*> columns(addresses, addresses + size);
+		for (auto& c : columns)
+		{
+			c = (c == &x) ? xs : (c == &y) ? ys : (c == &r) ? rs : c;
+		}
+		return columns;
+	};
+
+	const char* exprs[] = {
+		"x+5",
+		"sqrt(x^1.5+x^2.5) - y",
+		"sum3(x, y, 2) * c2(x, y)",
+		"x < y && y > 1 || !x",
+	};
+
+	int i;
+	for (i = 0; i < sizeof(exprs) / sizeof(const char*); ++i)
+	{
+		int	 err;
+		auto ex = te::compile(exprs[i], lookup, sizeof(lookup) / sizeof(te::variable), &err);
+		lok(ex);
+
+		auto columns = make_columns(ex->get_binding_addresses(), ex->get_binding_array_size());
+		lok(te::eval_batch(ex, rows, &columns[0], out));
+
+		for (size_t row = 0; row < rows; ++row)
+		{
+			x = xs[row];
+			y = ys[row];
+			lfequal(out[row], te::eval(ex));
+		}
+
+		// A stride of 0 broadcasts the first element of y to every row.
+		std::vector<size_t> strides(ex->get_binding_array_size(), 1);
+		for (size_t b = 0; b < strides.size(); ++b)
+		{
+			strides[b] = (columns[b] == ys) ? 0 : 1;
+		}
+		lok(te::eval_batch(ex, rows, &columns[0], out, &strides[0]));
+
+		for (size_t row = 0; row < rows; ++row)
+		{
+			x = xs[row];
+			y = ys[0];
+			lfequal(out[row], te::eval(ex));
+		}
+
+		delete ex;
+	}
+
+	// Rows leave the loop at different iterations and return through different statements.
+	const char* program =
+		"r: 0;"
+		"label: loop;"
+		"r: r + x;"
+		"x: x - 1;"
+		"jump: loop ? x > 0;"
+		"jump: is_big ? r > 10;"
+		"return: r;"
+		"label: is_big;"
+		"return: -r;";
+
+	int	 err  = 0;
+	auto prog = te::compile_program(program, lookup, 3, &err);
+	lok(prog);
+
+	te::env_traits::t_vector xs_in[rows];
+	std::copy(xs, xs + rows, xs_in);
+
+	auto columns = make_columns(prog->get_binding_addresses(), prog->get_binding_array_size());
+	lok(te::eval_program_batch(prog, rows, &columns[0], out));
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		x = xs_in[row];
+		lfequal(out[row], te::eval_program(prog));
+		lfequal(rs[row], r);
+		lfequal(xs[row], x);
+	}
+
+	delete prog;
+}
+
+void test_context()
+{
+	te::env_traits::t_vector x;
+	te::variable			 lookup[] = {{"x", &x}};
+
+	// Sums x, x - 1, ... 1 into a declared variable.
+	const char* program =
+		"var: acc;"
+		"acc: 0;"
+		"label: loop;"
+		"acc: acc + x;"
+		"x: x - 1;"
+		"jump: loop ? x > 0;"
+		"return: acc;";
+
+	int	 err  = 0;
+	auto prog = te::compile_program(program, lookup, 1, &err);
+	lok(prog);
+	lequal(int(prog->get_num_declared_variables()), 1);
+
+	// The program keeps its own storage for acc.
+	x = 4;
+	lfequal(te::eval_program(prog), 10);
+
+	int x_binding = -1;
+	for (size_t b = 0; b < prog->get_binding_array_size(); ++b)
+	{
+		x_binding = (prog->get_binding_addresses()[b] == &x) ? int(b) : x_binding;
+	}
+	lok(x_binding >= 0);
+
+	auto run = [&](te::env_traits::t_vector n, te::env_traits::t_vector& result, te::env_traits::t_vector& acc) {
+		te::env_traits::t_vector local_x = n;
+		te::execution_context	 ctx(prog);
+		ctx.bind(x_binding, &local_x);
+		result = (int(n) % 2) ? te::eval_program(prog, ctx) : te::eval_program_bytecode(prog, ctx);
+		acc	   = *ctx.get_declared_variable(0);
+	};
+
+	te::env_traits::t_vector result, acc;
+	x = 7;
+	run(5, result, acc);
+	lfequal(result, 15);
+	lfequal(acc, 15);
+	lfequal(x, 7);
+
+#if TP_THREADS_ENABLED
+	// One program, many threads, a context each.
+	static constexpr int			 num_threads = 8;
+	std::vector<std::thread>		 threads;
+	std::vector<te::env_traits::t_vector> results(num_threads * 64), accs(num_threads * 64);
+	for (int t = 0; t < num_threads; ++t)
+	{
+		threads.emplace_back([&, t]() {
+			for (int i = t; i < num_threads * 64; i += num_threads)
+			{
+				run(te::env_traits::t_vector(i % 50 + 1), results[i], accs[i]);
+			}
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	for (int i = 0; i < num_threads * 64; ++i)
+	{
+		const int n = i % 50 + 1;
+		lfequal(results[i], n * (n + 1) / 2);
+		lfequal(accs[i], results[i]);
+	}
+#endif // #if TP_THREADS_ENABLED
+
+	delete prog;
+}
+
+void test_incremental()
+{
+	te::env_traits::t_vector a = 1, b = 2, c = 3, d = 4, e = 5;
+	int						 calls	  = 0;
+	te::variable			 lookup[] = {{"a", &a}, {"b", &b}, {"c", &c}, {"d", &d}, {"e", &e}, {"f", counted, tp::CLOSURE1, &calls}};
+
+	int	 err;
+	auto ex = te::compile("sqrt(a * b + sin(c) * cos(c)) + (d * d - e / 2) * (b + exp(d / 10))", lookup, 5, &err);
+	lok(ex);
+
+	te::incremental_context inc(ex);
+	lfequal(inc.eval(), te::eval(ex));
+	lequal(inc.get_num_evaluated(), inc.get_num_nodes());
+
+	// Nothing changed, nothing runs.
+	lfequal(inc.eval(), te::eval(ex));
+	lequal(inc.get_num_evaluated(), 0);
+
+	// Only the path from c to the root runs again.
+	c = 0.5f;
+	inc.mark_dirty(&c);
+	lfequal(inc.eval(), te::eval(ex));
+	lok(inc.get_num_evaluated() > 0 && inc.get_num_evaluated() < inc.get_num_nodes() / 2);
+
+	a = 7;
+	e = -1;
+	inc.mark_dirty(&a);
+	inc.mark_dirty(&e);
+	lfequal(inc.eval(), te::eval(ex));
+
+	inc.mark_all_dirty();
+	lfequal(inc.eval(), te::eval(ex));
+	lequal(inc.get_num_evaluated(), inc.get_num_nodes());
+
+	delete ex;
+
+	// Closures run every time, their siblings come from the cache.
+	ex = te::compile("f(a) + sqrt(b * c)", lookup, 6, &err);
+	lok(ex);
+	te::incremental_context with_closure(ex);
+	calls = 0;
+	lfequal(with_closure.eval(), te::eval(ex));
+	lfequal(with_closure.eval(), te::eval(ex));
+	lequal(calls, 4);
+	lequal(with_closure.get_num_evaluated(), 2); // the closure and the addition
+	delete ex;
+
+	// Variables the program assigns are marked dirty by the program itself.
+	const char* program =
+		"var: n ? local;"
+		"var: r;"
+		"n: a;"
+		"r: b * sqrt(c + d + e);"
+		"label: loop;"
+		"r: r + d / n;"
+		"n: n - 1;"
+		"jump: loop ? n > 0;"
+		"return: r;";
+
+	auto prog = te::compile_program(program, lookup, 5, &err);
+	lok(prog);
+
+	te::incremental_context inc_prog(prog);
+	for (int run = 0; run < 6; ++run)
+	{
+		a = te::env_traits::t_vector(run % 3 + 1);
+		inc_prog.mark_dirty(&a);
+		if (run == 4)
+		{
+			d = 9;
+			inc_prog.mark_dirty(&d);
+		}
+		const auto value = inc_prog.eval();
+		lfequal(value, te::eval_program(prog));
+	}
+
+	delete prog;
+}
+
+void test_locals()
+{
+	te::env_traits::t_vector x, r;
+	te::variable			 lookup[] = {{"x", &x}, {"r", &r}};
+
+	// s lives in a frame slot of the bytecode, r stays a binding.
+	const char* program =
+		"var: s ? local;"
+		"s: 1;"
+		"r: 0;"
+		"label: loop;"
+		"s: s * 2;"
+		"r: r + s;"
+		"x: x - 1;"
+		"jump: loop ? x > 0;"
+		"return: r + s;";
+
+	int	 err  = 0;
+	auto prog = te::compile_program(program, lookup, 2, &err);
+	lok(prog);
+	lok(prog->get_bytecode_size() > 0);
+
+	const auto header = (const tp::bytecode_header*)prog->get_bytecode();
+	const auto code	  = (const tp::instruction*)(prog->get_bytecode() + sizeof(tp::bytecode_header));
+	lequal(header->num_locals, 1);
+
+	int s_binding = -1;
+	for (size_t b = 0; b < prog->get_binding_array_size(); ++b)
+	{
+		s_binding = (strcmp(prog->get_binding_names()[b], "s") == 0) ? int(b) : s_binding;
+	}
+	lok(s_binding >= 0);
+
+	int frame_accesses = 0;
+	for (int i = 0; i < header->num_instructions; ++i)
+	{
+		const bool binding_access = (code[i].op == tp::opcode::load_variable || code[i].op == tp::opcode::store_variable);
+		lok(!binding_access || code[i].arg_a != s_binding);
+		frame_accesses += (code[i].op == tp::opcode::load_local || code[i].op == tp::opcode::store_local) ? 1 : 0;
+	}
+	lok(frame_accesses > 0);
+
+#if TP_JIT_ENABLED
+	auto fn = te::jit(prog);
+#endif // #if TP_JIT_ENABLED
+	for (int i = 1; i < 8; ++i)
+	{
+		x				   = te::env_traits::t_vector(i);
+		const auto by_tree = te::eval_program(prog);
+		x				   = te::env_traits::t_vector(i);
+		lfequal(te::eval_program_bytecode(prog), by_tree);
+#if TP_JIT_ENABLED
+		x = te::env_traits::t_vector(i);
+		lfequal(te::eval_program_jit(fn, prog), by_tree);
+#endif // #if TP_JIT_ENABLED
+	}
+#if TP_JIT_ENABLED
+	delete fn;
+#endif // #if TP_JIT_ENABLED
+
+	// Every row of a batch gets its own frame.
+	static constexpr size_t	 rows = 100;
+	te::env_traits::t_vector xs[rows], rs[rows], out[rows];
+	for (size_t row = 0; row < rows; ++row)
+	{
+		xs[row] = te::env_traits::t_vector(row % 9 + 1);
+	}
+
+	std::vector<const void*> columns(prog->get_binding_addresses(), prog->get_binding_addresses() + prog->get_binding_array_size());
+	std::replace(columns.begin(), columns.end(), (const void*)&x, (const void*)xs);
+	std::replace(columns.begin(), columns.end(), (const void*)&r, (const void*)rs);
+	lok(te::eval_program_batch(prog, rows, &columns[0], out));
+	for (size_t row = 0; row < rows; ++row)
+	{
+		x = te::env_traits::t_vector(row % 9 + 1);
+		lfequal(out[row], te::eval_program_bytecode(prog));
+	}
+
+	delete prog;
+
+	// Locals start at 0 on every run, on every path. The second program has more locals than frame slots.
+	std::string many_locals;
+	std::string sum = "0";
+	for (int i = 0; i < TP_MAX_LOCALS + 2; ++i)
+	{
+		const auto name = "n" + std::to_string(i);
+		many_locals += "var: " + name + " ? local; " + name + ": " + name + " + x;";
+		sum += " + " + name;
+	}
+	many_locals += "return: " + sum + ";";
+
+	struct
+	{
+		std::string				 program;
+		te::env_traits::t_vector answer;
+	} counters[] = {
+		{"var: n ? local; n: n + x; return: n;", 3},
+		{many_locals, 3 * (TP_MAX_LOCALS + 2)},
+	};
+
+	for (const auto& c : counters)
+	{
+		auto counter = te::compile_program(c.program.c_str(), lookup, 2, &err);
+		lok(counter);
+
+		std::vector<std::string>	user_vars;
+		const tp::compiled_program* programs[] = {counter};
+		te::serialized_program		serialized(programs, 1, user_vars);
+		te::incremental_context		incremental(counter);
+#if TP_JIT_ENABLED
+		auto fn = te::jit(counter);
+#endif // #if TP_JIT_ENABLED
+
+		x = 3;
+		for (int run = 0; run < 2; ++run)
+		{
+			lfequal(te::eval_program(counter), c.answer);
+			lfequal(te::eval_program_bytecode(counter), c.answer);
+			lfequal(te::eval_program(serialized, 0, counter->get_binding_addresses()), c.answer);
+			lfequal(incremental.eval(), c.answer);
+#if TP_JIT_ENABLED
+			lfequal(te::eval_program_jit(fn, counter), c.answer);
+#endif // #if TP_JIT_ENABLED
+		}
+
+#if TP_JIT_ENABLED
+		delete fn;
+#endif // #if TP_JIT_ENABLED
+		delete counter;
+	}
+}
+
+int square_calls = 0;
+
+te::env_traits::t_vector square(te::env_traits::t_vector a)
+{
+	++square_calls;
+	return a * a;
+}
+
+void test_subexpressions()
+{
+	te::env_traits::t_vector x, y;
+	int						 calls	  = 0;
+	te::variable			 lookup[] = {{"x", &x}, {"y", &y}, {"sq", square, tp::FUNCTION1 | tp::FLAG_PURE}, {"f", counted, tp::CLOSURE1, &calls}};
+
+	struct
+	{
+		const char*				 program;
+		te::env_traits::t_vector x;
+		te::env_traits::t_vector answer;
+		int						 square_calls;
+		int						 calls;
+	} cases[] = {
+		{"y: sq(x) + sq(x) * 2; return: y + sq(x);", 3, 36, 1, 0},
+		{"return: sq(sq(x)) + sq(sq(x)) + sq(x);", 2, 36, 2, 0},
+		{"var: a; a: sq(x); x: x + 1; return: a + sq(x);", 3, 25, 2, 0},
+		{"var: a; a: sq(x); label: l; return: a + sq(x);", 3, 18, 1, 0},
+		{"var: a; a: sq(x); jump: l ? x > 5; y: x * x * x * x * x * x * x * x * x; label: l; return: a + sq(x);", 3, 18, 2, 0}, // too long for a select
+		{"var: a; a: sq(x); f(x); return: a + sq(x);", 3, 18, 2, 1},
+		{"return: f(x) + f(x);", 3, 6, 0, 2},
+		{"var: a; a: sq(x); jump: done ? sq(x) > 10; return: f(a); label: done; return: sq(x) + 1;", 4, 17, 2, 0}, // f keeps the jump
+		{"var: a; a: sq(x); jump: done ? sq(x) > 10; return: a; label: done; return: sq(x) + 1;", 1, 1, 1, 0},
+		{"var: a; a: sq(x); jump: done ? sq(x) > 10; return: a; label: done; return: sq(x) + 1;", 4, 17, 1, 0}, // one select shares sq(x)
+		{"var: _t1; _t1: x; y: sq(x) + 1; return: y * sq(x) + _t1;", 4, 276, 1, 0}, // the temporary doesn't take over a declared name
+	};
+
+	for (const auto& c : cases)
+	{
+		int	 err  = 0;
+		auto prog = te::compile_program(c.program, lookup, 4, &err);
+		lok(prog);
+		lok(prog->get_bytecode_size() > 0);
+
+		x			 = c.x;
+		square_calls = calls = 0;
+		lfequal(te::eval_program(prog), c.answer);
+		lequal(square_calls, c.square_calls);
+		lequal(calls, c.calls);
+
+		x			 = c.x;
+		square_calls = calls = 0;
+		lfequal(te::eval_program_bytecode(prog), c.answer);
+		lequal(square_calls, c.square_calls);
+		lequal(calls, c.calls);
+
+#if TP_JIT_ENABLED
+		auto fn		 = te::jit(prog);
+		x			 = c.x;
+		square_calls = calls = 0;
+		lfequal(te::eval_program_jit(fn, prog), c.answer);
+		lequal(square_calls, c.square_calls);
+		delete fn;
+#endif // #if TP_JIT_ENABLED
+
+		delete prog;
+	}
+
+	// The temporary is a statement of its own, assigned before the first use.
+	int	 err  = 0;
+	auto prog = te::compile_program("y: sq(x) + sq(x); return: y;", lookup, 4, &err);
+	lok(prog);
+	lequal(int(prog->get_statement_array_size()), 3);
+	lequal(int(prog->get_statements()[0].type), int(tp::statement_type::assign));
+
+	delete prog;
+}
+
+void test_dataflow()
+{
+	te::env_traits::t_vector x, y;
+	int						 calls	  = 0;
+	te::variable			 lookup[] = {{"x", &x}, {"y", &y}, {"f", counted, tp::CLOSURE1, &calls}};
+
+	struct
+	{
+		const char*				 program;
+		te::env_traits::t_vector x;
+		te::env_traits::t_vector answer;
+		int						 statements;
+	} cases[] = {
+		{"var: a; a: 2; return: a * x;", 3, 6, 2},
+		{"var: t ? local; t: 3; jump: big ? t > 2; return: 0; label: big; return: t * x;", 3, 9, 1},
+		{"y: x + 1; y: x * 2; return: y;", 3, 6, 2},
+		{"var: t ? local; t: 1; jump: l ? x > 0; t: 2; f(x); label: l; return: t;", 3, 1, 5}, // f keeps the jump
+		{"var: t ? local; t: 1; jump: l ? x > 0; t: 2; f(x); label: l; return: t;", -3, 2, 5},
+		{"var: t ? local; jump: l ? x > 0; t: 2; jump: m; label: l; t: 2; label: m; return: t * x;", -3, -6, 1},
+		{"var: a; var: t ? local; a: 2; t: 3; f(x); return: a + t;", 3, 5, 3},
+		{"return: x; y: 1; return: y;", 3, 3, 1},
+		{"var: i ? local; i: 0; label: loop; i: i + 1; jump: loop ? i < 3; return: i * x;", 3, 9, 4},
+		// Always taken jumps become unconditional, the tree path must not read a condition at offset 0.
+		{"y: 0; label: l; jump: out ? y >= 3; y: y + 1; x: x + 1; jump: l ? 1; label: out; return: x;", -1, 2, 6},
+		{"y: 0; label: l; jump: out ? y >= 3; y: y + 1; x: x + 1; jump: l ? 2 > 1; label: out; return: x;", -1, 2, 6},
+	};
+
+	for (const auto& c : cases)
+	{
+		int	 err  = 0;
+		auto prog = te::compile_program(c.program, lookup, 3, &err);
+		lok(prog);
+		lok(prog->get_bytecode_size() > 0);
+		lequal(int(prog->get_statement_array_size()), c.statements);
+
+		// Some programs assign x, every path starts from the case's x.
+		x = c.x;
+		lfequal(te::eval_program(prog), c.answer);
+		x = c.x;
+		lfequal(te::eval_program_bytecode(prog), c.answer);
+#if TP_JIT_ENABLED
+		auto fn = te::jit(prog);
+		x		= c.x;
+		lfequal(te::eval_program_jit(fn, prog), c.answer);
+		delete fn;
+#endif // #if TP_JIT_ENABLED
+
+		delete prog;
+	}
+}
+
+void test_threading()
+{
+	te::env_traits::t_vector x, y;
+	int						 calls	  = 0;
+	te::variable			 lookup[] = {{"x", &x}, {"y", &y}, {"f", counted, tp::CLOSURE1, &calls}};
+
+	struct
+	{
+		const char*				 program;
+		te::env_traits::t_vector x;
+		te::env_traits::t_vector answer;
+		int						 statements;
+	} cases[] = {
+		// Blocks written backwards are laid out in the order they run.
+		{"y: x; jump: one; label: two; y: y * 10 + 2; jump: three; label: one; y: y * 10 + 1; jump: two; label: three; return: y;", 3, 312, 4},
+		// Jumps to jumps go to the end of the chain, jumps to returns return. f keeps the returns from becoming a select.
+		{"jump: a ? x > 0; jump: b; label: a; jump: c; label: b; return: f(-x); label: c; return: x * 2;", 3, 6, 3},
+		{"jump: a ? x > 0; jump: b; label: a; jump: c; label: b; return: f(-x); label: c; return: x * 2;", -3, 3, 3},
+		{"var: i ? local; i: 0; label: loop; i: i + 1; jump: next; label: next; jump: loop ? i < x; return: i;", 5, 5, 4},
+		{"var: s ? local; s: x; label: again; jump: odd ? s % 2; jump: even; label: odd; s: f(s * 3 + 1); label: even; s: s / 2; jump: again ? s > 1; return: s;", 7, 1, 6},
+	};
+
+	for (const auto& c : cases)
+	{
+		int	 err  = 0;
+		auto prog = te::compile_program(c.program, lookup, 3, &err);
+		lok(prog);
+		lok(prog->get_bytecode_size() > 0);
+		lequal(int(prog->get_statement_array_size()), c.statements);
+
+		x = c.x;
+		lfequal(te::eval_program(prog), c.answer);
+		lfequal(te::eval_program_bytecode(prog), c.answer);
+#if TP_JIT_ENABLED
+		auto fn = te::jit(prog);
+		lfequal(te::eval_program_jit(fn, prog), c.answer);
+		delete fn;
+#endif // #if TP_JIT_ENABLED
+
+		delete prog;
+	}
+}
+
+void test_if_conversion()
+{
+	te::env_traits::t_vector x, y;
+	int						 calls	  = 0;
+	te::variable			 lookup[] = {{"x", &x}, {"y", &y}, {"f", counted, tp::CLOSURE1, &calls}};
+
+	const char* readme =
+		"jump: is_negative ? x < 0;"
+		"jump: is_positive ? x > 0;"
+		"return: 0;"
+		"label: is_negative;"
+		"return: -1 * x;"
+		"label: is_positive;"
+		"return: x;";
+
+	struct
+	{
+		const char*				 program;
+		te::env_traits::t_vector x;
+		te::env_traits::t_vector answer;
+		int						 statements;
+		int						 jumps;
+	} cases[] = {
+		{readme, -2, 2, 1, 0},
+		{readme, 0, 0, 1, 0},
+		{readme, 3, 3, 1, 0},
+		{"jump: l ? x < 2; return: 2; label: l; return: x;", 5, 2, 1, 0},
+		{"jump: l ? x > 1; y: x * 2; jump: m; label: l; y: x + 10; label: m; return: y;", 3, 13, 2, 0},
+		{"jump: l ? x > 1; y: x * 2; jump: m; label: l; y: x + 10; label: m; return: y;", 0, 0, 2, 0},
+		{"y: 1; jump: l ? x > 1; y: x * 2; label: l; return: y;", 3, 1, 3, 0},
+		{"y: 1; jump: l ? x > 1; y: x * 2; label: l; return: y;", 0, 0, 3, 0},
+		// The threading cases without the call: threading exposes a return diamond.
+		{"jump: a ? x > 0; jump: b; label: a; jump: c; label: b; return: -x; label: c; return: x * 2;", 3, 6, 1, 0},
+		{"jump: a ? x > 0; jump: b; label: a; jump: c; label: b; return: -x; label: c; return: x * 2;", -3, 3, 1, 0},
+		// The dataflow cases without the call: the assignment jumped around becomes a select.
+		{"var: t ? local; t: 1; jump: l ? x > 0; t: 2; label: l; return: t;", 3, 1, 3, 0},
+		{"var: t ? local; t: 1; jump: l ? x > 0; t: 2; label: l; return: t;", -3, 2, 3, 0},
+		// The threading loop without the call: only the jump back stays.
+		{"var: s ? local; s: x; label: again; jump: odd ? s % 2; jump: even; label: odd; s: s * 3 + 1; label: even; s: s / 2; jump: again ? s > 1; return: s;", 7, 1, 5, 1},
+		// Side effects and long expressions keep their jump.
+		{"jump: l ? x > 1; return: f(x); label: l; return: x;", 0, 0, 3, 1},
+		{"jump: l ? x > 1; return: x * x * x * x * x * x * x * x * x; label: l; return: x;", 0.5f, 1.0f / 512, 3, 1},
+	};
+
+	for (const auto& c : cases)
+	{
+		int	 err  = 0;
+		auto prog = te::compile_program(c.program, lookup, 3, &err);
+		lok(prog);
+		lok(prog->get_bytecode_size() > 0);
+		lequal(int(prog->get_statement_array_size()), c.statements);
+
+		const auto header = (const tp::bytecode_header*)prog->get_bytecode();
+		const auto code	  = (const tp::instruction*)(prog->get_bytecode() + sizeof(tp::bytecode_header));
+		int		   jumps  = 0;
+		for (int i = 0; i < header->num_instructions; ++i)
+		{
+			jumps += (code[i].op == tp::opcode::jump || code[i].op == tp::opcode::jump_if) ? 1 : 0;
+		}
+		lequal(jumps, c.jumps);
+
+		x = c.x;
+		lfequal(te::eval_program(prog), c.answer);
+		lfequal(te::eval_program_bytecode(prog), c.answer);
+#if TP_JIT_ENABLED
+		auto fn = te::jit(prog);
+		lfequal(te::eval_program_jit(fn, prog), c.answer);
+		delete fn;
+#endif // #if TP_JIT_ENABLED
+
+		delete prog;
+	}
+}
+
+void test_loop_invariants()
+{
+	te::env_traits::t_vector x;
+	int						 calls	  = 0;
+	te::variable			 lookup[] = {{"x", &x}, {"sq", square, tp::FUNCTION1 | tp::FLAG_PURE}, {"f", counted, tp::CLOSURE1, &calls}};
+
+	struct
+	{
+		const char*				 program;
+		te::env_traits::t_vector x;
+		te::env_traits::t_vector answer;
+		int						 square_calls;
+	} cases[] = {
+		// Newton iteration for the square root of sq(x)
+		{"var: g ? local; var: i ? local; g: 1; i: 0; label: loop; g: (g + sq(x) / g) / 2; i: i + 1; jump: loop ? i < 20; return: g;", 3, 3, 1},
+		{"var: g ? local; var: i ? local; g: 1; i: 0; label: loop; g: (g + sq(x) / g) / 2; i: i + 1; jump: loop ? i < 20; return: g;", -5, 5, 1},
+		{"var: i ? local; var: s ? local; s: 0; i: 0; label: loop; s: s + sq(i); i: i + 1; jump: loop ? i < 4; return: s;", 3, 14, 4},
+		{"var: i ? local; var: s ? local; s: 0; i: 0; label: loop; f(i); s: s + sq(x); i: i + 1; jump: loop ? i < 3; return: s;", 2, 12, 3},
+		{"var: i ? local; var: s ? local; s: 0; i: 0; label: loop; f(i); s: s + sq(i + 1); i: i + 1; jump: loop ? i < 3; return: s;", 2, 14, 3},
+		{"var: i ? local; var: s ? local; s: 0; i: 0; jump: inside ? x > 2; label: loop; s: s + sq(x); label: inside; i: i + 1; jump: loop ? i < 3; return: s;", 3, 18, 2},
+		{"var: i ? local; var: j ? local; var: s ? local; s: 0; i: 0; label: outer; j: 0; label: inner; s: s + sq(x) * i; j: j + 1; jump: inner ? j < 3; i: i + 1; jump: outer ? i < 3; return: s;", 2, 36, 1},
+		// The hoisted temporary doesn't take over a declared name
+		{"var: i ? local; var: s ? local; var: _t3; _t3: x; s: 0; i: 0; label: loop; s: s + sq(x); i: i + 1; jump: loop ? i < 3; return: s + _t3;", 2, 14, 1},
+	};
+
+	for (const auto& c : cases)
+	{
+		int	 err  = 0;
+		auto prog = te::compile_program(c.program, lookup, 3, &err);
+		lok(prog);
+		lok(prog->get_bytecode_size() > 0);
+
+		x			 = c.x;
+		square_calls = 0;
+		lfequal(te::eval_program(prog), c.answer);
+		lequal(square_calls, c.square_calls);
+
+		x			 = c.x;
+		square_calls = 0;
+		lfequal(te::eval_program_bytecode(prog), c.answer);
+		lequal(square_calls, c.square_calls);
+
+#if TP_JIT_ENABLED
+		auto fn		 = te::jit(prog);
+		x			 = c.x;
+		square_calls = 0;
+		lfequal(te::eval_program_jit(fn, prog), c.answer);
+		lequal(square_calls, c.square_calls);
+		delete fn;
+#endif // #if TP_JIT_ENABLED
+
+		delete prog;
+	}
+}
+
+#if TP_THREADS_ENABLED
+void test_parallel()
+{
+	static constexpr size_t rows = 20000; // several work items per thread
+
+	te::env_traits::t_vector x, t, r;
+	static te::env_traits::t_vector xs[rows], rs[rows], out[rows];
+	for (size_t i = 0; i < rows; ++i)
+	{
+		xs[i] = te::env_traits::t_vector(i % 23) * 0.25f;
+	}
+
+	te::variable lookup[] = {{"x", &x}, {"t", &t}, {"r", &r}};
+
+	// t is shared by all rows (stride 0) and written, every row still sees its own t.
+	const char* program =
+		"t: x * 2;"
+		"r: 0;"
+		"label: loop;"
+		"r: r + t;"
+		"t: t - 1;"
+		"jump: loop ? t > 0;"
+		"return: r - t;";
+
+	int	 err  = 0;
+	auto prog = te::compile_program(program, lookup, 3, &err);
+	lok(prog);
+
+	std::vector<const void*> columns(prog->get_binding_addresses(), prog->get_binding_addresses() + prog->get_binding_array_size());
+	std::vector<size_t>		 strides(columns.size(), 1);
+	for (size_t b = 0; b < columns.size(); ++b)
+	{
+		strides[b] = (columns[b] == &t) ? 0 : 1;
+		columns[b] = (columns[b] == &x) ? (const void*)xs : (columns[b] == &r) ? (const void*)rs : columns[b];
+	}
+
+	const int thread_counts[] = {1, 3, 8};
+	for (const int threads : thread_counts)
+	{
+		tp::thread_pool pool(threads);
+		lequal(pool.get_num_threads(), threads);
+
+		t = 100;
+		std::fill(out, out + rows, te::env_traits::nan());
+		lok(te::eval_program_parallel(pool, prog, rows, &columns[0], out, &strides[0]));
+		lfequal(t, 100);
+
+		for (size_t row = 0; row < rows; ++row)
+		{
+			x = xs[row];
+			lfequal(out[row], te::eval_program(prog));
+			lfequal(rs[row], r);
+		}
+	}
+
+	// The single threaded batch keeps the same per row copy.
+	t = 100;
+	lok(te::eval_program_batch(prog, rows, &columns[0], out, &strides[0]));
+	for (size_t row = 0; row < rows; row += 97)
+	{
+		x = xs[row];
+		lfequal(out[row], te::eval_program(prog));
+	}
+
+	delete prog;
+
+	// Expressions and an empty range.
+	tp::thread_pool pool;
+	auto			ex = te::compile("sqrt(x^1.5+x^2.5) - x", lookup, 1, &err);
+	lok(ex);
+
+	std::vector<const void*> ex_columns(ex->get_binding_addresses(), ex->get_binding_addresses() + ex->get_binding_array_size());
+	std::replace(ex_columns.begin(), ex_columns.end(), (const void*)&x, (const void*)xs);
+	lok(te::eval_parallel(pool, ex, rows, &ex_columns[0], out));
+	for (size_t row = 0; row < rows; ++row)
+	{
+		x = xs[row];
+		lfequal(out[row], te::eval(ex));
+	}
+	lok(te::eval_parallel(pool, ex, 0, &ex_columns[0], out));
+
+	delete ex;
+}
+#endif // #if TP_THREADS_ENABLED
+
+#if TP_JIT_ENABLED
+void test_jit()
+{
+	te::env_traits::t_vector x, y;
+	te::variable			 lookup[] = {
+		{"x", &x},
+		{"y", &y},
+		{"sum0", sum0, tp::FUNCTION0},
+		{"sum3", sum3, tp::FUNCTION3},
+		{"sum7", sum7, tp::FUNCTION7},
+		{"c0", clo0, tp::CLOSURE0, &y},
+		{"c2", clo2, tp::CLOSURE2, &y},
+	};
+
+	const char* exprs[] = {
+		"x+5",
+		"(x+5)*2-y/3",
+		"sqrt(x^1.5+x^2.5)",
+		"x % 2 + -y",
+		"sum0 + sum3(x, y, 2) * c2(x, y) - c0",
+		"sum7(x, y, 1, 2, 3, x, sum7(y, x, 4, 5, 6, y, 7))",
+		"x < y && y > 1 || !x",
+		"x == y, x != y, x >= y",
+		"-(x,(y,3))",
+		"-!x + !!y - -!y",
+		"select(x > y, sqrt(x), y * 2) + select(y, x, -x)",
+		"select(x < y, x, y) * max(x, 1) + clamp(y, 0, x) + x * y - fma(y, 2, x)",
+	};
+
+	int i;
+	for (i = 0; i < sizeof(exprs) / sizeof(const char*); ++i)
+	{
+		int	 err;
+		auto ex = te::compile(exprs[i], lookup, sizeof(lookup) / sizeof(te::variable), &err);
+		lok(ex);
+
+		auto fn = te::jit(ex);
+		lok(fn);
+
+		for (x = 0; x < 5; x += 0.5f)
+		{
+			for (y = 0; y < 3; y += 0.5f)
+			{
+				lfequal(te::eval_jit(fn, ex), te::eval(ex));
+			}
+		}
+
+		delete fn;
+		delete ex;
+	}
+
+	const char* program =
+		"r: 0;"
+		"label: loop;"
+		"r: r + sum3(x, 1, 0) / 2;"
+		"x: x - 1;"
+		"jump: loop ? x > 0;"
+		"jump: is_big ? r > 10;"
+		"return: r;"
+		"label: is_big;"
+		"return: -r;";
+
+	te::env_traits::t_vector r;
+	te::variable			 program_lookup[] = {{"x", &x}, {"r", &r}, {"sum3", sum3, tp::FUNCTION3}};
+
+	int	 err  = 0;
+	auto prog = te::compile_program(program, program_lookup, 3, &err);
+	lok(prog);
+
+	auto fn = te::jit(prog);
+	lok(fn);
+
+	for (i = 0; i < 8; ++i)
+	{
+		x				   = te::env_traits::t_vector(i);
+		const auto by_tree = te::eval_program(prog);
+		const auto r_tree  = r;
+		x				   = te::env_traits::t_vector(i);
+		lfequal(te::eval_program_jit(fn, prog), by_tree);
+		lfequal(r, r_tree);
+	}
+
+	// A missing translation falls back to the interpreter.
+	x = 3;
+	lfequal(te::eval_program_jit(nullptr, prog), te::env_traits::explicit_load_atom(4.5));
+
+	delete fn;
+	delete prog;
+}
+#endif // #if TP_JIT_ENABLED
+
+#if TP_SIMD_SSE || TP_SIMD_AVX2
+// Every lane of a packed evaluation has to match the scalar evaluation of that lane.
+template<typename T_TRAITS>
+void test_simd_traits()
+{
+	using tv			  = tp::impl<T_TRAITS>;
+	using t_atom		  = typename T_TRAITS::t_atom;
+	using t_vector		  = typename T_TRAITS::t_vector;
+	constexpr int lanes	  = T_TRAITS::lanes;
+
+	t_vector	 x, y;
+	tp::variable lookup[] = {{"x", &x}, {"y", &y}};
+
+	te::env_traits::t_vector sx, sy;
+	te::variable			 scalar_lookup[] = {{"x", &sx}, {"y", &sy}};
+
+	const char* exprs[] = {
+		"x+5",
+		"(x+5)*2-y/3",
+		"sqrt(x^1.5+x^2.5)",
+		"x % 2 + -y",
+		"exp(x - y) + ln(x + 1) + log10(y + 1)",
+		"sin(x * 3) * cos(y - x) + tan(x / 4)",
+		"abs(y - x) + floor(x) * ceil(y)",
+		"atan2(y, x) + fac(y) + ncr(5, y)",
+		"x < y && y > 1 || !x",
+		"x == y, x != y, x >= y",
+		"-!x + !!y - -!y",
+		"select(x < y, x, y) + max(x, 2) * clamp(y, 1, 3) + x * y - fma(y, 2, x)",
+	};
+
+	t_atom xs[lanes], ys[lanes], out[lanes];
+
+	for (int i = 0; i < sizeof(exprs) / sizeof(const char*); ++i)
+	{
+		int	 err;
+		auto ex = tv::compile(exprs[i], lookup, 2, &err);
+		lok(ex);
+
+		auto scalar = te::compile(exprs[i], scalar_lookup, 2, &err);
+		lok(scalar);
+
+		for (int step = 0; step < 6; ++step)
+		{
+			for (int l = 0; l < lanes; ++l)
+			{
+				xs[l] = t_atom(l + step) * t_atom(0.75);
+				ys[l] = t_atom((l * 3 + step) % 5);
+			}
+			x = t_vector::load(xs);
+			y = t_vector::load(ys);
+
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				(pass ? tv::eval_bytecode(ex) : tv::eval(ex)).store(out);
+
+				for (int l = 0; l < lanes; ++l)
+				{
+					sx				 = te::env_traits::t_vector(xs[l]);
+					sy				 = te::env_traits::t_vector(ys[l]);
+					const double exp = te::eval(scalar);
+					const double got = out[l];
+					if (exp != exp)
+					{
+						lok(got != got);
+					}
+					else
+					{
+						lfequal(got / (fabs(exp) > 1 ? fabs(exp) : 1), exp / (fabs(exp) > 1 ? fabs(exp) : 1));
+					}
+				}
+			}
+		}
+
+		delete scalar;
+		delete ex;
+	}
+
+	// Lanes leave the loop at different iterations and return through different statements, or split at an inverted jump.
+	const char* lane_programs[] = {
+		"r: 0;"
+		"label: loop;"
+		"r: r + x;"
+		"x: x - 1;"
+		"jump: loop ? x > 0;"
+		"jump: is_big ? r > 10;"
+		"return: r;"
+		"label: is_big;"
+		"return: -r;",
+		"r: x; label: again; jump: odd ? r % 2; jump: even; label: odd; r: r * 3 + 1; label: even; r: r / 2; jump: again ? r > 1; return: r;",
+	};
+
+	for (const char* program : lane_programs)
+	{
+		t_vector				 r;
+		tp::variable			 program_lookup[] = {{"x", &x}, {"r", &r}};
+		te::env_traits::t_vector sr;
+		te::variable			 scalar_program_lookup[] = {{"x", &sx}, {"r", &sr}};
+
+		int	 err;
+		auto prog = tv::compile_program(program, program_lookup, 2, &err);
+		lok(prog);
+
+		auto scalar = te::compile_program(program, scalar_program_lookup, 2, &err);
+		lok(scalar);
+
+		t_atom rs[lanes], xs_out[lanes];
+		for (int step = 0; step < 4; ++step)
+		{
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				for (int l = 0; l < lanes; ++l)
+				{
+					xs[l] = t_atom((l * 5 + step * 3) % 9);
+				}
+				x = t_vector::load(xs);
+				r = T_TRAITS::load_atom(-1);
+
+				(pass ? tv::eval_program_bytecode(prog) : tv::eval_program(prog)).store(out);
+				r.store(rs);
+				x.store(xs_out);
+
+				for (int l = 0; l < lanes; ++l)
+				{
+					sx = te::env_traits::t_vector(xs[l]);
+					lfequal(out[l], te::eval_program(scalar));
+					lfequal(rs[l], sr);
+					lfequal(xs_out[l], sx);
+				}
+			}
+		}
+
+		delete scalar;
+		delete prog;
+	}
+
+	// Special values go through the blends of the packed exp/log/sin/cos.
+	{
+		using t_scalar = tp_stdlib::native_builtins_impl<t_atom>;
+
+		const t_atom specials[] = {std::numeric_limits<t_atom>::infinity(), -std::numeric_limits<t_atom>::infinity(), 0, -1, 200, -200};
+		for (const t_atom s : specials)
+		{
+			x = T_TRAITS::load_atom(s);
+
+			const t_atom got[] = {
+				T_TRAITS::store_atom(T_TRAITS::t_native::exp(x)),
+				T_TRAITS::store_atom(T_TRAITS::t_native::log(x)),
+				T_TRAITS::store_atom(T_TRAITS::t_native::sin(x)),
+				T_TRAITS::store_atom(T_TRAITS::t_native::cos(x)),
+			};
+			const t_atom expected[] = {t_scalar::exp(s), t_scalar::log(s), t_scalar::sin(s), t_scalar::cos(s)};
+			for (int f = 0; f < 4; ++f)
+			{
+				if (expected[f] != expected[f] || expected[f] == std::numeric_limits<t_atom>::infinity() || expected[f] == -std::numeric_limits<t_atom>::infinity())
+				{
+					lok((got[f] != got[f] && expected[f] != expected[f]) || got[f] == expected[f]);
+				}
+				else
+				{
+					const double scale = fabs(expected[f]) > 1 ? fabs(expected[f]) : 1;
+					lfequal(got[f] / scale, expected[f] / scale);
+				}
+			}
+		}
+	}
+}
+
+void test_simd()
+{
+#if TP_SIMD_SSE
+	test_simd_traits<tp_stdlib::env_traits_f32x4>();
+#endif // #if TP_SIMD_SSE
+#if TP_SIMD_AVX2
+	test_simd_traits<tp_stdlib::env_traits_f32x8>();
+	test_simd_traits<tp_stdlib::env_traits_f64x4>();
+#endif // #if TP_SIMD_AVX2
+}
+#endif // #if TP_SIMD_SSE || TP_SIMD_AVX2
+
 void test_optimize()
 {
 	test_case cases[] = {
@@ -615,6 +2238,134 @@ void test_optimize()
 	}
 }
 
+void test_simplify()
+{
+	te::env_traits::t_vector x;
+	te::variable			 lookup[] = {{"x", &x}};
+
+	// Each expression compiles to the same tree as its rewrite.
+	test_equ cases[] = {
+		{"x*1", "x"},
+		{"1*x", "x"},
+		{"x-0", "x"},
+		{"x/1", "x"},
+		{"x*-1", "-x"},
+		{"x/-1", "-x"},
+		{"x/4", "x*0.25"},
+		{"x/-0.5", "x*-2"},
+		{"x^1", "x"},
+		{"x^0", "1"},
+		{"x^2", "x*x"},
+		{"x^-1", "1/x"},
+		{"-(-x)", "x"},
+		{"-(-(x^2))*1+1", "x*x+1"},
+		{"sin(x^2/2)", "sin(x*x*0.5)"},
+#if TP_FAST_MATH
+		{"x+0", "x"},
+		{"0+x", "x"},
+		{"x/3", "x*(1/3)"},
+		{"x^0.5", "sqrt x"},
+		{"x^3", "x*x*x"},
+		{"x^4", "x*x*x*x"},
+#else
+		{"x/3", "x/3"},
+		{"x^3", "x^3"},
+#endif // #if TP_FAST_MATH
+	};
+
+	for (const auto& c : cases)
+	{
+		int	 err;
+		auto a = te::compile(c.expr1, lookup, 1, &err);
+		auto b = te::compile(c.expr2, lookup, 1, &err);
+		lok(a && b);
+		lequal(int(a->get_data_size()), int(b->get_data_size()));
+		lequal(int(a->get_bytecode_size()), int(b->get_bytecode_size()));
+
+		for (int i = -3; i <= 3; ++i)
+		{
+			x = te::env_traits::explicit_load_atom(i + 3.5);
+			lfequal(te::eval(a), te::eval(b));
+			lfequal(te::eval_bytecode(a), te::eval_bytecode(b));
+		}
+
+		delete a;
+		delete b;
+	}
+}
+
+void test_fused()
+{
+	te::env_traits::t_vector x, y, z;
+	te::variable			 lookup[] = {{"x", &x}, {"y", &y}, {"z", &z}};
+
+	using t = te::env_traits::t_vector;
+
+	// Multiplications and additions only become fma when the optimizer may change the last bit.
+	auto contracted = [](tp::opcode op) { return TP_FMA_CONTRACT ? tp::opcode::fma : op; };
+
+	struct
+	{
+		const char* expr;
+		tp::opcode	op;
+		t (*reference)(t x, t y, t z);
+	} cases[] = {
+		{"x*y+z", contracted(tp::opcode::add), [](t x, t y, t z) { return x * y + z; }},
+		{"z+x*y", contracted(tp::opcode::add), [](t x, t y, t z) { return x * y + z; }},
+		{"x*y-z", contracted(tp::opcode::sub), [](t x, t y, t z) { return x * y - z; }},
+		{"x*y-2", contracted(tp::opcode::sub_k), [](t x, t y, t) { return x * y - 2; }},
+		{"fma(x, y, z)", tp::opcode::fma, [](t x, t y, t z) { return x * y + z; }},
+		{"select(x < y, x, y)", tp::opcode::min, [](t x, t y, t) { return (x < y) ? x : y; }},
+		{"select(x > y, x, y)", tp::opcode::max, [](t x, t y, t) { return (x > y) ? x : y; }},
+		{"select(x < y, y, x)", tp::opcode::max, [](t x, t y, t) { return (x < y) ? y : x; }},
+		{"select(x > y, y, x)", tp::opcode::min, [](t x, t y, t) { return (x > y) ? y : x; }},
+		{"select(x <= y, x, y)", tp::opcode::select, [](t x, t y, t) { return (x <= y) ? x : y; }},
+		{"select(x < y, x, z)", tp::opcode::select, [](t x, t y, t z) { return (x < y) ? x : z; }},
+		{"min(max(x, y), z)", tp::opcode::clamp, [](t x, t y, t z) { return std::min(std::max(x, y), z); }},
+		{"select(select(x > -1, x, -1) < 1, select(x > -1, x, -1), 1)", tp::opcode::clamp, [](t x, t, t) { return std::min(std::max(x, t(-1)), t(1)); }},
+	};
+
+	for (const auto& c : cases)
+	{
+		int	 err;
+		auto ex = te::compile(c.expr, lookup, 3, &err);
+		lok(ex);
+
+		const auto header = (const tp::bytecode_header*)ex->get_bytecode();
+		const auto code	  = (const tp::instruction*)(ex->get_bytecode() + sizeof(tp::bytecode_header));
+		bool	   found  = false;
+		for (int i = 0; i < header->num_instructions; ++i)
+		{
+			found |= (code[i].op == c.op);
+		}
+		lok(found);
+
+#if TP_JIT_ENABLED
+		auto fn = te::jit(ex);
+		lok(fn);
+#endif // #if TP_JIT_ENABLED
+
+		for (int i = 0; i < 27; ++i)
+		{
+			x = t(i % 3) - 1;
+			y = t((i / 3) % 3) * 0.5f;
+			z = t(i / 9) - 1.5f;
+
+			const t expected = c.reference(x, y, z);
+			lfequal(te::eval(ex), expected);
+			lfequal(te::eval_bytecode(ex), expected);
+#if TP_JIT_ENABLED
+			lfequal(te::eval_jit(fn, ex), expected);
+#endif // #if TP_JIT_ENABLED
+		}
+
+#if TP_JIT_ENABLED
+		delete fn;
+#endif // #if TP_JIT_ENABLED
+		delete ex;
+	}
+}
+
 void test_pow()
 {
 #ifdef TE_POW_FROM_RIGHT
@@ -814,9 +2565,37 @@ TEST_CASE("expression_test")
 	lrun("INFs", test_infs);
 	lrun("Variables", test_variables);
 	lrun("Functions", test_functions);
+	lrun("Operator override", test_operator_override);
 	lrun("Dynamic", test_dynamic);
 	lrun("Closure", test_closure);
+	lrun("ShortCircuit", test_short_circuit);
+	lrun("Bytecode", test_bytecode);
+	lrun("Bytecode operators", test_bytecode_operators);
+	lrun("Encoding", test_encoding);
+	lrun("Layout", test_layout);
+	lrun("Arena", test_arena);
+	lrun("Symbols", test_symbols);
+	lrun("Batch", test_batch);
+	lrun("Context", test_context);
+	lrun("Locals", test_locals);
+	lrun("Subexpressions", test_subexpressions);
+	lrun("Dataflow", test_dataflow);
+	lrun("Threading", test_threading);
+	lrun("If-conversion", test_if_conversion);
+	lrun("Loop invariants", test_loop_invariants);
+	lrun("Incremental", test_incremental);
+#if TP_THREADS_ENABLED
+	lrun("Parallel", test_parallel);
+#endif // #if TP_THREADS_ENABLED
+#if TP_JIT_ENABLED
+	lrun("JIT", test_jit);
+#endif // #if TP_JIT_ENABLED
+#if TP_SIMD_SSE || TP_SIMD_AVX2
+	lrun("SIMD", test_simd);
+#endif // #if TP_SIMD_SSE || TP_SIMD_AVX2
 	lrun("Optimize", test_optimize);
+	lrun("Simplify", test_simplify);
+	lrun("Fused", test_fused);
 	lrun("Pow", test_pow);
 	lrun("Combinatorics", test_combinatorics);
 	lrun("Logic", test_logic);